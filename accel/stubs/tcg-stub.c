@@ -14,6 +14,8 @@
 #include "cpu.h"
 #include "tcg/tcg.h"
 #include "exec/exec-all.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
 
 void tb_flush(CPUState *cpu)
 {
@@ -22,3 +24,14 @@ void tb_flush(CPUState *cpu)
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 {
 }
+
+void qmp_x_tcg_profile(TcgProfileOp op, Error **errp)
+{
+    error_setg(errp, "TCG profiling is only available with accel=tcg");
+}
+
+TcgProfile *qmp_x_query_tcg_profile(bool has_top, int64_t top, Error **errp)
+{
+    error_setg(errp, "TCG profiling is only available with accel=tcg");
+    return NULL;
+}
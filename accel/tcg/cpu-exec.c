@@ -169,7 +169,13 @@ static inline tcg_target_ulong cpu_tb_exec(CPUState *cpu, TranslationBlock *itb)
     }
 #endif /* DEBUG_DISAS */
 
+    if (unlikely(tcg_prof_enabled)) {
+        atomic_set__nocheck(&cpu->tcg_prof.tb_entries,
+                            cpu->tcg_prof.tb_entries + 1);
+        tcg_prof_set_state(cpu, TCG_PROF_CODE);
+    }
     ret = tcg_qemu_tb_exec(env, tb_ptr);
+    tcg_prof_set_state(cpu, TCG_PROF_RUNTIME);
     cpu->can_do_io = 1;
     last_tb = (TranslationBlock *)(ret & ~TB_EXIT_MASK);
     tb_exit = ret & TB_EXIT_MASK;
@@ -408,7 +414,11 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
         mmap_unlock();
         /* We add the TB in the virtual pc hash table for the fast lookup */
         atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+#ifdef CONFIG_USER_ONLY
+        tb_prefetch_successors(cpu, tb);
+#endif
     }
+    tcg_region_hit(tb->tc.ptr);
 #ifndef CONFIG_USER_ONLY
     /* We don't take care of direct jumps when address mapping changes in
      * system emulation. So it's not safe to make a direct jump to a TB
@@ -619,6 +629,12 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
     ret = cpu_tb_exec(cpu, tb);
     tb = (TranslationBlock *)(ret & ~TB_EXIT_MASK);
     *tb_exit = ret & TB_EXIT_MASK;
+    if (*tb_exit == TB_EXIT_TIER_UP) {
+        /* The TB is hot, swap in a superblock before running it again */
+        *last_tb = NULL;
+        tb_tier_up(cpu, tb);
+        return;
+    }
     if (*tb_exit != TB_EXIT_REQUESTED) {
         *last_tb = tb;
         return;
@@ -675,6 +691,7 @@ int cpu_exec(CPUState *cpu)
     rcu_read_lock();
 
     cc->cpu_exec_enter(cpu);
+    tcg_prof_set_state(cpu, TCG_PROF_RUNTIME);
 
     /* Calculate difference between guest clock and host clock.
      * This delay includes the delay of the last cycle, so
@@ -704,6 +721,7 @@ int cpu_exec(CPUState *cpu)
             qemu_mutex_unlock_iothread();
         }
         qemu_plugin_disable_mem_helpers(cpu);
+        tcg_prof_set_state(cpu, TCG_PROF_RUNTIME);
 
         assert_no_pages_locked();
     }
@@ -736,6 +754,7 @@ int cpu_exec(CPUState *cpu)
         }
     }
 
+    tcg_prof_set_state(cpu, TCG_PROF_IDLE);
     cc->cpu_exec_exit(cpu);
     rcu_read_unlock();
 
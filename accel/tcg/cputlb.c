@@ -90,6 +90,26 @@ static inline size_t sizeof_tlb(CPUTLBDescFast *fast)
     return fast->mask + (1 << CPU_TLB_ENTRY_BITS);
 }
 
+unsigned int cpu_vtlb_size = CPU_VTLB_DEFAULT_SIZE;
+
+static inline size_t vtlb_n_entries(CPUTLBDesc *desc)
+{
+    return (desc->vmask + 1) * CPU_VTLB_WAYS;
+}
+
+/*
+ * Return the index of the first victim tlb entry of the set for @page.
+ * Pages that conflict in the main table share the low bits of their page
+ * number, so hash the whole page number to spread them over the sets.
+ */
+static inline size_t vtlb_set_index(CPUTLBDesc *desc, target_ulong page)
+{
+    uint64_t hash = (uint64_t)(page >> TARGET_PAGE_BITS) *
+                    0x9e3779b97f4a7c15ull;
+
+    return ((hash >> 32) & desc->vmask) * CPU_VTLB_WAYS;
+}
+
 static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
                              size_t max_entries)
 {
@@ -217,9 +237,11 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
+    memset(desc->lpages, -1, sizeof(desc->lpages));
+    desc->lpage_next = 0;
     desc->vindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
-    memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->vtable, -1, vtlb_n_entries(desc) * sizeof(CPUTLBEntry));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
@@ -241,6 +263,9 @@ static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
     fast->mask = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
     fast->table = g_new(CPUTLBEntry, n_entries);
     desc->iotlb = g_new(CPUIOTLBEntry, n_entries);
+    desc->vmask = cpu_vtlb_size / CPU_VTLB_WAYS - 1;
+    desc->vtable = g_new(CPUTLBEntry, vtlb_n_entries(desc));
+    desc->viotlb = g_new(CPUIOTLBEntry, vtlb_n_entries(desc));
     tlb_mmu_flush_locked(desc, fast);
 }
 
@@ -306,6 +331,34 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_victim_counts(size_t *phits, size_t *pmisses)
+{
+    CPUState *cpu;
+    size_t hits = 0, misses = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        hits += atomic_read(&env_tlb(env)->c.victim_hit_count);
+        misses += atomic_read(&env_tlb(env)->c.victim_miss_count);
+    }
+    *phits = hits;
+    *pmisses = misses;
+}
+
+size_t tlb_large_page_fill_count(void)
+{
+    CPUState *cpu;
+    size_t fills = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        fills += atomic_read(&env_tlb(env)->c.large_page_fill_count);
+    }
+    return fills;
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -411,6 +464,23 @@ static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
     return te->addr_read == -1 && te->addr_write == -1 && te->addr_code == -1;
 }
 
+/**
+ * tlb_entry_page - return the page mapped by a non-empty entry
+ * @te: pointer to CPUTLBEntry
+ */
+static inline target_ulong tlb_entry_page(const CPUTLBEntry *te)
+{
+    target_ulong addr = te->addr_read;
+
+    if (addr == -1) {
+        addr = tlb_addr_write(te);
+    }
+    if (addr == -1) {
+        addr = te->addr_code;
+    }
+    return addr & TARGET_PAGE_MASK;
+}
+
 /* Called with tlb_c.lock held */
 static inline bool tlb_flush_entry_locked(CPUTLBEntry *tlb_entry,
                                           target_ulong page)
@@ -427,21 +497,69 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
                                               target_ulong page)
 {
     CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
+    size_t set = vtlb_set_index(d, page);
     int k;
 
     assert_cpu_is_self(env_cpu(env));
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
-        if (tlb_flush_entry_locked(&d->vtable[k], page)) {
+    for (k = 0; k < CPU_VTLB_WAYS; k++) {
+        if (tlb_flush_entry_locked(&d->vtable[set + k], page)) {
             tlb_n_used_entries_dec(env, mmu_idx);
         }
     }
 }
 
+/*
+ * Called with tlb_c.lock held.
+ * Flush the entries for the pages in the large page (@addr, @mask).
+ */
+static void tlb_flush_large_page_locked(CPUArchState *env, int midx,
+                                        target_ulong addr, target_ulong mask)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    target_ulong n_pages = (~mask >> TARGET_PAGE_BITS) + 1;
+    size_t n = tlb_n_entries(f);
+    size_t i;
+
+    if (n_pages <= n) {
+        target_ulong page = addr;
+
+        for (i = 0; i < n_pages; i++, page += TARGET_PAGE_SIZE) {
+            if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
+            tlb_flush_vtlb_page_locked(env, midx, page);
+        }
+        return;
+    }
+
+    /* The page is larger than the tlb, look at each entry instead.  */
+    for (i = 0; i < n; i++) {
+        CPUTLBEntry *te = &f->table[i];
+
+        if (!tlb_entry_is_empty(te) && (tlb_entry_page(te) & mask) == addr) {
+            memset(te, -1, sizeof(*te));
+            tlb_n_used_entries_dec(env, midx);
+        }
+    }
+    n = vtlb_n_entries(d);
+    for (i = 0; i < n; i++) {
+        CPUTLBEntry *te = &d->vtable[i];
+
+        if (!tlb_entry_is_empty(te) && (tlb_entry_page(te) & mask) == addr) {
+            memset(te, -1, sizeof(*te));
+            tlb_n_used_entries_dec(env, midx);
+        }
+    }
+}
+
 static void tlb_flush_page_locked(CPUArchState *env, int midx,
                                   target_ulong page)
 {
-    target_ulong lp_addr = env_tlb(env)->d[midx].large_page_addr;
-    target_ulong lp_mask = env_tlb(env)->d[midx].large_page_mask;
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    target_ulong lp_addr = d->large_page_addr;
+    target_ulong lp_mask = d->large_page_mask;
+    int i;
 
     /* Check if we need to flush due to large pages.  */
     if ((page & lp_mask) == lp_addr) {
@@ -449,12 +567,25 @@ static void tlb_flush_page_locked(CPUArchState *env, int midx,
                   TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
                   midx, lp_addr, lp_mask);
         tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
-    } else {
-        if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
-            tlb_n_used_entries_dec(env, midx);
+        return;
+    }
+
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        CPUTLBLargePage *lp = &d->lpages[i];
+
+        if ((page & lp->mask) == lp->vaddr) {
+            tlb_debug("flushing large page midx %d ("
+                      TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
+                      midx, lp->vaddr, lp->mask);
+            tlb_flush_large_page_locked(env, midx, lp->vaddr, lp->mask);
+            memset(lp, -1, sizeof(*lp));
         }
-        tlb_flush_vtlb_page_locked(env, midx, page);
     }
+
+    if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+        tlb_n_used_entries_dec(env, midx);
+    }
+    tlb_flush_vtlb_page_locked(env, midx, page);
 }
 
 /**
@@ -712,6 +843,30 @@ static inline void copy_tlb_helper_locked(CPUTLBEntry *d, const CPUTLBEntry *s)
     *d = *s;
 }
 
+/*
+ * Called with tlb_c.lock held, from the vCPU context.
+ * Move the non-empty entry @te and its iotlb entry @io into the victim tlb.
+ * A free way of the set is used if there is one, else the ways of the set
+ * are replaced in turn.
+ */
+static void tlb_victim_insert_locked(CPUTLBDesc *desc, const CPUTLBEntry *te,
+                                     const CPUIOTLBEntry *io)
+{
+    size_t set = vtlb_set_index(desc, tlb_entry_page(te));
+    size_t k;
+
+    for (k = 0; k < CPU_VTLB_WAYS; k++) {
+        if (tlb_entry_is_empty(&desc->vtable[set + k])) {
+            break;
+        }
+    }
+    if (k == CPU_VTLB_WAYS) {
+        k = desc->vindex++ % CPU_VTLB_WAYS;
+    }
+    copy_tlb_helper_locked(&desc->vtable[set + k], te);
+    desc->viotlb[set + k] = *io;
+}
+
 /* This is a cross vCPU call (i.e. another vCPU resetting the flags of
  * the target vCPU).
  * We must take tlb_c.lock to avoid racing with another vCPU update. The only
@@ -734,7 +889,8 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
                                          start1, length);
         }
 
-        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        n = vtlb_n_entries(&env_tlb(env)->d[mmu_idx]);
+        for (i = 0; i < n; i++) {
             tlb_reset_dirty_range_locked(&env_tlb(env)->d[mmu_idx].vtable[i],
                                          start1, length);
         }
@@ -767,21 +923,23 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+        size_t set = vtlb_set_index(desc, vaddr);
         int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_set_dirty1_locked(&env_tlb(env)->d[mmu_idx].vtable[k], vaddr);
+
+        for (k = 0; k < CPU_VTLB_WAYS; k++) {
+            tlb_set_dirty1_locked(&desc->vtable[set + k], vaddr);
         }
     }
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
-static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
-                               target_ulong vaddr, target_ulong size)
+/* Add the large page (@vaddr, @lp_mask) to the region that is flushed
+   as a whole.  */
+static void tlb_add_large_region(CPUTLBDesc *desc, target_ulong vaddr,
+                                 target_ulong lp_mask)
 {
-    target_ulong lp_addr = env_tlb(env)->d[mmu_idx].large_page_addr;
-    target_ulong lp_mask = ~(size - 1);
+    target_ulong lp_addr = desc->large_page_addr;
 
     if (lp_addr == (target_ulong)-1) {
         /* No previous large page.  */
@@ -790,25 +948,101 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
         /* Extend the existing region to include the new page.
            This is a compromise between unnecessary flushes and
            the cost of maintaining a full variable size TLB.  */
-        lp_mask &= env_tlb(env)->d[mmu_idx].large_page_mask;
+        lp_mask &= desc->large_page_mask;
         while (((lp_addr ^ vaddr) & lp_mask) != 0) {
             lp_mask <<= 1;
         }
     }
-    env_tlb(env)->d[mmu_idx].large_page_addr = lp_addr & lp_mask;
-    env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
+    desc->large_page_addr = lp_addr & lp_mask;
+    desc->large_page_mask = lp_mask;
+}
+
+/* Our TLB entries only map TARGET_PAGE_SIZE, so remember the large pages
+   that have entries in the TLB: flushing any page within one flushes the
+   entries of the whole large page.  If there are too many large pages,
+   the oldest ones are merged into a region that is flushed as a whole.
+   Linearly mapped large pages are also used to fill the TLB, see
+   tlb_fill_large_page().  */
+static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
+                               target_ulong vaddr, target_ulong size,
+                               hwaddr paddr, MemTxAttrs attrs, int prot,
+                               bool linear)
+{
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    target_ulong lp_mask = ~(size - 1);
+    target_ulong lp_addr = vaddr & lp_mask;
+    CPUTLBLargePage *lp = NULL;
+    int i;
+
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        CPUTLBLargePage *p = &desc->lpages[i];
+
+        if (p->vaddr == lp_addr && p->mask == lp_mask) {
+            lp = p;
+            break;
+        }
+        if (!lp && p->vaddr == (target_ulong)-1) {
+            lp = p;
+        }
+    }
+    if (!lp) {
+        lp = &desc->lpages[desc->lpage_next++ % CPU_TLB_LARGE_PAGES];
+        tlb_add_large_region(desc, lp->vaddr, lp->mask);
+    }
+
+    lp->vaddr = lp_addr;
+    lp->mask = lp_mask;
+    lp->attrs = attrs;
+    lp->prot = prot;
+    /* With PAGE_WRITE_INV, each write must go through tlb_fill.  */
+    if (linear && !(prot & PAGE_WRITE_INV)) {
+        lp->paddr = paddr - (vaddr - lp_addr);
+    } else {
+        lp->paddr = -1;
+    }
+}
+
+/*
+ * Fill the TLB entry for @addr from a linearly mapped large page that
+ * allows @access_type, without a page table walk.  Return false if
+ * there is none.
+ */
+static bool tlb_fill_large_page(CPUState *cpu, target_ulong addr,
+                                MMUAccessType access_type, int mmu_idx)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    int i;
+
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        CPUTLBLargePage *lp = &desc->lpages[i];
+
+        if ((addr & lp->mask) == lp->vaddr && lp->paddr != (hwaddr)-1 &&
+            (lp->prot & (1 << access_type))) {
+            target_ulong page = addr & TARGET_PAGE_MASK;
+
+            tlb_set_page_with_attrs(cpu, page, lp->paddr + (page - lp->vaddr),
+                                    lp->attrs, lp->prot, mmu_idx,
+                                    TARGET_PAGE_SIZE);
+            atomic_set(&env_tlb(env)->c.large_page_fill_count,
+                       env_tlb(env)->c.large_page_fill_count + 1);
+            return true;
+        }
+    }
+    return false;
 }
 
 /* Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
- * supplied size is only used by tlb_flush_page.
+ * supplied size is only used by tlb_flush_page and, for a linearly
+ * mapped large page, to fill later misses in the same page.
  *
  * Called from TCG-generated code, which is under an RCU read-side
  * critical section.
  */
-void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
-                             hwaddr paddr, MemTxAttrs attrs, int prot,
-                             int mmu_idx, target_ulong size)
+static void tlb_set_page_internal(CPUState *cpu, target_ulong vaddr,
+                                  hwaddr paddr, MemTxAttrs attrs, int prot,
+                                  int mmu_idx, target_ulong size, bool linear)
 {
     CPUArchState *env = cpu->env_ptr;
     CPUTLB *tlb = env_tlb(env);
@@ -830,7 +1064,8 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     if (size <= TARGET_PAGE_SIZE) {
         sz = TARGET_PAGE_SIZE;
     } else {
-        tlb_add_large_page(env, mmu_idx, vaddr, size);
+        tlb_add_large_page(env, mmu_idx, vaddr, size, paddr, attrs, prot,
+                           linear);
         sz = size;
     }
     vaddr_page = vaddr & TARGET_PAGE_MASK;
@@ -918,12 +1153,8 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, vaddr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
-        CPUTLBEntry *tv = &desc->vtable[vidx];
-
         /* Evict the old entry into the victim tlb.  */
-        copy_tlb_helper_locked(tv, te);
-        desc->viotlb[vidx] = desc->iotlb[index];
+        tlb_victim_insert_locked(desc, te, &desc->iotlb[index]);
         tlb_n_used_entries_dec(env, mmu_idx);
     }
 
@@ -976,6 +1207,22 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     qemu_spin_unlock(&tlb->c.lock);
 }
 
+void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
+                             hwaddr paddr, MemTxAttrs attrs, int prot,
+                             int mmu_idx, target_ulong size)
+{
+    tlb_set_page_internal(cpu, vaddr, paddr, attrs, prot, mmu_idx, size,
+                          false);
+}
+
+void tlb_set_large_page_with_attrs(CPUState *cpu, target_ulong vaddr,
+                                   hwaddr paddr, MemTxAttrs attrs, int prot,
+                                   int mmu_idx, target_ulong size)
+{
+    tlb_set_page_internal(cpu, vaddr, paddr, attrs, prot, mmu_idx, size,
+                          true);
+}
+
 /* Add a new TLB entry, but without specifying the memory
  * transaction attributes to be used.
  */
@@ -1008,14 +1255,25 @@ static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
                      MMUAccessType access_type, int mmu_idx, uintptr_t retaddr)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
+    int prof_state = cpu->tcg_prof.state;
     bool ok;
 
+    if (tlb_fill_large_page(cpu, addr, access_type, mmu_idx)) {
+        return;
+    }
+    if (unlikely(tcg_prof_enabled)) {
+        atomic_set__nocheck(&cpu->tcg_prof.tlb_fills,
+                            cpu->tcg_prof.tlb_fills + 1);
+        tcg_prof_set_state(cpu, TCG_PROF_TLB_FILL);
+    }
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
      */
     ok = cc->tlb_fill(cpu, addr, size, access_type, mmu_idx, false, retaddr);
     assert(ok);
+    tcg_prof_set_state(cpu, prof_state);
 }
 
 static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
@@ -1111,11 +1369,13 @@ static inline target_ulong tlb_read_ofs(CPUTLBEntry *entry, size_t ofs)
 static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
                            size_t elt_ofs, target_ulong page)
 {
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    size_t set = vtlb_set_index(desc, page);
     size_t vidx;
 
     assert_cpu_is_self(env_cpu(env));
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
-        CPUTLBEntry *vtlb = &env_tlb(env)->d[mmu_idx].vtable[vidx];
+    for (vidx = set; vidx < set + CPU_VTLB_WAYS; ++vidx) {
+        CPUTLBEntry *vtlb = &desc->vtable[vidx];
         target_ulong cmp;
 
         /* elt_ofs might correspond to .addr_write, so use atomic_read */
@@ -1126,21 +1386,37 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
 #endif
 
         if (cmp == page) {
-            /* Found entry in victim tlb, swap tlb and iotlb.  */
+            /*
+             * Found entry in victim tlb: move it to the main tlb, and the
+             * entry it replaces to the victim set of its own page.
+             */
             CPUTLBEntry tmptlb, *tlb = &env_tlb(env)->f[mmu_idx].table[index];
+            CPUIOTLBEntry tmpio, *io = &desc->iotlb[index];
 
             qemu_spin_lock(&env_tlb(env)->c.lock);
             copy_tlb_helper_locked(&tmptlb, tlb);
+            tmpio = *io;
             copy_tlb_helper_locked(tlb, vtlb);
-            copy_tlb_helper_locked(vtlb, &tmptlb);
+            *io = desc->viotlb[vidx];
+            memset(vtlb, -1, sizeof(*vtlb));
+            if (!tlb_entry_is_empty(&tmptlb)) {
+                tlb_victim_insert_locked(desc, &tmptlb, &tmpio);
+            }
             qemu_spin_unlock(&env_tlb(env)->c.lock);
 
-            CPUIOTLBEntry tmpio, *io = &env_tlb(env)->d[mmu_idx].iotlb[index];
-            CPUIOTLBEntry *vio = &env_tlb(env)->d[mmu_idx].viotlb[vidx];
-            tmpio = *io; *io = *vio; *vio = tmpio;
+            atomic_set(&env_tlb(env)->c.victim_hit_count,
+                       env_tlb(env)->c.victim_hit_count + 1);
+            if (unlikely(tcg_prof_enabled)) {
+                CPUState *cpu = env_cpu(env);
+
+                atomic_set__nocheck(&cpu->tcg_prof.tlb_victim_hits,
+                                    cpu->tcg_prof.tlb_victim_hits + 1);
+            }
             return true;
         }
     }
+    atomic_set(&env_tlb(env)->c.victim_miss_count,
+               env_tlb(env)->c.victim_miss_count + 1);
     return false;
 }
 
@@ -1263,7 +1539,8 @@ static int probe_access_internal(CPUArchState *env, target_ulong addr,
             CPUState *cs = env_cpu(env);
             CPUClass *cc = CPU_GET_CLASS(cs);
 
-            if (!cc->tlb_fill(cs, addr, fault_size, access_type,
+            if (!tlb_fill_large_page(cs, addr, access_type, mmu_idx) &&
+                !cc->tlb_fill(cs, addr, fault_size, access_type,
                               mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
                 *phost = NULL;
@@ -0,0 +1,301 @@
+/*
+ * Symbols for translated code, for the Linux perf tool
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Two formats are supported:
+ *
+ * - /tmp/perf-PID.map, a text file with one "start size name" line per
+ *   TB.  perf reads it directly at report time, but has no notion of
+ *   time, so once the code buffer is flushed or evicted and reused the
+ *   old and new symbols overlap.
+ *
+ * - /tmp/jit-PID.dump, the jitdump format.  Each TB is recorded with a
+ *   timestamp, a copy of its host code and the guest PC of each guest
+ *   instruction, so "perf inject --jit" resolves samples correctly even
+ *   when the code buffer is reused and "perf annotate" can show the
+ *   generated code.  Record with "perf record -k 1" so that the
+ *   timestamps match.
+ *
+ * Guest symbols come from lookup_symbol(), i.e. the ELF file loaded by
+ * linux-user or the kernel loaded by -kernel.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "tcg/tcg.h"
+#include "qemu/error-report.h"
+#include "elf.h"
+
+static FILE *perfmap;
+static FILE *jitdump;
+static uint64_t jitdump_code_index;
+
+#define JITDUMP_MAGIC       0x4A695444
+#define JITDUMP_VERSION     1
+
+enum {
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_DEBUG_INFO = 2,
+};
+
+typedef struct JitHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} JitHeader;
+
+typedef struct JitRecordPrefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+} JitRecordPrefix;
+
+/* Followed by the symbol name and the host code */
+typedef struct JitCodeLoad {
+    JitRecordPrefix p;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+} JitCodeLoad;
+
+/* Followed by nr_entry of (JitDebugEntry, name) */
+typedef struct JitDebugInfo {
+    JitRecordPrefix p;
+    uint64_t code_addr;
+    uint64_t nr_entry;
+} JitDebugInfo;
+
+typedef struct JitDebugEntry {
+    uint64_t addr;
+    int32_t lineno;
+    int32_t discrim;
+} JitDebugEntry;
+
+static uint64_t jitdump_timestamp(void)
+{
+    struct timespec ts;
+
+    /* This is what "perf record -k 1" uses.  */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* perf checks that the records match the host architecture.  */
+static uint32_t host_elf_machine(void)
+{
+    Elf64_Ehdr ehdr;
+    uint32_t mach = EM_NONE;
+    FILE *f = fopen("/proc/self/exe", "r");
+
+    if (f) {
+        if (fread(&ehdr, sizeof(ehdr), 1, f) == 1 &&
+            !memcmp(ehdr.e_ident, ELFMAG, SELFMAG)) {
+            /* e_machine is at the same offset for both ELF classes.  */
+            mach = ehdr.e_machine;
+        }
+        fclose(f);
+    }
+    return mach;
+}
+
+void perf_enable_perfmap(void)
+{
+    char *path = g_strdup_printf("/tmp/perf-%d.map", getpid());
+
+    perfmap = fopen(path, "w");
+    if (!perfmap) {
+        warn_report("cannot create %s: %s", path, strerror(errno));
+    }
+    g_free(path);
+}
+
+void perf_enable_jitdump(void)
+{
+    JitHeader header = {
+        .magic = JITDUMP_MAGIC,
+        .version = JITDUMP_VERSION,
+        .total_size = sizeof(header),
+        .elf_mach = host_elf_machine(),
+        .pid = getpid(),
+        .timestamp = jitdump_timestamp(),
+    };
+    char *path = g_strdup_printf("/tmp/jit-%d.dump", getpid());
+    int fd;
+
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0) {
+        warn_report("cannot create %s: %s", path, strerror(errno));
+        goto out;
+    }
+
+    /*
+     * perf finds the dump through an executable mapping of it, which
+     * "perf record" sees as an mmap event.  The mapping is never used
+     * and stays until the process exits.
+     */
+    if (mmap(NULL, qemu_real_host_page_size, PROT_READ | PROT_EXEC,
+             MAP_PRIVATE, fd, 0) == MAP_FAILED) {
+        warn_report("cannot map %s: %s", path, strerror(errno));
+        close(fd);
+        goto out;
+    }
+
+    jitdump = fdopen(fd, "w+");
+    if (!jitdump) {
+        warn_report("cannot open %s: %s", path, strerror(errno));
+        close(fd);
+        goto out;
+    }
+    fwrite(&header, sizeof(header), 1, jitdump);
+
+ out:
+    g_free(path);
+}
+
+bool perf_enabled(void)
+{
+    return perfmap || jitdump;
+}
+
+static void perf_report_perfmap(const void *start, size_t size,
+                                const char *name)
+{
+    flockfile(perfmap);
+    fprintf(perfmap, "%" PRIxPTR " %zx %s\n", (uintptr_t)start, size, name);
+    funlockfile(perfmap);
+}
+
+static void perf_report_jitdump(const void *start, size_t size,
+                                const char *name, const target_ulong *pcs,
+                                const uint16_t *end_off, int n_insns)
+{
+    uint64_t timestamp = jitdump_timestamp();
+    JitCodeLoad load;
+    int i;
+
+    flockfile(jitdump);
+
+    /* The debug information must come before the code it describes.  */
+    if (n_insns) {
+        JitDebugInfo info = {
+            .p.id = JIT_CODE_DEBUG_INFO,
+            .p.total_size = sizeof(info),
+            .p.timestamp = timestamp,
+            .code_addr = (uintptr_t)start,
+            .nr_entry = n_insns,
+        };
+        char **names = g_new(char *, n_insns);
+
+        for (i = 0; i < n_insns; i++) {
+            names[i] = g_strdup_printf("guest-0x" TARGET_FMT_lx, pcs[i]);
+            info.p.total_size += sizeof(JitDebugEntry) + strlen(names[i]) + 1;
+        }
+        fwrite(&info, sizeof(info), 1, jitdump);
+        for (i = 0; i < n_insns; i++) {
+            JitDebugEntry entry = {
+                .addr = (uintptr_t)start + (i ? end_off[i - 1] : 0),
+            };
+
+            fwrite(&entry, sizeof(entry), 1, jitdump);
+            fwrite(names[i], strlen(names[i]) + 1, 1, jitdump);
+            g_free(names[i]);
+        }
+        g_free(names);
+    }
+
+    load = (JitCodeLoad) {
+        .p.id = JIT_CODE_LOAD,
+        .p.total_size = sizeof(load) + strlen(name) + 1 + size,
+        .p.timestamp = timestamp,
+        .pid = getpid(),
+        .tid = qemu_get_thread_id(),
+        .vma = (uintptr_t)start,
+        .code_addr = (uintptr_t)start,
+        .code_size = size,
+        .code_index = jitdump_code_index++,
+    };
+    fwrite(&load, sizeof(load), 1, jitdump);
+    fwrite(name, strlen(name) + 1, 1, jitdump);
+    fwrite(start, size, 1, jitdump);
+
+    funlockfile(jitdump);
+}
+
+void perf_report_prologue(const void *start, size_t size)
+{
+    if (perfmap) {
+        perf_report_perfmap(start, size, "qemu-prologue");
+    }
+    if (jitdump) {
+        perf_report_jitdump(start, size, "qemu-prologue", NULL, NULL, 0);
+    }
+}
+
+/*
+ * Called from tb_gen_code() while tcg_ctx still holds the per-instruction
+ * data of @tb.
+ */
+void perf_report_code(const TranslationBlock *tb)
+{
+    const char *sym = lookup_symbol(tb->pc);
+    char *name;
+
+    if (sym[0]) {
+        name = g_strdup_printf("%s [guest-0x" TARGET_FMT_lx "]", sym, tb->pc);
+    } else {
+        name = g_strdup_printf("guest-0x" TARGET_FMT_lx, tb->pc);
+    }
+
+    if (perfmap) {
+        perf_report_perfmap(tb->tc.ptr, tb->tc.size, name);
+    }
+    if (jitdump) {
+        target_ulong pcs[TCG_MAX_INSNS];
+        int i;
+
+        for (i = 0; i < tb->icount; i++) {
+            pcs[i] = tcg_ctx->gen_insn_data[i][0];
+        }
+        perf_report_jitdump(tb->tc.ptr, tb->tc.size, name, pcs,
+                            tcg_ctx->gen_insn_end_off, tb->icount);
+    }
+    g_free(name);
+}
+
+/*
+ * Called right before the process exits.  Other threads may still be
+ * translating, so the files are only flushed and stay open.
+ */
+void perf_exit(void)
+{
+    if (perfmap) {
+        fflush(perfmap);
+    }
+    if (jitdump) {
+        fflush(jitdump);
+    }
+}
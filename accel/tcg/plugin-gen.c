@@ -62,6 +62,9 @@
  * 0: enum plugin_gen_from
  * 1: enum plugin_gen_cb
  * 2: set to 1 for mem callback that is a write, 0 otherwise.
+ * 3: for mem callbacks, the TCGv holding the guest address.  This is not
+ *    an operand of the op; it is only used by plugin_gen_inject().
+ * 4: for mem callbacks, the meminfo of the access.
  */
 
 enum plugin_gen_from {
@@ -126,21 +129,11 @@ static void gen_empty_udata_cb(void)
 }
 
 /*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
+ * Inline entries are emitted directly by plugin_gen_inject(), so they
+ * only need the plugin_cb_start/end markers.
  */
 static void gen_empty_inline_cb(void)
-{
-    TCGv_i64 val = tcg_temp_new_i64();
-    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
-
-    tcg_gen_ld_i64(val, ptr, 0);
-    /* pass an immediate != 0 so that it doesn't get optimized away */
-    tcg_gen_addi_i64(val, val, 0xdeadface);
-    tcg_gen_st_i64(val, ptr, 0);
-    tcg_temp_free_ptr(ptr);
-    tcg_temp_free_i64(val);
-}
+{ }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
 {
@@ -162,14 +155,15 @@ static void gen_empty_mem_helper(void)
 }
 
 static inline
-void gen_plugin_cb_start(enum plugin_gen_from from,
-                         enum plugin_gen_cb type, unsigned wr)
+TCGOp *gen_plugin_cb_start(enum plugin_gen_from from,
+                           enum plugin_gen_cb type, unsigned wr)
 {
     TCGOp *op;
 
     tcg_gen_plugin_cb_start(from, type, wr);
     op = tcg_last_op();
     QSIMPLEQ_INSERT_TAIL(&tcg_ctx->plugin_ops, op, plugin_link);
+    return op;
 }
 
 static void gen_wrapped(enum plugin_gen_from from,
@@ -214,8 +208,11 @@ static void gen_mem_wrapped(enum plugin_gen_cb type,
                             uint32_t info, bool is_mem)
 {
     int wr = !!(info & TRACE_MEM_ST);
+    TCGOp *op;
 
-    gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, type, wr);
+    op = gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, type, wr);
+    op->args[3] = (uintptr_t)addr;
+    op->args[4] = info;
     if (is_mem) {
         f->mem_fn(addr, info);
     } else {
@@ -228,11 +225,13 @@ void plugin_gen_empty_mem_callback(TCGv addr, uint32_t info)
 {
     union mem_gen_fn fn;
 
+    tcg_ctx->plugin_insn->mem_accesses++;
+
     fn.mem_fn = gen_empty_mem_cb;
     gen_mem_wrapped(PLUGIN_GEN_CB_MEM, &fn, addr, info, true);
 
     fn.inline_fn = gen_empty_inline_cb;
-    gen_mem_wrapped(PLUGIN_GEN_CB_INLINE, &fn, 0, info, false);
+    gen_mem_wrapped(PLUGIN_GEN_CB_INLINE, &fn, addr, info, false);
 }
 
 static TCGOp *find_op(TCGOp *op, TCGOpcode opc)
@@ -336,11 +335,6 @@ static TCGOp *copy_const_ptr(TCGOp **begin_op, TCGOp *op, void *ptr)
     return op;
 }
 
-static TCGOp *copy_const_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
-{
-    return copy_movi_i64(begin_op, op, v);
-}
-
 static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TARGET_LONG_BITS == 32) {
@@ -353,19 +347,6 @@ static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* 2x ld_i32 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-    } else {
-        /* ld_i64 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -379,18 +360,6 @@ static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* all 32-bit backends must implement add2_i32 */
-        g_assert(TCG_TARGET_HAS_add2_i32);
-        op = copy_op(begin_op, op, INDEX_op_add2_i32);
-    } else {
-        op = copy_op(begin_op, op, INDEX_op_add_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -457,28 +426,6 @@ static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
-static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
-                               TCGOp *begin_op, TCGOp *op,
-                               int *unused)
-{
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
-
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
-
-    /* const_i64 */
-    op = copy_const_i64(&begin_op, op, cb->inline_insn.imm);
-
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op);
-
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
-
-    return op;
-}
-
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
                             TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
@@ -565,10 +512,330 @@ inject_udata_cb(const GArray *cbs, TCGOp *begin_op)
     inject_cb_type(cbs, begin_op, append_udata_cb, op_ok);
 }
 
-static void
-inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
+/*
+ * Inline entries
+ *
+ * These are not copied from templates but emitted with the regular TCG
+ * API, right after the callback's plugin_cb_end op; see plugin_emit_begin().
+ * plugin_gen_inject() makes sure that they only use fresh temps, since
+ * the temps that the translator has freed may still be live there.
+ *
+ * Conditional callbacks and memory buffer checks add branches.  They are
+ * only emitted at the start of a TB or instruction, where no translator
+ * temps are live.
+ */
+static TCGOp *plugin_emit_begin(TCGOp *begin_op)
+{
+    TCGOp *end_op = find_op(begin_op, INDEX_op_plugin_cb_end);
+
+    tcg_debug_assert(end_op);
+    tcg_ctx->emit_before_op = QTAILQ_NEXT(end_op, link);
+    return end_op;
+}
+
+static void plugin_emit_end(TCGOp *begin_op, TCGOp *end_op)
+{
+    tcg_ctx->emit_before_op = NULL;
+    rm_ops_range(begin_op, end_op);
+}
+
+static void gen_load_cpu_index(TCGv_i32 cpu_index)
+{
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+}
+
+/* Return a pointer to the entry of the running vCPU in @score */
+static TCGv_ptr gen_scoreboard_entry(struct qemu_plugin_scoreboard *score)
+{
+    TCGv_ptr ptr = tcg_temp_new_ptr();
+    TCGv_ptr data = tcg_const_ptr(&score->data);
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+
+    gen_load_cpu_index(cpu_index);
+    /* Multiply at pointer width: the product can exceed 32 bits */
+    tcg_gen_extu_i32_ptr(ptr, cpu_index);
+    tcg_gen_muli_ptr(ptr, ptr, score->element_size);
+    tcg_gen_ld_ptr(data, data, 0);
+    tcg_gen_add_ptr(ptr, ptr, data);
+
+    tcg_temp_free_i32(cpu_index);
+    tcg_temp_free_ptr(data);
+    return ptr;
+}
+
+static TCGv_ptr gen_plugin_u64_ptr(qemu_plugin_u64 entry)
+{
+    TCGv_ptr ptr;
+
+    if (!entry.score) {
+        return tcg_const_ptr((void *)(uintptr_t)entry.offset);
+    }
+    ptr = gen_scoreboard_entry(entry.score);
+    tcg_gen_addi_ptr(ptr, ptr, entry.offset);
+    return ptr;
+}
+
+static void gen_inline_op(const struct qemu_plugin_dyn_cb *cb)
 {
-    inject_cb_type(cbs, begin_op, append_inline_cb, ok);
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->inline_insn.entry);
+    TCGv_i64 val = tcg_temp_new_i64();
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        tcg_gen_movi_i64(val, cb->inline_insn.imm);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    tcg_gen_st_i64(val, ptr, 0);
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
+static void gen_udata_call(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+    TCGv_ptr udata = tcg_const_ptr(cb->userp);
+    TCGOp *op;
+    int i;
+
+    gen_load_cpu_index(cpu_index);
+    gen_helper_plugin_vcpu_udata_cb(cpu_index, udata);
+
+    /* point the call to the plugin's callback, like copy_call() */
+    op = tcg_ctx->emit_before_op ?
+         QTAILQ_PREV(tcg_ctx->emit_before_op, link) : tcg_last_op();
+    while (op->opc != INDEX_op_call) {
+        op = QTAILQ_PREV(op, link);
+    }
+    for (i = 0; i < MAX_OPC_PARAM_ARGS; i++) {
+        if ((uintptr_t)op->args[i] == (uintptr_t)HELPER(plugin_vcpu_udata_cb)) {
+            break;
+        }
+    }
+    tcg_debug_assert(i < MAX_OPC_PARAM_ARGS);
+    op->args[i] = (uintptr_t)cb->f.vcpu_udata;
+    op->args[i + 1] = cb->tcg_flags;
+
+    tcg_temp_free_ptr(udata);
+    tcg_temp_free_i32(cpu_index);
+}
+
+static const TCGCond plugin_cond_to_tcg[] = {
+    [QEMU_PLUGIN_COND_NEVER] = TCG_COND_NEVER,
+    [QEMU_PLUGIN_COND_ALWAYS] = TCG_COND_ALWAYS,
+    [QEMU_PLUGIN_COND_EQ] = TCG_COND_EQ,
+    [QEMU_PLUGIN_COND_NE] = TCG_COND_NE,
+    [QEMU_PLUGIN_COND_LT] = TCG_COND_LTU,
+    [QEMU_PLUGIN_COND_LE] = TCG_COND_LEU,
+    [QEMU_PLUGIN_COND_GT] = TCG_COND_GTU,
+    [QEMU_PLUGIN_COND_GE] = TCG_COND_GEU,
+};
+
+static void gen_inline_cond_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGCond cond = plugin_cond_to_tcg[cb->inline_insn.cond];
+    TCGLabel *skip = NULL;
+
+    if (cond != TCG_COND_ALWAYS) {
+        TCGv_ptr ptr = gen_plugin_u64_ptr(cb->inline_insn.entry);
+        TCGv_i64 val = tcg_temp_new_i64();
+
+        skip = gen_new_label();
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_brcondi_i64(tcg_invert_cond(cond), val, cb->inline_insn.imm,
+                            skip);
+        tcg_temp_free_i64(val);
+        tcg_temp_free_ptr(ptr);
+    }
+    gen_udata_call(cb);
+    if (skip) {
+        gen_set_label(skip);
+    }
+}
+
+/* Append a record of the access at @addr to the running vCPU's buffer */
+static void gen_mem_buffer_record(const struct qemu_plugin_dyn_cb *cb,
+                                  TCGv addr, uint32_t info)
+{
+    struct qemu_plugin_mem_buffer *buf = cb->inline_insn.buf;
+    TCGv_ptr ptr = gen_scoreboard_entry(buf->score);
+    TCGv_ptr rec = tcg_temp_new_ptr();
+    TCGv_i64 n = tcg_temp_new_i64();
+    TCGv_i64 val = tcg_temp_new_i64();
+    TCGv_i32 meminfo = tcg_const_i32(info);
+    size_t recs = offsetof(struct qemu_plugin_mem_buffer_vcpu, recs);
+
+    tcg_gen_ld_i64(n, ptr, offsetof(struct qemu_plugin_mem_buffer_vcpu, n));
+    tcg_gen_muli_i64(val, n, sizeof(struct qemu_plugin_mem_record));
+    tcg_gen_trunc_i64_ptr(rec, val);
+    tcg_gen_add_ptr(rec, rec, ptr);
+    tcg_gen_addi_i64(n, n, 1);
+    tcg_gen_st_i64(n, ptr, offsetof(struct qemu_plugin_mem_buffer_vcpu, n));
+
+    tcg_gen_extu_tl_i64(val, addr);
+    tcg_gen_st_i64(val, rec,
+                   recs + offsetof(struct qemu_plugin_mem_record, vaddr));
+    tcg_gen_movi_i64(val, cb->inline_insn.pc);
+    tcg_gen_st_i64(val, rec,
+                   recs + offsetof(struct qemu_plugin_mem_record, pc));
+    tcg_gen_st_i32(meminfo, rec,
+                   recs + offsetof(struct qemu_plugin_mem_record, info));
+
+    tcg_temp_free_i32(meminfo);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_i64(n);
+    tcg_temp_free_ptr(rec);
+    tcg_temp_free_ptr(ptr);
+}
+
+/*
+ * Hand the records over to the plugin if fewer than @n entries are left,
+ * so that the buffer does not have to be checked on each access.
+ */
+static void gen_mem_buffer_check(struct qemu_plugin_mem_buffer *buf, size_t n)
+{
+    TCGLabel *skip = gen_new_label();
+    TCGv_ptr ptr = gen_scoreboard_entry(buf->score);
+    TCGv_i64 count = tcg_temp_new_i64();
+    TCGv_i32 cpu_index;
+    TCGv_ptr bufp;
+
+    tcg_gen_ld_i64(count, ptr,
+                   offsetof(struct qemu_plugin_mem_buffer_vcpu, n));
+    tcg_gen_brcondi_i64(TCG_COND_LEU, count, buf->n_entries - n, skip);
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(ptr);
+
+    cpu_index = tcg_temp_new_i32();
+    bufp = tcg_const_ptr(buf);
+    gen_load_cpu_index(cpu_index);
+    gen_helper_plugin_vcpu_mem_buffer_flush(cpu_index, bufp);
+    tcg_temp_free_ptr(bufp);
+    tcg_temp_free_i32(cpu_index);
+
+    gen_set_label(skip);
+}
+
+typedef struct MemBufferCount {
+    struct qemu_plugin_mem_buffer *buf;
+    size_t n;
+} MemBufferCount;
+
+/*
+ * Check the memory buffers once at the start of the TB, for all of the
+ * records that the TB can append, unless that is more than they hold.
+ * In that case, check them at the start of each instruction instead.
+ */
+static void gen_mem_buffer_checks_tb(struct qemu_plugin_tb *ptb)
+{
+    g_autoptr(GArray) counts = g_array_new(false, false,
+                                           sizeof(MemBufferCount));
+    size_t i, j, k;
+
+    for (i = 0; i < ptb->n; i++) {
+        struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, i);
+        GArray *cbs = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
+
+        for (j = 0; j < cbs->len; j++) {
+            struct qemu_plugin_dyn_cb *cb =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, j);
+            MemBufferCount *c;
+
+            if (cb->inline_insn.kind != PLUGIN_INLINE_MEM_BUFFER) {
+                continue;
+            }
+            for (k = 0; k < counts->len; k++) {
+                c = &g_array_index(counts, MemBufferCount, k);
+                if (c->buf == cb->inline_insn.buf) {
+                    break;
+                }
+            }
+            if (k == counts->len) {
+                MemBufferCount new = { .buf = cb->inline_insn.buf };
+
+                g_array_append_val(counts, new);
+            }
+            c = &g_array_index(counts, MemBufferCount, k);
+            c->n += insn->mem_accesses;
+        }
+    }
+
+    ptb->mem_buffer_insn_checks = false;
+    for (k = 0; k < counts->len; k++) {
+        MemBufferCount *c = &g_array_index(counts, MemBufferCount, k);
+
+        if (c->n > c->buf->n_entries) {
+            ptb->mem_buffer_insn_checks = true;
+            return;
+        }
+    }
+    for (k = 0; k < counts->len; k++) {
+        MemBufferCount *c = &g_array_index(counts, MemBufferCount, k);
+
+        if (c->n) {
+            gen_mem_buffer_check(c->buf, c->n);
+        }
+    }
+}
+
+static void gen_mem_buffer_checks_insn(struct qemu_plugin_insn *insn)
+{
+    GArray *cbs = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
+    size_t i;
+
+    if (!insn->mem_accesses) {
+        return;
+    }
+    for (i = 0; i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (cb->inline_insn.kind == PLUGIN_INLINE_MEM_BUFFER) {
+            /* n_entries is larger than any instruction's access count */
+            tcg_debug_assert(insn->mem_accesses <=
+                             cb->inline_insn.buf->n_entries);
+            gen_mem_buffer_check(cb->inline_insn.buf, insn->mem_accesses);
+        }
+    }
+}
+
+static void gen_inline_cbs(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
+{
+    size_t i;
+
+    if (!cbs) {
+        return;
+    }
+    for (i = 0; i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (!ok(begin_op, cb)) {
+            continue;
+        }
+        switch (cb->inline_insn.kind) {
+        case PLUGIN_INLINE_OP:
+            gen_inline_op(cb);
+            break;
+        case PLUGIN_INLINE_COND_CB:
+            gen_inline_cond_cb(cb);
+            break;
+        case PLUGIN_INLINE_MEM_BUFFER:
+            tcg_debug_assert(begin_op->args[0] == PLUGIN_GEN_FROM_MEM);
+            gen_mem_buffer_record(cb, (TCGv)(uintptr_t)begin_op->args[3],
+                                  begin_op->args[4]);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
 }
 
 static void
@@ -672,10 +939,14 @@ static void plugin_gen_tb_udata(const struct qemu_plugin_tb *ptb,
     inject_udata_cb(ptb->cbs[PLUGIN_CB_REGULAR], begin_op);
 }
 
-static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
+static void plugin_gen_tb_inline(struct qemu_plugin_tb *ptb,
                                  TCGOp *begin_op)
 {
-    inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
+    TCGOp *end_op = plugin_emit_begin(begin_op);
+
+    gen_mem_buffer_checks_tb(ptb);
+    gen_inline_cbs(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
+    plugin_emit_end(begin_op, end_op);
 }
 
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
@@ -690,8 +961,14 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
-    inject_inline_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE],
-                     begin_op, op_ok);
+    TCGOp *end_op = plugin_emit_begin(begin_op);
+
+    if (ptb->mem_buffer_insn_checks) {
+        gen_mem_buffer_checks_insn(insn);
+    }
+    gen_inline_cbs(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE], begin_op,
+                   op_ok);
+    plugin_emit_end(begin_op, end_op);
 }
 
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
@@ -706,9 +983,11 @@ static void plugin_gen_mem_inline(const struct qemu_plugin_tb *ptb,
 {
     const GArray *cbs;
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+    TCGOp *end_op = plugin_emit_begin(begin_op);
 
     cbs = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
-    inject_inline_cb(cbs, begin_op, op_rw);
+    gen_inline_cbs(cbs, begin_op, op_rw);
+    plugin_emit_end(begin_op, end_op);
 }
 
 static void plugin_gen_enable_mem_helper(const struct qemu_plugin_tb *ptb,
@@ -725,7 +1004,7 @@ static void plugin_gen_disable_mem_helper(const struct qemu_plugin_tb *ptb,
     inject_mem_disable_helper(insn, begin_op);
 }
 
-static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
+static void plugin_inject_cb(struct qemu_plugin_tb *ptb, TCGOp *begin_op,
                              int insn_idx)
 {
     enum plugin_gen_from from = begin_op->args[0];
@@ -835,12 +1114,18 @@ static void pr_ops(void)
 #endif
 }
 
-static void plugin_gen_inject(const struct qemu_plugin_tb *plugin_tb)
+static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
 {
+    TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
     TCGOp *op;
     int insn_idx;
 
     pr_ops();
+
+    /* see "Inline entries" above */
+    memcpy(free_temps, tcg_ctx->free_temps, sizeof(free_temps));
+    memset(tcg_ctx->free_temps, 0, sizeof(free_temps));
+
     insn_idx = -1;
     QSIMPLEQ_FOREACH(op, &tcg_ctx->plugin_ops, plugin_link) {
         enum plugin_gen_from from = op->args[0];
@@ -854,6 +1139,8 @@ static void plugin_gen_inject(const struct qemu_plugin_tb *plugin_tb)
         }
         plugin_inject_cb(plugin_tb, op, insn_idx);
     }
+
+    memcpy(tcg_ctx->free_temps, free_temps, sizeof(free_temps));
     pr_ops();
 }
 
@@ -918,6 +1205,9 @@ void plugin_gen_tb_end(CPUState *cpu)
     /* collect instrumentation requests */
     qemu_plugin_tb_trans_cb(cpu, ptb);
 
+    /* the ops emitted from now on do not belong to any instruction */
+    tcg_ctx->plugin_insn = NULL;
+
     /* inject the instrumentation at the appropriate places */
     plugin_gen_inject(ptb);
 
@@ -928,5 +1218,4 @@ void plugin_gen_tb_end(CPUState *cpu)
         }
     }
     ptb->n = 0;
-    tcg_ctx->plugin_insn = NULL;
 }
@@ -0,0 +1,395 @@
+/*
+ * Persistent translation cache for user-mode emulation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Short-lived processes spend much of their life translating the same
+ * dynamic loader and libc start-up code, run after run.  When enabled,
+ * this cache saves the front end output (the TCG ops, see tcg_ops_save())
+ * of TBs that come from executable file mappings, and replays it in later
+ * runs instead of decoding the guest code again.  Host code is not saved:
+ * it embeds absolute host addresses and is cheap to regenerate from the
+ * ops, which are position-independent as far as the host is concerned.
+ *
+ * There is one cache file per mapped file range, named after the identity
+ * of the QEMU binary, the CPU model, the mapped file (device, inode, size
+ * and modification time) and the file offset.  The guest address of the
+ * mapping is left out so that the same file is found again when the
+ * mapping moves, e.g. because of address space randomization.  Entries
+ * are still looked up by guest pc: the ops embed guest addresses, so a
+ * translation is only reused where it was made.
+ *
+ * Each entry keeps a copy of the guest code it was translated from and is
+ * only used if the code still matches, so self-modifying code or files
+ * patched in place never see stale translations.  Once restored, TBs are
+ * ordinary TBs and are invalidated on writes like any other.
+ *
+ * Translations are neither saved nor restored while plugins instrument
+ * code, breakpoints are set or single-stepping is on: translator_loop()
+ * generates different ops then, and restoring would bypass it.
+ *
+ * All of the state is protected by mmap_lock.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/cpu_ldst.h"
+#include "tcg/tcg.h"
+#include "qemu/xxhash.h"
+#include "qemu/error-report.h"
+
+#define TB_PERSIST_MAGIC    "QEMUTBC"
+#define TB_PERSIST_VERSION  2
+
+typedef struct TBPersistKey {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t trace_vcpu_dstate;
+} TBPersistKey;
+
+/* On-disk and in-memory layout of a cached TB */
+typedef struct TBPersistEntry {
+    TBPersistKey key;
+    uint32_t code_len;          /* guest code, at the start of data[] */
+    uint32_t ops_len;           /* tcg_ops_save() output, after the code */
+    uint8_t data[];
+} TBPersistEntry;
+
+typedef struct TBPersistHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_len;           /* followed by the key string */
+} TBPersistHeader;
+
+typedef struct TBPersistMap {
+    target_ulong start;
+    target_ulong end;
+    char *key;
+    char *path;
+    GHashTable *entries;        /* TBPersistKey -> TBPersistEntry */
+    bool dirty;
+} TBPersistMap;
+
+static struct {
+    char *dir;
+    char *ident;
+    GSList *maps;
+} tb_persist;
+
+static guint tb_persist_key_hash(gconstpointer p)
+{
+    const TBPersistKey *k = p;
+
+    return qemu_xxhash7(k->pc, k->cs_base, k->flags, k->cflags,
+                        k->trace_vcpu_dstate);
+}
+
+static gboolean tb_persist_key_equal(gconstpointer a, gconstpointer b)
+{
+    const TBPersistKey *ka = a, *kb = b;
+
+    return ka->pc == kb->pc && ka->cs_base == kb->cs_base &&
+           ka->flags == kb->flags && ka->cflags == kb->cflags &&
+           ka->trace_vcpu_dstate == kb->trace_vcpu_dstate;
+}
+
+static void tb_persist_key_init(TBPersistKey *k, const TranslationBlock *tb)
+{
+    memset(k, 0, sizeof(*k));
+    k->pc = tb->pc;
+    k->cs_base = tb->cs_base;
+    k->flags = tb->flags;
+    k->cflags = tb->cflags;
+    k->trace_vcpu_dstate = tb->trace_vcpu_dstate;
+}
+
+void tb_persist_init(const char *dir, const char *cpu_model)
+{
+    struct stat st;
+
+    if (g_mkdir_with_parents(dir, 0700) < 0) {
+        warn_report("cannot create translation cache directory %s: %s",
+                    dir, strerror(errno));
+        return;
+    }
+    /* Any rebuild of QEMU invalidates the whole cache.  */
+    if (stat("/proc/self/exe", &st) < 0) {
+        warn_report("cannot identify the QEMU binary, "
+                    "translation cache disabled");
+        return;
+    }
+
+    tb_persist.dir = g_strdup(dir);
+    tb_persist.ident = g_strdup_printf(
+        "qemu-%s %" PRIu64 ":%" PRIu64 ":%" PRId64 ":%" PRId64 ".%09ld %s",
+        TARGET_NAME, (uint64_t)st.st_dev, (uint64_t)st.st_ino,
+        (int64_t)st.st_size, (int64_t)st.st_mtim.tv_sec,
+        (long)st.st_mtim.tv_nsec, cpu_model ? cpu_model : "");
+}
+
+static void tb_persist_load(TBPersistMap *map)
+{
+    TBPersistHeader hdr;
+    gchar *buf;
+    gsize len, off;
+
+    if (!g_file_get_contents(map->path, &buf, &len, NULL)) {
+        return;
+    }
+    if (len < sizeof(hdr)) {
+        goto out;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    off = sizeof(hdr);
+    if (memcmp(hdr.magic, TB_PERSIST_MAGIC, sizeof(TB_PERSIST_MAGIC)) ||
+        hdr.version != TB_PERSIST_VERSION ||
+        hdr.key_len != strlen(map->key) || len - off < hdr.key_len ||
+        memcmp(buf + off, map->key, hdr.key_len)) {
+        goto out;
+    }
+    off += hdr.key_len;
+
+    while (len - off >= sizeof(TBPersistEntry)) {
+        TBPersistEntry head, *e;
+        size_t size;
+
+        memcpy(&head, buf + off, sizeof(head));
+        size = (size_t)head.code_len + head.ops_len;
+        if (size > len - off - sizeof(head)) {
+            break;
+        }
+        size += sizeof(head);
+        e = g_malloc(size);
+        memcpy(e, buf + off, size);
+        g_hash_table_replace(map->entries, &e->key, e);
+        off += size;
+    }
+
+ out:
+    g_free(buf);
+}
+
+static void tb_persist_save(TBPersistMap *map)
+{
+    TBPersistHeader hdr = {
+        .magic = TB_PERSIST_MAGIC,
+        .version = TB_PERSIST_VERSION,
+        .key_len = strlen(map->key),
+    };
+    GByteArray *buf = g_byte_array_new();
+    GHashTableIter iter;
+    TBPersistEntry *e;
+    GError *err = NULL;
+
+    g_byte_array_append(buf, (const guint8 *)&hdr, sizeof(hdr));
+    g_byte_array_append(buf, (const guint8 *)map->key, hdr.key_len);
+    g_hash_table_iter_init(&iter, map->entries);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&e)) {
+        g_byte_array_append(buf, (const guint8 *)e,
+                            sizeof(*e) + e->code_len + e->ops_len);
+    }
+
+    /* Written to a temporary file and renamed, so concurrent runs are safe */
+    if (!g_file_set_contents(map->path, (const gchar *)buf->data, buf->len,
+                             &err)) {
+        warn_report("cannot save translation cache %s: %s",
+                    map->path, err->message);
+        g_error_free(err);
+    }
+    g_byte_array_free(buf, true);
+    map->dirty = false;
+}
+
+static void tb_persist_map_free(TBPersistMap *map)
+{
+    if (map->dirty) {
+        tb_persist_save(map);
+    }
+    g_hash_table_destroy(map->entries);
+    g_free(map->key);
+    g_free(map->path);
+    g_free(map);
+}
+
+void tb_persist_map(target_ulong start, target_ulong len, int fd,
+                    off_t offset)
+{
+    TBPersistMap *map;
+    struct stat st;
+    gchar *name;
+
+    if (!tb_persist.dir || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return;
+    }
+
+    map = g_new0(TBPersistMap, 1);
+    map->start = start;
+    map->end = start + len;
+    map->key = g_strdup_printf(
+        "%s file=%" PRIu64 ":%" PRIu64 ":%" PRId64 ":%" PRId64 ".%09ld"
+        " offset=0x%" PRIx64,
+        tb_persist.ident, (uint64_t)st.st_dev, (uint64_t)st.st_ino,
+        (int64_t)st.st_size, (int64_t)st.st_mtim.tv_sec,
+        (long)st.st_mtim.tv_nsec, (uint64_t)offset);
+    name = g_compute_checksum_for_string(G_CHECKSUM_SHA256, map->key, -1);
+    map->path = g_strdup_printf("%s/%s.tbc", tb_persist.dir, name);
+    g_free(name);
+    map->entries = g_hash_table_new_full(tb_persist_key_hash,
+                                         tb_persist_key_equal, NULL, g_free);
+
+    tb_persist_load(map);
+    tb_persist.maps = g_slist_prepend(tb_persist.maps, map);
+}
+
+void tb_persist_unmap(target_ulong start, target_ulong len)
+{
+    target_ulong end = start + len;
+    GSList *l = tb_persist.maps;
+
+    while (l) {
+        TBPersistMap *map = l->data;
+
+        l = l->next;
+        if (map->start < end && start < map->end) {
+            tb_persist.maps = g_slist_remove(tb_persist.maps, map);
+            tb_persist_map_free(map);
+        }
+    }
+}
+
+void tb_persist_flush(void)
+{
+    GSList *l;
+
+    mmap_lock();
+    for (l = tb_persist.maps; l; l = l->next) {
+        TBPersistMap *map = l->data;
+
+        if (map->dirty) {
+            tb_persist_save(map);
+        }
+    }
+    mmap_unlock();
+}
+
+/* Find the mapping that holds all of [pc, pc + len).  */
+static TBPersistMap *tb_persist_find(target_ulong pc, target_ulong len)
+{
+    GSList *l;
+
+    for (l = tb_persist.maps; l; l = l->next) {
+        TBPersistMap *map = l->data;
+
+        if (pc >= map->start && pc < map->end) {
+            return len <= map->end - pc ? map : NULL;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Whether the ops of @tb are those translator_loop() generates with no
+ * debugging or instrumentation going on.
+ */
+static bool tb_persist_usable(CPUState *cpu, const TranslationBlock *tb)
+{
+    return tb_persist.maps && !(tb->cflags & CF_NOCACHE) &&
+           !cpu->singlestep_enabled && !singlestep &&
+           QTAILQ_EMPTY(&cpu->breakpoints) &&
+           !test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask);
+}
+
+bool tb_persist_restore(CPUState *cpu, TranslationBlock *tb, int max_insns)
+{
+    TBPersistMap *map;
+    TBPersistEntry *e;
+    TBPersistKey key;
+
+    if (!tb_persist_usable(cpu, tb)) {
+        return false;
+    }
+    map = tb_persist_find(tb->pc, 1);
+    if (!map) {
+        return false;
+    }
+    tb_persist_key_init(&key, tb);
+    e = g_hash_table_lookup(map->entries, &key);
+    if (!e) {
+        return false;
+    }
+
+    if (e->code_len > map->end - tb->pc ||
+        page_check_range(tb->pc, e->code_len, PAGE_READ) < 0 ||
+        memcmp(g2h(tb->pc), e->data, e->code_len)) {
+        /* The guest code changed since it was cached.  */
+        g_hash_table_remove(map->entries, &key);
+        map->dirty = true;
+        return false;
+    }
+
+    if (!tcg_ops_load(tcg_ctx, tb, e->data + e->code_len, e->ops_len)) {
+        g_hash_table_remove(map->entries, &key);
+        map->dirty = true;
+        return false;
+    }
+    if (tb->size != e->code_len) {
+        /*
+         * SMC protection covers [pc, pc + size): it must be the range
+         * that was compared with guest memory above.
+         */
+        tcg_func_start(tcg_ctx);
+        g_hash_table_remove(map->entries, &key);
+        map->dirty = true;
+        return false;
+    }
+    if (tb->icount > max_insns) {
+        /* Retrying a TB that was too large for the code buffer.  */
+        tcg_func_start(tcg_ctx);
+        return false;
+    }
+    return true;
+}
+
+void tb_persist_record(CPUState *cpu, TranslationBlock *tb)
+{
+    TBPersistMap *map;
+    TBPersistEntry *e;
+    GByteArray *ops;
+
+    if (!tb_persist_usable(cpu, tb)) {
+        return;
+    }
+    map = tb_persist_find(tb->pc, tb->size);
+    if (!map || page_check_range(tb->pc, tb->size, PAGE_READ) < 0) {
+        return;
+    }
+
+    ops = g_byte_array_new();
+    if (tcg_ops_save(tcg_ctx, tb, ops)) {
+        e = g_malloc0(sizeof(*e) + tb->size + ops->len);
+        tb_persist_key_init(&e->key, tb);
+        e->code_len = tb->size;
+        e->ops_len = ops->len;
+        memcpy(e->data, g2h(tb->pc), tb->size);
+        memcpy(e->data + tb->size, ops->data, ops->len);
+        g_hash_table_replace(map->entries, &e->key, e);
+        map->dirty = true;
+    }
+    g_byte_array_free(ops, true);
+}
@@ -0,0 +1,404 @@
+/*
+ * Background translation of the successors of new TBs, for user-mode
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * When a vCPU misses in the TB hash table, it translates the block
+ * itself before it can go on, and a program that starts up runs into
+ * such misses all the time.  When enabled, this file keeps a few threads
+ * that translate the statically known successors of each new TB (the
+ * targets of its direct jumps, see translator_set_successor(), and the
+ * instruction that follows it if the TB ended only because of its size)
+ * with the same CPU state flags, and publish them in the hash table like
+ * any other TB.  The successors of
+ * these speculative TBs are queued in turn, up to TB_PREFETCH_DEPTH
+ * blocks away from code that actually ran.  A vCPU that gets there later
+ * finds the code already translated.
+ *
+ * Translation stays serialized by mmap_lock, so the threads only help
+ * while the vCPUs execute code rather than translate it, and a single
+ * thread is usually enough.  The queue is a bounded stack: the most
+ * recent requests, which are the most likely to be needed soon, are
+ * served first, and the oldest are dropped when it overflows.
+ *
+ * Speculation must never fault, since no guest can take the signal:
+ * both pages that a TB may span must be mapped readable and executable,
+ * and not be in the middle of an mmap, munmap or mprotect call (see
+ * mmap_defer_host_prot()).  TBs close to the end of a mapping are left
+ * to the vCPUs, and so is code in writable pages: it is likely to be
+ * generated at run time, and translating it ahead would only make the
+ * guest fault on its next write.
+ *
+ * The threads translate with the CPUState of the vCPU that asked, and
+ * the translators only read from it what the TB flags describe or what
+ * does not change after realize, with two exceptions: breakpoints and
+ * single-stepping.  These only change within gdb_handlesig(), which
+ * keeps the threads idle with tb_prefetch_pause().
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/cpu_ldst.h"
+#include "tcg/tcg.h"
+#include "qemu/bitops.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+
+/* Requests waiting for a thread; the oldest are dropped beyond that */
+#define TB_PREFETCH_QUEUE   256
+/* How many speculative blocks away from executed code to go */
+#define TB_PREFETCH_DEPTH   4
+/* Successors of a TB: two direct jumps and the next instruction */
+#define TB_PREFETCH_NEXT    3
+
+typedef struct TBPrefetchReq {
+    CPUState *cpu;
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    unsigned int depth;
+} TBPrefetchReq;
+
+typedef struct TBPrefetchWorker {
+    QemuThread thread;
+    /* The CPU whose request is being served, see tb_prefetch_cpu_exit() */
+    CPUState *cpu;
+    /* Do not queue the successors of that request */
+    bool drop;
+} TBPrefetchWorker;
+
+static struct {
+    unsigned int nthreads;
+    TBPrefetchWorker *workers;
+
+    /* Protects everything below and TBPrefetchWorker.cpu and .drop */
+    QemuMutex lock;
+    QemuCond cond;
+    QemuCond idle_cond;
+    TBPrefetchReq queue[TB_PREFETCH_QUEUE];
+    unsigned int top;
+    unsigned int count;
+    /* Nesting count of tb_prefetch_pause() */
+    unsigned int paused;
+} tb_prefetch;
+
+/* Called with tb_prefetch.lock held.  */
+static void tb_prefetch_push(const TBPrefetchReq *req)
+{
+    tb_prefetch.top = (tb_prefetch.top + 1) % TB_PREFETCH_QUEUE;
+    tb_prefetch.queue[tb_prefetch.top] = *req;
+    if (tb_prefetch.count < TB_PREFETCH_QUEUE) {
+        tb_prefetch.count++;
+    }
+    qemu_cond_signal(&tb_prefetch.cond);
+}
+
+/* Called with tb_prefetch.lock held and a non-empty queue.  */
+static TBPrefetchReq tb_prefetch_pop(void)
+{
+    TBPrefetchReq req = tb_prefetch.queue[tb_prefetch.top];
+
+    tb_prefetch.top = (tb_prefetch.top + TB_PREFETCH_QUEUE - 1)
+                      % TB_PREFETCH_QUEUE;
+    tb_prefetch.count--;
+    return req;
+}
+
+/* Called while @tb cannot be flushed.  */
+static int tb_prefetch_next(const TranslationBlock *tb, target_ulong *next)
+{
+    int i, n = 0;
+
+    for (i = 0; i < 2; i++) {
+        if (tb->jmp_pc[i] != -1 && (!n || tb->jmp_pc[i] != next[0])) {
+            next[n++] = tb->jmp_pc[i];
+        }
+    }
+    if (tb->next_pc == -1) {
+        return n;
+    }
+    for (i = 0; i < n && next[i] != tb->next_pc; i++) {
+        continue;
+    }
+    if (i == n) {
+        next[n++] = tb->next_pc;
+    }
+    return n;
+}
+
+/*
+ * Called with tb_prefetch.lock held: drop the queued requests of @cpu,
+ * or all of them if @cpu is NULL, and the successors of the requests
+ * being served.
+ */
+static void tb_prefetch_purge(CPUState *cpu)
+{
+    unsigned int i, j, n;
+
+    /*
+     * Push the other requests back, oldest first.  This never overwrites
+     * a request that has not been looked at yet.
+     */
+    n = tb_prefetch.count;
+    tb_prefetch.count = 0;
+    for (i = 0, j = tb_prefetch.top + TB_PREFETCH_QUEUE - n + 1; i < n;
+         i++, j++) {
+        TBPrefetchReq *req = &tb_prefetch.queue[j % TB_PREFETCH_QUEUE];
+
+        if (cpu && req->cpu != cpu) {
+            tb_prefetch_push(req);
+        }
+    }
+    for (i = 0; i < tb_prefetch.nthreads; i++) {
+        TBPrefetchWorker *w = &tb_prefetch.workers[i];
+
+        if (w->cpu && (!cpu || w->cpu == cpu)) {
+            w->drop = true;
+        }
+    }
+}
+
+/*
+ * Called with tb_prefetch.lock held: wait until no thread serves a
+ * request of @cpu, or any request if @cpu is NULL.
+ */
+static void tb_prefetch_wait(CPUState *cpu)
+{
+    unsigned int i;
+    bool busy;
+
+    do {
+        busy = false;
+        for (i = 0; i < tb_prefetch.nthreads; i++) {
+            CPUState *c = tb_prefetch.workers[i].cpu;
+
+            busy |= c && (!cpu || c == cpu);
+        }
+        if (busy) {
+            qemu_cond_wait(&tb_prefetch.idle_cond, &tb_prefetch.lock);
+        }
+    } while (busy);
+}
+
+/* Can @pc be translated without any risk of faulting?  */
+static bool tb_prefetch_safe(target_ulong pc)
+{
+    target_ulong page = pc & TARGET_PAGE_MASK;
+    target_ulong last = page + 2 * TARGET_PAGE_SIZE - 1;
+
+    return last > page && guest_addr_valid(last)
+        && page_check_range(page, 2 * TARGET_PAGE_SIZE,
+                            PAGE_READ | PAGE_EXEC) == 0
+        && !((page_get_flags(page) | page_get_flags(last)) & PAGE_WRITE_ORG)
+        && !mmap_defer_host_prot(page, last + 1);
+}
+
+/*
+ * Translate @req unless it is already, and return the number of
+ * successors of the new TB stored in @next.
+ */
+static int tb_prefetch_translate(const TBPrefetchReq *req, target_ulong *next)
+{
+    TranslationBlock *tb;
+    int n = 0;
+
+    mmap_lock();
+    if (!tb_prefetch_safe(req->pc)) {
+        goto out;
+    }
+    rcu_read_lock();
+    tb = tb_htable_lookup(req->cpu, req->pc, req->cs_base, req->flags,
+                          req->cflags);
+    rcu_read_unlock();
+    if (tb) {
+        goto out;
+    }
+    tb = tb_gen_code_prefetch(req->cpu, req->pc, req->cs_base, req->flags,
+                              req->cflags);
+    if (tb && req->depth < TB_PREFETCH_DEPTH) {
+        n = tb_prefetch_next(tb, next);
+    }
+ out:
+    mmap_unlock();
+    return n;
+}
+
+static void *tb_prefetch_worker(void *opaque)
+{
+    TBPrefetchWorker *w = opaque;
+
+    rcu_register_thread();
+    tcg_register_thread();
+
+    qemu_mutex_lock(&tb_prefetch.lock);
+    for (;;) {
+        target_ulong next[TB_PREFETCH_NEXT];
+        TBPrefetchReq req;
+        int i, n;
+
+        while (!tb_prefetch.count) {
+            qemu_cond_wait(&tb_prefetch.cond, &tb_prefetch.lock);
+        }
+        req = tb_prefetch_pop();
+        w->cpu = req.cpu;
+        qemu_mutex_unlock(&tb_prefetch.lock);
+
+        n = tb_prefetch_translate(&req, next);
+
+        qemu_mutex_lock(&tb_prefetch.lock);
+        req.depth++;
+        for (i = 0; i < n && !w->drop; i++) {
+            req.pc = next[i];
+            tb_prefetch_push(&req);
+        }
+        w->cpu = NULL;
+        w->drop = false;
+        qemu_cond_broadcast(&tb_prefetch.idle_cond);
+    }
+    return NULL;
+}
+
+static void tb_prefetch_start_workers(void)
+{
+    unsigned int i;
+
+    qemu_mutex_init(&tb_prefetch.lock);
+    qemu_cond_init(&tb_prefetch.cond);
+    qemu_cond_init(&tb_prefetch.idle_cond);
+    tb_prefetch.top = 0;
+    tb_prefetch.count = 0;
+    tb_prefetch.paused = 0;
+    for (i = 0; i < tb_prefetch.nthreads; i++) {
+        tb_prefetch.workers[i].cpu = NULL;
+        tb_prefetch.workers[i].drop = false;
+        qemu_thread_create(&tb_prefetch.workers[i].thread, "tb-prefetch",
+                           tb_prefetch_worker, &tb_prefetch.workers[i],
+                           QEMU_THREAD_DETACHED);
+    }
+}
+
+void tb_prefetch_init(unsigned int threads)
+{
+    if (!threads) {
+        return;
+    }
+    tb_prefetch.nthreads = threads;
+    tb_prefetch.workers = g_new0(TBPrefetchWorker, threads);
+    tb_prefetch_start_workers();
+}
+
+/*
+ * Called by the vCPU thread after translating @tb, which it is about to
+ * execute.
+ */
+void tb_prefetch_successors(CPUState *cpu, TranslationBlock *tb)
+{
+    uint32_t cflags = tb_cflags(tb);
+    TBPrefetchReq req = {
+        .cpu = cpu,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+        .cflags = cflags & CF_HASH_MASK,
+    };
+    target_ulong next[TB_PREFETCH_NEXT];
+    int i, n;
+
+    if (!tb_prefetch.nthreads ||
+        (cflags & (CF_NOCACHE | CF_COUNT_MASK)) ||
+        cpu->singlestep_enabled || singlestep ||
+        !QTAILQ_EMPTY(&cpu->breakpoints) ||
+        /* The translation callbacks of plugins expect a vCPU thread */
+        test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return;
+    }
+
+    n = tb_prefetch_next(tb, next);
+    qemu_mutex_lock(&tb_prefetch.lock);
+    for (i = 0; i < n && !tb_prefetch.paused; i++) {
+        req.pc = next[i];
+        tb_prefetch_push(&req);
+    }
+    qemu_mutex_unlock(&tb_prefetch.lock);
+}
+
+/*
+ * Called by the thread of @cpu before it goes away: drop its requests
+ * and wait until no thread uses it any more.
+ */
+void tb_prefetch_cpu_exit(CPUState *cpu)
+{
+    if (!tb_prefetch.nthreads) {
+        return;
+    }
+
+    qemu_mutex_lock(&tb_prefetch.lock);
+    tb_prefetch_purge(cpu);
+    tb_prefetch_wait(cpu);
+    qemu_mutex_unlock(&tb_prefetch.lock);
+}
+
+/*
+ * Drop all requests and wait for the threads to be idle; no request is
+ * queued until the matching tb_prefetch_resume().  Called by a vCPU
+ * thread before it changes the debug state of any CPU.
+ */
+void tb_prefetch_pause(void)
+{
+    if (!tb_prefetch.nthreads) {
+        return;
+    }
+
+    qemu_mutex_lock(&tb_prefetch.lock);
+    tb_prefetch.paused++;
+    tb_prefetch_purge(NULL);
+    tb_prefetch_wait(NULL);
+    qemu_mutex_unlock(&tb_prefetch.lock);
+}
+
+void tb_prefetch_resume(void)
+{
+    if (!tb_prefetch.nthreads) {
+        return;
+    }
+
+    qemu_mutex_lock(&tb_prefetch.lock);
+    assert(tb_prefetch.paused);
+    tb_prefetch.paused--;
+    qemu_mutex_unlock(&tb_prefetch.lock);
+}
+
+/* Called by fork_start() with mmap_lock held.  */
+void tb_prefetch_fork_start(void)
+{
+    if (tb_prefetch.nthreads) {
+        qemu_mutex_lock(&tb_prefetch.lock);
+    }
+}
+
+void tb_prefetch_fork_end(int child)
+{
+    if (!tb_prefetch.nthreads) {
+        return;
+    }
+    if (child) {
+        /* The threads are gone, and so are the other CPUs.  */
+        tb_prefetch_start_workers();
+    } else {
+        qemu_mutex_unlock(&tb_prefetch.lock);
+    }
+}
@@ -28,6 +28,8 @@
 #include "sysemu/tcg.h"
 #include "qom/object.h"
 #include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/cputlb.h"
 #include "sysemu/cpus.h"
 #include "qemu/main-loop.h"
 #include "tcg/tcg.h"
@@ -41,6 +43,10 @@ typedef struct TCGState {
 
     bool mttcg_enabled;
     unsigned long tb_size;
+    uint32_t tier_threshold;
+    uint32_t victim_tlb_size;
+    bool perfmap;
+    bool jitdump;
 } TCGState;
 
 #define TYPE_TCG_ACCEL ACCEL_CLASS_NAME("tcg")
@@ -120,13 +126,25 @@ static void tcg_accel_instance_init(Object *obj)
     TCGState *s = TCG_STATE(obj);
 
     s->mttcg_enabled = default_mttcg_enabled();
+    s->victim_tlb_size = CPU_VTLB_DEFAULT_SIZE;
 }
 
 static int tcg_init(MachineState *ms)
 {
     TCGState *s = TCG_STATE(current_accel());
 
+#ifdef CONFIG_POSIX
+    /* Before tcg_exec_init(), which generates the prologue */
+    if (s->perfmap) {
+        perf_enable_perfmap();
+    }
+    if (s->jitdump) {
+        perf_enable_jitdump();
+    }
+#endif
     tcg_exec_init(s->tb_size * 1024 * 1024);
+    tb_tier_set_threshold(s->tier_threshold);
+    cpu_vtlb_size = s->victim_tlb_size;
     cpu_interrupt_handler = tcg_handle_interrupt;
     mttcg_enabled = s->mttcg_enabled;
     return 0;
@@ -194,6 +212,97 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_tier_threshold(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->tier_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tier_threshold(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+    if (value > INT32_MAX) {
+        error_setg(errp, "tier-threshold must be at most %d", INT32_MAX);
+        return;
+    }
+
+    s->tier_threshold = value;
+}
+
+static void tcg_get_victim_tlb_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->victim_tlb_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_victim_tlb_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+    if (!is_power_of_2(value) ||
+        value < CPU_VTLB_MIN_SIZE || value > CPU_VTLB_MAX_SIZE) {
+        error_setg(errp, "victim-tlb-size must be a power of 2 "
+                   "between %d and %d", CPU_VTLB_MIN_SIZE, CPU_VTLB_MAX_SIZE);
+        return;
+    }
+
+    s->victim_tlb_size = value;
+}
+
+#ifdef CONFIG_POSIX
+static char *tcg_get_perf(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->jitdump ? "jitdump" : s->perfmap ? "map" : "off");
+}
+
+static void tcg_set_perf(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    if (strcmp(value, "map") == 0) {
+        s->perfmap = true;
+        s->jitdump = false;
+    } else if (strcmp(value, "jitdump") == 0) {
+        s->perfmap = false;
+        s->jitdump = true;
+    } else if (strcmp(value, "off") == 0) {
+        s->perfmap = false;
+        s->jitdump = false;
+    } else {
+        error_setg(errp, "Invalid 'perf' setting %s", value);
+    }
+}
+#endif
+
 static void tcg_accel_class_init(ObjectClass *oc, void *data)
 {
     AccelClass *ac = ACCEL_CLASS(oc);
@@ -211,6 +320,26 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "tier-threshold", "int",
+        tcg_get_tier_threshold, tcg_set_tier_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tier-threshold",
+        "Executions before a TB is retranslated as a superblock (0 = never)");
+
+    object_class_property_add(oc, "victim-tlb-size", "int",
+        tcg_get_victim_tlb_size, tcg_set_victim_tlb_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "victim-tlb-size",
+        "Entries in the victim TLB of each MMU mode");
+
+#ifdef CONFIG_POSIX
+    object_class_property_add_str(oc, "perf",
+                                  tcg_get_perf,
+                                  tcg_set_perf);
+    object_class_property_set_description(oc, "perf",
+        "Symbols for translated code for perf (off, map or jitdump)");
+#endif
+
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -0,0 +1,297 @@
+/*
+ * TCG execution profiler
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Unlike the CONFIG_PROFILER counters, this profiler is always built in
+ * and costs nothing until it is turned on with x-tcg-profile or the HMP
+ * "tcg-profile" command.
+ *
+ * While it runs:
+ * - translated code is generated with CF_PROFILE, which makes each TB
+ *   count its executions in TranslationBlock.exec_count and makes each
+ *   helper call record itself in CPUTCGProf.state;
+ * - the execution loop, the translator and the softmmu TLB refill path
+ *   also keep CPUTCGProf.state up to date, and count TB entries,
+ *   translations and TLB misses per vCPU;
+ * - a thread samples the state of every vCPU every TCG_PROF_SAMPLE_US,
+ *   which gives a cheap breakdown of where each vCPU spends its time.
+ *
+ * Turning the profiler on or off flushes the translated code so that
+ * the instrumentation comes and goes with it.  The execution counts of
+ * the TBs are copied out first, so that they can still be queried.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "tcg/tcg.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "sysemu/tcg.h"
+
+#define TCG_PROF_SAMPLE_US  1000
+/* Number of TBs whose counts are kept when the profiler is turned off */
+#define TCG_PROF_SAVED_TBS  1024
+
+typedef struct TCGProfTB {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint16_t icount;
+    uint32_t host_size;
+    uint64_t count;
+} TCGProfTB;
+
+static struct {
+    QemuThread sampler;
+    /* Time the profiler ran for, up to @start if it is running */
+    int64_t elapsed;
+    int64_t start;
+    /* Sorted by count, most executed first */
+    GArray *saved_tbs;
+} tcg_prof;
+
+static void *tcg_prof_sampler(void *opaque)
+{
+    while (atomic_read(&tcg_prof_enabled)) {
+        CPUState *cpu;
+
+        g_usleep(TCG_PROF_SAMPLE_US);
+
+        cpu_list_lock();
+        CPU_FOREACH(cpu) {
+            CPUTCGProf *cp = &cpu->tcg_prof;
+            int state = atomic_read(&cp->state);
+
+            atomic_set__nocheck(&cp->samples[state], cp->samples[state] + 1);
+        }
+        cpu_list_unlock();
+    }
+    return NULL;
+}
+
+static gint tcg_prof_tb_cmp(gconstpointer ap, gconstpointer bp)
+{
+    const TCGProfTB *a = ap;
+    const TCGProfTB *b = bp;
+
+    return a->count < b->count ? 1 : a->count > b->count ? -1 : 0;
+}
+
+static gboolean tcg_prof_tb_collect(gpointer key, gpointer value,
+                                    gpointer data)
+{
+    const TranslationBlock *tb = value;
+    uint64_t count = atomic_read__nocheck(&tb->exec_count);
+    GArray *tbs = data;
+
+    if (count) {
+        TCGProfTB t = {
+            .pc = tb->pc,
+            .cs_base = tb->cs_base,
+            .flags = tb->flags,
+            .icount = tb->icount,
+            .host_size = tb->tc.size,
+            .count = count,
+        };
+
+        g_array_append_val(tbs, t);
+    }
+    return false;
+}
+
+/* Return the counted TBs, most executed first.  */
+static GArray *tcg_prof_tbs(void)
+{
+    GArray *tbs;
+
+    if (!tcg_prof_enabled) {
+        return g_array_ref(tcg_prof.saved_tbs);
+    }
+    tbs = g_array_new(false, false, sizeof(TCGProfTB));
+    tcg_tb_foreach(tcg_prof_tb_collect, tbs);
+    g_array_sort(tbs, tcg_prof_tb_cmp);
+    return tbs;
+}
+
+static void tcg_prof_reset(void)
+{
+    CPUState *cpu;
+
+    cpu_list_lock();
+    CPU_FOREACH(cpu) {
+        CPUTCGProf *cp = &cpu->tcg_prof;
+        int state = atomic_read(&cp->state);
+
+        /* Not atomic with respect to the vCPU, but good enough */
+        memset(cp, 0, sizeof(*cp));
+        atomic_set(&cp->state, state);
+    }
+    cpu_list_unlock();
+
+    g_array_set_size(tcg_prof.saved_tbs, 0);
+    tcg_prof.elapsed = 0;
+    tcg_prof.start = get_clock();
+    if (tcg_prof_enabled) {
+        tb_flush(first_cpu);
+    }
+}
+
+static void tcg_prof_on(void)
+{
+    if (tcg_prof_enabled) {
+        return;
+    }
+    g_array_set_size(tcg_prof.saved_tbs, 0);
+    tcg_prof.start = get_clock();
+    atomic_set(&tcg_prof_enabled, true);
+    qemu_thread_create(&tcg_prof.sampler, "tcg-prof", tcg_prof_sampler,
+                       NULL, QEMU_THREAD_JOINABLE);
+    tb_flush(first_cpu);
+}
+
+static void tcg_prof_off(void)
+{
+    GArray *tbs;
+
+    if (!tcg_prof_enabled) {
+        return;
+    }
+    tbs = tcg_prof_tbs();
+    if (tbs->len > TCG_PROF_SAVED_TBS) {
+        g_array_set_size(tbs, TCG_PROF_SAVED_TBS);
+    }
+    g_array_unref(tcg_prof.saved_tbs);
+    tcg_prof.saved_tbs = tbs;
+
+    atomic_set(&tcg_prof_enabled, false);
+    qemu_thread_join(&tcg_prof.sampler);
+    tcg_prof.elapsed += get_clock() - tcg_prof.start;
+    tb_flush(first_cpu);
+}
+
+void qmp_x_tcg_profile(TcgProfileOp op, Error **errp)
+{
+    if (!tcg_enabled()) {
+        error_setg(errp, "TCG profiling is only available with accel=tcg");
+        return;
+    }
+    if (!tcg_prof.saved_tbs) {
+        tcg_prof.saved_tbs = g_array_new(false, false, sizeof(TCGProfTB));
+    }
+
+    switch (op) {
+    case TCG_PROFILE_OP_ON:
+        tcg_prof_on();
+        break;
+    case TCG_PROFILE_OP_OFF:
+        tcg_prof_off();
+        break;
+    case TCG_PROFILE_OP_RESET:
+        tcg_prof_reset();
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static TcgProfileCpu *tcg_prof_query_cpu(CPUState *cpu)
+{
+    CPUTCGProf *cp = &cpu->tcg_prof;
+    TcgProfileCpu *info = g_new0(TcgProfileCpu, 1);
+
+    info->cpu_index = cpu->cpu_index;
+    info->samples_idle = atomic_read__nocheck(&cp->samples[TCG_PROF_IDLE]);
+    info->samples_runtime =
+        atomic_read__nocheck(&cp->samples[TCG_PROF_RUNTIME]);
+    info->samples_code = atomic_read__nocheck(&cp->samples[TCG_PROF_CODE]);
+    info->samples_helper =
+        atomic_read__nocheck(&cp->samples[TCG_PROF_HELPER]);
+    info->samples_tlb_fill =
+        atomic_read__nocheck(&cp->samples[TCG_PROF_TLB_FILL]);
+    info->samples_translate =
+        atomic_read__nocheck(&cp->samples[TCG_PROF_TRANSLATE]);
+    info->tb_entries = atomic_read__nocheck(&cp->tb_entries);
+    info->translations = atomic_read__nocheck(&cp->translations);
+    info->translate_ns = atomic_read__nocheck(&cp->translate_ns);
+    info->tlb_fills = atomic_read__nocheck(&cp->tlb_fills);
+    info->tlb_victim_hits = atomic_read__nocheck(&cp->tlb_victim_hits);
+    return info;
+}
+
+TcgProfile *qmp_x_query_tcg_profile(bool has_top, int64_t top, Error **errp)
+{
+    TcgProfile *prof;
+    TcgProfileCpuList **cpu_tail;
+    TcgProfileTbList **tb_tail;
+    CPUState *cpu;
+    GArray *tbs;
+    guint i;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "TCG profiling is only available with accel=tcg");
+        return NULL;
+    }
+    if (!has_top) {
+        top = 10;
+    }
+    if (!tcg_prof.saved_tbs) {
+        tcg_prof.saved_tbs = g_array_new(false, false, sizeof(TCGProfTB));
+    }
+
+    prof = g_new0(TcgProfile, 1);
+    prof->enabled = tcg_prof_enabled;
+    prof->elapsed_ns = tcg_prof.elapsed;
+    if (tcg_prof_enabled) {
+        prof->elapsed_ns += get_clock() - tcg_prof.start;
+    }
+    prof->sample_interval_us = TCG_PROF_SAMPLE_US;
+
+    cpu_tail = &prof->cpus;
+    cpu_list_lock();
+    CPU_FOREACH(cpu) {
+        TcgProfileCpuList *entry = g_new0(TcgProfileCpuList, 1);
+
+        entry->value = tcg_prof_query_cpu(cpu);
+        *cpu_tail = entry;
+        cpu_tail = &entry->next;
+    }
+    cpu_list_unlock();
+
+    tbs = tcg_prof_tbs();
+    tb_tail = &prof->hot_tbs;
+    for (i = 0; i < tbs->len; i++) {
+        const TCGProfTB *t = &g_array_index(tbs, TCGProfTB, i);
+
+        prof->executions += t->count;
+        if (i < top) {
+            TcgProfileTbList *entry = g_new0(TcgProfileTbList, 1);
+            TcgProfileTb *info = g_new0(TcgProfileTb, 1);
+            const char *sym = lookup_symbol(t->pc);
+
+            info->pc = t->pc;
+            info->cs_base = t->cs_base;
+            info->flags = t->flags;
+            info->executions = t->count;
+            info->guest_insns = t->icount;
+            info->host_size = t->host_size;
+            if (sym[0]) {
+                info->has_symbol = true;
+                info->symbol = g_strdup(sym);
+            }
+            entry->value = info;
+            *tb_tail = entry;
+            tb_tail = &entry->next;
+        }
+    }
+    g_array_unref(tbs);
+
+    return prof;
+}
@@ -145,7 +145,7 @@ uint64_t HELPER(ctpop_i64)(uint64_t arg)
     return ctpop64(arg);
 }
 
-void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+static TranslationBlock *lookup_tb(CPUArchState *env)
 {
     CPUState *cpu = env_cpu(env);
     TranslationBlock *tb;
@@ -154,13 +154,35 @@ void *HELPER(lookup_tb_ptr)(CPUArchState *env)
 
     tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, curr_cflags());
     if (tb == NULL) {
-        return tcg_ctx->code_gen_epilogue;
+        return NULL;
     }
+    tcg_region_hit(tb->tc.ptr);
     qemu_log_mask_and_addr(CPU_LOG_EXEC, pc,
                            "Chain %d: %p ["
                            TARGET_FMT_lx "/" TARGET_FMT_lx "/%#x] %s\n",
                            cpu->cpu_index, tb->tc.ptr, cs_base, pc, flags,
                            lookup_symbol(pc));
+    return tb;
+}
+
+void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    TranslationBlock *tb = lookup_tb(env);
+
+    return tb ? tb->tc.ptr : tcg_ctx->code_gen_epilogue;
+}
+
+/* Slow path of the inline caches, see tcg_gen_lookup_and_goto_ic() */
+void *HELPER(lookup_tb_ic)(CPUArchState *env, void *site, uint32_t n)
+{
+    TranslationBlock *tb = lookup_tb(env);
+
+    if (tb == NULL) {
+        return tcg_ctx->code_gen_epilogue;
+    }
+    if (site) {
+        tb_set_jmp_ic(site, n, tb);
+    }
     return tb->tc.ptr;
 }
 
@@ -161,11 +161,15 @@ struct page_collection {
     struct page_entry *max;
 };
 
-/* list iterators for lists of tagged pointers in TranslationBlock */
+/*
+ * list iterators for lists of tagged pointers in TranslationBlock; TBs are
+ * at least cache line aligned, which leaves room for up to TB_JMP_SLOTS tags
+ */
+QEMU_BUILD_BUG_ON(TB_JMP_SLOTS > 4);
 #define TB_FOR_EACH_TAGGED(head, tb, n, field)                          \
-    for (n = (head) & 1, tb = (TranslationBlock *)((head) & ~1);        \
-         tb; tb = (TranslationBlock *)tb->field[n], n = (uintptr_t)tb & 1, \
-             tb = (TranslationBlock *)((uintptr_t)tb & ~1))
+    for (n = (head) & 3, tb = (TranslationBlock *)((head) & ~3);        \
+         tb; tb = (TranslationBlock *)tb->field[n], n = (uintptr_t)tb & 3, \
+             tb = (TranslationBlock *)((uintptr_t)tb & ~3))
 
 #define PAGE_FOR_EACH_TB(pagedesc, tb, n)                       \
     TB_FOR_EACH_TAGGED((pagedesc)->first_tb, tb, n, page_next)
@@ -220,6 +224,8 @@ TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
+unsigned int tb_tier_threshold;
+bool tcg_prof_enabled;
 
 static void page_table_config_init(void)
 {
@@ -1225,6 +1231,10 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 
     CPU_FOREACH(cpu) {
         cpu_tb_jmp_cache_clear(cpu);
+#ifdef CONFIG_USER_ONLY
+        /* The return stacks point to the TBs that are going away */
+        memset(&cpu_neg(cpu)->ras, 0, sizeof(cpu_neg(cpu)->ras));
+#endif
     }
 
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
@@ -1242,6 +1252,56 @@ done:
     }
 }
 
+static gboolean tb_evict_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+
+    tb_phys_invalidate(tb, -1);
+    return false;
+}
+
+/* evict the translation blocks of the least used code regions */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_evict_count)
+{
+    size_t evicted;
+
+    mmap_lock();
+    /* Another CPU may have made room already, then just retry */
+    if (tb_ctx.tb_evict_count != tb_evict_count.host_int) {
+        mmap_unlock();
+        return;
+    }
+
+    evicted = tcg_region_evict(tb_evict_iter, NULL);
+    if (evicted) {
+        atomic_mb_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+    }
+    mmap_unlock();
+
+    if (!evicted) {
+        /* Nothing to evict, start over with an empty buffer */
+        unsigned tb_flush_count = atomic_mb_read(&tb_ctx.tb_flush_count);
+
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+    }
+}
+
+/*
+ * Make room in a full code buffer.  This is like tb_flush, except that
+ * only the TBs in the coldest regions are thrown away when possible.
+ */
+void tb_evict(CPUState *cpu)
+{
+    unsigned tb_evict_count = atomic_mb_read(&tb_ctx.tb_evict_count);
+
+    if (cpu_in_exclusive_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(tb_evict_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(tb_evict_count));
+    }
+}
+
 void tb_flush(CPUState *cpu)
 {
     if (tcg_enabled()) {
@@ -1377,6 +1437,53 @@ static inline void tb_remove_from_jmp_list(TranslationBlock *orig, int n_orig)
     g_assert_not_reached();
 }
 
+/*
+ * Point the inline cache @n (TB_JMP_IC or TB_JMP_RET) of @tb at @tb_next.
+ * Unlike direct jumps, which are chained once, inline caches follow the
+ * last destination and are retargeted by the lookup helper on each miss.
+ */
+void tb_set_jmp_ic(TranslationBlock *tb, int n, TranslationBlock *tb_next)
+{
+    uintptr_t old = atomic_read(&tb->jmp_dest[n]);
+    TranslationBlock *dest = (TranslationBlock *)(old & ~1);
+    TranslationBlock *jtb;
+    uintptr_t *pprev;
+    int jn;
+
+    tcg_debug_assert(n >= TB_JMP_IC && n < TB_JMP_SLOTS);
+    if (dest == tb_next || (old & 1)) {
+        /* already there, or @tb is being invalidated */
+        return;
+    }
+
+    if (dest) {
+        qemu_spin_lock(&dest->jmp_lock);
+        /* unless tb_jmp_unlink() or a concurrent miss got there first */
+        if (atomic_cmpxchg(&tb->jmp_dest[n], old, (uintptr_t)NULL) == old) {
+            atomic_set(&tb->jmp_ic[n - TB_JMP_IC], NULL);
+            pprev = &dest->jmp_list_head;
+            TB_FOR_EACH_JMP(dest, jtb, jn) {
+                if (jtb == tb && jn == n) {
+                    *pprev = tb->jmp_list_next[n];
+                    break;
+                }
+                pprev = &jtb->jmp_list_next[jn];
+            }
+        }
+        qemu_spin_unlock(&dest->jmp_lock);
+    }
+
+    qemu_spin_lock(&tb_next->jmp_lock);
+    if (!(tb_next->cflags & CF_INVALID) &&
+        !atomic_cmpxchg(&tb->jmp_dest[n], (uintptr_t)NULL,
+                        (uintptr_t)tb_next)) {
+        tb->jmp_list_next[n] = tb_next->jmp_list_head;
+        tb_next->jmp_list_head = (uintptr_t)tb | n;
+        atomic_set(&tb->jmp_ic[n - TB_JMP_IC], tb_next);
+    }
+    qemu_spin_unlock(&tb_next->jmp_lock);
+}
+
 /* reset the jump entry 'n' of a TB so that it is not chained to
    another TB */
 static inline void tb_reset_jump(TranslationBlock *tb, int n)
@@ -1394,7 +1501,11 @@ static inline void tb_jmp_unlink(TranslationBlock *dest)
     qemu_spin_lock(&dest->jmp_lock);
 
     TB_FOR_EACH_JMP(dest, tb, n) {
-        tb_reset_jump(tb, n);
+        if (n < TB_JMP_IC) {
+            tb_reset_jump(tb, n);
+        } else {
+            atomic_set(&tb->jmp_ic[n - TB_JMP_IC], NULL);
+        }
         atomic_and(&tb->jmp_dest[n], (uintptr_t)NULL | 1);
         /* No need to clear the list entry; setting the dest ptr is enough */
     }
@@ -1414,6 +1525,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     PageDesc *p;
     uint32_t h;
     tb_page_addr_t phys_pc;
+    int n;
 
     assert_memory_lock();
 
@@ -1451,9 +1563,12 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
         }
     }
 
-    /* suppress this TB from the two jump lists */
-    tb_remove_from_jmp_list(tb, 0);
-    tb_remove_from_jmp_list(tb, 1);
+    /* suppress this TB from its jump lists, and miss in its inline caches */
+    for (n = 0; n < TB_JMP_SLOTS; n++) {
+        tb_remove_from_jmp_list(tb, n);
+    }
+    atomic_set(&tb->jmp_ic[0], NULL);
+    atomic_set(&tb->jmp_ic[1], NULL);
 
     /* suppress any remaining jumps to this TB */
     tb_jmp_unlink(tb);
@@ -1553,8 +1668,11 @@ static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
             prot |= p2->flags;
             p2->flags &= ~PAGE_WRITE;
           }
-        mprotect(g2h(page_addr), qemu_host_page_size,
-                 (prot & PAGE_BITS) & ~PAGE_WRITE);
+        if (!mmap_defer_host_prot(page_addr,
+                                  page_addr + qemu_host_page_size)) {
+            mprotect(g2h(page_addr), qemu_host_page_size,
+                     (prot & PAGE_BITS) & ~PAGE_WRITE);
+        }
         if (DEBUG_TB_INVALIDATE_GATE) {
             printf("protecting code page: 0x" TB_PAGE_ADDR_FMT "\n", page_addr);
         }
@@ -1649,10 +1767,17 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     return tb;
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              target_ulong pc, target_ulong cs_base,
-                              uint32_t flags, int cflags)
+/*
+ * Called with mmap_lock held for user mode emulation.  With @prefetch,
+ * the translation is speculative and may run outside of the vCPU thread:
+ * NULL is returned, instead of leaving the execution loop to make room,
+ * when the code buffer is full.
+ */
+static TranslationBlock *tb_gen_code_internal(CPUState *cpu,
+                                              target_ulong pc,
+                                              target_ulong cs_base,
+                                              uint32_t flags, int cflags,
+                                              bool prefetch)
 {
     CPUArchState *env = cpu->env_ptr;
     TranslationBlock *tb, *existing_tb;
@@ -1660,6 +1785,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size, max_insns;
+    int64_t prof_start = 0;
 #ifdef CONFIG_PROFILER
     TCGProfile *prof = &tcg_ctx->prof;
     int64_t ti;
@@ -1667,6 +1793,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 
     assert_memory_lock();
 
+    if (unlikely(tcg_prof_enabled) && !prefetch) {
+        tcg_prof_set_state(cpu, TCG_PROF_TRANSLATE);
+        prof_start = get_clock();
+    }
+
     phys_pc = get_page_addr_code(env, pc);
 
     if (phys_pc == -1) {
@@ -1692,8 +1823,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  buffer_overflow:
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        if (prefetch) {
+            return NULL;
+        }
+        /* eviction or flush must be done */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1708,6 +1842,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cflags = cflags;
     tb->orig_tb = NULL;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->tier_count = tb_tier_threshold;
+    tb->exec_count = 0;
+    tb->jmp_pc[0] = -1;
+    tb->jmp_pc[1] = -1;
+    tb->next_pc = -1;
     tcg_ctx->tb_cflags = cflags;
  tb_overflow:
 
@@ -1720,7 +1859,14 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tcg_func_start(tcg_ctx);
 
     tcg_ctx->cpu = env_cpu(env);
+#ifdef CONFIG_USER_ONLY
+    if (!tb_persist_restore(cpu, tb, max_insns)) {
+        gen_intermediate_code(cpu, tb, max_insns);
+        tb_persist_record(cpu, tb);
+    }
+#else
     gen_intermediate_code(cpu, tb, max_insns);
+#endif
     tcg_ctx->cpu = NULL;
 
     trace_translate_block(tb, tb->pc, tb->tc.ptr);
@@ -1783,6 +1929,19 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
     tb->tc.size = gen_code_size;
 
+    if (unlikely(prof_start)) {
+        CPUTCGProf *cp = &cpu->tcg_prof;
+
+        atomic_set__nocheck(&cp->translations, cp->translations + 1);
+        atomic_set__nocheck(&cp->translate_ns,
+                            cp->translate_ns + get_clock() - prof_start);
+        tcg_prof_set_state(cpu, TCG_PROF_RUNTIME);
+    }
+
+    if (unlikely(perf_enabled())) {
+        perf_report_code(tb);
+    }
+
 #ifdef CONFIG_PROFILER
     atomic_set(&prof->code_time, prof->code_time + profile_getclock() - ti);
     atomic_set(&prof->code_in_len, prof->code_in_len + tb->size);
@@ -1856,10 +2015,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     /* init jump list */
     qemu_spin_init(&tb->jmp_lock);
     tb->jmp_list_head = (uintptr_t)NULL;
-    tb->jmp_list_next[0] = (uintptr_t)NULL;
-    tb->jmp_list_next[1] = (uintptr_t)NULL;
-    tb->jmp_dest[0] = (uintptr_t)NULL;
-    tb->jmp_dest[1] = (uintptr_t)NULL;
+    memset(tb->jmp_list_next, 0, sizeof(tb->jmp_list_next));
+    memset(tb->jmp_dest, 0, sizeof(tb->jmp_dest));
+    tb->jmp_ic[0] = NULL;
+    tb->jmp_ic[1] = NULL;
 
     /* init original jump addresses which have been set during tcg_gen_code() */
     if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
@@ -1892,6 +2051,55 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     return tb;
 }
 
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              target_ulong pc, target_ulong cs_base,
+                              uint32_t flags, int cflags)
+{
+    return tb_gen_code_internal(cpu, pc, cs_base, flags, cflags, false);
+}
+
+TranslationBlock *tb_gen_code_prefetch(CPUState *cpu,
+                                       target_ulong pc, target_ulong cs_base,
+                                       uint32_t flags, int cflags)
+{
+    return tb_gen_code_internal(cpu, pc, cs_base, flags, cflags, true);
+}
+
+/*
+ * Only targets whose translator follows jumps in CF_TIER1 TBs define
+ * TARGET_TB_SUPERBLOCKS.  Elsewhere a hot TB would just be translated
+ * again unchanged, so tiering stays off.
+ */
+void tb_tier_set_threshold(unsigned int threshold)
+{
+#ifdef TARGET_TB_SUPERBLOCKS
+    tb_tier_threshold = threshold;
+#else
+    if (threshold) {
+        warn_report("tier-threshold ignored: " TARGET_NAME
+                    " does not build superblocks");
+    }
+#endif
+}
+
+/*
+ * Replace @tb, which has just run out of its tier_count, with a superblock
+ * for the same guest state.  The CPU state must be at the start of @tb.
+ */
+void tb_tier_up(CPUState *cpu, TranslationBlock *tb)
+{
+    uint32_t cflags = (tb_cflags(tb) & CF_HASH_MASK) | CF_TIER1;
+    TranslationBlock *hot;
+
+    mmap_lock();
+    /* Also unlinks the jumps into @tb, they will chain to @hot instead */
+    tb_phys_invalidate(tb, -1);
+    hot = tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags, cflags);
+    mmap_unlock();
+
+    atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(hot->pc)], hot);
+}
+
 /*
  * @p must be non-NULL.
  * user-mode: call with mmap_lock held.
@@ -2338,6 +2546,7 @@ void dump_exec_info(void)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t victim_hits, victim_misses;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2372,6 +2581,8 @@ void dump_exec_info(void)
     qemu_printf("\nStatistics:\n");
     qemu_printf("TB flush count      %u\n",
                 atomic_read(&tb_ctx.tb_flush_count));
+    qemu_printf("TB eviction count   %u\n",
+                atomic_read(&tb_ctx.tb_evict_count));
     qemu_printf("TB invalidate count %zu\n",
                 tcg_tb_phys_invalidate_count());
 
@@ -2379,6 +2590,10 @@ void dump_exec_info(void)
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
     qemu_printf("TLB elided flushes  %zu\n", flush_elide);
+    tlb_victim_counts(&victim_hits, &victim_misses);
+    qemu_printf("TLB victim hits     %zu\n", victim_hits);
+    qemu_printf("TLB victim misses   %zu\n", victim_misses);
+    qemu_printf("TLB large page fills %zu\n", tlb_large_page_fill_count());
     tcg_dump_info();
 }
 
@@ -2669,8 +2884,14 @@ int page_unprotect(target_ulong address, uintptr_t pc)
                 }
 #endif
             }
-            mprotect((void *)g2h(host_start), qemu_host_page_size,
-                     prot & PAGE_BITS);
+            /*
+             * If the page is being remapped, the write is retried until
+             * the host protection is in place.
+             */
+            if (!mmap_defer_host_prot(host_start, host_end)) {
+                mprotect((void *)g2h(host_start), qemu_host_page_size,
+                         prot & PAGE_BITS);
+            }
         }
         mmap_unlock();
         /* If current TB was invalidated return to main loop */
@@ -31,6 +31,58 @@ void translator_loop_temp_check(DisasContextBase *db)
     }
 }
 
+bool translator_follow_jump(DisasContextBase *db, target_ulong dest)
+{
+    return db->superblock
+        && dest > db->pc_next
+        && (dest & TARGET_PAGE_MASK) == (db->pc_first & TARGET_PAGE_MASK)
+        && db->num_insns < db->max_insns;
+}
+
+/*
+ * Count the executions of a TB that can be promoted to a superblock.
+ * When the count runs out, leave before executing anything so that
+ * cpu_exec() can retranslate it (see tb_tier_up()).
+ */
+static void gen_tier_count(TranslationBlock *tb)
+{
+    TCGLabel *skip = gen_new_label();
+    TCGv_ptr ptr = tcg_const_ptr(&tb->tier_count);
+    TCGv_i32 count = tcg_temp_new_i32();
+
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_subi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_GT, count, 0, skip);
+    tcg_gen_exit_tb(tb, TB_EXIT_TIER_UP);
+    gen_set_label(skip);
+
+    tcg_temp_free_i32(count);
+    tcg_temp_free_ptr(ptr);
+}
+
+/* Count the executions of a CF_PROFILE TB, for the TCG profiler.  */
+static void gen_exec_count(TranslationBlock *tb)
+{
+    TCGv_ptr ptr = tcg_temp_new_ptr();
+    TCGv_i64 count = tcg_temp_new_i64();
+
+    tcg_gen_movi_tb_ptr(ptr, tb);
+    tcg_gen_ld_i64(count, ptr, offsetof(TranslationBlock, exec_count));
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, ptr, offsetof(TranslationBlock, exec_count));
+
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(ptr);
+}
+
+static bool tb_tier_counted(TranslationBlock *tb, int max_insns)
+{
+    return tb_tier_threshold && max_insns > 1
+        && !(tb_cflags(tb) & (CF_TIER1 | CF_NOCACHE | CF_USE_ICOUNT |
+                              CF_LAST_IO | CF_COUNT_MASK));
+}
+
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb, int max_insns)
 {
@@ -45,6 +97,7 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     db->num_insns = 0;
     db->max_insns = max_insns;
     db->singlestep_enabled = cpu->singlestep_enabled;
+    db->superblock = (tb_cflags(tb) & CF_TIER1) && max_insns > 1;
 
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
@@ -54,6 +107,12 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
     /* Start translating.  */
     gen_tb_start(db->tb);
+    if (tb_cflags(tb) & CF_PROFILE) {
+        gen_exec_count(tb);
+    }
+    if (tb_tier_counted(tb, max_insns)) {
+        gen_tier_count(tb);
+    }
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
@@ -123,6 +182,11 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
         }
     }
 
+    /* Only then may execution go on with the next instruction.  */
+    if (db->is_jmp == DISAS_TOO_MANY) {
+        db->tb->next_pc = db->pc_next;
+    }
+
     /* Emit code to exit the TB, as indicated by db->is_jmp.  */
     ops->tb_stop(db, cpu);
     gen_tb_end(db->tb, db->num_insns - bp_insn);
@@ -47,6 +47,12 @@ bool have_mmap_lock(void)
     return mmap_lock_count > 0 ? true : false;
 }
 
+/* mmap and friends keep mmap_lock throughout, see linux-user/mmap.c */
+bool mmap_defer_host_prot(target_ulong start, target_ulong end)
+{
+    return false;
+}
+
 /* Grab lock to make sure things are in a consistent state after fork().  */
 void mmap_fork_start(void)
 {
@@ -401,6 +401,81 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+/*
+ * Batch versions of the above, for vector helpers.  The checks on the
+ * status are done once for the whole batch; each element then takes the
+ * host FPU path unless its inputs or its result need the soft path.
+ * Elements whose inputs must be flushed also go the soft way, since the
+ * soft functions flush their inputs themselves.
+ */
+static inline void
+float32_gen2_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+               float_status *s, hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+               f32_check_fn pre, f32_check_fn post)
+{
+    size_t i;
+
+    if (unlikely(!can_use_fpu(s))) {
+        for (i = 0; i < n; i++) {
+            d[i] = soft(a[i], b[i], s);
+        }
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        union_float32 ua, ub, ur;
+
+        ua.s = a[i];
+        ub.s = b[i];
+        if (likely(pre(ua, ub))) {
+            ur.h = hard(ua.h, ub.h);
+            if (unlikely(f32_is_inf(ur))) {
+                s->float_exception_flags |= float_flag_overflow;
+            } else if (unlikely(fabsf(ur.h) <= FLT_MIN) && post(ua, ub)) {
+                goto soft;
+            }
+            d[i] = ur.s;
+            continue;
+        }
+    soft:
+        d[i] = soft(ua.s, ub.s, s);
+    }
+}
+
+static inline void
+float64_gen2_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+               float_status *s, hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+               f64_check_fn pre, f64_check_fn post)
+{
+    size_t i;
+
+    if (unlikely(!can_use_fpu(s))) {
+        for (i = 0; i < n; i++) {
+            d[i] = soft(a[i], b[i], s);
+        }
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        union_float64 ua, ub, ur;
+
+        ua.s = a[i];
+        ub.s = b[i];
+        if (likely(pre(ua, ub))) {
+            ur.h = hard(ua.h, ub.h);
+            if (unlikely(f64_is_inf(ur))) {
+                s->float_exception_flags |= float_flag_overflow;
+            } else if (unlikely(fabs(ur.h) <= DBL_MIN) && post(ua, ub)) {
+                goto soft;
+            }
+            d[i] = ur.s;
+            continue;
+        }
+    soft:
+        d[i] = soft(ua.s, ub.s, s);
+    }
+}
+
 /*----------------------------------------------------------------------------
 | Returns the fraction bits of the single-precision floating-point value `a'.
 *----------------------------------------------------------------------------*/
@@ -1158,6 +1233,34 @@ float64_sub(float64 a, float64 b, float_status *s)
     return float64_addsub(a, b, s, hard_f64_sub, soft_f64_sub);
 }
 
+void float32_add_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *s)
+{
+    float32_gen2_n(d, a, b, n, s, hard_f32_add, soft_f32_add,
+                   f32_is_zon2, f32_addsubmul_post);
+}
+
+void float32_sub_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *s)
+{
+    float32_gen2_n(d, a, b, n, s, hard_f32_sub, soft_f32_sub,
+                   f32_is_zon2, f32_addsubmul_post);
+}
+
+void float64_add_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *s)
+{
+    float64_gen2_n(d, a, b, n, s, hard_f64_add, soft_f64_add,
+                   f64_is_zon2, f64_addsubmul_post);
+}
+
+void float64_sub_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *s)
+{
+    float64_gen2_n(d, a, b, n, s, hard_f64_sub, soft_f64_sub,
+                   f64_is_zon2, f64_addsubmul_post);
+}
+
 /*
  * Returns the result of multiplying the floating-point values `a' and
  * `b'. The operation is performed according to the IEC/IEEE Standard
@@ -1260,6 +1363,20 @@ float64_mul(float64 a, float64 b, float_status *s)
                         f64_is_zon2, f64_addsubmul_post);
 }
 
+void float32_mul_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *s)
+{
+    float32_gen2_n(d, a, b, n, s, hard_f32_mul, soft_f32_mul,
+                   f32_is_zon2, f32_addsubmul_post);
+}
+
+void float64_mul_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *s)
+{
+    float64_gen2_n(d, a, b, n, s, hard_f64_mul, soft_f64_mul,
+                   f64_is_zon2, f64_addsubmul_post);
+}
+
 /*
  * Returns the result of multiplying the floating-point values `a' and
  * `b' then adding 'c', with no intermediate rounding step after the
@@ -1808,6 +1925,20 @@ float64_div(float64 a, float64 b, float_status *s)
                         f64_div_pre, f64_div_post);
 }
 
+void float32_div_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *s)
+{
+    float32_gen2_n(d, a, b, n, s, hard_f32_div, soft_f32_div,
+                   f32_div_pre, f32_div_post);
+}
+
+void float64_div_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *s)
+{
+    float64_gen2_n(d, a, b, n, s, hard_f64_div, soft_f64_div,
+                   f64_div_pre, f64_div_post);
+}
+
 /*
  * Float to Float conversions
  *
@@ -2038,17 +2169,45 @@ float16 float16_round_to_int(float16 a, float_status *s)
     return float16_round_pack_canonical(pr, s);
 }
 
+/*
+ * With inexact already set and the host rounding mode, rint() of a finite
+ * value can only differ from the soft version in the flags it raises.
+ */
 float32 float32_round_to_int(float32 a, float_status *s)
 {
-    FloatParts pa = float32_unpack_canonical(a, s);
-    FloatParts pr = round_to_int(pa, s->float_rounding_mode, 0, s);
+    union_float32 ua;
+    FloatParts pa, pr;
+
+    ua.s = a;
+    if (can_use_fpu(s)) {
+        float32_input_flush1(&ua.s, s);
+        if (likely(isfinite(ua.h))) {
+            ua.h = rintf(ua.h);
+            return ua.s;
+        }
+    }
+
+    pa = float32_unpack_canonical(ua.s, s);
+    pr = round_to_int(pa, s->float_rounding_mode, 0, s);
     return float32_round_pack_canonical(pr, s);
 }
 
 float64 float64_round_to_int(float64 a, float_status *s)
 {
-    FloatParts pa = float64_unpack_canonical(a, s);
-    FloatParts pr = round_to_int(pa, s->float_rounding_mode, 0, s);
+    union_float64 ua;
+    FloatParts pa, pr;
+
+    ua.s = a;
+    if (can_use_fpu(s)) {
+        float64_input_flush1(&ua.s, s);
+        if (likely(isfinite(ua.h))) {
+            ua.h = rint(ua.h);
+            return ua.s;
+        }
+    }
+
+    pa = float64_unpack_canonical(ua.s, s);
+    pr = round_to_int(pa, s->float_rounding_mode, 0, s);
     return float64_round_pack_canonical(pr, s);
 }
 
@@ -2187,6 +2346,61 @@ int64_t float16_to_int64(float16 a, float_status *s)
     return float16_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
+/*
+ * Hardfloat float to integer conversions.  If inexact is already set and
+ * the rounded value is in [lo, hi), the result is exact and no other flag
+ * can be raised.  Rounding either truncates or uses the host rounding
+ * mode, which is nearest-even.
+ */
+static inline bool hard_to_int(double d, bool rtz, double lo, double hi,
+                               const float_status *s, double *r)
+{
+    if (QEMU_NO_HARDFLOAT || !(s->float_exception_flags & float_flag_inexact)) {
+        return false;
+    }
+    if (rtz) {
+        *r = trunc(d);
+    } else if (likely(s->float_rounding_mode == float_round_nearest_even)) {
+        *r = rint(d);
+    } else {
+        return false;
+    }
+    return *r >= lo && *r < hi;
+}
+
+static inline bool f32_to_int_hard(float32 a, bool rtz, double lo, double hi,
+                                   float_status *s, double *r)
+{
+    union_float32 ua;
+
+    ua.s = a;
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    float32_input_flush1(&ua.s, s);
+    return hard_to_int(ua.h, rtz, lo, hi, s, r);
+}
+
+static inline bool f64_to_int_hard(float64 a, bool rtz, double lo, double hi,
+                                   float_status *s, double *r)
+{
+    union_float64 ua;
+
+    ua.s = a;
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    float64_input_flush1(&ua.s, s);
+    return hard_to_int(ua.h, rtz, lo, hi, s, r);
+}
+
+#define HARD_INT32_MIN  -2147483648.0
+#define HARD_INT32_END  2147483648.0
+#define HARD_INT64_MIN  -9223372036854775808.0
+#define HARD_INT64_END  9223372036854775808.0
+#define HARD_UINT32_END 4294967296.0
+#define HARD_UINT64_END 18446744073709551616.0
+
 int16_t float32_to_int16(float32 a, float_status *s)
 {
     return float32_to_int16_scalbn(a, s->float_rounding_mode, 0, s);
@@ -2194,11 +2408,21 @@ int16_t float32_to_int16(float32 a, float_status *s)
 
 int32_t float32_to_int32(float32 a, float_status *s)
 {
+    double r;
+
+    if (f32_to_int_hard(a, false, HARD_INT32_MIN, HARD_INT32_END, s, &r)) {
+        return r;
+    }
     return float32_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 int64_t float32_to_int64(float32 a, float_status *s)
 {
+    double r;
+
+    if (f32_to_int_hard(a, false, HARD_INT64_MIN, HARD_INT64_END, s, &r)) {
+        return r;
+    }
     return float32_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -2209,11 +2433,21 @@ int16_t float64_to_int16(float64 a, float_status *s)
 
 int32_t float64_to_int32(float64 a, float_status *s)
 {
+    double r;
+
+    if (f64_to_int_hard(a, false, HARD_INT32_MIN, HARD_INT32_END, s, &r)) {
+        return r;
+    }
     return float64_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 int64_t float64_to_int64(float64 a, float_status *s)
 {
+    double r;
+
+    if (f64_to_int_hard(a, false, HARD_INT64_MIN, HARD_INT64_END, s, &r)) {
+        return r;
+    }
     return float64_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -2239,11 +2473,21 @@ int16_t float32_to_int16_round_to_zero(float32 a, float_status *s)
 
 int32_t float32_to_int32_round_to_zero(float32 a, float_status *s)
 {
+    double r;
+
+    if (f32_to_int_hard(a, true, HARD_INT32_MIN, HARD_INT32_END, s, &r)) {
+        return r;
+    }
     return float32_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float32_to_int64_round_to_zero(float32 a, float_status *s)
 {
+    double r;
+
+    if (f32_to_int_hard(a, true, HARD_INT64_MIN, HARD_INT64_END, s, &r)) {
+        return r;
+    }
     return float32_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -2254,11 +2498,21 @@ int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
 
 int32_t float64_to_int32_round_to_zero(float64 a, float_status *s)
 {
+    double r;
+
+    if (f64_to_int_hard(a, true, HARD_INT32_MIN, HARD_INT32_END, s, &r)) {
+        return r;
+    }
     return float64_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float64_to_int64_round_to_zero(float64 a, float_status *s)
 {
+    double r;
+
+    if (f64_to_int_hard(a, true, HARD_INT64_MIN, HARD_INT64_END, s, &r)) {
+        return r;
+    }
     return float64_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -2407,11 +2661,21 @@ uint16_t float32_to_uint16(float32 a, float_status *s)
 
 uint32_t float32_to_uint32(float32 a, float_status *s)
 {
+    double r;
+
+    if (f32_to_int_hard(a, false, 0, HARD_UINT32_END, s, &r)) {
+        return r;
+    }
     return float32_to_uint32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 uint64_t float32_to_uint64(float32 a, float_status *s)
 {
+    double r;
+
+    if (f32_to_int_hard(a, false, 0, HARD_UINT64_END, s, &r)) {
+        return r;
+    }
     return float32_to_uint64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -2422,11 +2686,21 @@ uint16_t float64_to_uint16(float64 a, float_status *s)
 
 uint32_t float64_to_uint32(float64 a, float_status *s)
 {
+    double r;
+
+    if (f64_to_int_hard(a, false, 0, HARD_UINT32_END, s, &r)) {
+        return r;
+    }
     return float64_to_uint32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 uint64_t float64_to_uint64(float64 a, float_status *s)
 {
+    double r;
+
+    if (f64_to_int_hard(a, false, 0, HARD_UINT64_END, s, &r)) {
+        return r;
+    }
     return float64_to_uint64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -2452,11 +2726,21 @@ uint16_t float32_to_uint16_round_to_zero(float32 a, float_status *s)
 
 uint32_t float32_to_uint32_round_to_zero(float32 a, float_status *s)
 {
+    double r;
+
+    if (f32_to_int_hard(a, true, 0, HARD_UINT32_END, s, &r)) {
+        return r;
+    }
     return float32_to_uint32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 uint64_t float32_to_uint64_round_to_zero(float32 a, float_status *s)
 {
+    double r;
+
+    if (f32_to_int_hard(a, true, 0, HARD_UINT64_END, s, &r)) {
+        return r;
+    }
     return float32_to_uint64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -2467,11 +2751,21 @@ uint16_t float64_to_uint16_round_to_zero(float64 a, float_status *s)
 
 uint32_t float64_to_uint32_round_to_zero(float64 a, float_status *s)
 {
+    double r;
+
+    if (f64_to_int_hard(a, true, 0, HARD_UINT32_END, s, &r)) {
+        return r;
+    }
     return float64_to_uint32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 uint64_t float64_to_uint64_round_to_zero(float64 a, float_status *s)
 {
+    double r;
+
+    if (f64_to_int_hard(a, true, 0, HARD_UINT64_END, s, &r)) {
+        return r;
+    }
     return float64_to_uint64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -2555,14 +2849,39 @@ float32 int16_to_float32_scalbn(int16_t a, int scale, float_status *status)
     return int64_to_float32_scalbn(a, scale, status);
 }
 
+/*
+ * Hardfloat integer to float conversions.  Small magnitudes convert
+ * exactly and raise no flags in any rounding mode; larger ones need the
+ * same conditions as the arithmetic fast paths.
+ */
+static inline bool int_to_float_hard(uint64_t mag, int bits,
+                                     const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    return mag <= 1ull << bits || can_use_fpu(s);
+}
+
+static inline uint64_t int_to_float_mag(int64_t a)
+{
+    return a < 0 ? -(uint64_t)a : a;
+}
+
 float32 int64_to_float32(int64_t a, float_status *status)
 {
+    if (int_to_float_hard(int_to_float_mag(a), 24, status)) {
+        union_float32 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float32_scalbn(a, 0, status);
 }
 
 float32 int32_to_float32(int32_t a, float_status *status)
 {
-    return int64_to_float32_scalbn(a, 0, status);
+    return int64_to_float32(a, status);
 }
 
 float32 int16_to_float32(int16_t a, float_status *status)
@@ -2588,12 +2907,18 @@ float64 int16_to_float64_scalbn(int16_t a, int scale, float_status *status)
 
 float64 int64_to_float64(int64_t a, float_status *status)
 {
+    if (int_to_float_hard(int_to_float_mag(a), 53, status)) {
+        union_float64 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float64_scalbn(a, 0, status);
 }
 
 float64 int32_to_float64(int32_t a, float_status *status)
 {
-    return int64_to_float64_scalbn(a, 0, status);
+    return int64_to_float64(a, status);
 }
 
 float64 int16_to_float64(int16_t a, float_status *status)
@@ -2682,12 +3007,18 @@ float32 uint16_to_float32_scalbn(uint16_t a, int scale, float_status *status)
 
 float32 uint64_to_float32(uint64_t a, float_status *status)
 {
+    if (int_to_float_hard(a, 24, status)) {
+        union_float32 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return uint64_to_float32_scalbn(a, 0, status);
 }
 
 float32 uint32_to_float32(uint32_t a, float_status *status)
 {
-    return uint64_to_float32_scalbn(a, 0, status);
+    return uint64_to_float32(a, status);
 }
 
 float32 uint16_to_float32(uint16_t a, float_status *status)
@@ -2713,12 +3044,18 @@ float64 uint16_to_float64_scalbn(uint16_t a, int scale, float_status *status)
 
 float64 uint64_to_float64(uint64_t a, float_status *status)
 {
+    if (int_to_float_hard(a, 53, status)) {
+        union_float64 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return uint64_to_float64_scalbn(a, 0, status);
 }
 
 float64 uint32_to_float64(uint32_t a, float_status *status)
 {
-    return uint64_to_float64_scalbn(a, 0, status);
+    return uint64_to_float64(a, status);
 }
 
 float64 uint16_to_float64(uint16_t a, float_status *status)
@@ -2831,21 +3168,62 @@ MINMAX(16, max, false, false, false)
 MINMAX(16, maxnum, false, true, false)
 MINMAX(16, maxnummag, false, true, true)
 
-MINMAX(32, min, true, false, false)
-MINMAX(32, minnum, true, true, false)
-MINMAX(32, minnummag, true, true, true)
-MINMAX(32, max, false, false, false)
-MINMAX(32, maxnum, false, true, false)
-MINMAX(32, maxnummag, false, true, true)
+/*
+ * Without NaNs, min/max raise no flags and return one of the (flushed)
+ * inputs, so the host can pick it.  NaNs and results that would be
+ * flushed on output are left to the soft version.
+ */
+#define MINMAX_HARD(sz, name, ismin, isiee, ismag)                      \
+float ## sz float ## sz ## _ ## name(float ## sz a, float ## sz b,      \
+                                     float_status *s)                   \
+{                                                                       \
+    union_float ## sz ua, ub;                                           \
+    FloatParts pa, pb, pr;                                              \
+                                                                        \
+    ua.s = a;                                                           \
+    ub.s = b;                                                           \
+    if (!QEMU_NO_HARDFLOAT) {                                           \
+        float ## sz ## _input_flush2(&ua.s, &ub.s, s);                  \
+        if (likely(!isunordered(ua.h, ub.h))) {                         \
+            bool pick_b;                                                \
+                                                                        \
+            if (ismag && fabs(ua.h) != fabs(ub.h)) {                    \
+                pick_b = (fabs(ua.h) < fabs(ub.h)) ^ ismin;             \
+            } else if (ua.h == ub.h) {                                  \
+                pick_b = (signbit(ua.h) != 0) ^ ismin;                  \
+            } else {                                                    \
+                pick_b = (ua.h < ub.h) ^ ismin;                         \
+            }                                                           \
+            ua = pick_b ? ub : ua;                                      \
+            if (likely(!s->flush_to_zero ||                             \
+                       fpclassify(ua.h) != FP_SUBNORMAL)) {             \
+                return ua.s;                                            \
+            }                                                           \
+        }                                                               \
+    }                                                                   \
+    pa = float ## sz ## _unpack_canonical(a, s);                        \
+    pb = float ## sz ## _unpack_canonical(b, s);                        \
+    pr = minmax_floats(pa, pb, ismin, isiee, ismag, s);                 \
+                                                                        \
+    return float ## sz ## _round_pack_canonical(pr, s);                 \
+}
+
+MINMAX_HARD(32, min, true, false, false)
+MINMAX_HARD(32, minnum, true, true, false)
+MINMAX_HARD(32, minnummag, true, true, true)
+MINMAX_HARD(32, max, false, false, false)
+MINMAX_HARD(32, maxnum, false, true, false)
+MINMAX_HARD(32, maxnummag, false, true, true)
 
-MINMAX(64, min, true, false, false)
-MINMAX(64, minnum, true, true, false)
-MINMAX(64, minnummag, true, true, true)
-MINMAX(64, max, false, false, false)
-MINMAX(64, maxnum, false, true, false)
-MINMAX(64, maxnummag, false, true, true)
+MINMAX_HARD(64, min, true, false, false)
+MINMAX_HARD(64, minnum, true, true, false)
+MINMAX_HARD(64, minnummag, true, true, true)
+MINMAX_HARD(64, max, false, false, false)
+MINMAX_HARD(64, maxnum, false, true, false)
+MINMAX_HARD(64, maxnummag, false, true, true)
 
 #undef MINMAX
+#undef MINMAX_HARD
 
 /* Floating point compare */
 static FloatRelation compare_floats(FloatParts a, FloatParts b, bool is_quiet,
@@ -3017,6 +3017,9 @@ gdb_handlesig(CPUState *cpu, int sig)
         return sig;
     }
 
+    /* The prefetch threads read the breakpoints of the CPUs */
+    tb_prefetch_pause();
+
     /* disable single step if it was enabled */
     cpu_single_step(cpu, 0);
     tb_flush(cpu);
@@ -3028,7 +3031,7 @@ gdb_handlesig(CPUState *cpu, int sig)
     /* put_packet() might have detected that the peer terminated the
        connection.  */
     if (gdbserver_state.fd < 0) {
-        return sig;
+        goto out;
     }
 
     sig = 0;
@@ -3049,11 +3052,13 @@ gdb_handlesig(CPUState *cpu, int sig)
                 close(gdbserver_state.fd);
             }
             gdbserver_state.fd = -1;
-            return sig;
+            goto out;
         }
     }
     sig = gdbserver_state.signal;
     gdbserver_state.signal = 0;
+out:
+    tb_prefetch_resume();
     return sig;
 }
 
@@ -323,6 +323,24 @@ SRST
     being coalesced.
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tcg-profile",
+        .args_type  = "max:i?",
+        .params     = "[max]",
+        .help       = "show TCG execution profiling info, with up to max "
+                      "translated blocks (default: 10)",
+        .cmd        = hmp_info_tcg_profile,
+    },
+
+SRST
+  ``info tcg-profile`` [*max*]
+    Show where each vCPU spends its time, as sampled by the TCG execution
+    profiler, its translation and TLB miss counters, and the *max* (default:
+    10) most executed translated blocks.
+ERST
+#endif
+
     {
         .name       = "kvm",
         .args_type  = "",
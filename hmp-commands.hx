@@ -625,6 +625,40 @@ SRST
   whether profiling is on or off.
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tcg-profile",
+        .args_type  = "op:s?",
+        .params     = "[on|off|reset]",
+        .help       = "enable, disable or reset TCG execution profiling. "
+                      "With no arguments, prints whether profiling is on or off.",
+        .cmd        = hmp_tcg_profile,
+    },
+
+SRST
+``tcg-profile [on|off|reset]``
+  Enable, disable or reset TCG execution profiling. With no arguments, prints
+  whether profiling is on or off. Enabling or disabling the profiler flushes
+  the translated code.
+ERST
+#endif
+
+    {
+        .name       = "replay_seek",
+        .args_type  = "icount:l",
+        .params     = "icount",
+        .help       = "replay execution to the specified instruction count",
+        .cmd        = hmp_replay_seek,
+    },
+
+SRST
+``replay_seek`` *icount*
+  Automatically proceed to the instruction count *icount*, when
+  replaying the execution. The execution restarts from the closest
+  snapshot recorded at or before *icount*, unless the current position
+  is already closer, and the VM is paused once *icount* is reached.
+ERST
+
     {
         .name       = "system_reset",
         .args_type  = "",
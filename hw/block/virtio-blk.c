@@ -69,7 +69,16 @@ static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
 
 static void virtio_blk_free_request(VirtIOBlockReq *req)
 {
-    g_free(req);
+    virtqueue_element_free(&req->elem);
+}
+
+static void virtio_blk_notify(VirtIOBlock *s, VirtQueue *vq)
+{
+    if (s->dataplane_started && !s->dataplane_disabled) {
+        virtio_blk_data_plane_notify(s->dataplane, vq);
+    } else {
+        virtio_notify(VIRTIO_DEVICE(s), vq);
+    }
 }
 
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
@@ -81,10 +90,34 @@ static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
 
     stb_p(&req->in->status, status);
     virtqueue_push(req->vq, &req->elem, req->in_len);
-    if (s->dataplane_started && !s->dataplane_disabled) {
-        virtio_blk_data_plane_notify(s->dataplane, req->vq);
-    } else {
-        virtio_notify(vdev, req->vq);
+    virtio_blk_notify(s, req->vq);
+}
+
+/*
+ * Complete successful requests of the same virtqueue with a single update
+ * of the used ring and a single notification, then free them.
+ */
+static void virtio_blk_complete_batch(VirtIOBlockReq **reqs, unsigned int num)
+{
+    VirtIOBlock *s = reqs[0]->dev;
+    VirtQueueElement *elems[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int lens[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int i;
+
+    assert(num <= VIRTIO_BLK_MAX_MERGE_REQS);
+    for (i = 0; i < num; i++) {
+        trace_virtio_blk_req_complete(VIRTIO_DEVICE(s), reqs[i],
+                                      VIRTIO_BLK_S_OK);
+        stb_p(&reqs[i]->in->status, VIRTIO_BLK_S_OK);
+        elems[i] = &reqs[i]->elem;
+        lens[i] = reqs[i]->in_len;
+    }
+    virtqueue_push_batch(reqs[0]->vq, elems, lens, num);
+    virtio_blk_notify(s, reqs[0]->vq);
+
+    for (i = 0; i < num; i++) {
+        block_acct_done(blk_get_stats(s->blk), &reqs[i]->acct);
+        virtio_blk_free_request(reqs[i]);
     }
 }
 
@@ -117,6 +150,8 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
     VirtIOBlockReq *next = opaque;
     VirtIOBlock *s = next->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    VirtIOBlockReq *done[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int num_done = 0;
 
     aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
     while (next) {
@@ -147,9 +182,16 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
             }
         }
 
-        virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
-        block_acct_done(blk_get_stats(s->blk), &req->acct);
-        virtio_blk_free_request(req);
+        /* Merged requests usually, but not always, share a virtqueue */
+        if (num_done &&
+            (done[0]->vq != req->vq || num_done == ARRAY_SIZE(done))) {
+            virtio_blk_complete_batch(done, num_done);
+            num_done = 0;
+        }
+        done[num_done++] = req;
+    }
+    if (num_done) {
+        virtio_blk_complete_batch(done, num_done);
     }
     aio_context_release(blk_get_aio_context(s->conf.conf.blk));
 }
@@ -251,14 +293,22 @@ out:
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
+/*
+ * Pop up to VIRTQUEUE_POP_BATCH requests from @vq into @elems, and return
+ * how many were.
+ */
+static unsigned int virtio_blk_get_requests(VirtIOBlock *s, VirtQueue *vq,
+                                            VirtQueueElement **elems)
 {
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
+    unsigned int i, num;
 
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
+    num = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq), elems,
+                              VIRTQUEUE_POP_BATCH);
+    for (i = 0; i < num; i++) {
+        virtio_blk_init_request(s, vq, container_of(elems[i], VirtIOBlockReq,
+                                                    elem));
     }
-    return req;
+    return num;
 }
 
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
@@ -762,7 +812,8 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
 bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    VirtQueueElement *elems[VIRTQUEUE_POP_BATCH];
+    unsigned int i, num;
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
     bool progress = false;
@@ -775,11 +826,20 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
+        while ((num = virtio_blk_get_requests(s, vq, elems))) {
             progress = true;
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
+            for (i = 0; i < num; i++) {
+                VirtIOBlockReq *req = container_of(elems[i], VirtIOBlockReq,
+                                                   elem);
+
+                if (virtio_blk_handle_request(req, &mrb)) {
+                    virtqueue_detach_element(req->vq, &req->elem, 0);
+                    virtio_blk_free_request(req);
+                    break;
+                }
+            }
+            if (i < num) {
+                virtqueue_unpop_batch(vq, elems + i + 1, num - i - 1);
                 break;
             }
         }
@@ -1228,15 +1288,32 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBlock *s = VIRTIO_BLK(dev);
     VirtIOBlkConf *conf = &s->conf;
+    VirtIOBlockReq *req, *rq;
     unsigned i;
 
     blk_drain(s->blk);
     del_boot_device_lchs(dev, "/disk@0,0");
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
+
+    /*
+     * Requests parked by werror/rerror=stop are still there if the device
+     * goes away while the VM is stopped.  Their elements can outlive the
+     * virtqueues, so free them only once the queues are gone.
+     */
+    rq = s->rq;
+    s->rq = NULL;
+    for (req = rq; req; req = req->next) {
+        virtqueue_detach_element(req->vq, &req->elem, 0);
+    }
     for (i = 0; i < conf->num_queues; i++) {
         virtio_del_queue(vdev, i);
     }
+    while (rq) {
+        req = rq;
+        rq = req->next;
+        virtio_blk_free_request(req);
+    }
     qemu_del_vm_change_state_handler(s->change);
     blockdev_mark_auto_del(s->blk);
     virtio_cleanup(vdev);
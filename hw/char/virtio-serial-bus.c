@@ -1081,6 +1081,8 @@ static void virtio_serial_device_realize(DeviceState *dev, Error **errp)
     vser->c_ivq = virtio_add_queue(vdev, 32, control_in);
     /* control queue: guest to host */
     vser->c_ovq = virtio_add_queue(vdev, 32, control_out);
+    virtio_queue_set_control(vser->c_ivq);
+    virtio_queue_set_control(vser->c_ovq);
 
     for (i = 1; i < vser->bus.max_nr_ports; i++) {
         /* Add a per-port queue for host to guest transfers */
@@ -20,6 +20,7 @@
 #include "qapi/qapi-builtin-visit.h"
 #include "qapi/qapi-commands-machine.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qerror.h"
 #include "qapi/string-output-visitor.h"
 #include "qemu/error-report.h"
 #include "sysemu/numa.h"
@@ -172,3 +173,93 @@ void hmp_info_numa(Monitor *mon, const QDict *qdict)
     qapi_free_CpuInfoList(cpu_list);
     g_free(node_mem);
 }
+
+void hmp_tcg_profile(Monitor *mon, const QDict *qdict)
+{
+    const char *op = qdict_get_try_str(qdict, "op");
+    Error *err = NULL;
+
+    if (op == NULL) {
+        TcgProfile *prof = qmp_x_query_tcg_profile(true, 0, &err);
+
+        if (prof) {
+            monitor_printf(mon, "tcg-profile is %s\n",
+                           prof->enabled ? "on" : "off");
+            qapi_free_TcgProfile(prof);
+        }
+    } else if (!strcmp(op, "on")) {
+        qmp_x_tcg_profile(TCG_PROFILE_OP_ON, &err);
+    } else if (!strcmp(op, "off")) {
+        qmp_x_tcg_profile(TCG_PROFILE_OP_OFF, &err);
+    } else if (!strcmp(op, "reset")) {
+        qmp_x_tcg_profile(TCG_PROFILE_OP_RESET, &err);
+    } else {
+        error_setg(&err, QERR_INVALID_PARAMETER, op);
+    }
+    hmp_handle_error(mon, err);
+}
+
+static double tcg_profile_pct(uint64_t n, uint64_t total)
+{
+    return total ? 100.0 * n / total : 0;
+}
+
+void hmp_info_tcg_profile(Monitor *mon, const QDict *qdict)
+{
+    int64_t max = qdict_get_try_int(qdict, "max", 10);
+    Error *err = NULL;
+    TcgProfile *prof;
+    TcgProfileCpuList *cpu;
+    TcgProfileTbList *tb;
+
+    prof = qmp_x_query_tcg_profile(true, max, &err);
+    if (err) {
+        hmp_handle_error(mon, err);
+        return;
+    }
+
+    monitor_printf(mon, "TCG profile: %s, %.3f s, sampled every %" PRId64
+                   " us\n", prof->enabled ? "on" : "off",
+                   prof->elapsed_ns / 1e9, prof->sample_interval_us);
+
+    monitor_printf(mon, "\n CPU   idle runtime   code helper    tlb "
+                   "translate  TB entries  translations  translate ms"
+                   "  TLB fills  victim hits\n");
+    for (cpu = prof->cpus; cpu; cpu = cpu->next) {
+        TcgProfileCpu *c = cpu->value;
+        uint64_t total = c->samples_idle + c->samples_runtime +
+                         c->samples_code + c->samples_helper +
+                         c->samples_tlb_fill + c->samples_translate;
+
+        monitor_printf(mon, "%4" PRId64 " %5.1f%% %6.1f%% %5.1f%% %5.1f%% "
+                       "%5.1f%% %8.1f%% %11" PRIu64 " %13" PRIu64
+                       " %13.3f %10" PRIu64 " %12" PRIu64 "\n",
+                       c->cpu_index,
+                       tcg_profile_pct(c->samples_idle, total),
+                       tcg_profile_pct(c->samples_runtime, total),
+                       tcg_profile_pct(c->samples_code, total),
+                       tcg_profile_pct(c->samples_helper, total),
+                       tcg_profile_pct(c->samples_tlb_fill, total),
+                       tcg_profile_pct(c->samples_translate, total),
+                       c->tb_entries, c->translations,
+                       c->translate_ns / 1e6, c->tlb_fills,
+                       c->tlb_victim_hits);
+    }
+
+    monitor_printf(mon, "\nTB executions: %" PRIu64 "\n", prof->executions);
+    if (prof->hot_tbs) {
+        monitor_printf(mon, "          count       %%  insns   host  "
+                       "pc                  symbol\n");
+    }
+    for (tb = prof->hot_tbs; tb; tb = tb->next) {
+        TcgProfileTb *t = tb->value;
+
+        monitor_printf(mon, "%15" PRIu64 " %6.2f%% %6" PRId64 " %6" PRId64
+                       "  0x%016" PRIx64 "  %s\n", t->executions,
+                       tcg_profile_pct(t->executions, prof->executions),
+                       t->guest_insns, t->host_size, t->pc,
+                       t->has_symbol ? t->symbol : "");
+    }
+
+    qapi_free_TcgProfile(prof);
+}
@@ -16,6 +16,7 @@
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "block/aio-wait.h"
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
@@ -42,6 +43,7 @@
 #include "trace.h"
 #include "monitor/qdev.h"
 #include "hw/pci/pci.h"
+#include "net_rx_pkt.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -108,6 +110,8 @@ static VirtIOFeature feature_sizes[] = {
      .end = endof(struct virtio_net_config, mtu)},
     {.flags = 1ULL << VIRTIO_NET_F_SPEED_DUPLEX,
      .end = endof(struct virtio_net_config, duplex)},
+    {.flags = (1ULL << VIRTIO_NET_F_RSS) | (1ULL << VIRTIO_NET_F_HASH_REPORT),
+     .end = endof(struct virtio_net_config, supported_hash_types)},
     {}
 };
 
@@ -138,6 +142,11 @@ static void virtio_net_get_config(VirtIODevice *vdev, uint8_t *config)
     memcpy(netcfg.mac, n->mac, ETH_ALEN);
     virtio_stl_p(vdev, &netcfg.speed, n->net_conf.speed);
     netcfg.duplex = n->net_conf.duplex;
+    netcfg.rss_max_key_size = VIRTIO_NET_RSS_MAX_KEY_SIZE;
+    virtio_stw_p(vdev, &netcfg.rss_max_indirection_table_length,
+                 VIRTIO_NET_RSS_MAX_TABLE_LEN);
+    virtio_stl_p(vdev, &netcfg.supported_hash_types,
+                 VIRTIO_NET_RSS_SUPPORTED_HASHES);
     memcpy(config, &netcfg, n->config_size);
 }
 
@@ -312,24 +321,45 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+/* Notify the guest about a data queue, possibly from an iothread */
+static void virtio_net_notify(VirtIONet *n, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (n->dataplane_started) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
+        virtio_notify(vdev, vq);
+    }
+}
+
 static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify(VIRTIO_NET(vdev), vq);
     }
 }
 
+static void virtio_net_dataplane_stop(VirtIONet *n);
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev);
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     VirtIONetQueue *q;
     int i;
     uint8_t queue_status;
+    bool dataplane = n->dataplane_started;
 
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
 
+    /* Keep the iothreads away from the queues while they are updated */
+    if (dataplane) {
+        virtio_net_dataplane_stop(n);
+    }
+
     for (i = 0; i < n->max_queues; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
         bool queue_started;
@@ -375,6 +405,10 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             }
         }
     }
+
+    if (dataplane) {
+        virtio_net_start_ioeventfd(vdev);
+    }
 }
 
 static void virtio_net_set_link_status(NetClientState *nc)
@@ -496,6 +530,57 @@ static RxFilterInfo *virtio_net_query_rxfilter(NetClientState *nc)
     return info;
 }
 
+static void virtio_net_disable_rss(VirtIONet *n)
+{
+    if (n->rss_data.enabled) {
+        trace_virtio_net_rss_disable();
+    }
+    n->rss_data.enabled = false;
+}
+
+/* Back to the coalescing set with the properties of the device */
+static void virtio_net_reset_coalesce(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    n->coal_tx_frames = vdev->coalesce_frames;
+    n->coal_tx_usecs = vdev->coalesce_usecs;
+    n->coal_rx_frames = vdev->coalesce_frames;
+    n->coal_rx_usecs = vdev->coalesce_usecs;
+}
+
+/* Context: BH in the AioContext of the queue pair */
+static void virtio_net_set_coalesce_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+
+    virtio_queue_set_coalesce(q->rx_vq, n->coal_rx_frames, n->coal_rx_usecs);
+    virtio_queue_set_coalesce(q->tx_vq, n->coal_tx_frames, n->coal_tx_usecs);
+}
+
+/*
+ * Queues use their coalescing state when they notify the guest, so the
+ * ones processed by an iothread are updated there.
+ */
+static void virtio_net_set_coalesce(VirtIONet *n)
+{
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int i;
+
+    for (i = 0; i < n->max_queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (n->dataplane_started && i < queues) {
+            aio_context_acquire(q->ctx);
+            aio_wait_bh_oneshot(q->ctx, virtio_net_set_coalesce_bh, q);
+            aio_context_release(q->ctx);
+        } else {
+            virtio_net_set_coalesce_bh(q);
+        }
+    }
+}
+
 static void virtio_net_reset(VirtIODevice *vdev)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -513,6 +598,9 @@ static void virtio_net_reset(VirtIODevice *vdev)
     timer_del(n->announce_timer.tm);
     n->announce_timer.round = 0;
     n->status &= ~VIRTIO_NET_S_ANNOUNCE;
+    virtio_net_disable_rss(n);
+    /* virtio_reset() takes care of the virtqueues themselves */
+    virtio_net_reset_coalesce(n);
 
     /* Flush any MAC and VLAN filter table state */
     n->mac_table.in_use = 0;
@@ -561,7 +649,7 @@ static int peer_has_ufo(VirtIONet *n)
 }
 
 static void virtio_net_set_mrg_rx_bufs(VirtIONet *n, int mergeable_rx_bufs,
-                                       int version_1)
+                                       int version_1, int hash_report)
 {
     int i;
     NetClientState *nc;
@@ -569,12 +657,16 @@ static void virtio_net_set_mrg_rx_bufs(VirtIONet *n, int mergeable_rx_bufs,
     n->mergeable_rx_bufs = mergeable_rx_bufs;
 
     if (version_1) {
-        n->guest_hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
+        n->guest_hdr_len = hash_report ?
+            sizeof(struct virtio_net_hdr_v1_hash) :
+            sizeof(struct virtio_net_hdr_mrg_rxbuf);
     } else {
         n->guest_hdr_len = n->mergeable_rx_bufs ?
             sizeof(struct virtio_net_hdr_mrg_rxbuf) :
             sizeof(struct virtio_net_hdr);
     }
+    /* The hash only has a place in the virtio 1 header */
+    n->rss_data.populate_hash = version_1 && hash_report;
 
     for (i = 0; i < n->max_queues; i++) {
         nc = qemu_get_subqueue(n->nic, i);
@@ -697,10 +789,25 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_UFO);
     }
 
+    if (n->num_iothreads) {
+        /* The coalescing timers run in the main loop */
+        virtio_clear_feature(&features, VIRTIO_NET_F_RSC_EXT);
+    }
+    if (n->num_iothreads > 1) {
+        /* Packets would be steered to queues of another iothread */
+        virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
+        virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
+    }
+
     if (!get_vhost_net(nc->peer)) {
         return features;
     }
 
+    /* vhost does not know how to steer or hash packets */
+    virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
+    virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
+    /* Nor to coalesce notifications, which do not go through QEMU */
+    virtio_clear_feature(&features, VIRTIO_NET_F_NOTF_COAL);
     features = vhost_net_get_features(get_vhost_net(nc->peer), features);
     vdev->backend_features = features;
 
@@ -866,7 +973,9 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
                                virtio_has_feature(features,
                                                   VIRTIO_NET_F_MRG_RXBUF),
                                virtio_has_feature(features,
-                                                  VIRTIO_F_VERSION_1));
+                                                  VIRTIO_F_VERSION_1),
+                               virtio_has_feature(features,
+                                                  VIRTIO_NET_F_HASH_REPORT));
 
     n->rsc4_enabled = virtio_has_feature(features, VIRTIO_NET_F_RSC_EXT) &&
         virtio_has_feature(features, VIRTIO_NET_F_GUEST_TSO4);
@@ -920,7 +1029,7 @@ out_err:
 static int virtio_net_handle_rx_mode(VirtIONet *n, uint8_t cmd,
                                      struct iovec *iov, unsigned int iov_cnt)
 {
-    uint8_t on;
+    uint8_t on, *flag;
     size_t s;
     NetClientState *nc = qemu_get_queue(n->nic);
 
@@ -930,21 +1039,25 @@ static int virtio_net_handle_rx_mode(VirtIONet *n, uint8_t cmd,
     }
 
     if (cmd == VIRTIO_NET_CTRL_RX_PROMISC) {
-        n->promisc = on;
+        flag = &n->promisc;
     } else if (cmd == VIRTIO_NET_CTRL_RX_ALLMULTI) {
-        n->allmulti = on;
+        flag = &n->allmulti;
     } else if (cmd == VIRTIO_NET_CTRL_RX_ALLUNI) {
-        n->alluni = on;
+        flag = &n->alluni;
     } else if (cmd == VIRTIO_NET_CTRL_RX_NOMULTI) {
-        n->nomulti = on;
+        flag = &n->nomulti;
     } else if (cmd == VIRTIO_NET_CTRL_RX_NOUNI) {
-        n->nouni = on;
+        flag = &n->nouni;
     } else if (cmd == VIRTIO_NET_CTRL_RX_NOBCAST) {
-        n->nobcast = on;
+        flag = &n->nobcast;
     } else {
         return VIRTIO_NET_ERR;
     }
 
+    seqlock_write_begin(&n->rx_filter_seq);
+    *flag = on;
+    seqlock_write_end(&n->rx_filter_seq);
+
     rxfilter_notify(nc);
 
     return VIRTIO_NET_OK;
@@ -1076,11 +1189,13 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
         multi_overflow = 1;
     }
 
+    seqlock_write_begin(&n->rx_filter_seq);
     n->mac_table.in_use = in_use;
     n->mac_table.first_multi = first_multi;
     n->mac_table.uni_overflow = uni_overflow;
     n->mac_table.multi_overflow = multi_overflow;
     memcpy(n->mac_table.macs, macs, MAC_TABLE_ENTRIES * ETH_ALEN);
+    seqlock_write_end(&n->rx_filter_seq);
     g_free(macs);
     rxfilter_notify(nc);
 
@@ -1105,15 +1220,18 @@ static int virtio_net_handle_vlan_table(VirtIONet *n, uint8_t cmd,
         return VIRTIO_NET_ERR;
     }
 
-    if (vid >= MAX_VLAN)
+    if (vid >= MAX_VLAN ||
+        (cmd != VIRTIO_NET_CTRL_VLAN_ADD && cmd != VIRTIO_NET_CTRL_VLAN_DEL)) {
         return VIRTIO_NET_ERR;
+    }
 
-    if (cmd == VIRTIO_NET_CTRL_VLAN_ADD)
+    seqlock_write_begin(&n->rx_filter_seq);
+    if (cmd == VIRTIO_NET_CTRL_VLAN_ADD) {
         n->vlans[vid >> 5] |= (1U << (vid & 0x1f));
-    else if (cmd == VIRTIO_NET_CTRL_VLAN_DEL)
+    } else {
         n->vlans[vid >> 5] &= ~(1U << (vid & 0x1f));
-    else
-        return VIRTIO_NET_ERR;
+    }
+    seqlock_write_end(&n->rx_filter_seq);
 
     rxfilter_notify(nc);
 
@@ -1136,6 +1254,176 @@ static int virtio_net_handle_announce(VirtIONet *n, uint8_t cmd,
     }
 }
 
+static int virtio_net_handle_coal(VirtIONet *n, uint8_t cmd,
+                                  struct iovec *iov, unsigned int iov_cnt)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    struct virtio_net_ctrl_coal_tx tx;
+    struct virtio_net_ctrl_coal_rx rx;
+
+    if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_NOTF_COAL)) {
+        return VIRTIO_NET_ERR;
+    }
+
+    switch (cmd) {
+    case VIRTIO_NET_CTRL_NOTF_COAL_TX_SET:
+        if (iov_to_buf(iov, iov_cnt, 0, &tx, sizeof(tx)) != sizeof(tx)) {
+            return VIRTIO_NET_ERR;
+        }
+        n->coal_tx_frames = le32_to_cpu(tx.tx_max_packets);
+        n->coal_tx_usecs = le32_to_cpu(tx.tx_usecs);
+        break;
+    case VIRTIO_NET_CTRL_NOTF_COAL_RX_SET:
+        if (iov_to_buf(iov, iov_cnt, 0, &rx, sizeof(rx)) != sizeof(rx)) {
+            return VIRTIO_NET_ERR;
+        }
+        n->coal_rx_frames = le32_to_cpu(rx.rx_max_packets);
+        n->coal_rx_usecs = le32_to_cpu(rx.rx_usecs);
+        break;
+    default:
+        return VIRTIO_NET_ERR;
+    }
+
+    trace_virtio_net_coalesce(n, n->coal_tx_frames, n->coal_tx_usecs,
+                              n->coal_rx_frames, n->coal_rx_usecs);
+    virtio_net_set_coalesce(n);
+    return VIRTIO_NET_OK;
+}
+
+/*
+ * Parse struct virtio_net_rss_config (@do_rss) or struct
+ * virtio_net_hash_config, which shares its layout but has no indirection
+ * table.  Return the number of queue pairs the driver asks for, or 0 if
+ * the command is invalid, in which case RSS ends up disabled.
+ */
+static uint16_t virtio_net_handle_rss(VirtIONet *n, struct iovec *iov,
+                                      unsigned int iov_cnt, bool do_rss)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtioNetRssData *rss = &n->rss_data;
+    struct virtio_net_rss_config cfg;
+    size_t s, offset = 0, size_get;
+    uint16_t queues, i;
+    struct {
+        uint16_t max_tx_vq;
+        uint8_t hash_key_length;
+    } QEMU_PACKED temp;
+    const char *err_msg = "";
+    uint32_t err_value = 0;
+
+    if (do_rss && !virtio_vdev_has_feature(vdev, VIRTIO_NET_F_RSS)) {
+        err_msg = "RSS is not negotiated";
+        goto error;
+    }
+    if (!do_rss && !virtio_vdev_has_feature(vdev, VIRTIO_NET_F_HASH_REPORT)) {
+        err_msg = "Hash report is not negotiated";
+        goto error;
+    }
+
+    size_get = offsetof(struct virtio_net_rss_config, indirection_table);
+    s = iov_to_buf(iov, iov_cnt, offset, &cfg, size_get);
+    if (s != size_get) {
+        err_msg = "Short command buffer";
+        err_value = (uint32_t)s;
+        goto error;
+    }
+    rss->hash_types = virtio_ldl_p(vdev, &cfg.hash_types);
+    if (do_rss) {
+        rss->indirections_len =
+            virtio_lduw_p(vdev, &cfg.indirection_table_mask) + 1;
+        rss->default_queue = virtio_lduw_p(vdev, &cfg.unclassified_queue);
+    } else {
+        rss->indirections_len = 1;
+        rss->default_queue = 0;
+    }
+    if (!is_power_of_2(rss->indirections_len) ||
+        rss->indirections_len > VIRTIO_NET_RSS_MAX_TABLE_LEN) {
+        err_msg = "Invalid size of indirection table";
+        err_value = rss->indirections_len;
+        goto error;
+    }
+    if (rss->default_queue >= n->max_queues) {
+        err_msg = "Invalid default queue";
+        err_value = rss->default_queue;
+        goto error;
+    }
+    offset += size_get;
+
+    if (do_rss) {
+        size_get = sizeof(uint16_t) * rss->indirections_len;
+        s = iov_to_buf(iov, iov_cnt, offset, rss->indirections_table,
+                       size_get);
+        if (s != size_get) {
+            err_msg = "Short indirection table buffer";
+            err_value = (uint32_t)s;
+            goto error;
+        }
+        offset += size_get;
+    } else {
+        /* The hash is only reported, packets stay where they are */
+        rss->indirections_table[0] = 0;
+        size_get = sizeof(cfg.indirection_table);
+        offset += size_get;
+    }
+    for (i = 0; i < rss->indirections_len; i++) {
+        rss->indirections_table[i] =
+            virtio_lduw_p(vdev, &rss->indirections_table[i]);
+        if (rss->indirections_table[i] >= n->max_queues) {
+            err_msg = "Invalid queue in indirection table";
+            err_value = rss->indirections_table[i];
+            goto error;
+        }
+    }
+
+    size_get = sizeof(temp);
+    s = iov_to_buf(iov, iov_cnt, offset, &temp, size_get);
+    if (s != size_get) {
+        err_msg = "Can't get queues";
+        err_value = (uint32_t)s;
+        goto error;
+    }
+    queues = do_rss ? virtio_lduw_p(vdev, &temp.max_tx_vq) : n->curr_queues;
+    if (queues == 0 || queues > n->max_queues) {
+        err_msg = "Invalid number of queues";
+        err_value = queues;
+        goto error;
+    }
+    if (temp.hash_key_length > VIRTIO_NET_RSS_MAX_KEY_SIZE) {
+        err_msg = "Invalid key size";
+        err_value = temp.hash_key_length;
+        goto error;
+    }
+    if (!temp.hash_key_length && rss->hash_types) {
+        err_msg = "No key provided";
+        goto error;
+    }
+    if (!rss->hash_types) {
+        virtio_net_disable_rss(n);
+        return queues;
+    }
+    offset += size_get;
+
+    memset(rss->key, 0, sizeof(rss->key));
+    size_get = temp.hash_key_length;
+    s = iov_to_buf(iov, iov_cnt, offset, rss->key, size_get);
+    if (s != size_get) {
+        err_msg = "Can't get key buffer";
+        err_value = (uint32_t)s;
+        goto error;
+    }
+
+    rss->redirect = do_rss;
+    rss->enabled = true;
+    trace_virtio_net_rss_enable(rss->hash_types, rss->indirections_len,
+                                temp.hash_key_length);
+    return queues;
+
+error:
+    trace_virtio_net_rss_error(err_msg, err_value);
+    virtio_net_disable_rss(n);
+    return 0;
+}
+
 static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
                                 struct iovec *iov, unsigned int iov_cnt)
 {
@@ -1144,21 +1432,33 @@ static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
     size_t s;
     uint16_t queues;
 
-    s = iov_to_buf(iov, iov_cnt, 0, &mq, sizeof(mq));
-    if (s != sizeof(mq)) {
-        return VIRTIO_NET_ERR;
-    }
-
-    if (cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) {
+    if (cmd == VIRTIO_NET_CTRL_MQ_HASH_CONFIG) {
+        /* Only configures hash reporting, the queues are left alone */
+        queues = virtio_net_handle_rss(n, iov, iov_cnt, false);
+        return queues ? VIRTIO_NET_OK : VIRTIO_NET_ERR;
+    } else if (cmd == VIRTIO_NET_CTRL_MQ_RSS_CONFIG) {
+        queues = virtio_net_handle_rss(n, iov, iov_cnt, true);
+        if (queues == 1 && !n->multiqueue) {
+            /* Hashing still works, there is just nothing to steer */
+            return VIRTIO_NET_OK;
+        }
+    } else if (cmd == VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) {
+        s = iov_to_buf(iov, iov_cnt, 0, &mq, sizeof(mq));
+        if (s != sizeof(mq)) {
+            return VIRTIO_NET_ERR;
+        }
+        queues = virtio_lduw_p(vdev, &mq.virtqueue_pairs);
+        /* Automatic steering replaces RSS */
+        virtio_net_disable_rss(n);
+    } else {
         return VIRTIO_NET_ERR;
     }
 
-    queues = virtio_lduw_p(vdev, &mq.virtqueue_pairs);
-
     if (queues < VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN ||
         queues > VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX ||
         queues > n->max_queues ||
         !n->multiqueue) {
+        virtio_net_disable_rss(n);
         return VIRTIO_NET_ERR;
     }
 
@@ -1180,6 +1480,7 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
     size_t s;
     struct iovec *iov, *iov2;
     unsigned int iov_cnt;
+    bool stopped = false;
 
     for (;;) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
@@ -1209,9 +1510,20 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         } else if (ctrl.class == VIRTIO_NET_CTRL_ANNOUNCE) {
             status = virtio_net_handle_announce(n, ctrl.cmd, iov, iov_cnt);
         } else if (ctrl.class == VIRTIO_NET_CTRL_MQ) {
+            /*
+             * The set of queue pairs and the RSS state change under the
+             * iothreads, stop them until the batch is done.  Other
+             * commands are applied while they run.
+             */
+            if (n->dataplane_started) {
+                virtio_net_dataplane_stop(n);
+                stopped = true;
+            }
             status = virtio_net_handle_mq(n, ctrl.cmd, iov, iov_cnt);
         } else if (ctrl.class == VIRTIO_NET_CTRL_GUEST_OFFLOADS) {
             status = virtio_net_handle_offloads(n, ctrl.cmd, iov, iov_cnt);
+        } else if (ctrl.class == VIRTIO_NET_CTRL_NOTF_COAL) {
+            status = virtio_net_handle_coal(n, ctrl.cmd, iov, iov_cnt);
         }
 
         s = iov_from_buf(elem->in_sg, elem->in_num, 0, &status, sizeof(status));
@@ -1222,6 +1534,10 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         g_free(iov2);
         g_free(elem);
     }
+
+    if (stopped) {
+        virtio_net_start_ioeventfd(vdev);
+    }
 }
 
 /* RX */
@@ -1336,7 +1652,7 @@ static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
     }
 }
 
-static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
+static int do_receive_filter(VirtIONet *n, const uint8_t *buf, int size)
 {
     static const uint8_t bcast[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
     static const uint8_t vlan[] = {0x81, 0x00};
@@ -1387,21 +1703,141 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
     return 0;
 }
 
+/* Control commands change the filter while iothreads use it */
+static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
+{
+    unsigned start;
+    int ret;
+
+    do {
+        start = seqlock_read_begin(&n->rx_filter_seq);
+        ret = do_receive_filter(n, buf, size);
+    } while (seqlock_read_retry(&n->rx_filter_seq, start));
+    return ret;
+}
+
+/* Pick the most specific tuple that both the packet and @types allow.  */
+static int virtio_net_get_hash_type(bool isip4, bool isip6, bool isudp,
+                                    bool istcp, uint32_t types)
+{
+    if (isip4) {
+        if (istcp && (types & VIRTIO_NET_RSS_HASH_TYPE_TCPv4)) {
+            return NetPktRssIpV4Tcp;
+        }
+        if (isudp && (types & VIRTIO_NET_RSS_HASH_TYPE_UDPv4)) {
+            return NetPktRssIpV4Udp;
+        }
+        if (types & VIRTIO_NET_RSS_HASH_TYPE_IPv4) {
+            return NetPktRssIpV4;
+        }
+    } else if (isip6) {
+        if (istcp && (types & VIRTIO_NET_RSS_HASH_TYPE_TCP_EX)) {
+            return NetPktRssIpV6TcpEx;
+        }
+        if (istcp && (types & VIRTIO_NET_RSS_HASH_TYPE_TCPv6)) {
+            return NetPktRssIpV6Tcp;
+        }
+        if (isudp && (types & VIRTIO_NET_RSS_HASH_TYPE_UDP_EX)) {
+            return NetPktRssIpV6UdpEx;
+        }
+        if (isudp && (types & VIRTIO_NET_RSS_HASH_TYPE_UDPv6)) {
+            return NetPktRssIpV6Udp;
+        }
+        if (types & VIRTIO_NET_RSS_HASH_TYPE_IP_EX) {
+            return NetPktRssIpV6Ex;
+        }
+        if (types & VIRTIO_NET_RSS_HASH_TYPE_IPv6) {
+            return NetPktRssIpV6;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Hash the packet in @buf and return the index of the queue it belongs
+ * to, or @index if it should stay where it is.  The hash to report to
+ * the guest is stored in @hash_value and @hash_report.
+ */
+static int virtio_net_process_rss(VirtIONet *n, int index,
+                                  const uint8_t *buf, size_t size,
+                                  uint32_t *hash_value,
+                                  uint16_t *hash_report)
+{
+    static const uint16_t reports[] = {
+        [NetPktRssIpV4] = VIRTIO_NET_HASH_REPORT_IPv4,
+        [NetPktRssIpV4Tcp] = VIRTIO_NET_HASH_REPORT_TCPv4,
+        [NetPktRssIpV4Udp] = VIRTIO_NET_HASH_REPORT_UDPv4,
+        [NetPktRssIpV6] = VIRTIO_NET_HASH_REPORT_IPv6,
+        [NetPktRssIpV6Tcp] = VIRTIO_NET_HASH_REPORT_TCPv6,
+        [NetPktRssIpV6Udp] = VIRTIO_NET_HASH_REPORT_UDPv6,
+        [NetPktRssIpV6Ex] = VIRTIO_NET_HASH_REPORT_IPv6_EX,
+        [NetPktRssIpV6TcpEx] = VIRTIO_NET_HASH_REPORT_TCPv6_EX,
+        [NetPktRssIpV6UdpEx] = VIRTIO_NET_HASH_REPORT_UDPv6_EX,
+    };
+    VirtioNetRssData *rss = &n->rss_data;
+    bool isip4, isip6, isudp, istcp;
+    int type;
+
+    net_rx_pkt_set_protocols(n->rx_pkt, buf + n->host_hdr_len,
+                             size - n->host_hdr_len);
+    net_rx_pkt_get_protocols(n->rx_pkt, &isip4, &isip6, &isudp, &istcp);
+    type = virtio_net_get_hash_type(isip4, isip6, isudp, istcp,
+                                    rss->hash_types);
+    if (type < 0) {
+        *hash_value = 0;
+        *hash_report = VIRTIO_NET_HASH_REPORT_NONE;
+        return rss->redirect ? rss->default_queue : index;
+    }
+
+    *hash_value = net_rx_pkt_calc_rss_hash(n->rx_pkt, type, rss->key);
+    *hash_report = reports[type];
+    if (!rss->redirect) {
+        return index;
+    }
+    return rss->indirections_table[*hash_value &
+                                   (rss->indirections_len - 1)];
+}
+
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                       size_t size)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
-    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtIONetQueue *q;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     struct iovec mhdr_sg[VIRTQUEUE_MAX_SIZE];
     struct virtio_net_hdr_mrg_rxbuf mhdr;
     unsigned mhdr_cnt = 0;
     size_t offset, i, guest_offset;
+    uint32_t hash_value = 0;
+    uint16_t hash_report = VIRTIO_NET_HASH_REPORT_NONE;
 
     if (!virtio_net_can_receive(nc)) {
         return -1;
     }
 
+    if (n->rss_data.enabled) {
+        int index = virtio_net_process_rss(n, nc->queue_index, buf, size,
+                                           &hash_value, &hash_report);
+
+        if (index != nc->queue_index) {
+            NetClientState *target = qemu_get_subqueue(n->nic, index);
+
+            /*
+             * Queueing the packet would hold back the queue it came in
+             * on, which may not be congested at all: drop it instead,
+             * like a physical NIC whose target ring is full.
+             */
+            if (!virtio_net_can_receive(target) ||
+                !virtio_net_has_buffers(virtio_net_get_subqueue(target),
+                                        size + n->guest_hdr_len -
+                                        n->host_hdr_len)) {
+                return size;
+            }
+            nc = target;
+        }
+    }
+    q = virtio_net_get_subqueue(nc);
+
     /* hdr_len refers to the header we supply to the guest */
     if (!virtio_net_has_buffers(q, size + n->guest_hdr_len - n->host_hdr_len)) {
         return 0;
@@ -1452,6 +1888,17 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             }
 
             receive_header(n, sg, elem->in_num, buf, size);
+            if (n->rss_data.populate_hash) {
+                struct virtio_net_hdr_v1_hash hhdr;
+
+                virtio_stl_p(vdev, &hhdr.hash_value, hash_value);
+                virtio_stw_p(vdev, &hhdr.hash_report, hash_report);
+                hhdr.padding = 0;
+                iov_from_buf(sg, elem->in_num,
+                             offsetof(typeof(hhdr), hash_value),
+                             &hhdr.hash_value,
+                             sizeof(hhdr) - offsetof(typeof(hhdr), hash_value));
+            }
             offset = n->host_hdr_len;
             total += n->guest_hdr_len;
             guest_offset = n->guest_hdr_len;
@@ -1486,7 +1933,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    virtio_net_notify(n, q->rx_vq);
 
     return size;
 }
@@ -2111,26 +2558,94 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(n, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
     virtio_net_flush_tx(q);
 }
 
+/*
+ * Send the packet of @elem.  Returns 0 if it is done with, whether it went
+ * out or was dropped, -EBUSY if the peer queued it, and -EINVAL if the
+ * device is broken, in which case @elem has been detached and freed.
+ */
+static int virtio_net_tx_elem(VirtIONetQueue *q, VirtQueueElement *elem)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    ssize_t ret;
+    unsigned int out_num;
+    struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
+    struct virtio_net_hdr_mrg_rxbuf mhdr;
+
+    out_num = elem->out_num;
+    out_sg = elem->out_sg;
+    if (out_num < 1) {
+        virtio_error(vdev, "virtio-net header not in first element");
+        virtqueue_detach_element(q->tx_vq, elem, 0);
+        virtqueue_element_free(elem);
+        return -EINVAL;
+    }
+
+    if (n->has_vnet_hdr) {
+        if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
+            n->guest_hdr_len) {
+            virtio_error(vdev, "virtio-net header incorrect");
+            virtqueue_detach_element(q->tx_vq, elem, 0);
+            virtqueue_element_free(elem);
+            return -EINVAL;
+        }
+        if (n->needs_vnet_hdr_swap) {
+            virtio_net_hdr_swap(vdev, (void *) &mhdr);
+            sg2[0].iov_base = &mhdr;
+            sg2[0].iov_len = n->guest_hdr_len;
+            out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
+                               out_sg, out_num,
+                               n->guest_hdr_len, -1);
+            if (out_num == VIRTQUEUE_MAX_SIZE) {
+                /* Drop the packet */
+                return 0;
+            }
+            out_num += 1;
+            out_sg = sg2;
+        }
+    }
+    /*
+     * If host wants to see the guest header as is, we can
+     * pass it on unchanged. Otherwise, copy just the parts
+     * that host is interested in.
+     */
+    assert(n->host_hdr_len <= n->guest_hdr_len);
+    if (n->host_hdr_len != n->guest_hdr_len) {
+        unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
+                                   out_sg, out_num,
+                                   0, n->host_hdr_len);
+        sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
+                         out_sg, out_num,
+                         n->guest_hdr_len, -1);
+        out_num = sg_num;
+        out_sg = sg;
+    }
+
+    ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
+                                  out_sg, out_num, virtio_net_tx_complete);
+    return ret == 0 ? -EBUSY : 0;
+}
+
 /* TX */
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    VirtQueueElement *elem;
+    VirtQueueElement *elems[VIRTQUEUE_POP_BATCH];
     int32_t num_packets = 0;
-    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -2140,82 +2655,46 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
-    for (;;) {
-        ssize_t ret;
-        unsigned int out_num;
-        struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr_mrg_rxbuf mhdr;
+    do {
+        unsigned int i, done, num;
+        int ret = 0;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
+        num = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement), elems,
+                                  MIN(VIRTQUEUE_POP_BATCH,
+                                      MAX(n->tx_burst - num_packets, 1)));
+        if (!num) {
             break;
         }
 
-        out_num = elem->out_num;
-        out_sg = elem->out_sg;
-        if (out_num < 1) {
-            virtio_error(vdev, "virtio-net header not in first element");
-            virtqueue_detach_element(q->tx_vq, elem, 0);
-            g_free(elem);
-            return -EINVAL;
+        for (done = 0; done < num; done++) {
+            ret = virtio_net_tx_elem(q, elems[done]);
+            if (ret < 0) {
+                break;
+            }
         }
 
-        if (n->has_vnet_hdr) {
-            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
-                n->guest_hdr_len) {
-                virtio_error(vdev, "virtio-net header incorrect");
-                virtqueue_detach_element(q->tx_vq, elem, 0);
-                g_free(elem);
-                return -EINVAL;
-            }
-            if (n->needs_vnet_hdr_swap) {
-                virtio_net_hdr_swap(vdev, (void *) &mhdr);
-                sg2[0].iov_base = &mhdr;
-                sg2[0].iov_len = n->guest_hdr_len;
-                out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
-                                   out_sg, out_num,
-                                   n->guest_hdr_len, -1);
-                if (out_num == VIRTQUEUE_MAX_SIZE) {
-                    goto drop;
-                }
-                out_num += 1;
-                out_sg = sg2;
+        /* Complete the packets that are done with in one go */
+        if (done) {
+            virtqueue_push_batch(q->tx_vq, elems, NULL, done);
+            virtio_net_notify(n, q->tx_vq);
+            for (i = 0; i < done; i++) {
+                virtqueue_element_free(elems[i]);
             }
+            num_packets += done;
         }
-        /*
-         * If host wants to see the guest header as is, we can
-         * pass it on unchanged. Otherwise, copy just the parts
-         * that host is interested in.
-         */
-        assert(n->host_hdr_len <= n->guest_hdr_len);
-        if (n->host_hdr_len != n->guest_hdr_len) {
-            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
-                                       out_sg, out_num,
-                                       0, n->host_hdr_len);
-            sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
-                             out_sg, out_num,
-                             n->guest_hdr_len, -1);
-            out_num = sg_num;
-            out_sg = sg;
-        }
-
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
-        if (ret == 0) {
-            virtio_queue_set_notification(q->tx_vq, 0);
-            q->async_tx.elem = elem;
-            return -EBUSY;
-        }
-
-drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
 
-        if (++num_packets >= n->tx_burst) {
-            break;
+        if (ret < 0) {
+            /* Give back what comes after the packet that did not go out */
+            virtqueue_unpop_batch(q->tx_vq, elems + done + 1,
+                                  num - done - 1);
+            if (ret == -EBUSY) {
+                virtio_queue_set_notification(q->tx_vq, 0);
+                q->async_tx.elem = elems[done];
+            }
+            return ret;
         }
-    }
+    } while (num_packets < n->tx_burst);
+
     return num_packets;
 }
 
@@ -2344,6 +2823,213 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+/*
+ * Dataplane: with the iothread or iothreads property, each queue pair and
+ * the peer of its subqueue are processed in an iothread instead of the
+ * main loop.  This replaces the ioeventfd handling of the device, so the
+ * queue pairs move to their iothreads when the transport starts ioeventfd
+ * and back when it stops it.  The control queue is left without ioeventfd
+ * and runs in the vCPU thread, with the iothreads stopped.
+ */
+
+static bool virtio_net_dataplane_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    NetClientState *nc =
+        qemu_get_subqueue(n->nic, vq2q(virtio_get_queue_index(vq)));
+
+    /*
+     * The queue is polled whenever it has buffers, so only flush when
+     * the peer stopped sending for lack of them.  Packets queued for any
+     * other reason are flushed by virtio_net_set_status().
+     */
+    if (!nc->receive_disabled) {
+        return false;
+    }
+    virtio_net_handle_rx(vdev, vq);
+    return true;
+}
+
+static bool virtio_net_dataplane_handle_tx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    if (q->tx_waiting) {
+        return false;
+    }
+    virtio_net_handle_tx_bh(vdev, vq);
+    return true;
+}
+
+static bool virtio_net_has_filters(VirtIONet *n, int queues)
+{
+    int i;
+
+    for (i = 0; i < queues; i++) {
+        NetClientState *nc = qemu_get_subqueue(n->nic, i);
+
+        if (!QTAILQ_EMPTY(&nc->filters) || !QTAILQ_EMPTY(&nc->peer->filters)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Move the peer of queue pair @index to @ctx, unless it was deleted:
+ * qemu_del_net_client() then took it back to the main loop already.
+ */
+static void virtio_net_set_peer_aio_context(VirtIONet *n, int index,
+                                            AioContext *ctx)
+{
+    if (!n->nic->peer_deleted) {
+        qemu_set_net_aio_context(qemu_get_subqueue(n->nic, index)->peer, ctx);
+    }
+}
+
+/* Context: QEMU global mutex held */
+static int virtio_net_dataplane_start(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int nvqs = queues * 2;
+    int i, r;
+
+    r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (r != 0) {
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "ensure -accel kvm is set.", r);
+        return r;
+    }
+
+    for (i = 0; i < nvqs; i++) {
+        r = virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, true);
+        if (r != 0) {
+            error_report("virtio-net failed to set host notifier (%d)", r);
+            while (i--) {
+                virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+                virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+            }
+            k->set_guest_notifiers(qbus->parent, nvqs, false);
+            return r;
+        }
+    }
+
+    n->dataplane_started = true;
+    trace_virtio_net_dataplane_start(n, queues);
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = aio_bh_new(q->ctx, virtio_net_tx_bh, q);
+
+        aio_context_acquire(q->ctx);
+        virtio_net_set_peer_aio_context(n, i, q->ctx);
+        virtio_queue_aio_set_host_notifier_handler(q->rx_vq, q->ctx,
+                virtio_net_dataplane_handle_rx);
+        virtio_queue_aio_set_host_notifier_handler(q->tx_vq, q->ctx,
+                virtio_net_dataplane_handle_tx);
+        aio_context_release(q->ctx);
+
+        if (q->tx_waiting) {
+            qemu_bh_schedule(q->tx_bh);
+        }
+        /* Kick right away to begin processing requests already in vring */
+        event_notifier_set(virtio_queue_get_host_notifier(q->tx_vq));
+    }
+    return 0;
+}
+
+/*
+ * Stop notifications for new requests from guest and give the peer back
+ * to the main loop.
+ *
+ * Context: BH in IOThread
+ */
+static void virtio_net_dataplane_stop_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+
+    virtio_queue_aio_set_host_notifier_handler(q->rx_vq, q->ctx, NULL);
+    virtio_queue_aio_set_host_notifier_handler(q->tx_vq, q->ctx, NULL);
+    virtio_net_set_peer_aio_context(n, q - n->vqs, NULL);
+
+    /* virtio_net_set_status() reschedules it if tx_waiting */
+    qemu_bh_delete(q->tx_bh);
+    q->tx_bh = qemu_bh_new(virtio_net_tx_bh, q);
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_dataplane_stop(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int nvqs = queues * 2;
+    int i;
+
+    if (!n->dataplane_started) {
+        return;
+    }
+    trace_virtio_net_dataplane_stop(n);
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        aio_context_acquire(q->ctx);
+        aio_wait_bh_oneshot(q->ctx, virtio_net_dataplane_stop_bh, q);
+        aio_context_release(q->ctx);
+    }
+
+    for (i = 0; i < nvqs; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+    n->dataplane_started = false;
+}
+
+/*
+ * Also called to restart the dataplane after virtio_net_dataplane_stop();
+ * if that fails, the queues are processed in the main loop instead.
+ */
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+
+    if (!n->num_iothreads) {
+        return virtio_device_start_ioeventfd_impl(vdev);
+    }
+    if (virtio_net_has_filters(n, n->multiqueue ? n->max_queues : 1)) {
+        warn_report_once("virtio-net: network filters cannot run in an "
+                         "iothread, processing queues in the main loop");
+        return virtio_device_start_ioeventfd_impl(vdev);
+    }
+    if (virtio_net_dataplane_start(n) < 0) {
+        warn_report_once("virtio-net: processing queues in the main loop");
+        return virtio_device_start_ioeventfd_impl(vdev);
+    }
+    return 0;
+}
+
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+
+    if (n->dataplane_started) {
+        virtio_net_dataplane_stop(n);
+    } else {
+        virtio_device_stop_ioeventfd_impl(vdev);
+    }
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -2423,6 +3109,7 @@ static void virtio_net_change_num_queues(VirtIONet *n, int new_max_queues)
 
     /* add ctrl_vq last */
     n->ctrl_vq = virtio_add_queue(vdev, 64, virtio_net_handle_ctrl);
+    virtio_queue_set_control(n->ctrl_vq);
 }
 
 static void virtio_net_set_multiqueue(VirtIONet *n, int multiqueue)
@@ -2444,7 +3131,9 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
     trace_virtio_net_post_load_device();
     virtio_net_set_mrg_rx_bufs(n, n->mergeable_rx_bufs,
                                virtio_vdev_has_feature(vdev,
-                                                       VIRTIO_F_VERSION_1));
+                                                       VIRTIO_F_VERSION_1),
+                               virtio_vdev_has_feature(vdev,
+                                                       VIRTIO_NET_F_HASH_REPORT));
 
     /* MAC_TABLE_ENTRIES may be different from the saved image */
     if (n->mac_table.in_use > MAC_TABLE_ENTRIES) {
@@ -2464,6 +3153,7 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
     n->saved_guest_offloads = n->curr_guest_offloads;
 
     virtio_net_set_queues(n);
+    virtio_net_set_coalesce(n);
 
     /* Find the first multicast entry in the saved MAC filter */
     for (i = 0; i < n->mac_table.in_use; i++) {
@@ -2670,6 +3360,85 @@ static const VMStateDescription vmstate_virtio_net_has_vnet = {
     },
 };
 
+static bool virtio_net_rss_needed(void *opaque)
+{
+    return VIRTIO_NET(opaque)->rss_data.enabled;
+}
+
+/* Apply the checks of virtio_net_handle_rss() to the incoming state */
+static int virtio_net_rss_post_load(void *opaque, int version_id)
+{
+    VirtIONet *n = opaque;
+    VirtioNetRssData *rss = &n->rss_data;
+    int i;
+
+    if (!is_power_of_2(rss->indirections_len) ||
+        rss->indirections_len > VIRTIO_NET_RSS_MAX_TABLE_LEN) {
+        error_report("virtio-net: invalid RSS indirection table length %u",
+                     rss->indirections_len);
+        return -EINVAL;
+    }
+    if (rss->default_queue >= n->max_queues) {
+        error_report("virtio-net: RSS default queue %u out of range",
+                     rss->default_queue);
+        return -EINVAL;
+    }
+    for (i = 0; i < rss->indirections_len; i++) {
+        if (rss->indirections_table[i] >= n->max_queues) {
+            error_report("virtio-net: RSS indirection table entry %u "
+                         "out of range", rss->indirections_table[i]);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+static const VMStateDescription vmstate_virtio_net_rss = {
+    .name      = "virtio-net-device/rss",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = virtio_net_rss_needed,
+    .post_load = virtio_net_rss_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_BOOL(rss_data.enabled, VirtIONet),
+        VMSTATE_BOOL(rss_data.redirect, VirtIONet),
+        VMSTATE_UINT32(rss_data.hash_types, VirtIONet),
+        VMSTATE_UINT8_ARRAY(rss_data.key, VirtIONet,
+                            VIRTIO_NET_RSS_MAX_KEY_SIZE),
+        VMSTATE_UINT16(rss_data.indirections_len, VirtIONet),
+        VMSTATE_UINT16_ARRAY(rss_data.indirections_table, VirtIONet,
+                             VIRTIO_NET_RSS_MAX_TABLE_LEN),
+        VMSTATE_UINT16(rss_data.default_queue, VirtIONet),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
+static bool virtio_net_coalesce_needed(void *opaque)
+{
+    VirtIONet *n = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    return n->coal_tx_frames != vdev->coalesce_frames ||
+           n->coal_tx_usecs != vdev->coalesce_usecs ||
+           n->coal_rx_frames != vdev->coalesce_frames ||
+           n->coal_rx_usecs != vdev->coalesce_usecs;
+}
+
+static const VMStateDescription vmstate_virtio_net_coalesce = {
+    .name      = "virtio-net-device/coalesce",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = virtio_net_coalesce_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(coal_tx_frames, VirtIONet),
+        VMSTATE_UINT32(coal_tx_usecs, VirtIONet),
+        VMSTATE_UINT32(coal_rx_frames, VirtIONet),
+        VMSTATE_UINT32(coal_rx_usecs, VirtIONet),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
 static const VMStateDescription vmstate_virtio_net_device = {
     .name = "virtio-net-device",
     .version_id = VIRTIO_NET_VM_VERSION,
@@ -2720,6 +3489,11 @@ static const VMStateDescription vmstate_virtio_net_device = {
                             has_ctrl_guest_offloads),
         VMSTATE_END_OF_LIST()
    },
+    .subsections = (const VMStateDescription * []) {
+        &vmstate_virtio_net_rss,
+        &vmstate_virtio_net_coalesce,
+        NULL
+    }
 };
 
 static NetClientInfo net_virtio_info = {
@@ -2929,11 +3703,99 @@ out:
     }
 }
 
+static IOThread *virtio_net_find_iothread(const char *id, Error **errp)
+{
+    Object *obj = object_resolve_path_component(object_get_objects_root(), id);
+    IOThread *iothread = (IOThread *)object_dynamic_cast(obj, TYPE_IOTHREAD);
+
+    if (!iothread) {
+        error_setg(errp, "'%s' is not an iothread", id);
+    }
+    return iothread;
+}
+
+static void virtio_net_iothreads_init(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = MAX(n->nic_conf.peers.queues, 1);
+    char **ids;
+    int i;
+
+    if (!n->iothread && !n->iothread_ids) {
+        return;
+    }
+    if (n->iothread && n->iothread_ids) {
+        error_setg(errp, "'iothread' and 'iothreads' cannot be used together");
+        return;
+    }
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp, "device is incompatible with iothread "
+                   "(transport does not support notifiers)");
+        return;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread");
+        return;
+    }
+    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+        error_setg(errp, "tx=timer cannot be used with iothread");
+        return;
+    }
+    for (i = 0; i < queues; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (!qemu_has_net_aio_context(peer) || get_vhost_net(peer)) {
+            error_setg(errp, "iothread requires a tap or af-xdp netdev "
+                       "without vhost");
+            return;
+        }
+    }
+
+    if (n->iothread) {
+        n->iothreads = g_new(IOThread *, 1);
+        n->iothreads[n->num_iothreads++] = n->iothread;
+    } else {
+        ids = g_strsplit(n->iothread_ids, ":", -1);
+        n->iothreads = g_new(IOThread *, g_strv_length(ids));
+        for (i = 0; ids[i]; i++) {
+            IOThread *iothread = virtio_net_find_iothread(ids[i], errp);
+
+            if (!iothread) {
+                g_strfreev(ids);
+                g_free(n->iothreads);
+                n->iothreads = NULL;
+                n->num_iothreads = 0;
+                return;
+            }
+            n->iothreads[n->num_iothreads++] = iothread;
+        }
+        g_strfreev(ids);
+    }
+    for (i = 0; i < n->num_iothreads; i++) {
+        object_ref(OBJECT(n->iothreads[i]));
+    }
+}
+
+static void virtio_net_iothreads_cleanup(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->num_iothreads; i++) {
+        object_unref(OBJECT(n->iothreads[i]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
+    n->num_iothreads = 0;
+}
+
 static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIONet *n = VIRTIO_NET(dev);
     NetClientState *nc;
+    Error *err = NULL;
     int i;
 
     if (n->net_conf.mtu) {
@@ -2962,6 +3824,14 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         n->host_features |= (1ULL << VIRTIO_NET_F_SPEED_DUPLEX);
     }
 
+    if ((virtio_has_feature(n->host_features, VIRTIO_NET_F_RSS) ||
+         virtio_has_feature(n->host_features, VIRTIO_NET_F_HASH_REPORT) ||
+         virtio_has_feature(n->host_features, VIRTIO_NET_F_NOTF_COAL)) &&
+        !virtio_has_feature(n->host_features, VIRTIO_NET_F_CTRL_VQ)) {
+        error_setg(errp, "'rss', 'hash' and 'notf_coal' require 'ctrl_vq'");
+        return;
+    }
+
     if (n->failover) {
         n->primary_listener.should_be_hidden =
             virtio_net_primary_should_be_hidden;
@@ -3010,6 +3880,19 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+
+    virtio_net_iothreads_init(n, &err);
+    if (err) {
+        error_propagate(errp, err);
+        virtio_cleanup(vdev);
+        return;
+    }
+    virtio_net_reset_coalesce(n);
+    if (n->num_iothreads) {
+        /* The guest notifier mask callbacks only work with vhost */
+        vdev->use_guest_notifier_mask = false;
+    }
+
     n->vqs = g_malloc0(sizeof(VirtIONetQueue) * n->max_queues);
     n->curr_queues = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -3026,10 +3909,15 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
                                     n->net_conf.tx_queue_size);
 
     for (i = 0; i < n->max_queues; i++) {
+        if (n->num_iothreads) {
+            n->vqs[i].ctx = iothread_get_aio_context(
+                n->iothreads[i % n->num_iothreads]);
+        }
         virtio_net_add_queue(n, i);
     }
 
     n->ctrl_vq = virtio_add_queue(vdev, 64, virtio_net_handle_ctrl);
+    virtio_queue_set_control(n->ctrl_vq);
     qemu_macaddr_default_if_unset(&n->nic_conf.macaddr);
     memcpy(&n->mac[0], &n->nic_conf.macaddr, sizeof(n->mac));
     n->status = VIRTIO_NET_S_LINK_UP;
@@ -3063,18 +3951,21 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 
     n->vqs[0].tx_waiting = 0;
     n->tx_burst = n->net_conf.txburst;
-    virtio_net_set_mrg_rx_bufs(n, 0, 0);
+    virtio_net_set_mrg_rx_bufs(n, 0, 0, 0);
     n->promisc = 1; /* for compatibility */
 
     n->mac_table.macs = g_malloc0(MAC_TABLE_ENTRIES * ETH_ALEN);
 
     n->vlans = g_malloc0(MAX_VLAN >> 3);
+    seqlock_init(&n->rx_filter_seq);
 
     nc = qemu_get_queue(n->nic);
     nc->rxfilter_notify_enabled = 1;
 
     QTAILQ_INIT(&n->rsc_chains);
     n->qdev = dev;
+
+    net_rx_pkt_init(&n->rx_pkt, false);
 }
 
 static void virtio_net_device_unrealize(DeviceState *dev)
@@ -3111,6 +4002,8 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     g_free(n->vqs);
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
+    net_rx_pkt_uninit(n->rx_pkt);
+    virtio_net_iothreads_cleanup(n);
     virtio_cleanup(vdev);
 }
 
@@ -3212,6 +4105,12 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_BIT64("ctrl_guest_offloads", VirtIONet, host_features,
                     VIRTIO_NET_F_CTRL_GUEST_OFFLOADS, true),
     DEFINE_PROP_BIT64("mq", VirtIONet, host_features, VIRTIO_NET_F_MQ, false),
+    DEFINE_PROP_BIT64("rss", VirtIONet, host_features,
+                    VIRTIO_NET_F_RSS, false),
+    DEFINE_PROP_BIT64("hash", VirtIONet, host_features,
+                    VIRTIO_NET_F_HASH_REPORT, false),
+    DEFINE_PROP_BIT64("notf_coal", VirtIONet, host_features,
+                    VIRTIO_NET_F_NOTF_COAL, false),
     DEFINE_PROP_BIT64("guest_rsc_ext", VirtIONet, host_features,
                     VIRTIO_NET_F_RSC_EXT, false),
     DEFINE_PROP_UINT32("rsc_interval", VirtIONet, rsc_timeout,
@@ -3231,6 +4130,9 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_LINK("iothread", VirtIONet, iothread, TYPE_IOTHREAD,
+                     IOThread *),
+    DEFINE_PROP_STRING("iothreads", VirtIONet, iothread_ids),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3251,6 +4153,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->bad_features = virtio_net_bad_features;
     vdc->reset = virtio_net_reset;
     vdc->set_status = virtio_net_set_status;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
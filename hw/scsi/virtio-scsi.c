@@ -61,7 +61,7 @@ void virtio_scsi_free_req(VirtIOSCSIReq *req)
 {
     qemu_iovec_destroy(&req->resp_iov);
     qemu_sglist_destroy(&req->qsgl);
-    g_free(req);
+    virtqueue_element_free(&req->elem);
 }
 
 static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
@@ -595,7 +595,10 @@ static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
 
 bool virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
+    VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
+    VirtQueueElement *elems[VIRTQUEUE_POP_BATCH];
     VirtIOSCSIReq *req, *next;
+    unsigned int i, num;
     int ret = 0;
     bool suppress_notifications = virtio_queue_get_notification(vq);
     bool progress = false;
@@ -607,13 +610,24 @@ bool virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_scsi_pop_req(s, vq))) {
+        while (ret != -EINVAL &&
+               (num = virtqueue_pop_batch(vq, sizeof(VirtIOSCSIReq) +
+                                          vs->cdb_size, elems,
+                                          VIRTQUEUE_POP_BATCH))) {
             progress = true;
-            ret = virtio_scsi_handle_cmd_req_prepare(s, req);
-            if (!ret) {
-                QTAILQ_INSERT_TAIL(&reqs, req, next);
-            } else if (ret == -EINVAL) {
+            for (i = 0; i < num; i++) {
+                req = container_of(elems[i], VirtIOSCSIReq, elem);
+                virtio_scsi_init_req(s, vq, req);
+                ret = virtio_scsi_handle_cmd_req_prepare(s, req);
+                if (!ret) {
+                    QTAILQ_INSERT_TAIL(&reqs, req, next);
+                } else if (ret == -EINVAL) {
+                    break;
+                }
+            }
+            if (ret == -EINVAL) {
                 /* The device is broken and shouldn't process any request */
+                virtqueue_unpop_batch(vq, elems + i + 1, num - i - 1);
                 while (!QTAILQ_EMPTY(&reqs)) {
                     req = QTAILQ_FIRST(&reqs);
                     QTAILQ_REMOVE(&reqs, req, next);
@@ -910,6 +924,8 @@ void virtio_scsi_common_realize(DeviceState *dev,
 
     s->ctrl_vq = virtio_add_queue(vdev, s->conf.virtqueue_size, ctrl);
     s->event_vq = virtio_add_queue(vdev, s->conf.virtqueue_size, evt);
+    virtio_queue_set_control(s->ctrl_vq);
+    virtio_queue_set_control(s->event_vq);
     for (i = 0; i < s->conf.num_queues; i++) {
         s->cmd_vqs[i] = virtio_add_queue(vdev, s->conf.virtqueue_size, cmd);
     }
@@ -27,6 +27,7 @@
 #include "hw/virtio/virtio-access.h"
 #include "sysemu/dma.h"
 #include "sysemu/runstate.h"
+#include "hw/xen/xen.h"
 
 /*
  * The alignment to use between consumer and producer parts of vring.
@@ -122,6 +123,28 @@ struct VirtQueue
 
     unsigned int inuse;
 
+    /* Elements of virtqueue_pop_batch(), see virtqueue_arena_alloc() */
+    VirtQueueArena *arena;
+
+    /* Interrupt coalescing, see virtio_queue_coalesce() */
+    bool coalesce_control;
+    uint32_t coalesce_frames;
+    uint32_t coalesce_usecs;
+    /* Current values, lower than the above in adaptive mode */
+    uint32_t coalesce_cur_frames;
+    uint32_t coalesce_cur_usecs;
+    /* Used elements since the last interrupt */
+    unsigned int coalesce_count;
+    /* Used elements since @coalesce_window_start, for adaptive mode */
+    unsigned int coalesce_window_count;
+    int64_t coalesce_window_start;
+    /* An interrupt waits for @coalesce_timer */
+    bool coalesce_pending;
+    bool coalesce_irqfd;
+    QEMUTimer *coalesce_timer;
+    /* Where the timer runs, NULL for the main loop */
+    AioContext *coalesce_ctx;
+
     uint16_t vector;
     VirtIOHandleOutput handle_output;
     VirtIOHandleAIOOutput handle_aio_output;
@@ -737,7 +760,7 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
 {
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        virtqueue_packed_rewind(vq, 1);
+        virtqueue_packed_rewind(vq, elem->ndescs);
     } else {
         virtqueue_split_rewind(vq, 1);
     }
@@ -745,6 +768,24 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_detach_element(vq, elem, len);
 }
 
+/* virtqueue_unpop_batch:
+ * @vq: The #VirtQueue
+ * @elems: The last elements popped from @vq, in the order they were popped
+ * @num: number of elements
+ *
+ * Pretend the elements weren't popped from the virtqueue and free them with
+ * virtqueue_element_free().  This gives back the part of a
+ * virtqueue_pop_batch() that the device did not get to.
+ */
+void virtqueue_unpop_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                           unsigned int num)
+{
+    while (num--) {
+        virtqueue_unpop(vq, elems[num], 0);
+        virtqueue_element_free(elems[num]);
+    }
+}
+
 /* virtqueue_rewind:
  * @vq: The #VirtQueue
  * @num: Number of elements to push back
@@ -903,6 +944,9 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
         return;
     }
 
+    vq->coalesce_count += count;
+    vq->coalesce_window_count += count;
+
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         virtqueue_packed_flush(vq, count);
     } else {
@@ -918,6 +962,31 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+/* virtqueue_push_batch:
+ * @vq: The #VirtQueue
+ * @elems: The #VirtQueueElements to complete, in order
+ * @lens: number of bytes written to each element, or NULL if none
+ * @num: number of elements
+ *
+ * Like calling virtqueue_push() for each element, but the used ring index
+ * is only published once.  The caller still has to notify the guest.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int num)
+{
+    unsigned int i;
+
+    if (!num) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < num; i++) {
+        virtqueue_fill(vq, elems[i], lens ? lens[i] : 0, i);
+    }
+    virtqueue_flush(vq, num);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1293,10 +1362,67 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
+/*
+ * The guest RAM section that the last buffer of a virtqueue_pop_batch()
+ * was mapped from.  The buffers of a batch usually come from the same
+ * section, and most of them can then skip the walk of the flat view done
+ * by dma_memory_map().  Only valid within the RCU critical section of the
+ * batch; @fv is NULL if the cache cannot be used for the device.
+ */
+typedef struct VirtQueueMapCache {
+    FlatView *fv;
+    MemoryRegion *mr;
+    hwaddr addr;
+    hwaddr len;
+    hwaddr xlat;
+} VirtQueueMapCache;
+
+typedef struct VirtQueueBatch {
+    VirtQueueArena *arena;
+    VirtQueueMapCache map_cache;
+} VirtQueueBatch;
+
+/*
+ * Map @pa like dma_memory_map() would, or return NULL if it is not in
+ * directly accessible guest RAM.  The mapping is released by
+ * dma_memory_unmap() as usual.
+ */
+static void *virtqueue_map_cached(VirtQueueMapCache *cache, hwaddr pa,
+                                  hwaddr *plen, bool is_write)
+{
+    hwaddr ofs;
+
+    if (!cache->mr || pa < cache->addr || pa - cache->addr >= cache->len) {
+        MemoryRegion *mr;
+        hwaddr xlat, len = HWADDR_MAX - pa;
+
+        mr = flatview_translate(cache->fv, pa, &xlat, &len, is_write,
+                                MEMTXATTRS_UNSPECIFIED);
+        /* The length is only clamped to the section for RAM */
+        if (!memory_region_is_ram(mr) || memory_region_is_ram_device(mr)) {
+            return NULL;
+        }
+        cache->mr = mr;
+        cache->addr = pa;
+        cache->len = len;
+        cache->xlat = xlat;
+    }
+
+    if (!memory_access_is_direct(cache->mr, is_write)) {
+        return NULL;
+    }
+
+    ofs = pa - cache->addr;
+    *plen = MIN(*plen, cache->len - ofs);
+    memory_region_ref(cache->mr);
+    return qemu_map_ram_ptr(cache->mr->ram_block, cache->xlat + ofs);
+}
+
 static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
                                hwaddr *addr, struct iovec *iov,
                                unsigned int max_num_sg, bool is_write,
-                               hwaddr pa, size_t sz)
+                               hwaddr pa, size_t sz,
+                               VirtQueueMapCache *cache)
 {
     bool ok = false;
     unsigned num_sg = *p_num_sg;
@@ -1316,10 +1442,17 @@ static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
             goto out;
         }
 
-        iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
-                                              is_write ?
-                                              DMA_DIRECTION_FROM_DEVICE :
-                                              DMA_DIRECTION_TO_DEVICE);
+        iov[num_sg].iov_base = NULL;
+        if (cache && cache->fv) {
+            iov[num_sg].iov_base = virtqueue_map_cached(cache, pa, &len,
+                                                        is_write);
+        }
+        if (!iov[num_sg].iov_base) {
+            iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
+                                                  is_write ?
+                                                  DMA_DIRECTION_FROM_DEVICE :
+                                                  DMA_DIRECTION_TO_DEVICE);
+        }
         if (!iov[num_sg].iov_base) {
             virtio_error(vdev, "virtio: bogus descriptor or out of resources");
             goto out;
@@ -1406,10 +1539,152 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     elem->out_addr = (void *)elem + out_addr_ofs;
     elem->in_sg = (void *)elem + in_sg_ofs;
     elem->out_sg = (void *)elem + out_sg_ofs;
+    elem->arena = NULL;
+    return elem;
+}
+
+/* Number of preallocated elements of a virtqueue */
+#define VIRTQUEUE_ARENA_SLOTS 256
+/* Scatter-gather entries of a preallocated element */
+#define VIRTQUEUE_ARENA_SG 32
+
+/*
+ * A virtqueue keeps preallocated elements for virtqueue_pop_batch(), so
+ * that the hot path does not go through the allocator for each request.
+ * Slots are taken and given back from whatever thread processes the
+ * queue, and elements may outlive the virtqueue: the arena then goes away
+ * with the last of them.
+ */
+struct VirtQueueArena {
+    QemuSpin lock;
+    void *mem;
+    size_t elem_size;
+    size_t slot_size;
+    unsigned int nslots;
+    /* Protected by @lock */
+    bool orphaned;
+    unsigned int nfree;
+    unsigned int free_slots[];
+};
+
+static VirtQueueArena *virtqueue_arena_new(size_t sz, unsigned int nslots)
+{
+    VirtQueueArena *arena = g_malloc(sizeof(*arena) +
+                                     nslots * sizeof(arena->free_slots[0]));
+    unsigned int i;
+
+    qemu_spin_init(&arena->lock);
+    arena->elem_size = sz;
+    arena->slot_size = QEMU_ALIGN_UP(QEMU_ALIGN_UP(sz, sizeof(hwaddr)) +
+                                     VIRTQUEUE_ARENA_SG * sizeof(hwaddr) +
+                                     VIRTQUEUE_ARENA_SG * sizeof(struct iovec),
+                                     64);
+    arena->mem = qemu_memalign(64, nslots * arena->slot_size);
+    arena->nslots = nslots;
+    arena->orphaned = false;
+    arena->nfree = nslots;
+    /* Hand out the first slots first */
+    for (i = 0; i < nslots; i++) {
+        arena->free_slots[i] = nslots - 1 - i;
+    }
+    return arena;
+}
+
+static void virtqueue_arena_destroy(VirtQueueArena *arena)
+{
+    qemu_vfree(arena->mem);
+    g_free(arena);
+}
+
+/* Called when @vq goes away, possibly with some elements still in use.  */
+static void virtqueue_arena_release(VirtQueue *vq)
+{
+    VirtQueueArena *arena = vq->arena;
+    bool destroy;
+
+    if (!arena) {
+        return;
+    }
+    vq->arena = NULL;
+
+    qemu_spin_lock(&arena->lock);
+    arena->orphaned = true;
+    destroy = arena->nfree == arena->nslots;
+    qemu_spin_unlock(&arena->lock);
+
+    if (destroy) {
+        virtqueue_arena_destroy(arena);
+    }
+}
+
+/*
+ * Like virtqueue_alloc_element(), but take the element from @arena if
+ * it has a slot left that fits.
+ */
+static void *virtqueue_arena_alloc(VirtQueueArena *arena, size_t sz,
+                                   unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem;
+    hwaddr *addr;
+    struct iovec *sg;
+    unsigned int slot;
+
+    if (sz != arena->elem_size || out_num + in_num > VIRTQUEUE_ARENA_SG) {
+        return virtqueue_alloc_element(sz, out_num, in_num);
+    }
+
+    qemu_spin_lock(&arena->lock);
+    if (!arena->nfree) {
+        qemu_spin_unlock(&arena->lock);
+        return virtqueue_alloc_element(sz, out_num, in_num);
+    }
+    slot = arena->free_slots[--arena->nfree];
+    qemu_spin_unlock(&arena->lock);
+
+    elem = arena->mem + slot * arena->slot_size;
+    addr = (void *)elem + QEMU_ALIGN_UP(sz, sizeof(hwaddr));
+    sg = (void *)(addr + VIRTQUEUE_ARENA_SG);
+    trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    elem->out_num = out_num;
+    elem->in_num = in_num;
+    elem->in_addr = addr;
+    elem->out_addr = addr + in_num;
+    elem->in_sg = sg;
+    elem->out_sg = sg + in_num;
+    elem->arena = arena;
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/* virtqueue_element_free:
+ * @elem: The #VirtQueueElement
+ *
+ * Free an element returned by virtqueue_pop() or virtqueue_pop_batch(),
+ * once it has been pushed or detached.
+ */
+void virtqueue_element_free(VirtQueueElement *elem)
+{
+    VirtQueueArena *arena = elem->arena;
+    bool destroy;
+
+    if (!arena) {
+        g_free(elem);
+        return;
+    }
+
+    qemu_spin_lock(&arena->lock);
+    arena->free_slots[arena->nfree++] =
+        ((void *)elem - arena->mem) / arena->slot_size;
+    destroy = arena->orphaned && arena->nfree == arena->nslots;
+    qemu_spin_unlock(&arena->lock);
+
+    if (destroy) {
+        virtqueue_arena_destroy(arena);
+    }
+}
+
+/* Called within rcu_read_lock() if @batch is not NULL.  */
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz,
+                                 VirtQueueBatch *batch)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1446,7 +1721,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    /* virtqueue_pop_batch() does it once for the whole batch */
+    if (!batch && virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
@@ -1493,7 +1769,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
             map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len,
+                                        batch ? &batch->map_cache : NULL);
         } else {
             if (in_num) {
                 virtio_error(vdev, "Incorrect order for descriptors");
@@ -1501,7 +1778,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
             }
             map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len,
+                                        batch ? &batch->map_cache : NULL);
         }
         if (!map_ok) {
             goto err_undo_map;
@@ -1521,7 +1799,11 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (batch && batch->arena) {
+        elem = virtqueue_arena_alloc(batch->arena, sz, out_num, in_num);
+    } else {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    }
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1546,7 +1828,9 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+/* Called within rcu_read_lock() if @batch is not NULL.  */
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz,
+                                  VirtQueueBatch *batch)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1621,7 +1905,8 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
             map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len,
+                                        batch ? &batch->map_cache : NULL);
         } else {
             if (in_num) {
                 virtio_error(vdev, "Incorrect order for descriptors");
@@ -1629,7 +1914,8 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
             }
             map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len,
+                                        batch ? &batch->map_cache : NULL);
         }
         if (!map_ok) {
             goto err_undo_map;
@@ -1647,7 +1933,11 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (batch && batch->arena) {
+        elem = virtqueue_arena_alloc(batch->arena, sz, out_num, in_num);
+    } else {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    }
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1688,12 +1978,66 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        return virtqueue_packed_pop(vq, sz, NULL);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop(vq, sz, NULL);
     }
 }
 
+/* virtqueue_pop_batch:
+ * @vq: The #VirtQueue
+ * @sz: size of the structures that embed the elements, as for virtqueue_pop()
+ * @elems: array that receives the elements
+ * @max: maximum number of elements to pop
+ *
+ * Pop up to @max elements at once.  The elements are usually taken from
+ * memory that the virtqueue keeps around, and must be released with
+ * virtqueue_element_free() rather than g_free(), in the thread that
+ * processes the virtqueue.
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz,
+                                 VirtQueueElement **elems, unsigned int max)
+{
+    VirtIODevice *vdev = vq->vdev;
+    VirtQueueBatch batch = {};
+    bool packed = virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED);
+    unsigned int n;
+
+    if (virtio_device_disabled(vdev) || !vq->vring.num) {
+        return 0;
+    }
+
+    if (!vq->arena) {
+        vq->arena = virtqueue_arena_new(sz, MIN(vq->vring.num,
+                                                VIRTQUEUE_ARENA_SLOTS));
+    }
+    batch.arena = vq->arena;
+
+    RCU_READ_LOCK_GUARD();
+    /* With an IOMMU or Xen, leave the translation to dma_memory_map() */
+    if (vdev->dma_as == &address_space_memory && !xen_enabled()) {
+        batch.map_cache.fv = address_space_to_flatview(vdev->dma_as);
+    }
+
+    for (n = 0; n < max; n++) {
+        elems[n] = packed ? virtqueue_packed_pop(vq, sz, &batch)
+                          : virtqueue_split_pop(vq, sz, &batch);
+        if (!elems[n]) {
+            break;
+        }
+    }
+
+    if (n && !packed &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    trace_virtqueue_pop_batch(vq, n, max);
+    return n;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -1980,6 +2324,35 @@ static enum virtio_device_endian virtio_current_cpu_endian(void)
     }
 }
 
+static void virtio_queue_coalesce_reset(VirtQueue *vq)
+{
+    VirtIODevice *vdev = vq->vdev;
+
+    if (vq->coalesce_timer) {
+        timer_del(vq->coalesce_timer);
+    }
+    vq->coalesce_pending = false;
+    vq->coalesce_count = 0;
+    vq->coalesce_window_count = 0;
+    vq->coalesce_window_start = 0;
+    if (vq->coalesce_control) {
+        virtio_queue_set_coalesce(vq, 0, 0);
+    } else {
+        virtio_queue_set_coalesce(vq, vdev->coalesce_frames,
+                                  vdev->coalesce_usecs);
+    }
+}
+
+static void virtio_queue_coalesce_cleanup(VirtQueue *vq)
+{
+    if (vq->coalesce_timer) {
+        timer_del(vq->coalesce_timer);
+        timer_free(vq->coalesce_timer);
+        vq->coalesce_timer = NULL;
+    }
+    vq->coalesce_pending = false;
+}
+
 void virtio_reset(void *opaque)
 {
     VirtIODevice *vdev = opaque;
@@ -2027,6 +2400,7 @@ void virtio_reset(void *opaque)
         vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
         vdev->vq[i].inuse = 0;
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
+        virtio_queue_coalesce_reset(&vdev->vq[i]);
     }
 }
 
@@ -2412,6 +2786,7 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].handle_aio_output = NULL;
     vdev->vq[i].used_elems = g_malloc0(sizeof(VirtQueueElement) *
                                        queue_size);
+    virtio_queue_coalesce_reset(&vdev->vq[i]);
 
     return &vdev->vq[i];
 }
@@ -2425,6 +2800,9 @@ void virtio_delete_queue(VirtQueue *vq)
     g_free(vq->used_elems);
     vq->used_elems = NULL;
     virtio_virtqueue_reset_region_cache(vq);
+    virtqueue_arena_release(vq);
+    virtio_queue_coalesce_cleanup(vq);
+    vq->coalesce_control = false;
 }
 
 void virtio_del_queue(VirtIODevice *vdev, int n)
@@ -2448,6 +2826,184 @@ static void virtio_set_isr(VirtIODevice *vdev, int value)
     }
 }
 
+/*
+ * Adaptive mode scales the coalescing of a virtqueue with the rate of used
+ * elements, measured over windows of at least VIRTIO_COALESCE_WINDOW_NS:
+ * none up to VIRTIO_COALESCE_RATE_LOW elements per second, and the
+ * configured maximum from VIRTIO_COALESCE_RATE_HIGH.
+ */
+#define VIRTIO_COALESCE_WINDOW_NS   (10 * SCALE_MS)
+#define VIRTIO_COALESCE_RATE_LOW    10000
+#define VIRTIO_COALESCE_RATE_HIGH   200000
+
+static void virtio_queue_coalesce_tune(VirtQueue *vq, int64_t now)
+{
+    int64_t elapsed = now - vq->coalesce_window_start;
+    uint64_t rate, scale;
+
+    if (elapsed < VIRTIO_COALESCE_WINDOW_NS) {
+        return;
+    }
+
+    rate = (uint64_t)vq->coalesce_window_count * NANOSECONDS_PER_SECOND /
+           elapsed;
+    if (rate <= VIRTIO_COALESCE_RATE_LOW) {
+        scale = 0;
+    } else if (rate >= VIRTIO_COALESCE_RATE_HIGH) {
+        scale = 256;
+    } else {
+        scale = (rate - VIRTIO_COALESCE_RATE_LOW) * 256 /
+                (VIRTIO_COALESCE_RATE_HIGH - VIRTIO_COALESCE_RATE_LOW);
+    }
+
+    vq->coalesce_cur_frames = vq->coalesce_frames ?
+        MAX(vq->coalesce_frames * scale / 256, 1) : 0;
+    vq->coalesce_cur_usecs = vq->coalesce_usecs * scale / 256;
+    vq->coalesce_window_start = now;
+    vq->coalesce_window_count = 0;
+    trace_virtio_queue_coalesce_tune(vq, rate, vq->coalesce_cur_frames,
+                                     vq->coalesce_cur_usecs);
+}
+
+/* Send the interrupt that virtio_queue_coalesce() held back.  */
+static void virtio_queue_coalesce_fire(VirtQueue *vq)
+{
+    vq->coalesce_pending = false;
+    vq->coalesce_count = 0;
+
+    if (vq->coalesce_irqfd) {
+        trace_virtio_notify_irqfd(vq->vdev, vq);
+        virtio_set_isr(vq->vdev, 0x1);
+        event_notifier_set(&vq->guest_notifier);
+    } else {
+        trace_virtio_notify(vq->vdev, vq);
+        virtio_set_isr(vq->vdev, 0x1);
+        virtio_notify_vector(vq->vdev, vq->vector);
+    }
+}
+
+static void virtio_queue_coalesce_timer(void *opaque)
+{
+    VirtQueue *vq = opaque;
+
+    if (vq->coalesce_pending) {
+        virtio_queue_coalesce_fire(vq);
+    }
+}
+
+/*
+ * Called when @vq should interrupt the guest.  Return true if the
+ * interrupt is held back until the current max-usecs have passed or
+ * max-frames elements have been used, whichever comes first.
+ */
+static bool virtio_queue_coalesce(VirtQueue *vq, bool irqfd)
+{
+    uint32_t frames, usecs;
+    int64_t now;
+
+    if (!vq->coalesce_usecs) {
+        return false;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    if (vq->vdev->coalesce_adaptive) {
+        virtio_queue_coalesce_tune(vq, now);
+    }
+    frames = vq->coalesce_cur_frames;
+    usecs = vq->coalesce_cur_usecs;
+
+    if (!usecs || frames == 1 || (frames && vq->coalesce_count >= frames)) {
+        if (vq->coalesce_pending) {
+            timer_del(vq->coalesce_timer);
+            vq->coalesce_pending = false;
+        }
+        vq->coalesce_count = 0;
+        return false;
+    }
+
+    vq->coalesce_irqfd = irqfd;
+    if (!vq->coalesce_pending) {
+        if (!vq->coalesce_timer) {
+            vq->coalesce_timer = aio_timer_new(vq->coalesce_ctx ?:
+                                               qemu_get_aio_context(),
+                                               QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                               virtio_queue_coalesce_timer,
+                                               vq);
+        }
+        timer_mod(vq->coalesce_timer, now + (int64_t)usecs * SCALE_US);
+        vq->coalesce_pending = true;
+    }
+    trace_virtio_queue_coalesce(vq, vq->coalesce_count, frames, usecs);
+    return true;
+}
+
+/*
+ * The coalescing timer of @vq runs where the virtqueue is processed.
+ * Called from there before @vq moves to another AioContext, or to the
+ * main loop if @ctx is NULL.
+ */
+static void virtio_queue_coalesce_set_context(VirtQueue *vq, AioContext *ctx)
+{
+    if (vq->coalesce_timer) {
+        timer_del(vq->coalesce_timer);
+        timer_free(vq->coalesce_timer);
+        vq->coalesce_timer = NULL;
+    }
+    if (vq->coalesce_pending) {
+        virtio_queue_coalesce_fire(vq);
+    }
+    vq->coalesce_ctx = ctx;
+}
+
+/* virtio_queue_set_coalesce:
+ * @vq: The #VirtQueue
+ * @max_frames: used elements after which the guest is interrupted, or 0
+ * @max_usecs: time for which an interrupt may be held back
+ *
+ * Coalesce the interrupts of @vq like ethtool -C does for NICs.  A
+ * @max_usecs of 0 or a @max_frames of 1 turns coalescing off.  With the
+ * coalesce-adaptive property of the device, these are the values used at
+ * high rates, and less coalescing happens at lower ones.
+ */
+void virtio_queue_set_coalesce(VirtQueue *vq, uint32_t max_frames,
+                               uint32_t max_usecs)
+{
+    bool adaptive = vq->vdev->coalesce_adaptive;
+
+    vq->coalesce_frames = max_frames;
+    vq->coalesce_usecs = max_usecs;
+    vq->coalesce_cur_frames = adaptive ? 0 : max_frames;
+    vq->coalesce_cur_usecs = adaptive ? 0 : max_usecs;
+}
+
+/* virtio_queue_set_control:
+ * @vq: The #VirtQueue
+ *
+ * Mark @vq as a control or event queue.  The coalesce-* properties of the
+ * device only apply to its data queues; interrupts of @vq are never held
+ * back unless the device calls virtio_queue_set_coalesce() itself.
+ */
+void virtio_queue_set_control(VirtQueue *vq)
+{
+    vq->coalesce_control = true;
+    virtio_queue_set_coalesce(vq, 0, 0);
+}
+
+/* Send the interrupts held back in the main loop.  */
+static void virtio_device_coalesce_flush(VirtIODevice *vdev)
+{
+    int i;
+
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        VirtQueue *vq = &vdev->vq[i];
+
+        if (vq->coalesce_pending && !vq->coalesce_ctx) {
+            timer_del(vq->coalesce_timer);
+            virtio_queue_coalesce_fire(vq);
+        }
+    }
+}
+
 static bool virtio_split_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     uint16_t old, new;
@@ -2531,6 +3087,10 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
         }
     }
 
+    if (virtio_queue_coalesce(vq, true)) {
+        return;
+    }
+
     trace_virtio_notify_irqfd(vdev, vq);
 
     /*
@@ -2566,6 +3126,10 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
         }
     }
 
+    if (virtio_queue_coalesce(vq, false)) {
+        return;
+    }
+
     trace_virtio_notify(vdev, vq);
     virtio_irq(vq);
 }
@@ -3223,6 +3787,14 @@ static void virtio_vmstate_change(void *opaque, int running, RunState state)
     if (!backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
+
+    /*
+     * Interrupts that are still held back would be lost by migration.  By
+     * now, virtqueues processed in an IOThread are back in the main loop.
+     */
+    if (!running) {
+        virtio_device_coalesce_flush(vdev);
+    }
 }
 
 void virtio_instance_init_common(Object *proxy_obj, void *data,
@@ -3520,6 +4092,7 @@ void virtio_queue_aio_set_host_notifier_handler(VirtQueue *vq, AioContext *ctx,
                                                 VirtIOHandleAIOOutput handle_output)
 {
     if (handle_output) {
+        virtio_queue_coalesce_set_context(vq, ctx);
         vq->handle_aio_output = handle_output;
         aio_set_event_notifier(ctx, &vq->host_notifier, true,
                                virtio_queue_host_notifier_aio_read,
@@ -3533,6 +4106,7 @@ void virtio_queue_aio_set_host_notifier_handler(VirtQueue *vq, AioContext *ctx,
          * in case poll callback didn't have time to run. */
         virtio_queue_host_notifier_aio_read(&vq->host_notifier);
         vq->handle_aio_output = NULL;
+        virtio_queue_coalesce_set_context(vq, NULL);
     }
 }
 
@@ -3657,6 +4231,8 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
             break;
         }
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
+        virtqueue_arena_release(&vdev->vq[i]);
+        virtio_queue_coalesce_cleanup(&vdev->vq[i]);
     }
     g_free(vdev->vq);
 }
@@ -3676,10 +4252,14 @@ static Property virtio_properties[] = {
     DEFINE_VIRTIO_COMMON_FEATURES(VirtIODevice, host_features),
     DEFINE_PROP_BOOL("use-started", VirtIODevice, use_started, true),
     DEFINE_PROP_BOOL("use-disabled-flag", VirtIODevice, use_disabled_flag, true),
+    DEFINE_PROP_UINT32("coalesce-frames", VirtIODevice, coalesce_frames, 0),
+    DEFINE_PROP_UINT32("coalesce-usecs", VirtIODevice, coalesce_usecs, 0),
+    DEFINE_PROP_BOOL("coalesce-adaptive", VirtIODevice, coalesce_adaptive,
+                     false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -3741,7 +4321,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
@@ -79,8 +79,18 @@ typedef uint64_t target_ulong;
 
 #if !defined(CONFIG_USER_ONLY) && defined(CONFIG_TCG)
 
-/* use a fully associative victim tlb of 8 entries */
-#define CPU_VTLB_SIZE 8
+/*
+ * The victim tlb is set associative, with CPU_VTLB_WAYS entries per set.
+ * Its size in entries can be changed with -accel tcg,victim-tlb-size=n
+ * and is a power of two between CPU_VTLB_MIN_SIZE and CPU_VTLB_MAX_SIZE.
+ */
+#define CPU_VTLB_WAYS 4
+#define CPU_VTLB_MIN_SIZE 8
+#define CPU_VTLB_MAX_SIZE 4096
+#define CPU_VTLB_DEFAULT_SIZE 128
+
+/* Number of large pages tracked individually per MMU mode */
+#define CPU_TLB_LARGE_PAGES 16
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -148,29 +158,55 @@ typedef struct CPUIOTLBEntry {
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
+/*
+ * A page larger than TARGET_PAGE_SIZE, with entries in the tlb.
+ * The page is matched if (addr & mask) == vaddr; both are -1 if unused.
+ */
+typedef struct CPUTLBLargePage {
+    target_ulong vaddr;
+    target_ulong mask;
+    /*
+     * For a page that is mapped linearly, the physical address of its
+     * first byte and the attributes and permissions of the whole page.
+     * paddr is -1 otherwise.
+     */
+    hwaddr paddr;
+    MemTxAttrs attrs;
+    int prot;
+} CPUTLBLargePage;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
  */
 typedef struct CPUTLBDesc {
     /*
-     * Describe a region covering all of the large pages allocated
-     * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
+     * Describe a region covering the large pages that no longer fit
+     * in lpages.  When any page within this region is flushed, we must
+     * flush the entire tlb.  The region is matched if
      * (addr & large_page_mask) == large_page_addr.
      */
     target_ulong large_page_addr;
     target_ulong large_page_mask;
+    /* The large pages allocated into the tlb.  */
+    CPUTLBLargePage lpages[CPU_TLB_LARGE_PAGES];
+    /* The next entry of lpages to replace when it is full.  */
+    size_t lpage_next;
     /* host time (in ns) at the beginning of the time window */
     int64_t window_begin_ns;
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
+    /* The next way to replace in a full set of the tlb victim table.  */
     size_t vindex;
-    /* The tlb victim table, in two parts.  */
-    CPUTLBEntry vtable[CPU_VTLB_SIZE];
-    CPUIOTLBEntry viotlb[CPU_VTLB_SIZE];
+    /* Number of sets in the tlb victim table, minus one.  */
+    size_t vmask;
+    /*
+     * The tlb victim table, in two parts.  Set S is made of the
+     * CPU_VTLB_WAYS entries starting at S * CPU_VTLB_WAYS.
+     */
+    CPUTLBEntry *vtable;
+    CPUIOTLBEntry *viotlb;
     /* The iotlb.  */
     CPUIOTLBEntry *iotlb;
 } CPUTLBDesc;
@@ -206,6 +242,11 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /* Lookups that missed the main table, and whether the victim hit.  */
+    size_t victim_hit_count;
+    size_t victim_miss_count;
+    /* Misses filled from a large page, without calling tlb_fill.  */
+    size_t large_page_fill_count;
 } CPUTLBCommon;
 
 /*
@@ -231,12 +272,38 @@ typedef struct CPUTLB { } CPUTLB;
 
 #endif  /* !CONFIG_USER_ONLY && CONFIG_TCG */
 
+#if defined(CONFIG_USER_ONLY) && defined(CONFIG_TCG)
+
+/*
+ * Return address prediction stack, used by the generated code for
+ * call/return pairs.  Each entry is the TB that made a call; the
+ * TB_JMP_RET inline cache of that TB predicts where the call returns.
+ * The stack wraps around, and entries are checked before being trusted.
+ */
+#define CPU_RAS_SIZE 16
+
+typedef struct CPUReturnStack {
+    uintptr_t tb[CPU_RAS_SIZE];
+    uint32_t top;
+} CPUReturnStack;
+
+/* This will be used by tcg_gen_push_return() to compute offsets.  */
+#define CPU_RAS_OFS(FIELD) \
+    ((int)offsetof(ArchCPU, neg.ras.FIELD) - (int)offsetof(ArchCPU, env))
+
+#else
+
+typedef struct CPUReturnStack { } CPUReturnStack;
+
+#endif  /* CONFIG_USER_ONLY && CONFIG_TCG */
+
 /*
  * This structure must be placed in ArchCPU immediately
  * before CPUArchState, as a field named "neg".
  */
 typedef struct CPUNegativeOffsetState {
     CPUTLB tlb;
+    CPUReturnStack ras;
     IcountDecr icount_decr;
 } CPUNegativeOffsetState;
 
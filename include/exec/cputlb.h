@@ -27,5 +27,10 @@
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code(ram_addr_t ram_addr);
 void tlb_flush_counts(size_t *full, size_t *part, size_t *elide);
+void tlb_victim_counts(size_t *hits, size_t *misses);
+size_t tlb_large_page_fill_count(void);
+
+/* Number of entries in the victim tlb of each mmu_idx */
+extern unsigned int cpu_vtlb_size;
 #endif
 #endif
@@ -70,6 +70,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags,
                               int cflags);
+TranslationBlock *tb_gen_code_prefetch(CPUState *cpu,
+                                       target_ulong pc, target_ulong cs_base,
+                                       uint32_t flags, int cflags);
+void tb_tier_up(CPUState *cpu, TranslationBlock *tb);
 
 void QEMU_NORETURN cpu_loop_exit(CPUState *cpu);
 void QEMU_NORETURN cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc);
@@ -271,6 +275,18 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu, uint16_t idxmap);
 void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
                              hwaddr paddr, MemTxAttrs attrs,
                              int prot, int mmu_idx, target_ulong size);
+/**
+ * tlb_set_large_page_with_attrs:
+ *
+ * This function is equivalent to tlb_set_page_with_attrs(), for a page
+ * of @size bytes that is mapped linearly to physical memory, with the
+ * same @attrs and @prot throughout.  Later misses on other addresses of
+ * the page are then filled without calling the tlb_fill() hook, until
+ * the page is flushed from the TLB.
+ */
+void tlb_set_large_page_with_attrs(CPUState *cpu, target_ulong vaddr,
+                                   hwaddr paddr, MemTxAttrs attrs,
+                                   int prot, int mmu_idx, target_ulong size);
 /* tlb_set_page:
  *
  * This function is equivalent to calling tlb_set_page_with_attrs()
@@ -408,6 +424,11 @@ struct tb_tc {
     size_t size;
 };
 
+/* Outgoing jumps of a TB: two direct jumps, then the inline caches */
+#define TB_JMP_IC      2
+#define TB_JMP_RET     3
+#define TB_JMP_SLOTS   4
+
 struct TranslationBlock {
     target_ulong pc;   /* simulated PC corresponding to this block (EIP + CS base) */
     target_ulong cs_base; /* CS base for this block */
@@ -422,15 +443,28 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_TIER1       0x00100000 /* Superblock retranslated from a hot TB */
+#define CF_PROFILE     0x00200000 /* Instrumented for the TCG profiler */
 #define CF_CLUSTER_MASK 0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 /* cflags' mask for hashing/comparison */
 #define CF_HASH_MASK   \
-    (CF_COUNT_MASK | CF_LAST_IO | CF_USE_ICOUNT | CF_PARALLEL | CF_CLUSTER_MASK)
+    (CF_COUNT_MASK | CF_LAST_IO | CF_USE_ICOUNT | CF_PARALLEL | \
+     CF_PROFILE | CF_CLUSTER_MASK)
 
     /* Per-vCPU dynamic tracing state used to generate this TB */
     uint32_t trace_vcpu_dstate;
 
+    /*
+     * Executions left before the TB is retranslated with CF_TIER1.
+     * Decremented by the generated code without any locking, so it is
+     * only approximate when several vCPUs run the TB.
+     */
+    int32_t tier_count;
+
+    /* Executions counted by CF_PROFILE code, also without any locking */
+    uint64_t exec_count;
+
     struct tb_tc tc;
 
     /* original tb when cflags has CF_NOCACHE */
@@ -454,13 +488,28 @@ struct TranslationBlock {
     uint16_t jmp_reset_offset[2]; /* offset of original jump target */
 #define TB_JMP_RESET_OFFSET_INVALID 0xffff /* indicates no jump generated */
     uintptr_t jmp_target_arg[2];  /* target address or offset */
+    /* guest PC of the direct jumps, or -1; see translator_set_successor() */
+    target_ulong jmp_pc[2];
+    /* guest PC after the TB if it ended only because of its size, or -1 */
+    target_ulong next_pc;
+
+    /*
+     * Inline caches of the indirect jumps and of the returns of this TB,
+     * see tcg_gen_lookup_and_goto_ic() and tcg_gen_push_return().  They
+     * hold the last destination TB and are read by the generated code
+     * without locking; they are linked like the two direct jumps above,
+     * as outgoing jumps TB_JMP_IC and TB_JMP_RET, and cleared whenever
+     * that link is broken.
+     */
+    struct TranslationBlock *jmp_ic[2];
 
     /*
      * Each TB has a NULL-terminated list (jmp_list_head) of incoming jumps.
-     * Each TB can have two outgoing jumps, and therefore can participate
-     * in two lists. The list entries are kept in jmp_list_next[2]. The least
-     * significant bit (LSB) of the pointers in these lists is used to encode
-     * which of the two list entries is to be used in the pointed TB.
+     * Each TB can have TB_JMP_SLOTS outgoing jumps, and therefore can
+     * participate in as many lists. The list entries are kept in
+     * jmp_list_next[]. The two least significant bits of the pointers in
+     * these lists are used to encode which of the list entries is to be used
+     * in the pointed TB.
      *
      * List traversals are protected by jmp_lock. The destination TB of each
      * outgoing jump is kept in jmp_dest[] so that the appropriate jmp_lock
@@ -473,11 +522,16 @@ struct TranslationBlock {
      * to a destination TB that has CF_INVALID set.
      */
     uintptr_t jmp_list_head;
-    uintptr_t jmp_list_next[2];
-    uintptr_t jmp_dest[2];
+    uintptr_t jmp_list_next[TB_JMP_SLOTS];
+    uintptr_t jmp_dest[TB_JMP_SLOTS];
 };
 
 extern bool parallel_cpus;
+/* Executions after which a TB is retranslated as a superblock, 0 = never */
+extern unsigned int tb_tier_threshold;
+void tb_tier_set_threshold(unsigned int threshold);
+/* Whether the TCG profiler is running, see accel/tcg/tcg-prof.c */
+extern bool tcg_prof_enabled;
 
 /* Hide the atomic_read to make code a little easier on the eyes */
 static inline uint32_t tb_cflags(const TranslationBlock *tb)
@@ -489,7 +543,16 @@ static inline uint32_t tb_cflags(const TranslationBlock *tb)
 static inline uint32_t curr_cflags(void)
 {
     return (parallel_cpus ? CF_PARALLEL : 0)
-         | (use_icount ? CF_USE_ICOUNT : 0);
+         | (use_icount ? CF_USE_ICOUNT : 0)
+         | (tcg_prof_enabled ? CF_PROFILE : 0);
+}
+
+/* Record what @cpu is doing, for the TCG profiler's sampler */
+static inline void tcg_prof_set_state(CPUState *cpu, TCGProfState state)
+{
+    if (unlikely(tcg_prof_enabled)) {
+        atomic_set(&cpu->tcg_prof.state, state);
+    }
 }
 
 /* TranslationBlock invalidate API */
@@ -500,12 +563,38 @@ void tb_invalidate_phys_range(target_ulong start, target_ulong end);
 void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr, MemTxAttrs attrs);
 #endif
 void tb_flush(CPUState *cpu);
+void tb_evict(CPUState *cpu);
+void tb_set_jmp_ic(TranslationBlock *tb, int n, TranslationBlock *tb_next);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags,
                                    uint32_t cf_mask);
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr);
 
+/* perf.c */
+#ifdef CONFIG_POSIX
+void perf_enable_perfmap(void);
+void perf_enable_jitdump(void);
+bool perf_enabled(void);
+void perf_report_prologue(const void *start, size_t size);
+void perf_report_code(const TranslationBlock *tb);
+void perf_exit(void);
+#else
+static inline bool perf_enabled(void)
+{
+    return false;
+}
+static inline void perf_report_prologue(const void *start, size_t size)
+{
+}
+static inline void perf_report_code(const TranslationBlock *tb)
+{
+}
+static inline void perf_exit(void)
+{
+}
+#endif
+
 /* GETPC is the true target of the return instruction that we'll execute.  */
 #if defined(CONFIG_TCG_INTERPRETER)
 extern uintptr_t tci_tb_ptr;
@@ -551,6 +640,25 @@ struct MemoryRegionSection *iotlb_to_section(CPUState *cpu,
 void mmap_lock(void);
 void mmap_unlock(void);
 bool have_mmap_lock(void);
+bool mmap_defer_host_prot(target_ulong start, target_ulong end);
+
+/* tb-persist.c */
+void tb_persist_init(const char *dir, const char *cpu_model);
+void tb_persist_map(target_ulong start, target_ulong len, int fd,
+                    off_t offset);
+void tb_persist_unmap(target_ulong start, target_ulong len);
+void tb_persist_flush(void);
+bool tb_persist_restore(CPUState *cpu, TranslationBlock *tb, int max_insns);
+void tb_persist_record(CPUState *cpu, TranslationBlock *tb);
+
+/* tb-prefetch.c */
+void tb_prefetch_init(unsigned int threads);
+void tb_prefetch_successors(CPUState *cpu, TranslationBlock *tb);
+void tb_prefetch_cpu_exit(CPUState *cpu);
+void tb_prefetch_pause(void);
+void tb_prefetch_resume(void);
+void tb_prefetch_fork_start(void);
+void tb_prefetch_fork_end(int child);
 
 /**
  * get_page_addr_code() - user-mode version
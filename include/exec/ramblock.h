@@ -59,6 +59,16 @@ struct RAMBlock {
      */
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
+
+    /*
+     * With the mapped-ram migration capability, every page of the block
+     * has a fixed slot at pages_offset in the migration file, and
+     * file_bmap records which slots hold valid (non-zero) data.  The
+     * bitmap itself is stored at bitmap_offset.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    off_t pages_offset;
 };
 #endif
 #endif
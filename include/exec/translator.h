@@ -63,6 +63,7 @@ typedef enum DisasJumpType {
  * @num_insns: Number of translated instructions (including current).
  * @max_insns: Maximum number of instructions to be translated in this TB.
  * @singlestep_enabled: "Hardware" single stepping enabled.
+ * @superblock: The TB is a superblock (CF_TIER1), see translator_follow_jump.
  *
  * Architecture-agnostic disassembly context.
  */
@@ -74,6 +75,7 @@ typedef struct DisasContextBase {
     int num_insns;
     int max_insns;
     bool singlestep_enabled;
+    bool superblock;
 } DisasContextBase;
 
 /**
@@ -145,6 +147,39 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
 void translator_loop_temp_check(DisasContextBase *db);
 
+/**
+ * translator_follow_jump:
+ * @db: Disassembly context.
+ * @dest: Address execution continues at after the current instruction.
+ *
+ * Return true if the translation of a superblock may go on at @dest,
+ * instead of ending the TB with a jump there.  The target then sets
+ * db->pc_next to @dest and keeps db->is_jmp at DISAS_NEXT.
+ *
+ * @dest must not be before the end of the current instruction: only
+ * forward jumps within the page of db->pc_first are followed, so that
+ * [pc_first, pc_next) still covers every instruction in the TB and
+ * writes to any of them invalidate it.
+ */
+bool translator_follow_jump(DisasContextBase *db, target_ulong dest);
+
+/**
+ * translator_set_successor:
+ * @db: Disassembly context.
+ * @n: Index of the direct jump, as passed to tcg_gen_goto_tb().
+ * @dest: Address the jump goes to.
+ *
+ * Record @dest as a statically known successor of the TB, so that it
+ * can be translated ahead of time (see accel/tcg/tb-prefetch.c).  Call
+ * this from the target's gen_goto_tb(), whether or not the jump can be
+ * chained.
+ */
+static inline void translator_set_successor(DisasContextBase *db, int n,
+                                            target_ulong dest)
+{
+    db->tb->jmp_pc[n] = dest;
+}
+
 /*
  * Translator Load Functions
  *
@@ -338,6 +338,15 @@ float32 float32_add(float32, float32, float_status *status);
 float32 float32_sub(float32, float32, float_status *status);
 float32 float32_mul(float32, float32, float_status *status);
 float32 float32_div(float32, float32, float_status *status);
+/* Element-wise on n values; d may be a or b but must not partially overlap */
+void float32_add_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *status);
+void float32_sub_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *status);
+void float32_mul_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *status);
+void float32_div_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+                   float_status *status);
 float32 float32_rem(float32, float32, float_status *status);
 float32 float32_muladd(float32, float32, float32, int, float_status *status);
 float32 float32_sqrt(float32, float_status *status);
@@ -528,6 +537,15 @@ float64 float64_add(float64, float64, float_status *status);
 float64 float64_sub(float64, float64, float_status *status);
 float64 float64_mul(float64, float64, float_status *status);
 float64 float64_div(float64, float64, float_status *status);
+/* Element-wise on n values; d may be a or b but must not partially overlap */
+void float64_add_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *status);
+void float64_sub_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *status);
+void float64_mul_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *status);
+void float64_div_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+                   float_status *status);
 float64 float64_rem(float64, float64, float_status *status);
 float64 float64_muladd(float64, float64, float64, int, float_status *status);
 float64 float64_sqrt(float64, float_status *status);
@@ -292,6 +292,35 @@ struct qemu_work_item;
 #define CPU_UNSET_NUMA_NODE_ID -1
 #define CPU_TRACE_DSTATE_MAX_EVENTS 32
 
+/* What a vCPU is doing, as sampled by the TCG profiler */
+typedef enum TCGProfState {
+    TCG_PROF_IDLE,          /* outside cpu_exec() */
+    TCG_PROF_RUNTIME,       /* in cpu_exec(), outside generated code */
+    TCG_PROF_CODE,          /* generated code */
+    TCG_PROF_HELPER,        /* helper called from generated code */
+    TCG_PROF_TLB_FILL,      /* softmmu TLB refill */
+    TCG_PROF_TRANSLATE,     /* tb_gen_code() */
+    TCG_PROF_NB_STATES,
+} TCGProfState;
+
+/**
+ * CPUTCGProf:
+ * @state: current #TCGProfState, written by the vCPU thread.
+ * @samples: number of times each state was sampled, written by the
+ *   sampler thread.
+ *
+ * The other counters are written by the vCPU thread only.
+ */
+typedef struct CPUTCGProf {
+    int state;
+    uint64_t samples[TCG_PROF_NB_STATES];
+    uint64_t tb_entries;
+    uint64_t translations;
+    uint64_t translate_ns;
+    uint64_t tlb_fills;
+    uint64_t tlb_victim_hits;
+} CPUTCGProf;
+
 /**
  * CPUState:
  * @cpu_index: CPU index (informative).
@@ -337,6 +366,7 @@ struct qemu_work_item;
  *                        to @trace_dstate).
  * @trace_dstate: Dynamic tracing state of events for this vCPU (bitmask).
  * @plugin_mask: Plugin event bitmap. Modified only via async work.
+ * @tcg_prof: TCG profiler state and counters, see accel/tcg/tcg-prof.c.
  * @ignore_memory_transaction_failures: Cached copy of the MachineState
  *    flag of the same name: allows the board to suppress calling of the
  *    CPU do_transaction_failed hook function.
@@ -419,6 +449,8 @@ struct CPUState {
 
     GArray *plugin_mem_cbs;
 
+    CPUTCGProf tcg_prof;
+
     /* TODO Move common fields from CPUArchState here. */
     int cpu_index;
     int cluster_index;
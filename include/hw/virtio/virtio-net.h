@@ -19,6 +19,30 @@
 #include "hw/virtio/virtio.h"
 #include "net/announce.h"
 #include "qemu/option_int.h"
+#include "qemu/seqlock.h"
+#include "sysemu/iothread.h"
+
+/*
+ * Notification coalescing, as defined by Linux 6.0.  The imported headers
+ * predate it; drop this once scripts/update-linux-headers.sh brings it in.
+ */
+#ifndef VIRTIO_NET_F_NOTF_COAL
+#define VIRTIO_NET_F_NOTF_COAL 53
+
+#define VIRTIO_NET_CTRL_NOTF_COAL 6
+#define VIRTIO_NET_CTRL_NOTF_COAL_TX_SET 0
+#define VIRTIO_NET_CTRL_NOTF_COAL_RX_SET 1
+
+struct virtio_net_ctrl_coal_tx {
+    uint32_t tx_max_packets;
+    uint32_t tx_usecs;
+};
+
+struct virtio_net_ctrl_coal_rx {
+    uint32_t rx_max_packets;
+    uint32_t rx_usecs;
+};
+#endif
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 #define VIRTIO_NET(obj) \
@@ -136,8 +160,36 @@ typedef struct VirtIONetQueue {
         VirtQueueElement *elem;
     } async_tx;
     struct VirtIONet *n;
+    /* Context of the iothread that processes the queue pair, if any */
+    AioContext *ctx;
 } VirtIONetQueue;
 
+/* Receive-side scaling, as configured by the driver */
+#define VIRTIO_NET_RSS_MAX_KEY_SIZE     40
+#define VIRTIO_NET_RSS_MAX_TABLE_LEN    128
+#define VIRTIO_NET_RSS_SUPPORTED_HASHES (VIRTIO_NET_RSS_HASH_TYPE_IPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_TCPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_UDPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_IPv6 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_TCPv6 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_UDPv6 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_IP_EX | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_TCP_EX | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_UDP_EX)
+
+typedef struct VirtioNetRssData {
+    bool enabled;
+    /* Steer packets to the queue the indirection table selects */
+    bool redirect;
+    /* Report the hash in struct virtio_net_hdr_v1_hash */
+    bool populate_hash;
+    uint32_t hash_types;
+    uint8_t key[VIRTIO_NET_RSS_MAX_KEY_SIZE];
+    uint16_t indirections_len;
+    uint16_t indirections_table[VIRTIO_NET_RSS_MAX_TABLE_LEN];
+    uint16_t default_queue;
+} VirtioNetRssData;
+
 struct VirtIONet {
     VirtIODevice parent_obj;
     uint8_t mac[ETH_ALEN];
@@ -174,6 +226,8 @@ struct VirtIONet {
         uint8_t *macs;
     } mac_table;
     uint32_t *vlans;
+    /* Around changes to the rx filter above, which the iothreads read */
+    QemuSeqLock rx_filter_seq;
     virtio_net_conf net_conf;
     NICConf nic_conf;
     DeviceState *qdev;
@@ -199,6 +253,19 @@ struct VirtIONet {
     bool failover;
     DeviceListener primary_listener;
     Notifier migration_state;
+    VirtioNetRssData rss_data;
+    /* Notification coalescing of the data queues, see NOTF_COAL */
+    uint32_t coal_tx_frames;
+    uint32_t coal_tx_usecs;
+    uint32_t coal_rx_frames;
+    uint32_t coal_rx_usecs;
+    struct NetRxPkt *rx_pkt;
+    IOThread *iothread;
+    char *iothread_ids;
+    /* Queue pair i runs in iothreads[i % num_iothreads] */
+    IOThread **iothreads;
+    int num_iothreads;
+    bool dataplane_started;
 };
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
@@ -49,6 +49,11 @@ typedef struct VirtQueue VirtQueue;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
+/* A reasonable number of elements for virtqueue_pop_batch() */
+#define VIRTQUEUE_POP_BATCH 32
+
+typedef struct VirtQueueArena VirtQueueArena;
+
 typedef struct VirtQueueElement
 {
     unsigned int index;
@@ -60,6 +65,8 @@ typedef struct VirtQueueElement
     hwaddr *out_addr;
     struct iovec *in_sg;
     struct iovec *out_sg;
+    /* Set if the element must be released with virtqueue_element_free() */
+    VirtQueueArena *arena;
 } VirtQueueElement;
 
 #define VIRTIO_QUEUE_MAX 1024
@@ -109,6 +116,10 @@ struct VirtIODevice
     char *bus_name;
     uint8_t device_endian;
     bool use_guest_notifier_mask;
+    /* Initial interrupt coalescing of the virtqueues */
+    uint32_t coalesce_frames;
+    uint32_t coalesce_usecs;
+    bool coalesce_adaptive;
     AddressSpace *dma_as;
     QLIST_HEAD(, VirtQueue) *vector_queues;
 };
@@ -200,6 +211,13 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz,
+                                 VirtQueueElement **elems, unsigned int max);
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int num);
+void virtqueue_element_free(VirtQueueElement *elem);
+void virtqueue_unpop_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                           unsigned int num);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -230,6 +248,9 @@ void virtio_notify_config(VirtIODevice *vdev);
 
 bool virtio_queue_get_notification(VirtQueue *vq);
 void virtio_queue_set_notification(VirtQueue *vq, int enable);
+void virtio_queue_set_coalesce(VirtQueue *vq, uint32_t max_frames,
+                               uint32_t max_usecs);
+void virtio_queue_set_control(VirtQueue *vq);
 
 int virtio_queue_ready(VirtQueue *vq);
 
@@ -313,6 +334,9 @@ EventNotifier *virtio_queue_get_guest_notifier(VirtQueue *vq);
 void virtio_queue_set_guest_notifier_fd_handler(VirtQueue *vq, bool assign,
                                                 bool with_irqfd);
 int virtio_device_start_ioeventfd(VirtIODevice *vdev);
+/* The default VirtioDeviceClass.start_ioeventfd/stop_ioeventfd */
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev);
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev);
 int virtio_device_grab_ioeventfd(VirtIODevice *vdev);
 void virtio_device_release_ioeventfd(VirtIODevice *vdev);
 bool virtio_device_ioeventfd_enabled(VirtIODevice *vdev);
@@ -44,6 +44,7 @@ enum QIOChannelFeature {
     QIO_CHANNEL_FEATURE_FD_PASS,
     QIO_CHANNEL_FEATURE_SHUTDOWN,
     QIO_CHANNEL_FEATURE_LISTEN,
+    QIO_CHANNEL_FEATURE_SEEKABLE,
 };
 
 
@@ -136,6 +137,16 @@ struct QIOChannelClass {
                      off_t offset,
                      int whence,
                      Error **errp);
+    ssize_t (*io_pwritev)(QIOChannel *ioc,
+                          const struct iovec *iov,
+                          size_t niov,
+                          off_t offset,
+                          Error **errp);
+    ssize_t (*io_preadv)(QIOChannel *ioc,
+                         const struct iovec *iov,
+                         size_t niov,
+                         off_t offset,
+                         Error **errp);
     void (*io_set_aio_fd_handler)(QIOChannel *ioc,
                                   AioContext *ctx,
                                   IOHandler *io_read,
@@ -602,6 +613,86 @@ off_t qio_channel_io_seek(QIOChannel *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_pwritev:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to write data from
+ * @niov: the length of the @iov array
+ * @offset: offset in the channel where writes should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Write data from the memory regions referenced by @iov
+ * to the channel at @offset, without changing the current
+ * I/O position of the channel. Not all implementations
+ * support this facility; callers should check for
+ * QIO_CHANNEL_FEATURE_SEEKABLE first.
+ *
+ * Returns: the number of bytes written, or -1 on error
+ */
+ssize_t qio_channel_pwritev(QIOChannel *ioc,
+                            const struct iovec *iov,
+                            size_t niov,
+                            off_t offset,
+                            Error **errp);
+
+/**
+ * qio_channel_pwrite:
+ * @ioc: the channel object
+ * @buf: the memory region to write data from
+ * @buflen: the number of bytes in @buf
+ * @offset: offset in the channel where writes should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Behaves as qio_channel_pwritev(), but with a single
+ * memory region.
+ */
+ssize_t qio_channel_pwrite(QIOChannel *ioc,
+                           const char *buf,
+                           size_t buflen,
+                           off_t offset,
+                           Error **errp);
+
+/**
+ * qio_channel_preadv:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to read data into
+ * @niov: the length of the @iov array
+ * @offset: offset in the channel where reads should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Read data from the channel at @offset into the memory
+ * regions referenced by @iov, without changing the current
+ * I/O position of the channel. Not all implementations
+ * support this facility; callers should check for
+ * QIO_CHANNEL_FEATURE_SEEKABLE first.
+ *
+ * Returns: the number of bytes read, 0 at end of file,
+ * or -1 on error
+ */
+ssize_t qio_channel_preadv(QIOChannel *ioc,
+                           const struct iovec *iov,
+                           size_t niov,
+                           off_t offset,
+                           Error **errp);
+
+/**
+ * qio_channel_pread:
+ * @ioc: the channel object
+ * @buf: the memory region to read data into
+ * @buflen: the number of bytes in @buf
+ * @offset: offset in the channel where reads should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Behaves as qio_channel_preadv(), but with a single
+ * memory region.
+ */
+ssize_t qio_channel_pread(QIOChannel *ioc,
+                          char *buf,
+                          size_t buflen,
+                          off_t offset,
+                          Error **errp);
+
+
 /**
  * qio_channel_create_watch:
  * @ioc: the channel object
@@ -182,6 +182,16 @@ struct VMStateDescription {
     int minimum_version_id;
     int minimum_version_id_old;
     MigrationPriority priority;
+    /*
+     * The handlers only touch the state of this one instance, so with
+     * the parallel-device-state capability the section can be saved and
+     * loaded by a worker thread, concurrently with other parallel
+     * sections of the same priority.  The BQL is held by the migration
+     * thread, not by the worker, so on load the post_load hooks of the
+     * section and of its subsections are deferred to the migration
+     * thread; see vmstate_load_state_deferred().
+     */
+    bool parallel;
     LoadStateHandler *load_state_old;
     int (*pre_load)(void *opaque);
     int (*post_load)(void *opaque, int version_id);
@@ -1171,6 +1181,18 @@ extern const VMStateInfo vmstate_info_qlist;
 
 int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, int version_id);
+
+/* A post_load hook queued by vmstate_load_state_deferred() */
+typedef struct VMStatePostLoad {
+    const VMStateDescription *vmsd;
+    void *opaque;
+    int version_id;
+} VMStatePostLoad;
+
+int vmstate_load_state_deferred(QEMUFile *f, const VMStateDescription *vmsd,
+                                void *opaque, int version_id,
+                                GArray *post_load);
+int vmstate_run_post_load(GArray *post_load);
 int vmstate_save_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, QJSON *vmdesc);
 int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
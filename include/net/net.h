@@ -60,6 +60,7 @@ typedef int (SetVnetBE)(NetClientState *, bool);
 typedef struct SocketReadState SocketReadState;
 typedef void (SocketReadStateFinalize)(SocketReadState *rs);
 typedef void (NetAnnounce)(NetClientState *);
+typedef void (SetAioContext)(NetClientState *, AioContext *);
 
 typedef struct NetClientInfo {
     NetClientDriver type;
@@ -81,6 +82,7 @@ typedef struct NetClientInfo {
     SetVnetLE *set_vnet_le;
     SetVnetBE *set_vnet_be;
     NetAnnounce *announce;
+    SetAioContext *set_aio_context;
 } NetClientInfo;
 
 struct NetClientState {
@@ -100,6 +102,8 @@ struct NetClientState {
     int vnet_hdr_len;
     bool is_netdev;
     QTAILQ_HEAD(, NetFilterState) filters;
+    /* Where the handlers run, NULL for the main loop */
+    AioContext *ctx;
 };
 
 typedef struct NICState {
@@ -165,6 +169,8 @@ void qemu_set_offload(NetClientState *nc, int csum, int tso4, int tso6,
 void qemu_set_vnet_hdr_len(NetClientState *nc, int len);
 int qemu_set_vnet_le(NetClientState *nc, bool is_le);
 int qemu_set_vnet_be(NetClientState *nc, bool is_be);
+bool qemu_has_net_aio_context(NetClientState *nc);
+void qemu_set_net_aio_context(NetClientState *nc, AioContext *ctx);
 void qemu_macaddr_default_if_unset(MACAddr *macaddr);
 int qemu_show_nic_models(const char *arg, const char *const *models);
 void qemu_check_nic_model(NICInfo *nd, const char *model);
@@ -71,6 +71,13 @@ enum plugin_dyn_cb_subtype {
     PLUGIN_N_CB_SUBTYPES,
 };
 
+/* What an inline entry does; they are all expanded in the code cache */
+enum plugin_inline_kind {
+    PLUGIN_INLINE_OP,
+    PLUGIN_INLINE_COND_CB,
+    PLUGIN_INLINE_MEM_BUFFER,
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -86,12 +93,43 @@ struct qemu_plugin_dyn_cb {
     /* fields specific to each dyn_cb type go here */
     union {
         struct {
+            enum plugin_inline_kind kind;
             enum qemu_plugin_op op;
+            enum qemu_plugin_cond cond;
+            /*
+             * Target of @op, or operand of @cond.  A NULL @entry.score
+             * means that @entry.offset is the address of the target.
+             */
+            qemu_plugin_u64 entry;
             uint64_t imm;
+            /* PLUGIN_INLINE_MEM_BUFFER */
+            struct qemu_plugin_mem_buffer *buf;
+            uint64_t pc;
         } inline_insn;
     };
 };
 
+struct qemu_plugin_scoreboard {
+    /* loaded by the code cache on each use, so that it can be resized */
+    void *data;
+    size_t element_size;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
+/* What a memory access buffer holds for each vCPU */
+struct qemu_plugin_mem_buffer_vcpu {
+    uint64_t n;
+    struct qemu_plugin_mem_record recs[];
+};
+
+struct qemu_plugin_mem_buffer {
+    struct qemu_plugin_scoreboard *score;
+    size_t n_entries;
+    qemu_plugin_vcpu_mem_buffer_cb_t cb;
+    void *userdata;
+    QLIST_ENTRY(qemu_plugin_mem_buffer) entry;
+};
+
 struct qemu_plugin_insn {
     GByteArray *data;
     uint64_t vaddr;
@@ -99,6 +137,8 @@ struct qemu_plugin_insn {
     GArray *cbs[PLUGIN_N_CB_TYPES][PLUGIN_N_CB_SUBTYPES];
     bool calls_helpers;
     bool mem_helper;
+    /* number of memory accesses that the code cache instruments */
+    unsigned int mem_accesses;
 };
 
 /*
@@ -136,6 +176,8 @@ struct qemu_plugin_tb {
     void *haddr1;
     void *haddr2;
     GArray *cbs[PLUGIN_N_CB_SUBTYPES];
+    /* check the memory access buffers at each insn instead of once per TB */
+    bool mem_buffer_insn_checks;
 };
 
 /**
@@ -156,6 +198,7 @@ struct qemu_plugin_insn *qemu_plugin_tb_insn_get(struct qemu_plugin_tb *tb)
     g_byte_array_set_size(insn->data, 0);
     insn->calls_helpers = false;
     insn->mem_helper = false;
+    insn->mem_accesses = 0;
 
     for (i = 0; i < PLUGIN_N_CB_TYPES; i++) {
         for (j = 0; j < PLUGIN_N_CB_SUBTYPES; j++) {
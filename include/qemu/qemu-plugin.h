@@ -51,7 +51,7 @@ typedef uint64_t qemu_plugin_id_t;
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 0
+#define QEMU_PLUGIN_VERSION 1
 
 typedef struct {
     /* string describing architecture */
@@ -179,6 +179,70 @@ void qemu_plugin_register_vcpu_idle_cb(qemu_plugin_id_t id,
 void qemu_plugin_register_vcpu_resume_cb(qemu_plugin_id_t id,
                                          qemu_plugin_vcpu_simple_cb_t cb);
 
+/*
+ * Per-vCPU storage
+ *
+ * A scoreboard holds one entry per vCPU, of a size chosen by the plugin.
+ * Inline operations and conditional callbacks can work on a uint64_t
+ * member of the entry of the vCPU that executes them, which lets plugins
+ * keep per-vCPU state from translated code without callbacks, atomics or
+ * cache line bouncing between vCPUs.
+ */
+struct qemu_plugin_scoreboard;
+
+/**
+ * typedef qemu_plugin_u64 - a uint64_t member of the entries of a scoreboard
+ * @score: the scoreboard
+ * @offset: offset of the member in each entry
+ */
+typedef struct {
+    struct qemu_plugin_scoreboard *score;
+    size_t offset;
+} qemu_plugin_u64;
+
+/**
+ * qemu_plugin_scoreboard_new() - allocate a scoreboard
+ * @element_size: size in bytes of the entry of each vCPU
+ *
+ * The entries are zeroed, including those of vCPUs created later on.
+ * Returns the new scoreboard.
+ */
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size);
+
+/**
+ * qemu_plugin_scoreboard_free() - free a scoreboard
+ * @score: the scoreboard
+ *
+ * The memory is released once translated code that may use @score has
+ * been flushed, so this can be called while vCPUs run.  The plugin must
+ * not use @score, nor register callbacks with it, after this call.
+ */
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+/**
+ * qemu_plugin_scoreboard_find() - get the entry of a vCPU
+ * @score: the scoreboard
+ * @vcpu_index: index of the vCPU
+ *
+ * The scoreboard may move when a vCPU is created, so do not keep the
+ * returned pointer beyond the callback that obtained it.
+ */
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index);
+
+/* Accessors for a uint64_t member of the entry of a vCPU */
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index);
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val);
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added);
+
+/**
+ * qemu_plugin_u64_sum() - sum a member over all vCPUs
+ * @entry: the member
+ */
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry);
+
 /*
  * Opaque types that the plugin is given during the translation and
  * instrumentation phase.
@@ -231,7 +295,20 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
                                           void *userdata);
 
 enum qemu_plugin_op {
-    QEMU_PLUGIN_INLINE_ADD_U64,
+    QEMU_PLUGIN_INLINE_ADD_U64,     /* add @imm to the target */
+    QEMU_PLUGIN_INLINE_STORE_U64,   /* store @imm to the target */
+};
+
+/* Unsigned comparisons of a uint64_t with an immediate */
+enum qemu_plugin_cond {
+    QEMU_PLUGIN_COND_NEVER,
+    QEMU_PLUGIN_COND_ALWAYS,
+    QEMU_PLUGIN_COND_EQ,
+    QEMU_PLUGIN_COND_NE,
+    QEMU_PLUGIN_COND_LT,
+    QEMU_PLUGIN_COND_LE,
+    QEMU_PLUGIN_COND_GT,
+    QEMU_PLUGIN_COND_GE,
 };
 
 /**
@@ -249,6 +326,44 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - per-vCPU inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the scoreboard member targeted by the op
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_tb_exec_inline(), but the op works on
+ * the entry of the vCPU that executes the translated unit.
+ */
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_cond_cb() - conditional execution cb
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition under which @cb is called
+ * @entry: the scoreboard member compared with @imm
+ * @imm: the immediate operand of @cond
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called every time a translated unit executes and
+ * the executing vCPU's @entry compares to @imm as given by @cond.  The
+ * comparison is done inline, so calls that are skipped cost very little.
+ *
+ * Inline ops and conditional callbacks of a translated unit run in the
+ * order in which they were registered.
+ */
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm, void *userdata);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_cb() - register insn execution cb
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -278,6 +393,37 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - per-vCPU inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the scoreboard member targeted by the op
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_insn_exec_inline(), but the op works on
+ * the entry of the vCPU that executes the instruction.
+ */
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_insn_exec_cond_cb() - conditional insn cb
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition under which @cb is called
+ * @entry: the scoreboard member compared with @imm
+ * @imm: the immediate operand of @cond
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * See qemu_plugin_register_vcpu_tb_exec_cond_cb().
+ */
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn, qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags, enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry, uint64_t imm, void *userdata);
+
 /*
  * Helpers to query information about the instructions in a block
  */
@@ -350,6 +496,65 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op, qemu_plugin_u64 entry, uint64_t imm);
+
+/*
+ * Memory access buffers
+ *
+ * Instead of calling the plugin on every access, the translated code can
+ * append a record of each access to a per-vCPU buffer.  The plugin is
+ * handed the records in bulk, on the vCPU thread, when the buffer of a
+ * vCPU fills up, when the vCPU exits and before the *atexit* callbacks
+ * run.
+ */
+struct qemu_plugin_mem_buffer;
+
+struct qemu_plugin_mem_record {
+    uint64_t vaddr;
+    uint64_t pc;                    /* address of the instruction */
+    qemu_plugin_meminfo_t info;
+    uint32_t reserved;
+};
+
+typedef void
+(*qemu_plugin_vcpu_mem_buffer_cb_t)(unsigned int vcpu_index,
+                                    const struct qemu_plugin_mem_record *recs,
+                                    size_t n, void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_new() - allocate a memory access buffer
+ * @n_entries: number of records that each vCPU buffers
+ * @cb: callback that consumes the records
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * @n_entries is raised to a minimum of 1024.
+ */
+struct qemu_plugin_mem_buffer *
+qemu_plugin_mem_buffer_new(size_t n_entries,
+                           qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                           void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_free() - free a memory access buffer
+ * @buf: the buffer
+ *
+ * Records still in the buffer are dropped.  The same restrictions as for
+ * qemu_plugin_scoreboard_free() apply.
+ */
+void qemu_plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf);
+
+/**
+ * qemu_plugin_register_vcpu_mem_buffer() - record accesses of an insn
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @rw: which kind of accesses to record
+ * @buf: the buffer that receives the records
+ */
+void qemu_plugin_register_vcpu_mem_buffer(struct qemu_plugin_insn *insn,
+                                          enum qemu_plugin_mem_rw rw,
+                                          struct qemu_plugin_mem_buffer *buf);
+
 
 
 typedef void
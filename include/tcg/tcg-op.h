@@ -833,6 +833,51 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+/**
+ * tcg_gen_lookup_and_goto_ic() - jump to @addr through an inline cache
+ * @tb: The TB being translated
+ * @addr: Guest address of the target TB
+ *
+ * Like tcg_gen_lookup_and_goto_ptr(), but first compare @addr with the
+ * start of the last TB this jump went to, and jump there directly if
+ * they match.  The inline cache is shared by the indirect jumps of @tb.
+ *
+ * The cache only compares addresses: use it only for jumps that cannot
+ * change the cs_base and flags that TBs are looked up with.  In softmmu
+ * mode, where the same address can refer to different code, this is a
+ * plain tcg_gen_lookup_and_goto_ptr().
+ */
+void tcg_gen_lookup_and_goto_ic(const TranslationBlock *tb, TCGv addr);
+
+/**
+ * tcg_gen_push_return() - record a call on the return prediction stack
+ * @tb: The TB being translated, which performs the call
+ *
+ * To be paired with tcg_gen_lookup_and_goto_return() in the code of the
+ * callee.
+ */
+void tcg_gen_push_return(const TranslationBlock *tb);
+
+/**
+ * tcg_gen_lookup_and_goto_return() - return to @addr
+ * @tb: The TB being translated
+ * @addr: Guest address of the target TB
+ *
+ * Pop the TB of the latest call from the return prediction stack, and
+ * jump to @addr through that TB's return inline cache.  The same rules
+ * as for tcg_gen_lookup_and_goto_ic() apply.
+ */
+void tcg_gen_lookup_and_goto_return(const TranslationBlock *tb, TCGv addr);
+
+/**
+ * tcg_gen_movi_tb_ptr() - load the address of a TB
+ * @ret: Destination
+ * @tb: The TB being translated
+ *
+ * Unlike a host pointer constant, this can be relocated by tcg_ops_load().
+ */
+void tcg_gen_movi_tb_ptr(TCGv_ptr ret, const TranslationBlock *tb);
+
 static inline void tcg_gen_plugin_cb_start(unsigned from, unsigned type,
                                            unsigned wr)
 {
@@ -1285,6 +1330,11 @@ static inline void tcg_gen_addi_ptr(TCGv_ptr r, TCGv_ptr a, intptr_t b)
     glue(tcg_gen_addi_,PTR)((NAT)r, (NAT)a, b);
 }
 
+static inline void tcg_gen_muli_ptr(TCGv_ptr r, TCGv_ptr a, intptr_t b)
+{
+    glue(tcg_gen_muli_,PTR)((NAT)r, (NAT)a, b);
+}
+
 static inline void tcg_gen_brcondi_ptr(TCGCond cond, TCGv_ptr a,
                                        intptr_t b, TCGLabel *label)
 {
@@ -1300,6 +1350,15 @@ static inline void tcg_gen_ext_i32_ptr(TCGv_ptr r, TCGv_i32 a)
 #endif
 }
 
+static inline void tcg_gen_extu_i32_ptr(TCGv_ptr r, TCGv_i32 a)
+{
+#if UINTPTR_MAX == UINT32_MAX
+    tcg_gen_mov_i32((NAT)r, a);
+#else
+    tcg_gen_extu_i32_i64((NAT)r, a);
+#endif
+}
+
 static inline void tcg_gen_trunc_i64_ptr(TCGv_ptr r, TCGv_i64 a)
 {
 #if UINTPTR_MAX == UINT32_MAX
@@ -559,6 +559,9 @@ typedef struct TCGOp {
 #define TCGOP_VECL(X)     (X)->param1
 #define TCGOP_VECE(X)     (X)->param2
 
+/* Set on the movi emitted by tcg_gen_movi_tb_ptr().  */
+#define TCGOP_TB_PTR(X)   (X)->param1
+
 /* Make sure operands fit in the bitfields above.  */
 QEMU_BUILD_BUG_ON(NB_OPS > (1 << 8));
 
@@ -600,6 +603,8 @@ struct TCGContext {
 
     TCGRegSet reserved_regs;
     uint32_t tb_cflags; /* cflags of the current TB */
+    /* The ops of the current TB embed host addresses, see tcg_ops_save() */
+    bool host_ptr_consts;
     intptr_t current_frame_offset;
     intptr_t frame_start;
     intptr_t frame_end;
@@ -633,6 +638,9 @@ struct TCGContext {
 
     size_t tb_phys_invalidate_count;
 
+    /* Per-region TB lookups by this thread, see tcg_region_hit() */
+    uint32_t *region_hits;
+
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
 
@@ -661,6 +669,9 @@ struct TCGContext {
 
     /* list to quickly access the injected ops */
     QSIMPLEQ_HEAD(, TCGOp) plugin_ops;
+
+    /* if set, tcg_emit_op() inserts new ops before this one */
+    TCGOp *emit_before_op;
 #endif
 
     TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
@@ -820,6 +831,8 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_init(void);
 void tcg_region_reset_all(void);
+void tcg_region_hit(const void *tc_ptr);
+size_t tcg_region_evict(GTraverseFunc func, gpointer user_data);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -857,6 +870,33 @@ void tcg_func_start(TCGContext *s);
 
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb);
 
+/**
+ * tcg_ops_save:
+ * @s: the TCG context holding the front end output for @tb
+ * @tb: the TB being translated
+ * @buf: byte array to append the encoded ops to
+ *
+ * Encode the ops of @tb, as produced by the front end and before any
+ * optimization, so that tcg_ops_load() can recreate them in a later run
+ * of the same QEMU binary.  Returns false, leaving @buf untouched, if the
+ * ops embed host addresses that would not survive a restart.
+ */
+bool tcg_ops_save(TCGContext *s, const TranslationBlock *tb, GByteArray *buf);
+
+/**
+ * tcg_ops_load:
+ * @s: the TCG context, freshly reset by tcg_func_start()
+ * @tb: the TB being translated
+ * @data: ops encoded by tcg_ops_save()
+ * @len: length of @data
+ *
+ * Recreate the ops of @tb in place of running the front end, and set
+ * @tb's size and icount.  Returns false, leaving @s reset, if @data is
+ * malformed or does not match this binary.
+ */
+bool tcg_ops_load(TCGContext *s, TranslationBlock *tb,
+                  const void *data, size_t len);
+
 void tcg_set_frame(TCGContext *s, TCGReg reg, intptr_t start, intptr_t size);
 
 TCGTemp *tcg_global_mem_new_internal(TCGType, TCGv_ptr,
@@ -1041,12 +1081,21 @@ TCGv_vec tcg_const_ones_vec(TCGType);
 TCGv_vec tcg_const_zeros_vec_matching(TCGv_vec);
 TCGv_vec tcg_const_ones_vec_matching(TCGv_vec);
 
+/* Host addresses make the ops unfit for tcg_ops_save(), so flag them.  */
 #if UINTPTR_MAX == UINT32_MAX
-# define tcg_const_ptr(x)        ((TCGv_ptr)tcg_const_i32((intptr_t)(x)))
-# define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i32((intptr_t)(x)))
+# define tcg_const_ptr(x)                                               \
+    (tcg_ctx->host_ptr_consts = true,                                  \
+     (TCGv_ptr)tcg_const_i32((intptr_t)(x)))
+# define tcg_const_local_ptr(x)                                         \
+    (tcg_ctx->host_ptr_consts = true,                                  \
+     (TCGv_ptr)tcg_const_local_i32((intptr_t)(x)))
 #else
-# define tcg_const_ptr(x)        ((TCGv_ptr)tcg_const_i64((intptr_t)(x)))
-# define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i64((intptr_t)(x)))
+# define tcg_const_ptr(x)                                               \
+    (tcg_ctx->host_ptr_consts = true,                                  \
+     (TCGv_ptr)tcg_const_i64((intptr_t)(x)))
+# define tcg_const_local_ptr(x)                                         \
+    (tcg_ctx->host_ptr_consts = true,                                  \
+     (TCGv_ptr)tcg_const_local_i64((intptr_t)(x)))
 #endif
 
 TCGLabel *gen_new_label(void);
@@ -1181,11 +1230,9 @@ static inline unsigned get_mmuidx(TCGMemOpIdx oi)
  *        TB index (0 or 1). That is, we left the TB via (the equivalent
  *        of) "goto_tb <index>". The main loop uses this to determine
  *        how to link the TB just executed to the next.
- *  2:    we are using instruction counting code generation, and we
- *        did not start executing this TB because the instruction counter
- *        would hit zero midway through it. In this case the pointer
- *        returned is the TB we were about to execute, and the caller must
- *        arrange to execute the remaining count of instructions.
+ *  2:    the TB has run tb_tier_threshold times and we did not start
+ *        executing it.  The pointer returned is that TB, which the caller
+ *        should retranslate as a superblock before going on.
  *  3:    we stopped because the CPU's exit_request flag was set
  *        (usually meaning that there is an interrupt that needs to be
  *        handled). The pointer returned is the TB we were about to execute
@@ -1208,6 +1255,7 @@ static inline unsigned get_mmuidx(TCGMemOpIdx oi)
 #define TB_EXIT_IDX0      0
 #define TB_EXIT_IDX1      1
 #define TB_EXIT_IDXMAX    1
+#define TB_EXIT_TIER_UP   2
 #define TB_EXIT_REQUESTED 3
 
 #ifdef HAVE_TCG_QEMU_TB_EXEC
@@ -2569,7 +2569,8 @@ static void load_elf_image(const char *image_name, int image_fd,
         info->brk = info->end_code;
     }
 
-    if (qemu_log_enabled()) {
+    /* -perfmap and -jitdump name translated code after guest symbols */
+    if (qemu_log_enabled() || perf_enabled()) {
         load_symbols(ehdr, image_fd, load_bias);
     }
 
@@ -36,4 +36,6 @@ void preexit_cleanup(CPUArchState *env, int code)
 #endif
         gdb_exit(env, code);
         qemu_plugin_atexit_cb();
+        tb_persist_flush();
+        perf_exit();
 }
@@ -56,6 +56,8 @@ static const char *gdbstub;
 static envlist_t *envlist;
 static const char *cpu_model;
 static const char *cpu_type;
+static const char *tb_cache_dir;
+static unsigned long tb_prefetch_threads;
 static const char *seed_optarg;
 unsigned long mmap_min_addr;
 unsigned long guest_base;
@@ -128,11 +130,13 @@ void fork_start(void)
 {
     start_exclusive();
     mmap_fork_start();
+    tb_prefetch_fork_start();
     cpu_list_lock();
 }
 
 void fork_end(int child)
 {
+    tb_prefetch_fork_end(child);
     mmap_fork_end(child);
     if (child) {
         CPUState *cpu, *next_cpu;
@@ -374,6 +378,41 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_tier_threshold(const char *arg)
+{
+    unsigned long threshold;
+
+    if (qemu_strtoul(arg, NULL, 0, &threshold) || threshold > INT32_MAX) {
+        fprintf(stderr, "Invalid tier threshold: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    tb_tier_set_threshold(threshold);
+}
+
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_dir = arg;
+}
+
+static void handle_arg_tb_prefetch(const char *arg)
+{
+    if (qemu_strtoul(arg, NULL, 0, &tb_prefetch_threads) ||
+        tb_prefetch_threads > 64) {
+        fprintf(stderr, "Invalid number of prefetch threads: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void handle_arg_perfmap(const char *arg)
+{
+    perf_enable_perfmap();
+}
+
+static void handle_arg_jitdump(const char *arg)
+{
+    perf_enable_jitdump();
+}
+
 static void handle_arg_strace(const char *arg)
 {
     enable_strace = true;
@@ -454,6 +493,16 @@ static const struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"tier-threshold", "QEMU_TIER_THRESHOLD", true, handle_arg_tier_threshold,
+     "count",      "retranslate TBs run 'count' times as superblocks"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "keep translations across runs in directory 'dir'"},
+    {"tb-prefetch", "QEMU_TB_PREFETCH", true, handle_arg_tb_prefetch,
+     "threads",    "translate code ahead of the CPU in 'threads' threads"},
+    {"perfmap",    "QEMU_PERFMAP",     false, handle_arg_perfmap,
+     "",           "write symbols for translated code to /tmp/perf-PID.map"},
+    {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
+     "",           "write translated code to /tmp/jit-PID.dump for perf"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
@@ -707,6 +756,11 @@ int main(int argc, char **argv, char **envp)
     /* init tcg before creating CPUs and to get qemu_host_page_size */
     tcg_exec_init(0);
 
+    if (tb_cache_dir) {
+        tb_persist_init(tb_cache_dir, cpu_model);
+    }
+    tb_prefetch_init(tb_prefetch_threads);
+
     cpu = cpu_create(cpu_type);
     env = cpu->env_ptr;
     cpu_reset(cpu);
@@ -21,9 +21,43 @@
 #include "exec/log.h"
 #include "qemu.h"
 
+/*
+ * mmap_lock protects the page flags and everything that the translator
+ * looks at.  mmap, munmap and mprotect used to hold it around their host
+ * system calls, which stalled every other thread that wanted to map
+ * memory or translate code for as long as the kernel took, e.g. to
+ * populate or tear down a large mapping.
+ *
+ * Instead, they now lock the host pages they change with
+ * mmap_range_lock(), which only excludes calls on overlapping ranges,
+ * and drop mmap_lock around the host system calls, and only around them:
+ * the page flags are still read and updated with mmap_lock held, before
+ * mmap_host_begin() and after mmap_host_end().  While a range is "in flight",
+ * the translator leaves the host protection of its pages alone and the
+ * call invalidates any code translated from them when it completes; see
+ * mmap_defer_host_prot().
+ */
+typedef struct MmapRange {
+    abi_ulong start;
+    abi_ulong last;
+    /* false if the caller keeps mmap_lock throughout, see mmap_range_lock */
+    bool locked;
+    /* code was translated from the range while in flight */
+    bool code;
+    QTAILQ_ENTRY(MmapRange) next;
+} MmapRange;
+
 static pthread_mutex_t mmap_mutex = PTHREAD_MUTEX_INITIALIZER;
 static __thread int mmap_lock_count;
 
+/* In-flight ranges, protected by mmap_mutex */
+static QTAILQ_HEAD(, MmapRange) mmap_ranges =
+    QTAILQ_HEAD_INITIALIZER(mmap_ranges);
+static pthread_cond_t mmap_range_cond = PTHREAD_COND_INITIALIZER;
+/* set by fork to drain the in-flight ranges */
+static bool mmap_ranges_frozen;
+static __thread MmapRange *mmap_range_held;
+
 void mmap_lock(void)
 {
     if (mmap_lock_count++ == 0) {
@@ -49,21 +83,191 @@ void mmap_fork_start(void)
     if (mmap_lock_count)
         abort();
     pthread_mutex_lock(&mmap_mutex);
+    /* The calls in flight only need mmap_lock to complete */
+    mmap_ranges_frozen = true;
+    while (!QTAILQ_EMPTY(&mmap_ranges)) {
+        pthread_cond_wait(&mmap_range_cond, &mmap_mutex);
+    }
 }
 
 void mmap_fork_end(int child)
 {
-    if (child)
+    mmap_ranges_frozen = false;
+    if (child) {
         pthread_mutex_init(&mmap_mutex, NULL);
-    else
+        pthread_cond_init(&mmap_range_cond, NULL);
+    } else {
+        pthread_cond_broadcast(&mmap_range_cond);
         pthread_mutex_unlock(&mmap_mutex);
+    }
+}
+
+/* Find a call in flight over [@start, @last], other than our own */
+static MmapRange *mmap_range_find(abi_ulong start, abi_ulong last)
+{
+    MmapRange *r;
+
+    QTAILQ_FOREACH(r, &mmap_ranges, next) {
+        if (r != mmap_range_held && r->start <= last && start <= r->last) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Lock the host pages [@start, @end) for an mmap, munmap or mprotect,
+ * waiting for the overlapping calls in flight.  Called with mmap_lock
+ * held.  Returns true if it had to wait.
+ *
+ * The range is not locked when the caller cannot drop mmap_lock: when it
+ * is nested in another call on the same range or in a caller of its own
+ * that holds mmap_lock, e.g. the ELF loader.  The call then runs with
+ * mmap_lock held throughout, as it used to, but it still waits for the
+ * calls of other threads over the range: their host system calls would
+ * race with its own.
+ */
+static bool mmap_range_lock(MmapRange *r, abi_ulong start, abi_ulong end)
+{
+    bool nested = mmap_lock_count > 1 || mmap_range_held;
+    bool waited = false;
+
+    r->start = start;
+    r->last = end - 1;
+    r->locked = false;
+    r->code = false;
+    if (start == end) {
+        return false;
+    }
+    while ((mmap_ranges_frozen && !nested) ||
+           mmap_range_find(r->start, r->last)) {
+        pthread_cond_wait(&mmap_range_cond, &mmap_mutex);
+        waited = true;
+    }
+    if (nested) {
+        return waited;
+    }
+    QTAILQ_INSERT_TAIL(&mmap_ranges, r, next);
+    r->locked = true;
+    mmap_range_held = r;
+    return waited;
+}
+
+/*
+ * Set the host protection of the host page at @addr from the flags of
+ * its target pages.  Called with mmap_lock held.
+ */
+static void mmap_reprotect_host_page(abi_ulong addr)
+{
+    abi_ulong end = addr + qemu_host_page_size;
+    int prot = 0;
+
+    for (; addr < end; addr += TARGET_PAGE_SIZE) {
+        prot |= page_get_flags(addr);
+    }
+    /* Fails harmlessly if nothing is mapped there any more */
+    mprotect(g2h(end - qemu_host_page_size), qemu_host_page_size,
+             prot & PAGE_BITS);
+}
+
+/* Called with mmap_lock held */
+static void mmap_range_unlock(MmapRange *r)
+{
+    if (r->code) {
+        /* see mmap_defer_host_prot() */
+        tb_invalidate_phys_range(r->start, r->last + 1);
+        /*
+         * The protection of host pages shared with target pages outside
+         * the call was computed before mmap_lock was dropped, and may
+         * have been changed meanwhile by the translator or by
+         * page_unprotect(); e.g. a page made writable again would fault
+         * forever.  Recompute it from the page flags.
+         */
+        mmap_reprotect_host_page(r->start);
+        if (r->last + 1 - r->start > qemu_host_page_size) {
+            mmap_reprotect_host_page(r->last + 1 - qemu_host_page_size);
+        }
+    }
+    if (r->locked) {
+        QTAILQ_REMOVE(&mmap_ranges, r, next);
+        r->locked = false;
+        mmap_range_held = NULL;
+        pthread_cond_broadcast(&mmap_range_cond);
+    }
+}
+
+/* Whether this thread's call in flight covers [@start, @end) */
+static bool mmap_range_owns(abi_ulong start, abi_ulong end)
+{
+    return mmap_range_held && mmap_range_held->start <= start &&
+           end - 1 <= mmap_range_held->last;
+}
+
+/* Called with mmap_lock held */
+static bool mmap_range_is_free(abi_ulong start, abi_ulong end)
+{
+    abi_ulong addr;
+
+    for (addr = start; addr != end; addr += TARGET_PAGE_SIZE) {
+        if (page_get_flags(addr)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Wait for the calls in flight over [@start, @end), keeping mmap_lock */
+void mmap_range_wait(abi_ulong start, abi_ulong end)
+{
+    MmapRange r;
+
+    mmap_range_lock(&r, start, end);
+    mmap_range_unlock(&r);
+}
+
+/* Drop mmap_lock around host system calls, if @r allows it */
+static void mmap_host_begin(const MmapRange *r)
+{
+    if (r->locked) {
+        mmap_unlock();
+    }
+}
+
+static void mmap_host_end(const MmapRange *r)
+{
+    if (r->locked) {
+        mmap_lock();
+    }
+}
+
+/*
+ * Called with mmap_lock held by the translator before changing the host
+ * protection of [@start, @end) to catch self-modifying code.  If a call
+ * is in flight over the range, it returns true: the host protection is
+ * left to the call, which will also invalidate the code translated from
+ * the range in the meantime when it completes.
+ */
+bool mmap_defer_host_prot(target_ulong start, target_ulong end)
+{
+    MmapRange *r;
+    bool busy = false;
+
+    assert(have_mmap_lock());
+    QTAILQ_FOREACH(r, &mmap_ranges, next) {
+        if (r->start <= end - 1 && start <= r->last) {
+            r->code = true;
+            busy = true;
+        }
+    }
+    return busy;
 }
 
 /* NOTE: all the constants are the HOST ones, but addresses are target. */
 int target_mprotect(abi_ulong start, abi_ulong len, int prot)
 {
     abi_ulong end, host_start, host_end, addr;
-    int prot1, ret;
+    int prot_start = 0, prot_end = 0, ret;
+    MmapRange range;
 
     trace_target_mprotect(start, len, prot);
 
@@ -81,30 +285,40 @@ int target_mprotect(abi_ulong start, abi_ulong len, int prot)
     mmap_lock();
     host_start = start & qemu_host_page_mask;
     host_end = HOST_PAGE_ALIGN(end);
+    mmap_range_lock(&range, host_start, host_end);
+
+    /* get the protection of the target pages outside the range */
     if (start > host_start) {
         /* handle host page containing start */
-        prot1 = prot;
+        prot_start = prot;
         for(addr = host_start; addr < start; addr += TARGET_PAGE_SIZE) {
-            prot1 |= page_get_flags(addr);
+            prot_start |= page_get_flags(addr);
         }
         if (host_end == host_start + qemu_host_page_size) {
             for(addr = end; addr < host_end; addr += TARGET_PAGE_SIZE) {
-                prot1 |= page_get_flags(addr);
+                prot_start |= page_get_flags(addr);
             }
             end = host_end;
         }
-        ret = mprotect(g2h(host_start), qemu_host_page_size, prot1 & PAGE_BITS);
+    }
+    if (end < host_end) {
+        prot_end = prot;
+        for(addr = end; addr < host_end; addr += TARGET_PAGE_SIZE) {
+            prot_end |= page_get_flags(addr);
+        }
+    }
+
+    mmap_host_begin(&range);
+    if (start > host_start) {
+        ret = mprotect(g2h(host_start), qemu_host_page_size,
+                       prot_start & PAGE_BITS);
         if (ret != 0)
             goto error;
         host_start += qemu_host_page_size;
     }
     if (end < host_end) {
-        prot1 = prot;
-        for(addr = end; addr < host_end; addr += TARGET_PAGE_SIZE) {
-            prot1 |= page_get_flags(addr);
-        }
         ret = mprotect(g2h(host_end - qemu_host_page_size), qemu_host_page_size,
-                       prot1 & PAGE_BITS);
+                       prot_end & PAGE_BITS);
         if (ret != 0)
             goto error;
         host_end -= qemu_host_page_size;
@@ -116,32 +330,58 @@ int target_mprotect(abi_ulong start, abi_ulong len, int prot)
         if (ret != 0)
             goto error;
     }
+    mmap_host_end(&range);
     page_set_flags(start, start + len, prot | PAGE_VALID);
+    mmap_range_unlock(&range);
     mmap_unlock();
     return 0;
 error:
+    mmap_host_end(&range);
+    mmap_range_unlock(&range);
     mmap_unlock();
     return ret;
 }
 
-/* map an incomplete host page */
+/*
+ * Return the protection of the target pages of the host page at
+ * @real_start that are outside [@start, @end), for mmap_frag().
+ */
+static int mmap_frag_prot(abi_ulong real_start, abi_ulong start, abi_ulong end)
+{
+    abi_ulong real_end = real_start + qemu_host_page_size, addr;
+    int prot = 0;
+
+    assert(have_mmap_lock());
+    for (addr = real_start; addr < real_end; addr += TARGET_PAGE_SIZE) {
+        if (addr < start || addr >= end) {
+            prot |= page_get_flags(addr);
+        }
+    }
+    return prot;
+}
+
+/*
+ * map an incomplete host page
+ * @prot1 is the protection of the other target pages in the host page,
+ * from mmap_frag_prot().  The page flags must not be read here: the
+ * caller may have dropped mmap_lock, and then only its range lock keeps
+ * other mapping calls off the host page.  The translator and
+ * page_unprotect() may still change the flags of the other target pages
+ * meanwhile, but they leave the host protection to the caller; see
+ * mmap_defer_host_prot().
+ */
 static int mmap_frag(abi_ulong real_start,
                      abi_ulong start, abi_ulong end,
-                     int prot, int flags, int fd, abi_ulong offset)
+                     int prot, int prot1, int flags, int fd,
+                     abi_ulong offset)
 {
-    abi_ulong real_end, addr;
+    abi_ulong real_end;
     void *host_start;
-    int prot1, prot_new;
+    int prot_new;
 
     real_end = real_start + qemu_host_page_size;
     host_start = g2h(real_start);
-
-    /* get the protection of the target pages outside the mapping */
-    prot1 = 0;
-    for(addr = real_start; addr < real_end; addr++) {
-        if (addr < start || addr >= end)
-            prot1 |= page_get_flags(addr);
-    }
+    assert(have_mmap_lock() || mmap_range_owns(real_start, real_end));
 
     if (prot1 == 0) {
         /* no page was there, so we allocate one */
@@ -232,7 +472,7 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size,
             looped = true;
         } else {
             prot = page_get_flags(addr);
-            if (prot) {
+            if (prot || mmap_range_find(addr, addr + incr - 1)) {
                 /* Page in use.  Restart below this page.  */
                 addr = end_addr = ((addr - size) & -align) + size;
             } else if (addr && addr + size == end_addr) {
@@ -249,7 +489,8 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size,
 /*
  * Find and reserve a free memory area of size 'size'. The search
  * starts at 'start'.
- * It must be called with mmap_lock() held.
+ * It must be called with mmap_lock() held.  With reserved_va, the
+ * ranges of the calls in flight are not free either.
  * Return -1 if error.
  */
 abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size, abi_ulong align)
@@ -359,11 +600,34 @@ abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size, abi_ulong align)
     }
 }
 
+/*
+ * Give back what is left of an area reserved by mmap_find_vma() that
+ * could not be used.  Called with mmap_lock held and no other call in
+ * flight over the area, so the host pages that no target page uses are
+ * exactly those still reserved.
+ */
+static void mmap_release_vma(abi_ulong start, abi_ulong end)
+{
+    abi_ulong addr;
+
+    if (reserved_va) {
+        /* mmap_find_vma_reserved() does not reserve anything */
+        return;
+    }
+    for (addr = start; addr < end; addr += qemu_host_page_size) {
+        if (mmap_range_is_free(addr, addr + qemu_host_page_size)) {
+            munmap(g2h(addr), qemu_host_page_size);
+        }
+    }
+}
+
 /* NOTE: all the constants are the HOST ones */
 abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
                      int flags, int fd, abi_ulong offset)
 {
     abi_ulong ret, end, real_start, real_end, retaddr, host_offset, host_len;
+    int prot_start = 0, prot_end = 0;
+    MmapRange range = { };
 
     mmap_lock();
     trace_target_mmap(start, len, prot, flags, fd, offset);
@@ -393,10 +657,19 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
     if (!(flags & MAP_FIXED)) {
         host_len = len + offset - host_offset;
         host_len = HOST_PAGE_ALIGN(host_len);
-        start = mmap_find_vma(real_start, host_len, TARGET_PAGE_SIZE);
-        if (start == (abi_ulong)-1) {
-            errno = ENOMEM;
-            goto fail;
+        for (;;) {
+            start = mmap_find_vma(real_start, host_len, TARGET_PAGE_SIZE);
+            if (start == (abi_ulong)-1) {
+                errno = ENOMEM;
+                goto fail;
+            }
+            if (!mmap_range_lock(&range, start, start + host_len) ||
+                mmap_range_is_free(start, start + host_len)) {
+                break;
+            }
+            /* Another call mapped something there while we waited */
+            mmap_release_vma(start, start + host_len);
+            mmap_range_unlock(&range);
         }
     }
 
@@ -435,13 +708,14 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
         host_len = len + offset - host_offset;
         host_len = HOST_PAGE_ALIGN(host_len);
 
+        mmap_host_begin(&range);
         /* Note: we prefer to control the mapping address. It is
            especially important if qemu_host_page_size >
            qemu_real_host_page_size */
         p = mmap(g2h(start), host_len, prot,
                  flags | MAP_FIXED | MAP_ANONYMOUS, -1, 0);
         if (p == MAP_FAILED)
-            goto fail;
+            goto fail_host;
         /* update start so that it points to the file position at 'offset' */
         host_start = (unsigned long)p;
         if (!(flags & MAP_ANONYMOUS)) {
@@ -449,10 +723,11 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
                      flags | MAP_FIXED, fd, host_offset);
             if (p == MAP_FAILED) {
                 munmap(g2h(start), host_len);
-                goto fail;
+                goto fail_host;
             }
             host_start += offset - host_offset;
         }
+        mmap_host_end(&range);
         start = h2g(host_start);
     } else {
         if (start & ~TARGET_PAGE_MASK) {
@@ -472,6 +747,21 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
             goto fail;
         }
 
+        mmap_range_lock(&range, real_start, real_end);
+
+        /* the partial host pages at both ends, see mmap_frag() */
+        if (start > real_start) {
+            prot_start = mmap_frag_prot(real_start, start,
+                                        MIN(end, real_start +
+                                            qemu_host_page_size));
+        }
+        if (end < real_end) {
+            prot_end = mmap_frag_prot(real_end - qemu_host_page_size,
+                                      MAX(start, real_end -
+                                          qemu_host_page_size), end);
+        }
+        mmap_host_begin(&range);
+
         /* worst case: we cannot map the file because the offset is not
            aligned, so we read it */
         if (!(flags & MAP_ANONYMOUS) &&
@@ -481,19 +771,20 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
             if ((flags & MAP_TYPE) == MAP_SHARED &&
                 (prot & PROT_WRITE)) {
                 errno = EINVAL;
-                goto fail;
+                goto fail_host;
             }
             retaddr = target_mmap(start, len, prot | PROT_WRITE,
                                   MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS,
                                   -1, 0);
             if (retaddr == -1)
-                goto fail;
+                goto fail_host;
             if (pread(fd, g2h(start), len, offset) == -1)
-                goto fail;
+                goto fail_host;
             if (!(prot & PROT_WRITE)) {
                 ret = target_mprotect(start, len, prot);
                 assert(ret == 0);
             }
+            mmap_host_end(&range);
             goto the_end;
         }
         
@@ -502,25 +793,25 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
             if (real_end == real_start + qemu_host_page_size) {
                 /* one single host page */
                 ret = mmap_frag(real_start, start, end,
-                                prot, flags, fd, offset);
+                                prot, prot_start, flags, fd, offset);
                 if (ret == -1)
-                    goto fail;
+                    goto fail_host;
                 goto the_end1;
             }
             ret = mmap_frag(real_start, start, real_start + qemu_host_page_size,
-                            prot, flags, fd, offset);
+                            prot, prot_start, flags, fd, offset);
             if (ret == -1)
-                goto fail;
+                goto fail_host;
             real_start += qemu_host_page_size;
         }
         /* handle the end of the mapping */
         if (end < real_end) {
             ret = mmap_frag(real_end - qemu_host_page_size,
                             real_end - qemu_host_page_size, end,
-                            prot, flags, fd,
+                            prot, prot_end, flags, fd,
                             offset + real_end - qemu_host_page_size - start);
             if (ret == -1)
-                goto fail;
+                goto fail_host;
             real_end -= qemu_host_page_size;
         }
 
@@ -535,10 +826,11 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
             p = mmap(g2h(real_start), real_end - real_start,
                      prot, flags, fd, offset1);
             if (p == MAP_FAILED)
-                goto fail;
+                goto fail_host;
         }
-    }
  the_end1:
+        mmap_host_end(&range);
+    }
     page_set_flags(start, start + len, prot | PAGE_VALID);
  the_end:
     trace_target_mmap_complete(start);
@@ -546,9 +838,17 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
         log_page_dump(__func__);
     }
     tb_invalidate_phys_range(start, start + len);
+    tb_persist_unmap(start, len);
+    if (!(flags & MAP_ANONYMOUS) && (prot & PROT_EXEC)) {
+        tb_persist_map(start, len, fd, offset);
+    }
+    mmap_range_unlock(&range);
     mmap_unlock();
     return start;
+fail_host:
+    mmap_host_end(&range);
 fail:
+    mmap_range_unlock(&range);
     mmap_unlock();
     return -1;
 }
@@ -598,6 +898,7 @@ int target_munmap(abi_ulong start, abi_ulong len)
 {
     abi_ulong end, real_start, real_end, addr;
     int prot, ret;
+    MmapRange range;
 
     trace_target_munmap(start, len);
 
@@ -612,6 +913,7 @@ int target_munmap(abi_ulong start, abi_ulong len)
     end = start + len;
     real_start = start & qemu_host_page_mask;
     real_end = HOST_PAGE_ALIGN(end);
+    mmap_range_lock(&range, real_start, real_end);
 
     if (start > real_start) {
         /* handle host page containing start */
@@ -640,17 +942,21 @@ int target_munmap(abi_ulong start, abi_ulong len)
     ret = 0;
     /* unmap what we can */
     if (real_start < real_end) {
+        mmap_host_begin(&range);
         if (reserved_va) {
             mmap_reserve(real_start, real_end - real_start);
         } else {
             ret = munmap(g2h(real_start), real_end - real_start);
         }
+        mmap_host_end(&range);
     }
 
     if (ret == 0) {
         page_set_flags(start, start + len, 0);
         tb_invalidate_phys_range(start, start + len);
+        tb_persist_unmap(start, len);
     }
+    mmap_range_unlock(&range);
     mmap_unlock();
     return ret;
 }
@@ -669,9 +975,14 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
         return -1;
     }
 
+    /* This one keeps mmap_lock throughout */
     mmap_lock();
+    mmap_range_wait(old_addr & qemu_host_page_mask,
+                    HOST_PAGE_ALIGN(old_addr + MAX(old_size, new_size)));
 
     if (flags & MREMAP_FIXED) {
+        mmap_range_wait(new_addr & qemu_host_page_mask,
+                        HOST_PAGE_ALIGN(new_addr + new_size));
         host_addr = mremap(g2h(old_addr), old_size, new_size,
                            flags, g2h(new_addr));
 
@@ -730,6 +1041,7 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
         prot = page_get_flags(old_addr);
         page_set_flags(old_addr, old_addr + old_size, 0);
         page_set_flags(new_addr, new_addr + new_size, prot | PAGE_VALID);
+        tb_persist_unmap(old_addr, old_size);
     }
     tb_invalidate_phys_range(new_addr, new_addr + new_size);
     mmap_unlock();
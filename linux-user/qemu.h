@@ -452,6 +452,7 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
 extern unsigned long last_brk;
 extern abi_ulong mmap_next_start;
 abi_ulong mmap_find_vma(abi_ulong, abi_ulong, abi_ulong);
+void mmap_range_wait(abi_ulong start, abi_ulong end);
 void mmap_fork_start(void);
 void mmap_fork_end(int child);
 
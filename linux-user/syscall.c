@@ -4291,11 +4291,14 @@ static inline abi_ulong do_shmat(CPUArchState *cpu_env,
         return -TARGET_EINVAL;
     }
 
+    /* This one keeps mmap_lock throughout */
     mmap_lock();
 
-    if (shmaddr)
+    if (shmaddr) {
+        mmap_range_wait(shmaddr & qemu_host_page_mask,
+                        HOST_PAGE_ALIGN(shmaddr + shm_info.shm_segsz));
         host_raddr = shmat(shmid, (void *)g2h(shmaddr), shmflg);
-    else {
+    } else {
         abi_ulong mmap_start;
 
         /* In order to use the host shmat, we need to honor host SHMLBA.  */
@@ -4341,6 +4344,8 @@ static inline abi_long do_shmdt(abi_ulong shmaddr)
 
     for (i = 0; i < N_SHM_REGIONS; ++i) {
         if (shm_regions[i].in_use && shm_regions[i].start == shmaddr) {
+            mmap_range_wait(shmaddr & qemu_host_page_mask,
+                            HOST_PAGE_ALIGN(shmaddr + shm_regions[i].size));
             shm_regions[i].in_use = false;
             page_set_flags(shmaddr, shmaddr + shm_regions[i].size, 0);
             break;
@@ -7640,6 +7645,7 @@ static abi_long do_syscall1(void *cpu_env, int num, abi_long arg1,
         if (CPU_NEXT(first_cpu)) {
             TaskState *ts = cpu->opaque;
 
+            tb_prefetch_cpu_exit(cpu);
             object_property_set_bool(OBJECT(cpu), false, "realized", NULL);
             object_unref(OBJECT(cpu));
             /*
@@ -7892,6 +7898,7 @@ static abi_long do_syscall1(void *cpu_env, int num, abi_long arg1,
              * before the execve completes and makes it the other
              * program's problem.
              */
+            tb_persist_flush();
             ret = get_errno(safe_execve(p, argp, envp));
             unlock_user(p, arg1, 0);
 
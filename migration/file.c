@@ -0,0 +1,370 @@
+/*
+ * QEMU live migration to and from a plain file
+ *
+ * The file channel is seekable, which allows RAM to be stored at fixed
+ * offsets when the mapped-ram capability is enabled.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "channel.h"
+#include "file.h"
+#include "migration.h"
+#include "io/channel-file.h"
+#include "trace.h"
+
+/*
+ * With mapped-ram and multifd, RAM pages are written and read at their
+ * fixed offsets by a pool of threads instead of the migration thread.
+ * The threads share their own descriptors for the migration file, one of
+ * them opened with O_DIRECT when the direct-io parameter is set.
+ */
+typedef struct FileIOJob {
+    uint8_t *host;
+    size_t len;
+    off_t offset;
+    QSIMPLEQ_ENTRY(FileIOJob) next;
+} FileIOJob;
+
+typedef struct {
+    QemuThread *threads;
+    int thread_count;
+    bool writable;
+    QIOChannel *ioc;
+    /* NULL unless direct-io is set */
+    QIOChannel *direct_ioc;
+    QemuMutex lock;
+    /* signalled when a job is queued or the threads must quit */
+    QemuCond job_cond;
+    /* signalled when a job completes */
+    QemuCond done_cond;
+    QSIMPLEQ_HEAD(, FileIOJob) jobs;
+    /* jobs queued or in flight */
+    unsigned int pending;
+    bool quit;
+    Error *error;
+} FileIOState;
+
+/* Bound on the number of queued jobs per thread */
+#define FILE_IO_JOBS_PER_THREAD 8
+
+static char *file_path;
+static FileIOState *file_io;
+
+static QIOChannel *file_io_open(bool writable, bool direct, Error **errp)
+{
+    int flags = writable ? O_WRONLY : O_RDONLY;
+    QIOChannelFile *fioc;
+
+    if (direct) {
+#ifdef O_DIRECT
+        flags |= O_DIRECT;
+#else
+        error_setg(errp, "direct-io is not supported on this host");
+        return NULL;
+#endif
+    }
+
+    fioc = qio_channel_file_new_path(file_path, flags, 0, errp);
+    if (!fioc) {
+        return NULL;
+    }
+    if (!qio_channel_has_feature(QIO_CHANNEL(fioc),
+                                 QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg(errp, "Migration file %s is not seekable", file_path);
+        object_unref(OBJECT(fioc));
+        return NULL;
+    }
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-io");
+    return QIO_CHANNEL(fioc);
+}
+
+static int file_io_run(FileIOState *s, FileIOJob *job, Error **errp)
+{
+    QIOChannel *ioc = s->ioc;
+    size_t done = 0;
+
+    /* O_DIRECT needs the buffer, offset and length to be block aligned */
+    if (s->direct_ioc &&
+        QEMU_IS_ALIGNED((uintptr_t)job->host | job->offset | job->len,
+                        qemu_real_host_page_size)) {
+        ioc = s->direct_ioc;
+    }
+
+    while (done < job->len) {
+        ssize_t len;
+
+        if (s->writable) {
+            len = qio_channel_pwrite(ioc, (char *)job->host + done,
+                                     job->len - done, job->offset + done,
+                                     errp);
+        } else {
+            len = qio_channel_pread(ioc, (char *)job->host + done,
+                                    job->len - done, job->offset + done,
+                                    errp);
+        }
+        if (len < 0) {
+            if (len == QIO_CHANNEL_ERR_BLOCK) {
+                error_setg(errp, "Migration file %s would block", file_path);
+            }
+            return -1;
+        }
+        if (len == 0) {
+            error_setg(errp, "Unexpected end of migration file %s at "
+                       "offset %lld", file_path,
+                       (long long)(job->offset + done));
+            return -1;
+        }
+        done += len;
+    }
+    return 0;
+}
+
+static void *file_io_thread(void *opaque)
+{
+    FileIOState *s = opaque;
+
+    qemu_mutex_lock(&s->lock);
+    while (true) {
+        Error *local_err = NULL;
+        FileIOJob *job;
+        bool failed;
+
+        while (!s->quit && QSIMPLEQ_EMPTY(&s->jobs)) {
+            qemu_cond_wait(&s->job_cond, &s->lock);
+        }
+        if (s->quit) {
+            break;
+        }
+        job = QSIMPLEQ_FIRST(&s->jobs);
+        QSIMPLEQ_REMOVE_HEAD(&s->jobs, next);
+        failed = s->error;
+        qemu_mutex_unlock(&s->lock);
+
+        /* Skip the I/O once an error has been hit, the result is void */
+        if (!failed) {
+            trace_migration_file_io(s->writable, job->offset, job->len);
+            if (file_io_run(s, job, &local_err) < 0) {
+                qemu_mutex_lock(&s->lock);
+                if (!s->error) {
+                    s->error = local_err;
+                    local_err = NULL;
+                }
+                qemu_mutex_unlock(&s->lock);
+                error_free(local_err);
+            }
+        }
+        g_free(job);
+
+        qemu_mutex_lock(&s->lock);
+        s->pending--;
+        qemu_cond_broadcast(&s->done_cond);
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+/*
+ * Start the page I/O threads for the migration file, one per multifd
+ * channel.  Only valid after a file: migration has been started.
+ */
+int file_io_setup(bool writable, Error **errp)
+{
+    FileIOState *s;
+    int i;
+
+    assert(!file_io);
+    if (!file_path) {
+        error_setg(errp, "multifd with mapped-ram requires a file: "
+                   "migration URI");
+        return -1;
+    }
+    if (migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+        error_setg(errp, "multifd compression is not compatible with "
+                   "mapped-ram");
+        return -1;
+    }
+
+    s = g_new0(FileIOState, 1);
+    s->writable = writable;
+    s->ioc = file_io_open(writable, false, errp);
+    if (!s->ioc) {
+        g_free(s);
+        return -1;
+    }
+    if (migrate_direct_io()) {
+        s->direct_ioc = file_io_open(writable, true, errp);
+        if (!s->direct_ioc) {
+            object_unref(OBJECT(s->ioc));
+            g_free(s);
+            return -1;
+        }
+    }
+
+    qemu_mutex_init(&s->lock);
+    qemu_cond_init(&s->job_cond);
+    qemu_cond_init(&s->done_cond);
+    QSIMPLEQ_INIT(&s->jobs);
+
+    s->thread_count = migrate_multifd_channels();
+    s->threads = g_new0(QemuThread, s->thread_count);
+    for (i = 0; i < s->thread_count; i++) {
+        char *name = g_strdup_printf("mig/file_io_%d", i);
+
+        qemu_thread_create(&s->threads[i], name, file_io_thread, s,
+                           QEMU_THREAD_JOINABLE);
+        g_free(name);
+    }
+
+    trace_migration_file_io_setup(writable, s->thread_count,
+                                  !!s->direct_ioc);
+    file_io = s;
+    return 0;
+}
+
+bool file_io_active(void)
+{
+    return file_io;
+}
+
+/*
+ * Queue a transfer of @len bytes between @host and offset @offset of the
+ * migration file.  @host must stay valid until file_io_wait() returns.
+ * Blocks while the queue is full.
+ */
+void file_io_queue(uint8_t *host, size_t len, off_t offset)
+{
+    FileIOState *s = file_io;
+    FileIOJob *job = g_new(FileIOJob, 1);
+
+    job->host = host;
+    job->len = len;
+    job->offset = offset;
+
+    qemu_mutex_lock(&s->lock);
+    while (s->pending >= s->thread_count * FILE_IO_JOBS_PER_THREAD) {
+        qemu_cond_wait(&s->done_cond, &s->lock);
+    }
+    QSIMPLEQ_INSERT_TAIL(&s->jobs, job, next);
+    s->pending++;
+    qemu_cond_signal(&s->job_cond);
+    qemu_mutex_unlock(&s->lock);
+}
+
+/*
+ * Wait for all queued transfers to complete.
+ *
+ * Returns 0 on success, or -1 with @errp set if any of them failed.
+ */
+int file_io_wait(Error **errp)
+{
+    FileIOState *s = file_io;
+    int ret = 0;
+
+    if (!s) {
+        return 0;
+    }
+
+    qemu_mutex_lock(&s->lock);
+    while (s->pending) {
+        qemu_cond_wait(&s->done_cond, &s->lock);
+    }
+    if (s->error) {
+        error_propagate(errp, error_copy(s->error));
+        ret = -1;
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+/* Stop the page I/O threads, dropping any transfer not yet started */
+void file_io_cleanup(void)
+{
+    FileIOState *s = file_io;
+    FileIOJob *job, *next_job;
+    int i;
+
+    if (!s) {
+        return;
+    }
+
+    qemu_mutex_lock(&s->lock);
+    s->quit = true;
+    QSIMPLEQ_FOREACH_SAFE(job, &s->jobs, next, next_job) {
+        g_free(job);
+    }
+    QSIMPLEQ_INIT(&s->jobs);
+    qemu_cond_broadcast(&s->job_cond);
+    qemu_mutex_unlock(&s->lock);
+
+    for (i = 0; i < s->thread_count; i++) {
+        qemu_thread_join(&s->threads[i]);
+    }
+
+    file_io = NULL;
+    g_free(s->threads);
+    qemu_cond_destroy(&s->done_cond);
+    qemu_cond_destroy(&s->job_cond);
+    qemu_mutex_destroy(&s->lock);
+    error_free(s->error);
+    if (s->direct_ioc) {
+        object_unref(OBJECT(s->direct_ioc));
+    }
+    object_unref(OBJECT(s->ioc));
+    g_free(s);
+}
+
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    trace_migration_file_outgoing(filename);
+    fioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY | O_TRUNC,
+                                     0600, errp);
+    if (!fioc) {
+        return;
+    }
+    g_free(file_path);
+    file_path = g_strdup(filename);
+
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-outgoing");
+    migration_channel_connect(s, QIO_CHANNEL(fioc), NULL, NULL);
+    object_unref(OBJECT(fioc));
+}
+
+static gboolean file_accept_incoming_migration(QIOChannel *ioc,
+                                               GIOCondition condition,
+                                               gpointer opaque)
+{
+    migration_channel_process_incoming(ioc);
+    object_unref(OBJECT(ioc));
+    return G_SOURCE_REMOVE;
+}
+
+void file_start_incoming_migration(const char *filename, Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    trace_migration_file_incoming(filename);
+    fioc = qio_channel_file_new_path(filename, O_RDONLY, 0, errp);
+    if (!fioc) {
+        return;
+    }
+    g_free(file_path);
+    file_path = g_strdup(filename);
+
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-incoming");
+    qio_channel_add_watch_full(QIO_CHANNEL(fioc), G_IO_IN,
+                               file_accept_incoming_migration,
+                               NULL, NULL,
+                               g_main_context_get_thread_default());
+}
@@ -0,0 +1,20 @@
+/*
+ * QEMU live migration to and from a plain file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_FILE_H
+#define QEMU_MIGRATION_FILE_H
+void file_start_incoming_migration(const char *filename, Error **errp);
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp);
+
+int file_io_setup(bool writable, Error **errp);
+bool file_io_active(void);
+void file_io_queue(uint8_t *host, size_t len, off_t offset);
+int file_io_wait(Error **errp);
+void file_io_cleanup(void);
+#endif
@@ -0,0 +1,400 @@
+/*
+ * Multifd XBZRLE implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/host-utils.h"
+#include "exec/target_page.h"
+#include "exec/ramblock.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "ram.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * The data of an xbzrle packet starts with one be32 header per page,
+ * followed by the payload of each page in order.  The top byte of the
+ * header says how the page was sent, the rest is the payload length.
+ */
+#define XBZRLE_PAGE_UNCHANGED 0    /* same as the cached copy, no payload */
+#define XBZRLE_PAGE_ZERO      1    /* all zeros, no payload */
+#define XBZRLE_PAGE_NORMAL    2    /* the whole page */
+#define XBZRLE_PAGE_ENCODED   3    /* xbzrle delta against the cache */
+
+#define XBZRLE_HDR(kind, len) (((uint32_t)(kind) << 24) | (len))
+#define XBZRLE_HDR_KIND(hdr)  ((hdr) >> 24)
+#define XBZRLE_HDR_LEN(hdr)   ((hdr) & 0xffffff)
+
+struct xbzrle_data {
+    /* cache for the pages assigned to this channel */
+    PageCache *cache;
+    /* copy of the page being encoded, the guest may still write to it */
+    uint8_t *current_buf;
+    /* a page full of zeros */
+    uint8_t *zero_page;
+    /* headers and payload of the packet */
+    uint8_t *buf;
+    size_t buf_len;
+    /*
+     * Statistics, only touched by the channel thread while it has a job.
+     * multifd_xbzrle_send_sync() folds them into the global counters.
+     */
+    uint64_t pages;
+    uint64_t bytes;
+    uint64_t cache_miss;
+    uint64_t overflow;
+    uint64_t zero_pages;
+    int64_t saved_bytes;
+};
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Each channel gets an equal share of the xbzrle cache.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    size_t page_size = qemu_target_page_size();
+    uint64_t cache_pages;
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+
+    cache_pages = migrate_xbzrle_cache_size() / page_size /
+                  migrate_multifd_channels();
+    cache_pages = pow2floor(MAX(cache_pages, 1));
+    x->cache = cache_init(cache_pages * page_size, page_size, errp);
+    if (!x->cache) {
+        g_free(x);
+        return -1;
+    }
+
+    x->buf_len = page_count * (sizeof(uint32_t) + page_size);
+    x->buf = g_try_malloc(x->buf_len);
+    if (!x->buf) {
+        cache_fini(x->cache);
+        g_free(x);
+        error_setg(errp, "multifd %d: out of memory for xbzrle buffer",
+                   p->id);
+        return -1;
+    }
+    x->current_buf = g_malloc(page_size);
+    x->zero_page = g_malloc0(page_size);
+    p->data = x;
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * Free the cache and the buffers.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+
+    if (!x) {
+        return;
+    }
+    cache_fini(x->cache);
+    g_free(x->buf);
+    g_free(x->current_buf);
+    g_free(x->zero_page);
+    g_free(x);
+    p->data = NULL;
+}
+
+/**
+ * xbzrle_send_page: encode one page into the packet
+ *
+ * Follows save_xbzrle_page(): a page is only encoded once it is in the
+ * cache, and the cache always matches what the destination has.
+ *
+ * Returns the header for the page; the payload is written at @out.
+ *
+ * @x: xbzrle state of the channel
+ * @addr: ram address of the page, used as cache key
+ * @host: the guest page
+ * @update: whether the cache may be updated
+ * @out: where the payload goes, room for a whole page
+ */
+static uint32_t xbzrle_send_page(struct xbzrle_data *x, ram_addr_t addr,
+                                 const uint8_t *host, bool update,
+                                 uint8_t *out)
+{
+    size_t page_size = qemu_target_page_size();
+    /* only changes while the channels are synced, see ram_save_iterate */
+    uint64_t age = ram_counters.dirty_sync_count;
+    uint8_t *cached;
+    int len;
+
+    memcpy(x->current_buf, host, page_size);
+
+    if (buffer_is_zero(x->current_buf, page_size)) {
+        x->zero_pages++;
+        if (update) {
+            /* a stale cached copy would break the next delta */
+            cache_insert(x->cache, addr, x->zero_page, age);
+        }
+        return XBZRLE_HDR(XBZRLE_PAGE_ZERO, 0);
+    }
+
+    if (!cache_is_cached(x->cache, addr, age)) {
+        x->cache_miss++;
+        if (update) {
+            cache_insert(x->cache, addr, x->current_buf, age);
+        }
+        memcpy(out, x->current_buf, page_size);
+        return XBZRLE_HDR(XBZRLE_PAGE_NORMAL, page_size);
+    }
+
+    cached = get_cached_data(x->cache, addr);
+    len = xbzrle_encode_buffer(cached, x->current_buf, page_size, out,
+                               page_size);
+    if (update && len != 0) {
+        memcpy(cached, x->current_buf, page_size);
+    }
+
+    if (len == -1) {
+        /* sent whole, so neither an xbzrle page nor xbzrle bytes */
+        trace_save_xbzrle_page_overflow();
+        x->overflow++;
+        memcpy(out, x->current_buf, page_size);
+        return XBZRLE_HDR(XBZRLE_PAGE_NORMAL, page_size);
+    }
+
+    x->pages++;
+    if (len == 0) {
+        trace_save_xbzrle_page_skipping();
+        return XBZRLE_HDR(XBZRLE_PAGE_UNCHANGED, 0);
+    }
+
+    x->bytes += len + sizeof(uint32_t);
+    return XBZRLE_HDR(XBZRLE_PAGE_ENCODED, len);
+}
+
+/**
+ * xbzrle_send_prepare: prepare date to be able to send
+ *
+ * Encode all the pages of the packet against the channel cache.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, uint32_t used,
+                               Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+    MultiFDPages_t *pages = p->pages;
+    uint32_t *hdr = (uint32_t *)x->buf;
+    size_t out_size = used * sizeof(uint32_t);
+    uint32_t i;
+
+    for (i = 0; i < used; i++) {
+        ram_addr_t addr = pages->block->offset + pages->offset[i];
+        uint32_t h;
+
+        h = xbzrle_send_page(x, addr, pages->iov[i].iov_base,
+                             pages->xbzrle_update, x->buf + out_size);
+        out_size += XBZRLE_HDR_LEN(h);
+        hdr[i] = cpu_to_be32(h);
+    }
+
+    x->saved_bytes += (int64_t)used * qemu_target_page_size() - out_size;
+    p->next_packet_size = out_size;
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+    return 0;
+}
+
+/**
+ * xbzrle_send_write: do the actual write of the data
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_write(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+
+    return qio_channel_write_all(p->c, (void *)x->buf, p->next_packet_size,
+                                 errp);
+}
+
+/**
+ * multifd_xbzrle_send_sync: account the work done by a channel
+ *
+ * Called by the migration thread from multifd_send_sync_main(), once
+ * the channel has flushed all its packets.
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_xbzrle_send_sync(MultiFDSendParams *p)
+{
+    struct xbzrle_data *x = p->data;
+
+    xbzrle_counters.pages += x->pages;
+    xbzrle_counters.bytes += x->bytes;
+    xbzrle_counters.cache_miss += x->cache_miss;
+    xbzrle_counters.overflow += x->overflow;
+    /*
+     * multifd_queue_page() counted every page as a normal one, but only
+     * cache misses and overflows were sent whole.
+     */
+    ram_counters.duplicate += x->zero_pages;
+    ram_counters.normal -= x->zero_pages + x->pages;
+    ram_counters.multifd_bytes -= x->saved_bytes;
+    ram_counters.transferred -= x->saved_bytes;
+
+    x->pages = 0;
+    x->bytes = 0;
+    x->cache_miss = 0;
+    x->overflow = 0;
+    x->zero_pages = 0;
+    x->saved_bytes = 0;
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * The destination does not know in advance whether the source will use
+ * xbzrle, so the staging buffer is allocated by xbzrle_recv_pages().
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    return 0;
+}
+
+/**
+ * xbzrle_recv_cleanup: cleanup receive side
+ *
+ * The staging buffer is freed by multifd_load_cleanup().
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+}
+
+/**
+ * xbzrle_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the whole packet and apply each page to guest memory.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                             Error **errp)
+{
+    size_t page_size = qemu_target_page_size();
+    size_t in_size = p->next_packet_size;
+    size_t max_size = used * (sizeof(uint32_t) + page_size);
+    size_t pos = used * sizeof(uint32_t);
+    uint32_t i;
+    int ret;
+
+    if (in_size < pos || in_size > max_size) {
+        error_setg(errp, "multifd %d: xbzrle packet size %zu for %u pages",
+                   p->id, in_size, used);
+        return -1;
+    }
+
+    if (p->xbzrle_buf_len < max_size) {
+        g_free(p->xbzrle_buf);
+        p->xbzrle_buf = g_malloc(max_size);
+        p->xbzrle_buf_len = max_size;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)p->xbzrle_buf, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < used; i++) {
+        uint32_t hdr = ldl_be_p(p->xbzrle_buf + i * sizeof(uint32_t));
+        uint32_t len = XBZRLE_HDR_LEN(hdr);
+        uint8_t *host = p->pages->iov[i].iov_base;
+
+        if (len > in_size - pos) {
+            error_setg(errp, "multifd %d: xbzrle page %u overruns packet",
+                       p->id, i);
+            return -1;
+        }
+
+        switch (XBZRLE_HDR_KIND(hdr)) {
+        case XBZRLE_PAGE_UNCHANGED:
+            break;
+        case XBZRLE_PAGE_ZERO:
+            if (!buffer_is_zero(host, page_size)) {
+                memset(host, 0, page_size);
+            }
+            break;
+        case XBZRLE_PAGE_NORMAL:
+            if (len != page_size) {
+                error_setg(errp, "multifd %d: xbzrle page %u has size %u",
+                           p->id, i, len);
+                return -1;
+            }
+            memcpy(host, p->xbzrle_buf + pos, page_size);
+            break;
+        case XBZRLE_PAGE_ENCODED:
+            if (xbzrle_decode_buffer(p->xbzrle_buf + pos, len, host,
+                                     page_size) == -1) {
+                error_setg(errp, "multifd %d: xbzrle decode error", p->id);
+                return -1;
+            }
+            break;
+        default:
+            error_setg(errp, "multifd %d: unknown xbzrle page type 0x%x",
+                       p->id, XBZRLE_HDR_KIND(hdr));
+            return -1;
+        }
+        pos += len;
+    }
+
+    if (pos != in_size) {
+        error_setg(errp, "multifd %d: xbzrle packet has %zu trailing bytes",
+                   p->id, in_size - pos);
+        return -1;
+    }
+    return 0;
+}
+
+MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .send_write = xbzrle_send_write,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv_pages = xbzrle_recv_pages
+};
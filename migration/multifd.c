@@ -382,6 +382,11 @@ struct {
     int exiting;
     /* multifd ops */
     MultiFDMethods *ops;
+    /*
+     * With xbzrle every channel owns the cache for its share of guest
+     * RAM, so pages are queued per channel here instead of in pages.
+     */
+    MultiFDPages_t **channel_pages;
 } *multifd_send_state;
 
 /*
@@ -402,13 +407,38 @@ struct {
  * false.
  */
 
+/*
+ * multifd_send_job: give the pages queued in *@queue to channel @p
+ *
+ * The channel must be idle and its mutex held; it is released here.
+ * *@queue gets the (empty) pages the channel was holding.
+ */
+static void multifd_send_job(QEMUFile *f, MultiFDSendParams *p,
+                             MultiFDPages_t **queue)
+{
+    MultiFDPages_t *pages = *queue;
+    uint64_t transferred;
+
+    assert(!p->pages->used);
+    assert(!p->pages->block);
+
+    p->packet_num = multifd_send_state->packet_num++;
+    *queue = p->pages;
+    p->pages = pages;
+    transferred = ((uint64_t) pages->used) * qemu_target_page_size()
+                + p->packet_len;
+    qemu_file_update_transfer(f, transferred);
+    ram_counters.multifd_bytes += transferred;
+    ram_counters.transferred += transferred;
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&p->sem);
+}
+
 static int multifd_send_pages(QEMUFile *f)
 {
     int i;
     static int next_channel;
     MultiFDSendParams *p = NULL; /* make happy gcc */
-    MultiFDPages_t *pages = multifd_send_state->pages;
-    uint64_t transferred;
 
     if (atomic_read(&multifd_send_state->exiting)) {
         return -1;
@@ -431,27 +461,92 @@ static int multifd_send_pages(QEMUFile *f)
         }
         qemu_mutex_unlock(&p->mutex);
     }
-    assert(!p->pages->used);
-    assert(!p->pages->block);
+    multifd_send_job(f, p, &multifd_send_state->pages);
 
-    p->packet_num = multifd_send_state->packet_num++;
-    multifd_send_state->pages = p->pages;
-    p->pages = pages;
-    transferred = ((uint64_t) pages->used) * qemu_target_page_size()
-                + p->packet_len;
-    qemu_file_update_transfer(f, transferred);
-    ram_counters.multifd_bytes += transferred;
-    ram_counters.transferred += transferred;;
-    qemu_mutex_unlock(&p->mutex);
-    qemu_sem_post(&p->sem);
+    return 1;
+}
+
+/*
+ * With xbzrle a page must always go through the same channel, as it is
+ * encoded against that channel's cache.  Pages are spread in runs of one
+ * packet so that batches stay contiguous.
+ */
+static int multifd_page_channel(RAMBlock *block, ram_addr_t offset)
+{
+    uint64_t addr = block->offset + offset;
+
+    return (addr / MULTIFD_PACKET_SIZE) % migrate_multifd_channels();
+}
+
+static int multifd_send_channel_pages(QEMUFile *f, int id)
+{
+    MultiFDSendParams *p = &multifd_send_state->params[id];
+
+    if (atomic_read(&multifd_send_state->exiting)) {
+        return -1;
+    }
+
+    qemu_mutex_lock(&p->mutex);
+    while (p->pending_job && !p->quit) {
+        qemu_cond_wait(&p->job_done, &p->mutex);
+    }
+    if (p->quit) {
+        error_report("%s: channel %d has already quit!", __func__, id);
+        qemu_mutex_unlock(&p->mutex);
+        return -1;
+    }
+    p->pending_job++;
+    multifd_send_job(f, p, &multifd_send_state->channel_pages[id]);
 
     return 1;
 }
 
-int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset)
+static int multifd_queue_channel_page(QEMUFile *f, RAMBlock *block,
+                                      ram_addr_t offset, bool xbzrle_update)
 {
-    MultiFDPages_t *pages = multifd_send_state->pages;
+    int id = multifd_page_channel(block, offset);
+    MultiFDPages_t *pages = multifd_send_state->channel_pages[id];
+
+    if (pages->block && pages->block != block) {
+        if (multifd_send_channel_pages(f, id) < 0) {
+            return -1;
+        }
+        pages = multifd_send_state->channel_pages[id];
+    }
+
+    pages->block = block;
+    pages->xbzrle_update = xbzrle_update;
+    pages->offset[pages->used] = offset;
+    pages->iov[pages->used].iov_base = block->host + offset;
+    pages->iov[pages->used].iov_len = qemu_target_page_size();
+    pages->used++;
+
+    if (pages->used == pages->allocated) {
+        return multifd_send_channel_pages(f, id);
+    }
+    return 1;
+}
+
+/**
+ * multifd_queue_page: queue a page to be sent by the multifd channels
+ *
+ * Returns 1 on success or -1 on error
+ *
+ * @f: QEMUFile used for bandwidth accounting
+ * @block: block that contains the page
+ * @offset: offset inside the block for the page
+ * @xbzrle_update: whether xbzrle may add the page to its cache
+ */
+int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset,
+                       bool xbzrle_update)
+{
+    MultiFDPages_t *pages;
 
+    if (multifd_send_state->channel_pages) {
+        return multifd_queue_channel_page(f, block, offset, xbzrle_update);
+    }
+
+    pages = multifd_send_state->pages;
     if (!pages->block) {
         pages->block = block;
     }
@@ -472,7 +567,7 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset)
     }
 
     if (pages->block != block) {
-        return  multifd_queue_page(f, block, offset);
+        return  multifd_queue_page(f, block, offset, xbzrle_update);
     }
 
     return 1;
@@ -512,6 +607,7 @@ static void multifd_send_terminate_threads(Error *err)
         qemu_mutex_lock(&p->mutex);
         p->quit = true;
         qemu_sem_post(&p->sem);
+        qemu_cond_signal(&p->job_done);
         qemu_mutex_unlock(&p->mutex);
     }
 }
@@ -520,7 +616,7 @@ void multifd_save_cleanup(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_use_channels()) {
         return;
     }
     multifd_send_terminate_threads(NULL);
@@ -540,10 +636,14 @@ void multifd_save_cleanup(void)
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem);
         qemu_sem_destroy(&p->sem_sync);
+        qemu_cond_destroy(&p->job_done);
         g_free(p->name);
         p->name = NULL;
         multifd_pages_clear(p->pages);
         p->pages = NULL;
+        if (multifd_send_state->channel_pages) {
+            multifd_pages_clear(multifd_send_state->channel_pages[i]);
+        }
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
@@ -556,6 +656,8 @@ void multifd_save_cleanup(void)
     qemu_sem_destroy(&multifd_send_state->channels_ready);
     g_free(multifd_send_state->params);
     multifd_send_state->params = NULL;
+    g_free(multifd_send_state->channel_pages);
+    multifd_send_state->channel_pages = NULL;
     multifd_pages_clear(multifd_send_state->pages);
     multifd_send_state->pages = NULL;
     g_free(multifd_send_state);
@@ -566,10 +668,18 @@ void multifd_send_sync_main(QEMUFile *f)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_use_channels()) {
         return;
     }
-    if (multifd_send_state->pages->used) {
+    if (multifd_send_state->channel_pages) {
+        for (i = 0; i < migrate_multifd_channels(); i++) {
+            if (multifd_send_state->channel_pages[i]->used &&
+                multifd_send_channel_pages(f, i) < 0) {
+                error_report("%s: multifd_send_channel_pages fail", __func__);
+                return;
+            }
+        }
+    } else if (multifd_send_state->pages->used) {
         if (multifd_send_pages(f) < 0) {
             error_report("%s: multifd_send_pages fail", __func__);
             return;
@@ -602,6 +712,9 @@ void multifd_send_sync_main(QEMUFile *f)
 
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
+        if (multifd_send_state->ops == &multifd_xbzrle_ops) {
+            multifd_xbzrle_send_sync(p);
+        }
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
@@ -670,12 +783,16 @@ static void *multifd_send_thread(void *opaque)
 
             qemu_mutex_lock(&p->mutex);
             p->pending_job--;
+            qemu_cond_signal(&p->job_done);
             qemu_mutex_unlock(&p->mutex);
 
             if (flags & MULTIFD_FLAG_SYNC) {
                 qemu_sem_post(&p->sem_sync);
             }
-            qemu_sem_post(&multifd_send_state->channels_ready);
+            /* with xbzrle the migration thread waits on job_done instead */
+            if (!multifd_send_state->channel_pages) {
+                qemu_sem_post(&multifd_send_state->channels_ready);
+            }
         } else if (p->quit) {
             qemu_mutex_unlock(&p->mutex);
             break;
@@ -723,6 +840,7 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
         /* Error happen, we need to tell who pay attention to me */
         qemu_sem_post(&multifd_send_state->channels_ready);
         qemu_sem_post(&p->sem_sync);
+        qemu_cond_signal(&p->job_done);
         /*
          * Although multifd_send_thread is not created, but main migration
          * thread neet to judge whether it is running, so we need to mark
@@ -740,13 +858,33 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
     }
 }
 
+/*
+ * With mapped-ram, multifd pages go to the migration file through the
+ * file I/O threads and no multifd channel is created.
+ */
+bool multifd_use_channels(void)
+{
+    return migrate_use_multifd() && !migrate_mapped_ram();
+}
+
+/*
+ * XBZRLE runs on the send channels when multifd is used, unless pages
+ * are already being compressed.
+ */
+bool multifd_use_xbzrle(void)
+{
+    return migrate_use_multifd() && migrate_use_xbzrle() &&
+           !migrate_use_compression() &&
+           migrate_multifd_compression() == MULTIFD_COMPRESSION_NONE;
+}
+
 int multifd_save_setup(Error **errp)
 {
     int thread_count;
     uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_use_channels()) {
         return 0;
     }
     thread_count = migrate_multifd_channels();
@@ -755,7 +893,13 @@ int multifd_save_setup(Error **errp)
     multifd_send_state->pages = multifd_pages_init(page_count);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
     atomic_set(&multifd_send_state->exiting, 0);
-    multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
+    if (multifd_use_xbzrle()) {
+        multifd_send_state->ops = &multifd_xbzrle_ops;
+        multifd_send_state->channel_pages = g_new0(MultiFDPages_t *,
+                                                   thread_count);
+    } else {
+        multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
+    }
 
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
@@ -763,10 +907,15 @@ int multifd_save_setup(Error **errp)
         qemu_mutex_init(&p->mutex);
         qemu_sem_init(&p->sem, 0);
         qemu_sem_init(&p->sem_sync, 0);
+        qemu_cond_init(&p->job_done);
         p->quit = false;
         p->pending_job = 0;
         p->id = i;
         p->pages = multifd_pages_init(page_count);
+        if (multifd_send_state->channel_pages) {
+            multifd_send_state->channel_pages[i] =
+                multifd_pages_init(page_count);
+        }
         p->packet_len = sizeof(MultiFDPacket_t)
                       + sizeof(uint64_t) * page_count;
         p->packet = g_malloc0(p->packet_len);
@@ -840,7 +989,7 @@ int multifd_load_cleanup(Error **errp)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_use_channels()) {
         return 0;
     }
     multifd_recv_terminate_threads(NULL);
@@ -871,6 +1020,9 @@ int multifd_load_cleanup(Error **errp)
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
+        g_free(p->xbzrle_buf);
+        p->xbzrle_buf = NULL;
+        p->xbzrle_buf_len = 0;
         multifd_recv_state->ops->recv_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
@@ -886,7 +1038,7 @@ void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_use_channels()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -953,7 +1105,14 @@ static void *multifd_recv_thread(void *opaque)
         qemu_mutex_unlock(&p->mutex);
 
         if (used) {
-            ret = multifd_recv_state->ops->recv_pages(p, used, &local_err);
+            MultiFDMethods *ops = multifd_recv_state->ops;
+
+            /* xbzrle is chosen by the source alone, see multifd_use_xbzrle */
+            if ((flags & MULTIFD_FLAG_COMPRESSION_MASK) ==
+                MULTIFD_FLAG_XBZRLE) {
+                ops = &multifd_xbzrle_ops;
+            }
+            ret = ops->recv_pages(p, used, &local_err);
             if (ret != 0) {
                 break;
             }
@@ -985,7 +1144,7 @@ int multifd_load_setup(Error **errp)
     uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_use_channels()) {
         return 0;
     }
     thread_count = migrate_multifd_channels();
@@ -1027,7 +1186,7 @@ bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_use_channels()) {
         return true;
     }
 
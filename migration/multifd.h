@@ -21,7 +21,10 @@ bool multifd_recv_all_channels_created(void);
 bool multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
 void multifd_send_sync_main(QEMUFile *f);
-int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
+int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset,
+                       bool xbzrle_update);
+bool multifd_use_xbzrle(void);
+bool multifd_use_channels(void);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
@@ -32,6 +35,7 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_XBZRLE (3 << 1)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -63,6 +67,8 @@ typedef struct {
     /* pointer to each page */
     struct iovec *iov;
     RAMBlock *block;
+    /* xbzrle: pages may be added to the channel cache */
+    bool xbzrle_update;
 } MultiFDPages_t;
 
 typedef struct {
@@ -104,6 +110,8 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* signalled when pending_job drops, protected by mutex */
+    QemuCond job_done;
     /* used for compression methods */
     void *data;
 }  MultiFDSendParams;
@@ -145,6 +153,9 @@ typedef struct {
     QemuSemaphore sem_sync;
     /* used for de-compression methods */
     void *data;
+    /* xbzrle packets are staged here, allocated on first use */
+    uint8_t *xbzrle_buf;
+    size_t xbzrle_buf_len;
 } MultiFDRecvParams;
 
 typedef struct {
@@ -166,5 +177,8 @@ typedef struct {
 
 void multifd_register_ops(int method, MultiFDMethods *ops);
 
+extern MultiFDMethods multifd_xbzrle_ops;
+void multifd_xbzrle_send_sync(MultiFDSendParams *p);
+
 #endif
 
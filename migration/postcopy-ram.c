@@ -1270,6 +1270,142 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
     }
 }
 
+/*
+ * Write-protect tracking, used by background snapshots on the source side:
+ * guest RAM is write-protected and each write fault is reported through
+ * the userfaultfd so the page can be saved before it is modified.
+ */
+
+/**
+ * uffd_wp_open: open a non-blocking userfaultfd with write-protect faults
+ *
+ * Returns: the fd on success, -1 if the host lacks support
+ */
+int uffd_wp_open(void)
+{
+    struct uffdio_api api_struct = {0};
+    uint64_t ioctl_mask;
+    int ufd;
+
+    ufd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (ufd == -1) {
+        return -1;
+    }
+
+    api_struct.api = UFFD_API;
+    api_struct.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+    if (ioctl(ufd, UFFDIO_API, &api_struct)) {
+        close(ufd);
+        return -1;
+    }
+
+    ioctl_mask = (__u64)1 << _UFFDIO_REGISTER |
+                 (__u64)1 << _UFFDIO_UNREGISTER;
+    if ((api_struct.ioctls & ioctl_mask) != ioctl_mask) {
+        close(ufd);
+        return -1;
+    }
+
+    return ufd;
+}
+
+/* Returns true if the host kernel supports userfaultfd write-protection */
+bool uffd_wp_supported_by_host(void)
+{
+    int ufd = uffd_wp_open();
+
+    if (ufd < 0) {
+        return false;
+    }
+    close(ufd);
+    return true;
+}
+
+/**
+ * uffd_wp_register: register a memory range for write-protect faults
+ *
+ * Returns: 0 on success, -errno if the range can't be write-protected
+ * (e.g. shared or hugetlbfs memory on kernels lacking support for it)
+ */
+int uffd_wp_register(int ufd, void *host, uint64_t length)
+{
+    struct uffdio_register reg_struct;
+
+    reg_struct.range.start = (uintptr_t)host;
+    reg_struct.range.len = length;
+    reg_struct.mode = UFFDIO_REGISTER_MODE_WP;
+
+    if (ioctl(ufd, UFFDIO_REGISTER, &reg_struct)) {
+        return -errno;
+    }
+    if (!(reg_struct.ioctls & ((__u64)1 << _UFFDIO_WRITEPROTECT))) {
+        uffd_wp_unregister(ufd, host, length);
+        return -ENOTSUP;
+    }
+    return 0;
+}
+
+int uffd_wp_unregister(int ufd, void *host, uint64_t length)
+{
+    struct uffdio_range range_struct;
+
+    range_struct.start = (uintptr_t)host;
+    range_struct.len = length;
+
+    if (ioctl(ufd, UFFDIO_UNREGISTER, &range_struct)) {
+        return -errno;
+    }
+    return 0;
+}
+
+/**
+ * uffd_wp_protect: set or clear write protection on a registered range
+ *
+ * Clearing the protection also wakes up any thread faulting on the range.
+ *
+ * Returns: 0 on success, -errno on failure
+ */
+int uffd_wp_protect(int ufd, void *host, uint64_t length, bool wp)
+{
+    struct uffdio_writeprotect wp_struct;
+
+    wp_struct.range.start = (uintptr_t)host;
+    wp_struct.range.len = length;
+    wp_struct.mode = wp ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+
+    if (ioctl(ufd, UFFDIO_WRITEPROTECT, &wp_struct)) {
+        int e = errno;
+        error_report("%s: %s host: %p length: %" PRIu64,
+                     __func__, strerror(e), host, length);
+        return -e;
+    }
+    return 0;
+}
+
+/**
+ * uffd_wp_read_fault: fetch a pending write-protect fault, if any
+ *
+ * Returns: the faulting host address, or NULL if there is nothing pending
+ */
+void *uffd_wp_read_fault(int ufd)
+{
+    struct uffd_msg msg;
+    ssize_t ret;
+
+    do {
+        ret = read(ufd, &msg, sizeof(msg));
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret != sizeof(msg)) {
+        return NULL;
+    }
+    if (msg.event != UFFD_EVENT_PAGEFAULT ||
+        !(msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP)) {
+        return NULL;
+    }
+    return (void *)(uintptr_t)msg.arg.pagefault.address;
+}
+
 #else
 /* No target OS support, stubs just fail */
 void fill_destination_postcopy_migration_info(MigrationInfo *info)
@@ -1334,6 +1470,38 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
     assert(0);
     return -1;
 }
+
+int uffd_wp_open(void)
+{
+    return -1;
+}
+
+bool uffd_wp_supported_by_host(void)
+{
+    return false;
+}
+
+int uffd_wp_register(int ufd, void *host, uint64_t length)
+{
+    return -ENOSYS;
+}
+
+int uffd_wp_unregister(int ufd, void *host, uint64_t length)
+{
+    assert(0);
+    return -1;
+}
+
+int uffd_wp_protect(int ufd, void *host, uint64_t length, bool wp)
+{
+    assert(0);
+    return -1;
+}
+
+void *uffd_wp_read_fault(int ufd)
+{
+    return NULL;
+}
 #endif
 
 /* ------------------------------------------------------------------------- */
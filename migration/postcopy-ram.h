@@ -179,4 +179,15 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd, uint64_t client_addr,
 int postcopy_request_shared_page(struct PostCopyFD *pcfd, RAMBlock *rb,
                                  uint64_t client_addr, uint64_t offset);
 
+/*
+ * userfaultfd write-protect helpers, used to track guest writes during
+ * background snapshots.
+ */
+bool uffd_wp_supported_by_host(void);
+int uffd_wp_open(void);
+int uffd_wp_register(int ufd, void *host, uint64_t length);
+int uffd_wp_unregister(int ufd, void *host, uint64_t length);
+int uffd_wp_protect(int ufd, void *host, uint64_t length, bool wp);
+void *uffd_wp_read_fault(int ufd);
+
 #endif
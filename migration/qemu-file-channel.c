@@ -27,6 +27,7 @@
 #include "qemu-file.h"
 #include "io/channel-socket.h"
 #include "qemu/iov.h"
+#include "qapi/error.h"
 
 
 static ssize_t channel_writev_buffer(void *opaque,
@@ -99,6 +100,88 @@ static ssize_t channel_get_buffer(void *opaque,
 }
 
 
+static ssize_t channel_write_buffer_at(void *opaque,
+                                       const uint8_t *buf,
+                                       size_t size,
+                                       off_t pos,
+                                       Error **errp)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t len;
+
+        len = qio_channel_pwrite(ioc, (const char *)buf + done, size - done,
+                                 pos + done, errp);
+        if (len == QIO_CHANNEL_ERR_BLOCK) {
+            error_setg(errp, "Unexpected blocking write at offset %lld",
+                       (long long)(pos + done));
+            return -EIO;
+        }
+        if (len < 0) {
+            return -EIO;
+        }
+        if (len == 0) {
+            error_setg(errp, "Unable to write at offset %lld: no progress",
+                       (long long)(pos + done));
+            return -EIO;
+        }
+        done += len;
+    }
+
+    return done;
+}
+
+
+static ssize_t channel_get_buffer_at(void *opaque,
+                                     uint8_t *buf,
+                                     size_t size,
+                                     off_t pos,
+                                     Error **errp)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t len;
+
+        len = qio_channel_pread(ioc, (char *)buf + done, size - done,
+                                pos + done, errp);
+        if (len == QIO_CHANNEL_ERR_BLOCK) {
+            error_setg(errp, "Unexpected blocking read at offset %lld",
+                       (long long)(pos + done));
+            return -EIO;
+        }
+        if (len < 0) {
+            return -EIO;
+        }
+        if (len == 0) {
+            break;
+        }
+        done += len;
+    }
+
+    return done;
+}
+
+
+static off_t channel_seek(void *opaque,
+                          off_t offset,
+                          int whence,
+                          Error **errp)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    off_t ret;
+
+    ret = qio_channel_io_seek(ioc, offset, whence, errp);
+    if (ret == (off_t)-1) {
+        return -EIO;
+    }
+    return ret;
+}
+
+
 static int channel_close(void *opaque, Error **errp)
 {
     int ret;
@@ -178,14 +261,42 @@ static const QEMUFileOps channel_output_ops = {
 };
 
 
+static const QEMUFileOps channel_seekable_input_ops = {
+    .get_buffer = channel_get_buffer,
+    .close = channel_close,
+    .shut_down = channel_shutdown,
+    .set_blocking = channel_set_blocking,
+    .get_return_path = channel_get_input_return_path,
+    .get_buffer_at = channel_get_buffer_at,
+    .seek = channel_seek,
+};
+
+
+static const QEMUFileOps channel_seekable_output_ops = {
+    .writev_buffer = channel_writev_buffer,
+    .close = channel_close,
+    .shut_down = channel_shutdown,
+    .set_blocking = channel_set_blocking,
+    .get_return_path = channel_get_output_return_path,
+    .write_buffer_at = channel_write_buffer_at,
+    .seek = channel_seek,
+};
+
+
 QEMUFile *qemu_fopen_channel_input(QIOChannel *ioc)
 {
     object_ref(OBJECT(ioc));
+    if (qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        return qemu_fopen_ops(ioc, &channel_seekable_input_ops);
+    }
     return qemu_fopen_ops(ioc, &channel_input_ops);
 }
 
 QEMUFile *qemu_fopen_channel_output(QIOChannel *ioc)
 {
     object_ref(OBJECT(ioc));
+    if (qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        return qemu_fopen_ops(ioc, &channel_seekable_output_ops);
+    }
     return qemu_fopen_ops(ioc, &channel_output_ops);
 }
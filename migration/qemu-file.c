@@ -173,6 +173,17 @@ bool qemu_file_is_writable(QEMUFile *f)
     return f->ops->writev_buffer;
 }
 
+bool qemu_file_is_seekable(QEMUFile *f)
+{
+    if (!f->ops->seek) {
+        return false;
+    }
+    if (qemu_file_is_writable(f)) {
+        return f->ops->write_buffer_at;
+    }
+    return f->ops->get_buffer_at;
+}
+
 static void qemu_iovec_release_ram(QEMUFile *f)
 {
     struct iovec iov;
@@ -804,6 +815,113 @@ int qemu_put_qemu_file(QEMUFile *f_des, QEMUFile *f_src)
     return len;
 }
 
+/*
+ * Write @buflen bytes of @buf at offset @pos of the underlying file.
+ * The stream position is unchanged.
+ */
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                        off_t pos)
+{
+    Error *local_error = NULL;
+    ssize_t ret;
+
+    if (f->last_error) {
+        return;
+    }
+
+    ret = f->ops->write_buffer_at(f->opaque, buf, buflen, pos, &local_error);
+    if (ret != buflen) {
+        qemu_file_set_error_obj(f, ret < 0 ? ret : -EIO, local_error);
+        return;
+    }
+
+    f->bytes_xfer += buflen;
+    qemu_update_position(f, buflen);
+}
+
+/*
+ * Read @buflen bytes at offset @pos of the underlying file into @buf.
+ * The stream position is unchanged.
+ *
+ * Returns the number of bytes read; anything short of @buflen also sets
+ * the error state of @f.
+ */
+size_t qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t buflen,
+                          off_t pos)
+{
+    Error *local_error = NULL;
+    ssize_t ret;
+
+    if (f->last_error) {
+        return 0;
+    }
+
+    ret = f->ops->get_buffer_at(f->opaque, buf, buflen, pos, &local_error);
+    if (ret != buflen) {
+        qemu_file_set_error_obj(f, ret < 0 ? ret : -EIO, local_error);
+        return ret < 0 ? 0 : ret;
+    }
+
+    return buflen;
+}
+
+/*
+ * Return the offset of the stream within the underlying file, taking
+ * buffered data into account, or a negative errno value.
+ */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *local_error = NULL;
+    off_t ret;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    }
+    if (f->last_error) {
+        return f->last_error;
+    }
+
+    ret = f->ops->seek(f->opaque, 0, SEEK_CUR, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, ret, local_error);
+        return ret;
+    }
+
+    if (!qemu_file_is_writable(f)) {
+        ret -= f->buf_size - f->buf_index;
+    }
+    return ret;
+}
+
+/*
+ * Move the stream to offset @off of the underlying file, interpreted
+ * relative to @whence.  Pending writes are flushed and buffered reads
+ * are dropped first.
+ */
+void qemu_set_offset(QEMUFile *f, off_t off, int whence)
+{
+    Error *local_error = NULL;
+    off_t ret;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        if (whence == SEEK_CUR) {
+            off -= f->buf_size - f->buf_index;
+        }
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+    if (f->last_error) {
+        return;
+    }
+
+    ret = f->ops->seek(f->opaque, off, whence, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, ret, local_error);
+    }
+}
+
 /*
  * Get a string whose length is determined by a single preceding byte
  * A preallocated 256 byte buffer must be passed in.
@@ -103,6 +103,31 @@ typedef QEMUFile *(QEMURetPathFunc)(void *opaque);
 typedef int (QEMUFileShutdownFunc)(void *opaque, bool rd, bool wr,
                                    Error **errp);
 
+/*
+ * Write a buffer at an absolute offset of the underlying file without
+ * moving the stream position.  The handler must write all of the data
+ * or return a negative errno value.
+ */
+typedef ssize_t (QEMUFileWriteBufferAtFunc)(void *opaque, const uint8_t *buf,
+                                            size_t size, off_t pos,
+                                            Error **errp);
+
+/*
+ * Read a buffer from an absolute offset of the underlying file without
+ * moving the stream position.  Returns the number of bytes read, which
+ * is only short at end of file, or a negative errno value.
+ */
+typedef ssize_t (QEMUFileGetBufferAtFunc)(void *opaque, uint8_t *buf,
+                                          size_t size, off_t pos,
+                                          Error **errp);
+
+/*
+ * Reposition the stream of the underlying file, with lseek() semantics.
+ * Returns the resulting offset, or a negative errno value.
+ */
+typedef off_t (QEMUFileSeekFunc)(void *opaque, off_t offset, int whence,
+                                 Error **errp);
+
 typedef struct QEMUFileOps {
     QEMUFileGetBufferFunc *get_buffer;
     QEMUFileCloseFunc *close;
@@ -110,6 +135,9 @@ typedef struct QEMUFileOps {
     QEMUFileWritevBufferFunc *writev_buffer;
     QEMURetPathFunc *get_return_path;
     QEMUFileShutdownFunc *shut_down;
+    QEMUFileWriteBufferAtFunc *write_buffer_at;
+    QEMUFileGetBufferAtFunc *get_buffer_at;
+    QEMUFileSeekFunc *seek;
 } QEMUFileOps;
 
 typedef struct QEMUFileHooks {
@@ -133,6 +161,7 @@ void qemu_put_buffer_async(QEMUFile *f, const uint8_t *buf, size_t size,
                            bool may_free);
 bool qemu_file_mode_is_not_valid(const char *mode);
 bool qemu_file_is_writable(QEMUFile *f);
+bool qemu_file_is_seekable(QEMUFile *f);
 
 #include "migration/qemu-file-types.h"
 
@@ -142,6 +171,18 @@ ssize_t qemu_put_compression_data(QEMUFile *f, z_stream *stream,
                                   const uint8_t *p, size_t size);
 int qemu_put_qemu_file(QEMUFile *f_des, QEMUFile *f_src);
 
+/*
+ * Random access helpers, only usable when qemu_file_is_seekable().
+ * Data written with qemu_put_buffer_at() bypasses the stream buffer but
+ * is accounted as transferred.
+ */
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                        off_t pos);
+size_t qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t buflen,
+                          off_t pos);
+off_t qemu_get_offset(QEMUFile *f);
+void qemu_set_offset(QEMUFile *f, off_t off, int whence);
+
 /*
  * Note that you can only peek continuous bytes from where the current pointer
  * is; you aren't guaranteed to be able to peak to +n bytes unless you've
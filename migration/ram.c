@@ -55,6 +55,7 @@
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "file.h"
 
 /***********************************************************/
 /* ram save/restore */
@@ -75,6 +76,15 @@
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
 
+/*
+ * mapped-ram layout: version of the per-RAMBlock header, and alignment of
+ * the region holding the pages of each block in the migration file.
+ */
+#define MAPPED_RAM_HDR_VERSION         1
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+/* Largest transfer handed to the file I/O threads at once */
+#define MAPPED_RAM_MAX_IO_SIZE           (512 * 1024)
+
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
     return buffer_is_zero(p, size);
@@ -353,6 +363,12 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* userfaultfd tracking guest writes during background snapshot */
+    int uffdio_fd;
+    /* mapped-ram: run of pages not yet queued to the file I/O threads */
+    RAMBlock *mapped_ram_block;
+    ram_addr_t mapped_ram_offset;
+    size_t mapped_ram_len;
 };
 typedef struct RAMState RAMState;
 
@@ -665,7 +681,7 @@ static void mig_throttle_guest_down(uint64_t bytes_dirty_period,
  */
 static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
 {
-    if (rs->ram_bulk_stage || !migrate_use_xbzrle()) {
+    if (rs->ram_bulk_stage || !migrate_use_xbzrle() || multifd_use_xbzrle()) {
         return;
     }
 
@@ -1178,7 +1194,11 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
 {
     int pages = -1;
     uint8_t *p;
-    bool send_async = true;
+    /*
+     * A background snapshot removes the write protection of a page as soon
+     * as it has been queued, so the data must be copied out right away.
+     */
+    bool send_async = !migrate_background_snapshot();
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
     ram_addr_t current_addr = block->offset + offset;
@@ -1209,10 +1229,95 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
     return pages;
 }
 
+/* Hand the pending run of mapped-ram pages to the file I/O threads */
+static void mapped_ram_queue_pending(RAMState *rs)
+{
+    RAMBlock *block = rs->mapped_ram_block;
+
+    if (rs->mapped_ram_len) {
+        file_io_queue(block->host + rs->mapped_ram_offset,
+                      rs->mapped_ram_len,
+                      block->pages_offset + rs->mapped_ram_offset);
+        rs->mapped_ram_len = 0;
+    }
+}
+
+/**
+ * mapped_ram_save_wait: wait for the mapped-ram pages written so far
+ *
+ * Pages must be in the file before the dirty bitmap is synced again,
+ * otherwise an older copy of a page could land after a newer one.
+ *
+ * Returns zero on success or negative on error, which is also set on
+ * the migration stream.
+ *
+ * @rs: current RAM state
+ */
+static int mapped_ram_save_wait(RAMState *rs)
+{
+    Error *local_err = NULL;
+
+    mapped_ram_queue_pending(rs);
+    if (file_io_wait(&local_err) < 0) {
+        qemu_file_set_error_obj(rs->f, -EIO, local_err);
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * save_mapped_ram_page: write a page to its fixed slot in the file
+ *
+ * Zero pages are not written; their bit is cleared in the file bitmap so
+ * that any stale copy from an earlier iteration is ignored on load (the
+ * destination RAM starts out zeroed).  When the file I/O threads are
+ * running, contiguous pages are batched and written by them instead.
+ *
+ * Returns the number of pages written.
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int save_mapped_ram_page(RAMState *rs, RAMBlock *block,
+                                ram_addr_t offset)
+{
+    uint8_t *p = block->host + offset;
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+
+    if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+        clear_bit(page, block->file_bmap);
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    if (file_io_active()) {
+        /* Extend the pending run, or queue it and start a new one */
+        if (rs->mapped_ram_block != block ||
+            rs->mapped_ram_offset + rs->mapped_ram_len != offset ||
+            rs->mapped_ram_len >= MAPPED_RAM_MAX_IO_SIZE) {
+            mapped_ram_queue_pending(rs);
+            rs->mapped_ram_block = block;
+            rs->mapped_ram_offset = offset;
+        }
+        rs->mapped_ram_len += TARGET_PAGE_SIZE;
+        qemu_file_update_transfer(rs->f, TARGET_PAGE_SIZE);
+    } else {
+        qemu_put_buffer_at(rs->f, p, TARGET_PAGE_SIZE,
+                           block->pages_offset + offset);
+    }
+    set_bit(page, block->file_bmap);
+    ram_counters.transferred += TARGET_PAGE_SIZE;
+    ram_counters.normal++;
+    return 1;
+}
+
 static int ram_save_multifd_page(RAMState *rs, RAMBlock *block,
-                                 ram_addr_t offset)
+                                 ram_addr_t offset, bool last_stage)
 {
-    if (multifd_queue_page(rs->f, block, offset) < 0) {
+    bool xbzrle_update = !rs->ram_bulk_stage && !last_stage;
+
+    if (multifd_queue_page(rs->f, block, offset, xbzrle_update) < 0) {
         return -1;
     }
     ram_counters.normal++;
@@ -1440,6 +1545,35 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
     return block;
 }
 
+/**
+ * poll_fault_page: try to get the next write fault from the guest
+ *
+ * Only used during background snapshot, returns NULL if no fault is
+ * pending.
+ *
+ * @rs: current RAM state
+ * @offset: used to return the offset within the RAMBlock
+ */
+static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
+{
+    RAMBlock *block;
+    void *host;
+
+    if (rs->uffdio_fd < 0) {
+        return NULL;
+    }
+
+    host = uffd_wp_read_fault(rs->uffdio_fd);
+    if (!host) {
+        return NULL;
+    }
+
+    block = qemu_ram_block_from_host(host, false, offset);
+    assert(block && (block->flags & RAM_UF_WRITEPROTECT));
+    trace_ram_write_tracking_fault(block->idstr, (uint64_t)*offset);
+    return block;
+}
+
 /**
  * get_queued_page: unqueue a page from the postcopy requests
  *
@@ -1479,6 +1613,14 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
 
     } while (block && !dirty);
 
+    if (!block) {
+        /*
+         * With a background snapshot, vCPUs blocked on a write-protected
+         * page are waiting for it to be saved, serve them first.
+         */
+        block = poll_fault_page(rs, &offset);
+    }
+
     if (block) {
         /*
          * As soon as we start servicing pages out of order, then we have
@@ -1665,10 +1807,22 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return res;
     }
 
+    if (migrate_mapped_ram()) {
+        return save_mapped_ram_page(rs, block, offset);
+    }
+
     if (save_compress_page(rs, block, offset)) {
         return 1;
     }
 
+    /*
+     * With XBZRLE the multifd channels look for zero pages themselves, so
+     * that their caches never hold a copy of a page that was zeroed.
+     */
+    if (multifd_use_xbzrle() && !migration_in_postcopy()) {
+        return ram_save_multifd_page(rs, block, offset, last_stage);
+    }
+
     res = save_zero_page(rs, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -1691,12 +1845,39 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
      */
     if (!save_page_use_compression(rs) && migrate_use_multifd()
         && !migration_in_postcopy()) {
-        return ram_save_multifd_page(rs, block, offset);
+        return ram_save_multifd_page(rs, block, offset, last_stage);
     }
 
     return ram_save_page(rs, pss, last_stage);
 }
 
+/**
+ * ram_save_release_protection: drop write protection from saved pages
+ *
+ * During background snapshot every page of the host page has been
+ * copied out (or was saved earlier), so the guest may write to it again.
+ *
+ * Returns 0 on success or -errno on failure
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we have just sent
+ * @start_page: first page of the range that was scanned
+ */
+static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
+                                       unsigned long start_page)
+{
+    void *host;
+    uint64_t length;
+
+    if (!(pss->block->flags & RAM_UF_WRITEPROTECT)) {
+        return 0;
+    }
+
+    host = pss->block->host + (start_page << TARGET_PAGE_BITS);
+    length = (pss->page - start_page + 1) << TARGET_PAGE_BITS;
+    return uffd_wp_protect(rs->uffdio_fd, host, length, false);
+}
+
 /**
  * ram_save_host_page: save a whole host page
  *
@@ -1721,6 +1902,8 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
     int tmppages, pages = 0;
     size_t pagesize_bits =
         qemu_ram_pagesize(pss->block) >> TARGET_PAGE_BITS;
+    unsigned long start_page = pss->page;
+    int res;
 
     if (ramblock_is_ignored(pss->block)) {
         error_report("block %s should not be migrated !", pss->block->idstr);
@@ -1749,7 +1932,9 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
 
     /* The offset we leave with is the last one we looked at */
     pss->page--;
-    return pages;
+
+    res = ram_save_release_protection(rs, pss, start_page);
+    return res < 0 ? res : pages;
 }
 
 /**
@@ -1889,15 +2074,22 @@ static void ram_save_cleanup(void *opaque)
     /* caller have hold iothread lock or is in a bh, so there is
      * no writing race against the migration bitmap
      */
-    memory_global_dirty_log_stop();
+    if (migrate_background_snapshot()) {
+        ram_write_tracking_stop();
+    } else {
+        memory_global_dirty_log_stop();
+    }
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->clear_bmap);
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
+    file_io_cleanup();
     xbzrle_cleanup();
     compress_threads_save_cleanup();
     ram_state_cleanup(rsp);
@@ -2229,7 +2421,8 @@ static int xbzrle_init(void)
 {
     Error *local_err = NULL;
 
-    if (!migrate_use_xbzrle()) {
+    /* with multifd every channel has its own cache */
+    if (!migrate_use_xbzrle() || multifd_use_xbzrle()) {
         return 0;
     }
 
@@ -2290,6 +2483,7 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    (*rsp)->uffdio_fd = -1;
 
     /*
      * Count the total number of pages used by ram blocks not including any
@@ -2349,8 +2543,14 @@ static void ram_init_bitmaps(RAMState *rs)
 
     WITH_RCU_READ_LOCK_GUARD() {
         ram_list_init_bitmaps();
-        memory_global_dirty_log_start();
-        migration_bitmap_sync_precopy(rs);
+        /*
+         * A background snapshot saves every page exactly once and tracks
+         * guest writes with userfaultfd instead of the dirty log.
+         */
+        if (!migrate_background_snapshot()) {
+            memory_global_dirty_log_start();
+            migration_bitmap_sync_precopy(rs);
+        }
     }
     qemu_mutex_unlock_ramlist();
     qemu_mutex_unlock_iothread();
@@ -2461,6 +2661,207 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * granularity of these critical sections.
  */
 
+/**
+ * mapped_ram_setup_ramblock: reserve the file regions of a RAMBlock
+ *
+ * Writes the mapped-ram header of @block to the stream and moves the
+ * stream past the region reserved for the block's bitmap and pages, so
+ * that pages can later be written at fixed offsets.
+ *
+ * Returns zero on success or negative on error
+ *
+ * @f: QEMUFile where to send the data
+ * @block: RAMBlock being described
+ */
+static int mapped_ram_setup_ramblock(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    /* version, page size, bitmap offset and pages offset */
+    size_t header_size = sizeof(uint32_t) + 3 * sizeof(uint64_t);
+    off_t offset = qemu_get_offset(f);
+
+    if (offset < 0) {
+        return offset;
+    }
+
+    block->file_bmap = bitmap_new(num_pages);
+    block->bitmap_offset = offset + header_size;
+    block->pages_offset = ROUND_UP(block->bitmap_offset + bitmap_size,
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    qemu_put_be32(f, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    qemu_set_offset(f, block->pages_offset + block->used_length, SEEK_SET);
+    return qemu_file_get_error(f);
+}
+
+/**
+ * mapped_ram_save_bitmaps: write the file bitmaps of all RAMBlocks
+ *
+ * Called once all pages have been written, so that the bitmaps describe
+ * the final content of the file.
+ *
+ * @f: QEMUFile where to send the data
+ */
+static void mapped_ram_save_bitmaps(QEMUFile *f)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        unsigned long *le_bitmap = bitmap_new(num_pages);
+
+        bitmap_to_le(le_bitmap, block->file_bmap, num_pages);
+        qemu_put_buffer_at(f, (uint8_t *)le_bitmap,
+                           BITS_TO_LONGS(num_pages) * sizeof(unsigned long),
+                           block->bitmap_offset);
+        g_free(le_bitmap);
+    }
+}
+
+/* Returns true if RAMBlock @block is never written by the guest */
+static bool ram_write_tracking_skip(RAMBlock *block)
+{
+    return block->mr->readonly || block->mr->rom_device;
+}
+
+/**
+ * ram_write_tracking_compatible: check if all guest RAM can be
+ * write-protected with userfaultfd
+ */
+bool ram_write_tracking_compatible(void)
+{
+    RAMBlock *block;
+    bool ret = true;
+    int ufd;
+
+    ufd = uffd_wp_open();
+    if (ufd < 0) {
+        return false;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            if (ram_write_tracking_skip(block)) {
+                continue;
+            }
+            if (uffd_wp_register(ufd, block->host, block->max_length)) {
+                ret = false;
+                break;
+            }
+            uffd_wp_unregister(ufd, block->host, block->max_length);
+        }
+    }
+
+    close(ufd);
+    return ret;
+}
+
+/*
+ * Write protection only applies to populated pages, so fault in every
+ * page of @block before protecting it.  Reading is enough and maps the
+ * shared zero page for untouched memory.
+ */
+static void ram_block_populate_pages(RAMBlock *block)
+{
+    ram_addr_t offset;
+
+    for (offset = 0; offset < block->used_length;
+         offset += qemu_ram_pagesize(block)) {
+        char tmp = *((volatile char *)block->host + offset);
+
+        /* Don't optimize the read out */
+        asm volatile("" : "+r" (tmp));
+    }
+}
+
+/**
+ * ram_write_tracking_start: write-protect all of guest RAM
+ *
+ * Must be called with the VM stopped, after ram_save_setup().
+ *
+ * Returns 0 for success or -1 on failure
+ */
+int ram_write_tracking_start(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+
+    rs->uffdio_fd = uffd_wp_open();
+    if (rs->uffdio_fd < 0) {
+        error_report("%s: userfaultfd write-protect not available", __func__);
+        return -1;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (ram_write_tracking_skip(block)) {
+            continue;
+        }
+
+        ram_block_populate_pages(block);
+        if (uffd_wp_register(rs->uffdio_fd, block->host, block->max_length)) {
+            goto fail;
+        }
+        /* From now on, unregistering is part of the cleanup */
+        block->flags |= RAM_UF_WRITEPROTECT;
+        memory_region_ref(block->mr);
+
+        if (uffd_wp_protect(rs->uffdio_fd, block->host, block->max_length,
+                            true)) {
+            goto fail;
+        }
+        trace_ram_write_tracking_ramblock_start(block->idstr, block->host,
+                                                block->max_length);
+    }
+
+    return 0;
+
+fail:
+    error_report("%s: failed to write-protect RAM block %s",
+                 __func__, block->idstr);
+    ram_write_tracking_stop();
+    return -1;
+}
+
+/**
+ * ram_write_tracking_stop: remove write protection from guest RAM
+ *
+ * Wakes up any vCPU still blocked on a write fault.
+ */
+void ram_write_tracking_stop(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+
+    if (!rs || rs->uffdio_fd < 0) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (!(block->flags & RAM_UF_WRITEPROTECT)) {
+            continue;
+        }
+        uffd_wp_protect(rs->uffdio_fd, block->host, block->max_length, false);
+        uffd_wp_unregister(rs->uffdio_fd, block->host, block->max_length);
+        trace_ram_write_tracking_ramblock_stop(block->idstr, block->host,
+                                               block->max_length);
+
+        block->flags &= ~RAM_UF_WRITEPROTECT;
+        memory_region_unref(block->mr);
+    }
+
+    close(rs->uffdio_fd);
+    rs->uffdio_fd = -1;
+}
+
 /**
  * ram_save_setup: Setup RAM for migration
  *
@@ -2473,6 +2874,13 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMState **rsp = opaque;
     RAMBlock *block;
+    int ret;
+
+    if (migrate_mapped_ram() && !qemu_file_is_seekable(f)) {
+        error_report("mapped-ram requires a seekable migration channel, "
+                     "such as file:");
+        return -1;
+    }
 
     if (compress_threads_save_setup()) {
         return -1;
@@ -2487,6 +2895,15 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     }
     (*rsp)->f = f;
 
+    if (migrate_mapped_ram() && migrate_use_multifd()) {
+        Error *local_err = NULL;
+
+        if (file_io_setup(true, &local_err) < 0) {
+            error_report_err(local_err);
+            return -1;
+        }
+    }
+
     WITH_RCU_READ_LOCK_GUARD() {
         qemu_put_be64(f, ram_bytes_total_common(true) | RAM_SAVE_FLAG_MEM_SIZE);
 
@@ -2501,6 +2918,12 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                ret = mapped_ram_setup_ramblock(f, block);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
         }
     }
 
@@ -2605,6 +3028,9 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
     ram_control_after_iterate(f, RAM_CONTROL_ROUND);
 
 out:
+    if (ret >= 0 && migrate_mapped_ram()) {
+        ret = mapped_ram_save_wait(rs);
+    }
     if (ret >= 0
         && migration_is_setup_or_active(migrate_get_current()->state)) {
         multifd_send_sync_main(rs->f);
@@ -2663,6 +3089,13 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
         flush_compressed_data(rs);
         ram_control_after_iterate(f, RAM_CONTROL_FINISH);
+
+        if (ret >= 0 && migrate_mapped_ram()) {
+            ret = mapped_ram_save_wait(rs);
+        }
+        if (ret >= 0 && migrate_mapped_ram()) {
+            mapped_ram_save_bitmaps(f);
+        }
     }
 
     if (ret >= 0) {
@@ -3122,6 +3555,15 @@ static int ram_load_setup(QEMUFile *f, void *opaque)
         return -1;
     }
 
+    if (migrate_mapped_ram() && migrate_use_multifd()) {
+        Error *local_err = NULL;
+
+        if (file_io_setup(false, &local_err) < 0) {
+            error_report_err(local_err);
+            return -1;
+        }
+    }
+
     xbzrle_load_setup();
     ramblock_recv_map_init();
 
@@ -3136,6 +3578,7 @@ static int ram_load_cleanup(void *opaque)
         qemu_ram_block_writeback(rb);
     }
 
+    file_io_cleanup();
     xbzrle_load_cleanup();
     compress_threads_load_cleanup();
 
@@ -3398,6 +3841,114 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+/**
+ * parse_mapped_ram_block: load the pages of a RAMBlock from its file slots
+ *
+ * Reads the mapped-ram header that follows the block description in the
+ * stream, loads every page marked in the file bitmap with as few reads as
+ * possible, and moves the stream past the block's reserved region.
+ *
+ * Returns 0 for success or -errno in case of error
+ *
+ * @f: QEMUFile where to receive the data
+ * @block: RAMBlock being loaded
+ * @length: used length of @block on the source
+ */
+static int parse_mapped_ram_block(QEMUFile *f, RAMBlock *block,
+                                  ram_addr_t length)
+{
+    unsigned long num_pages = length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    unsigned long *bitmap, *le_bitmap;
+    unsigned long set_bit_idx, clear_bit_idx;
+    uint32_t version;
+    uint64_t page_size;
+    int ret = 0;
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be64(f);
+    block->bitmap_offset = qemu_get_be64(f);
+    block->pages_offset = qemu_get_be64(f);
+
+    if (version != MAPPED_RAM_HDR_VERSION) {
+        error_report("Unsupported mapped-ram header version %" PRIu32
+                     " for block %s", version, block->idstr);
+        return -EINVAL;
+    }
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_report("Mismatched mapped-ram page size %" PRIu64
+                     " for block %s", page_size, block->idstr);
+        return -EINVAL;
+    }
+    if (!QEMU_IS_ALIGNED(block->pages_offset,
+                         MAPPED_RAM_FILE_OFFSET_ALIGNMENT)) {
+        error_report("Misaligned mapped-ram pages offset 0x%" PRIx64
+                     " for block %s", (uint64_t)block->pages_offset,
+                     block->idstr);
+        return -EINVAL;
+    }
+
+    le_bitmap = bitmap_new(num_pages);
+    bitmap = bitmap_new(num_pages);
+    if (qemu_get_buffer_at(f, (uint8_t *)le_bitmap, bitmap_size,
+                           block->bitmap_offset) != bitmap_size) {
+        error_report("Unable to read mapped-ram bitmap of block %s",
+                     block->idstr);
+        ret = -EIO;
+        goto out;
+    }
+    bitmap_from_le(bitmap, le_bitmap, num_pages);
+
+    /*
+     * Read each run of valid pages with a single request, or split it
+     * across the file I/O threads; ram_load_precopy() waits for them.
+     */
+    for (set_bit_idx = find_first_bit(bitmap, num_pages);
+         set_bit_idx < num_pages;
+         set_bit_idx = find_next_bit(bitmap, num_pages, clear_bit_idx + 1)) {
+        ram_addr_t offset = (ram_addr_t)set_bit_idx << TARGET_PAGE_BITS;
+        size_t run_size;
+        void *host;
+
+        clear_bit_idx = find_next_zero_bit(bitmap, num_pages, set_bit_idx + 1);
+        run_size = (clear_bit_idx - set_bit_idx) << TARGET_PAGE_BITS;
+
+        host = host_from_ram_block_offset(block, offset);
+        if (!host) {
+            error_report("Illegal RAM offset " RAM_ADDR_FMT, offset);
+            ret = -EINVAL;
+            goto out;
+        }
+
+        if (file_io_active()) {
+            size_t done, len;
+
+            for (done = 0; done < run_size; done += len) {
+                len = MIN(run_size - done, MAPPED_RAM_MAX_IO_SIZE);
+                file_io_queue((uint8_t *)host + done, len,
+                              block->pages_offset + offset + done);
+            }
+        } else if (qemu_get_buffer_at(f, host, run_size,
+                                      block->pages_offset + offset) !=
+                   run_size) {
+            error_report("Unable to read pages of block %s at offset "
+                         RAM_ADDR_FMT, block->idstr, offset);
+            ret = -EIO;
+            goto out;
+        }
+        ramblock_recv_bitmap_set_range(block, host,
+                                       clear_bit_idx - set_bit_idx);
+    }
+
+    qemu_set_offset(f, block->pages_offset + length, SEEK_SET);
+    ret = qemu_file_get_error(f);
+
+out:
+    g_free(le_bitmap);
+    g_free(bitmap);
+    return ret;
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -3537,6 +4088,15 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        if (!qemu_file_is_seekable(f)) {
+                            error_report("mapped-ram requires a seekable "
+                                         "migration channel, such as file:");
+                            ret = -EINVAL;
+                        } else {
+                            ret = parse_mapped_ram_block(f, block, length);
+                        }
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -3547,6 +4107,14 @@ static int ram_load_precopy(QEMUFile *f)
 
                 total_ram_bytes -= length;
             }
+            if (!ret && migrate_mapped_ram()) {
+                Error *local_err = NULL;
+
+                if (file_io_wait(&local_err) < 0) {
+                    error_report_err(local_err);
+                    ret = -EIO;
+                }
+            }
             break;
 
         case RAM_SAVE_FLAG_ZERO:
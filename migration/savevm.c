@@ -62,6 +62,8 @@
 #include "qjson.h"
 #include "migration/colo.h"
 #include "qemu/bitmap.h"
+#include "qemu/rcu.h"
+#include "qemu/units.h"
 #include "net/announce.h"
 
 const unsigned int postcopy_ram_discard_version = 0;
@@ -89,6 +91,8 @@ enum qemu_vm_cmd {
 };
 
 #define MAX_VM_CMD_PACKAGED_SIZE UINT32_MAX
+/* Largest device state accepted in a QEMU_VM_SECTION_BUFFERED section */
+#define MAX_VM_SECTION_BUFFERED_SIZE (16 * MiB)
 static struct mig_cmd_args {
     ssize_t     len; /* -1 = variable */
     const char *name;
@@ -925,7 +929,8 @@ static void save_section_header(QEMUFile *f, SaveStateEntry *se,
     qemu_put_be32(f, se->section_id);
 
     if (section_type == QEMU_VM_SECTION_FULL ||
-        section_type == QEMU_VM_SECTION_START) {
+        section_type == QEMU_VM_SECTION_START ||
+        section_type == QEMU_VM_SECTION_BUFFERED) {
         /* ID string */
         size_t len = strlen(se->idstr);
         qemu_put_byte(f, len);
@@ -948,6 +953,258 @@ static void save_section_footer(QEMUFile *f, SaveStateEntry *se)
     }
 }
 
+/*
+ * Parallel device state (the parallel-device-state capability).
+ *
+ * Sections whose VMStateDescription is marked parallel are sent as
+ * QEMU_VM_SECTION_BUFFERED: the usual header, a be32 length, the state
+ * saved into a buffer of that length, and the footer.  A batch holds a
+ * run of consecutive parallel sections with the same priority; its jobs
+ * are spread over a pool of worker threads and the caller waits for all
+ * of them before the next section is handled, so anything that is not in
+ * the batch keeps its place in the stream order.  On load, the post_load
+ * hooks are run afterwards by the caller, which holds the BQL.
+ */
+typedef struct DeviceStateJob {
+    SaveStateEntry *se;
+    /* Buffer channel the state is saved to or loaded from */
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    /* Deferred post_load hooks, VMStatePostLoad, load only */
+    GArray *post_load;
+    int ret;
+} DeviceStateJob;
+
+typedef struct DeviceStateBatch {
+    GArray *jobs;
+    bool load;
+    /* Index of the next job to pick, atomic */
+    unsigned int next;
+
+    /* Worker pool, started by the first batch with more than one job */
+    QemuThread *threads;
+    unsigned int nthreads;
+    QemuMutex lock;
+    /* Bumped for every run, workers wait for it to change */
+    unsigned int generation;
+    QemuCond work_cond;
+    /* Workers still busy with the current run */
+    unsigned int busy;
+    QemuCond done_cond;
+    bool quit;
+} DeviceStateBatch;
+
+/* Bound on the pool size, device state is small */
+#define DEVICE_STATE_MAX_THREADS 16
+
+static bool se_is_parallel(SaveStateEntry *se)
+{
+    return se->vmsd && se->vmsd->parallel;
+}
+
+static void device_state_batch_init(DeviceStateBatch *batch, bool load)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->jobs = g_array_new(false, false, sizeof(DeviceStateJob));
+    batch->load = load;
+}
+
+static void device_state_batch_destroy(DeviceStateBatch *batch)
+{
+    unsigned int i;
+
+    assert(!batch->jobs->len);
+    if (batch->threads) {
+        qemu_mutex_lock(&batch->lock);
+        batch->quit = true;
+        qemu_cond_broadcast(&batch->work_cond);
+        qemu_mutex_unlock(&batch->lock);
+        for (i = 0; i < batch->nthreads; i++) {
+            qemu_thread_join(&batch->threads[i]);
+        }
+        g_free(batch->threads);
+        qemu_cond_destroy(&batch->done_cond);
+        qemu_cond_destroy(&batch->work_cond);
+        qemu_mutex_destroy(&batch->lock);
+    }
+    g_array_free(batch->jobs, true);
+}
+
+/*
+ * A new parallel section can join the batch only if it has the same
+ * priority as the sections already in it.
+ */
+static bool device_state_batch_compatible(DeviceStateBatch *batch,
+                                          SaveStateEntry *se)
+{
+    DeviceStateJob *first;
+
+    if (!batch->jobs->len) {
+        return true;
+    }
+    first = &g_array_index(batch->jobs, DeviceStateJob, 0);
+    return save_state_priority(first->se) == save_state_priority(se);
+}
+
+static void device_state_batch_work(DeviceStateBatch *batch)
+{
+    unsigned int i;
+
+    while ((i = atomic_fetch_inc(&batch->next)) < batch->jobs->len) {
+        DeviceStateJob *job = &g_array_index(batch->jobs, DeviceStateJob, i);
+
+        if (batch->load) {
+            SaveStateEntry *se = job->se;
+
+            trace_vmstate_load(se->idstr, se->vmsd->name);
+            job->ret = vmstate_load_state_deferred(job->f, se->vmsd,
+                                                   se->opaque,
+                                                   se->load_version_id,
+                                                   job->post_load);
+        } else {
+            job->bioc = qio_channel_buffer_new(4096);
+            qio_channel_set_name(QIO_CHANNEL(job->bioc),
+                                 "migration-savevm-device-buffer");
+            job->f = qemu_fopen_channel_output(QIO_CHANNEL(job->bioc));
+            object_unref(OBJECT(job->bioc));
+            job->ret = vmstate_save(job->f, job->se, NULL);
+            qemu_fflush(job->f);
+        }
+        if (!job->ret) {
+            job->ret = qemu_file_get_error(job->f);
+        }
+    }
+}
+
+static void *device_state_batch_thread(void *opaque)
+{
+    DeviceStateBatch *batch = opaque;
+    unsigned int generation = 0;
+
+    rcu_register_thread();
+    qemu_mutex_lock(&batch->lock);
+    while (true) {
+        while (!batch->quit && batch->generation == generation) {
+            qemu_cond_wait(&batch->work_cond, &batch->lock);
+        }
+        if (batch->quit) {
+            break;
+        }
+        generation = batch->generation;
+        qemu_mutex_unlock(&batch->lock);
+
+        device_state_batch_work(batch);
+
+        qemu_mutex_lock(&batch->lock);
+        if (!--batch->busy) {
+            qemu_cond_signal(&batch->done_cond);
+        }
+    }
+    qemu_mutex_unlock(&batch->lock);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void device_state_batch_start_pool(DeviceStateBatch *batch)
+{
+    unsigned int i;
+
+    /* The calling thread is a worker too */
+    batch->nthreads = MIN(g_get_num_processors(),
+                          DEVICE_STATE_MAX_THREADS) - 1;
+    batch->threads = g_new(QemuThread, batch->nthreads);
+    qemu_mutex_init(&batch->lock);
+    qemu_cond_init(&batch->work_cond);
+    qemu_cond_init(&batch->done_cond);
+    for (i = 0; i < batch->nthreads; i++) {
+        qemu_thread_create(&batch->threads[i], "devstate",
+                           device_state_batch_thread, batch,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+/* Run all jobs of the batch; the calling thread takes part too */
+static void device_state_batch_run(DeviceStateBatch *batch)
+{
+    batch->next = 0;
+    if (batch->jobs->len > 1 && !batch->threads &&
+        g_get_num_processors() > 1) {
+        device_state_batch_start_pool(batch);
+    }
+    if (batch->jobs->len == 1 || !batch->nthreads) {
+        trace_device_state_batch_run(batch->load, batch->jobs->len, 1);
+        device_state_batch_work(batch);
+        return;
+    }
+
+    trace_device_state_batch_run(batch->load, batch->jobs->len,
+                                 batch->nthreads + 1);
+    qemu_mutex_lock(&batch->lock);
+    batch->busy = batch->nthreads;
+    batch->generation++;
+    qemu_cond_broadcast(&batch->work_cond);
+    qemu_mutex_unlock(&batch->lock);
+
+    device_state_batch_work(batch);
+
+    qemu_mutex_lock(&batch->lock);
+    while (batch->busy) {
+        qemu_cond_wait(&batch->done_cond, &batch->lock);
+    }
+    qemu_mutex_unlock(&batch->lock);
+}
+
+/*
+ * Save the sections of the batch in parallel, then write them out in
+ * order.  Returns the first error, if any.
+ */
+static int qemu_savevm_flush_parallel(QEMUFile *f, DeviceStateBatch *batch,
+                                      QJSON *vmdesc)
+{
+    unsigned int i;
+    int ret = 0;
+
+    if (!batch->jobs->len) {
+        return 0;
+    }
+
+    device_state_batch_run(batch);
+    for (i = 0; i < batch->jobs->len; i++) {
+        DeviceStateJob *job = &g_array_index(batch->jobs, DeviceStateJob, i);
+        SaveStateEntry *se = job->se;
+
+        if (!job->ret && job->bioc->usage > MAX_VM_SECTION_BUFFERED_SIZE) {
+            error_report("State of device '%s' is too large to be buffered "
+                         "(%zu bytes)", se->idstr, job->bioc->usage);
+            job->ret = -EFBIG;
+        }
+        if (job->ret) {
+            ret = ret ? ret : job->ret;
+        } else if (!ret) {
+            trace_savevm_section_start(se->idstr, se->section_id);
+
+            /* The fields are not described for buffered sections */
+            json_start_object(vmdesc, NULL);
+            json_prop_str(vmdesc, "name", se->idstr);
+            json_prop_int(vmdesc, "instance_id", se->instance_id);
+            json_end_object(vmdesc);
+
+            save_section_header(f, se, QEMU_VM_SECTION_BUFFERED);
+            qemu_put_be32(f, job->bioc->usage);
+            qemu_put_buffer(f, job->bioc->data, job->bioc->usage);
+            trace_savevm_section_end(se->idstr, se->section_id, 0);
+            save_section_footer(f, se);
+        }
+        qemu_fclose(job->f);
+    }
+    g_array_set_size(batch->jobs, 0);
+
+    if (ret) {
+        qemu_file_set_error(f, ret);
+    }
+    return ret;
+}
+
 /**
  * qemu_savevm_command_send: Send a 'QEMU_VM_COMMAND' type element with the
  *                           command and associated data.
@@ -1353,16 +1610,18 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     return 0;
 }
 
-static
 int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                                     bool in_postcopy,
                                                     bool inactivate_disks)
 {
     g_autoptr(QJSON) vmdesc = NULL;
+    bool parallel = migrate_parallel_device_state();
+    DeviceStateBatch batch;
     int vmdesc_len;
     SaveStateEntry *se;
     int ret;
 
+    device_state_batch_init(&batch, false);
     vmdesc = qjson_new();
     json_prop_int(vmdesc, "page_size", qemu_target_page_size());
     json_start_array(vmdesc, "devices");
@@ -1376,6 +1635,23 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
             continue;
         }
 
+        if (parallel && se_is_parallel(se)) {
+            DeviceStateJob job = { .se = se };
+
+            if (!device_state_batch_compatible(&batch, se)) {
+                ret = qemu_savevm_flush_parallel(f, &batch, vmdesc);
+                if (ret) {
+                    goto out;
+                }
+            }
+            g_array_append_val(batch.jobs, job);
+            continue;
+        }
+        ret = qemu_savevm_flush_parallel(f, &batch, vmdesc);
+        if (ret) {
+            goto out;
+        }
+
         trace_savevm_section_start(se->idstr, se->section_id);
 
         json_start_object(vmdesc, NULL);
@@ -1386,13 +1662,19 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         ret = vmstate_save(f, se, vmdesc);
         if (ret) {
             qemu_file_set_error(f, ret);
-            return ret;
+            goto out;
         }
         trace_savevm_section_end(se->idstr, se->section_id, 0);
         save_section_footer(f, se);
 
         json_end_object(vmdesc);
     }
+    ret = qemu_savevm_flush_parallel(f, &batch, vmdesc);
+out:
+    device_state_batch_destroy(&batch);
+    if (ret) {
+        return ret;
+    }
 
     if (inactivate_disks) {
         /* Inactivate before sending QEMU_VM_EOF so that the
@@ -2245,8 +2527,11 @@ static bool check_section_footer(QEMUFile *f, SaveStateEntry *se)
     return true;
 }
 
-static int
-qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
+/*
+ * Read the header of a FULL, START or BUFFERED section and look up the
+ * entry it belongs to.
+ */
+static int qemu_loadvm_section_header(QEMUFile *f, SaveStateEntry **sep)
 {
     uint32_t instance_id, version_id, section_id;
     SaveStateEntry *se;
@@ -2297,10 +2582,25 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
         return -EINVAL;
     }
 
+    *sep = se;
+    return 0;
+}
+
+static int
+qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
+{
+    SaveStateEntry *se;
+    int ret;
+
+    ret = qemu_loadvm_section_header(f, &se);
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = vmstate_load(f, se);
     if (ret < 0) {
         error_report("error while loading state for instance 0x%"PRIx32" of"
-                     " device '%s'", instance_id, idstr);
+                     " device '%s'", se->instance_id, se->idstr);
         return ret;
     }
     if (!check_section_footer(f, se)) {
@@ -2310,6 +2610,99 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
     return 0;
 }
 
+/*
+ * Load the sections queued in the batch in parallel.  Returns the first
+ * error, if any.
+ */
+static int qemu_loadvm_flush_parallel(DeviceStateBatch *batch)
+{
+    unsigned int i;
+    int ret = 0;
+
+    if (!batch->jobs->len) {
+        return 0;
+    }
+
+    device_state_batch_run(batch);
+    for (i = 0; i < batch->jobs->len; i++) {
+        DeviceStateJob *job = &g_array_index(batch->jobs, DeviceStateJob, i);
+
+        /* In stream order, with the BQL held */
+        if (!job->ret && !ret) {
+            job->ret = vmstate_run_post_load(job->post_load);
+        }
+        g_array_free(job->post_load, true);
+        if (job->ret < 0) {
+            error_report("error while loading state for instance 0x%"PRIx32
+                         " of device '%s'", job->se->instance_id,
+                         job->se->idstr);
+            ret = ret ? ret : job->ret;
+        }
+        qemu_fclose(job->f);
+    }
+    g_array_set_size(batch->jobs, 0);
+
+    return ret;
+}
+
+static int
+qemu_loadvm_section_buffered(QEMUFile *f, DeviceStateBatch *batch)
+{
+    DeviceStateJob job = { 0 };
+    SaveStateEntry *se;
+    size_t length;
+    int ret;
+
+    ret = qemu_loadvm_section_header(f, &se);
+    if (ret < 0) {
+        return ret;
+    }
+
+    length = qemu_get_be32(f);
+    trace_qemu_loadvm_state_section_buffered(se->idstr, length);
+    if (length > MAX_VM_SECTION_BUFFERED_SIZE) {
+        error_report("Buffered section for '%s' too large (%zu bytes)",
+                     se->idstr, length);
+        return -EINVAL;
+    }
+
+    job.se = se;
+    job.bioc = qio_channel_buffer_new(length);
+    qio_channel_set_name(QIO_CHANNEL(job.bioc),
+                         "migration-loadvm-device-buffer");
+    ret = qemu_get_buffer(f, job.bioc->data, length);
+    if (ret != length) {
+        object_unref(OBJECT(job.bioc));
+        error_report("Buffered section receive fail for '%s' ret=%d "
+                     "length=%zu", se->idstr, ret, length);
+        return (ret < 0) ? ret : -EINVAL;
+    }
+    job.bioc->usage += length;
+    job.f = qemu_fopen_channel_input(QIO_CHANNEL(job.bioc));
+    object_unref(OBJECT(job.bioc));
+
+    if (!check_section_footer(f, se)) {
+        qemu_fclose(job.f);
+        return -EINVAL;
+    }
+
+    if (!se_is_parallel(se) || !device_state_batch_compatible(batch, se)) {
+        ret = qemu_loadvm_flush_parallel(batch);
+        if (ret < 0) {
+            qemu_fclose(job.f);
+            return ret;
+        }
+    }
+    job.post_load = g_array_new(false, false, sizeof(VMStatePostLoad));
+    g_array_append_val(batch->jobs, job);
+
+    if (!se_is_parallel(se)) {
+        /* Not parallel on this side, just load it here and now */
+        return qemu_loadvm_flush_parallel(batch);
+    }
+    return 0;
+}
+
 static int
 qemu_loadvm_section_part_end(QEMUFile *f, MigrationIncomingState *mis)
 {
@@ -2465,9 +2858,11 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
 
 int qemu_loadvm_state_main(QEMUFile *f, MigrationIncomingState *mis)
 {
+    DeviceStateBatch batch;
     uint8_t section_type;
     int ret = 0;
 
+    device_state_batch_init(&batch, true);
 retry:
     while (true) {
         section_type = qemu_get_byte(f);
@@ -2478,7 +2873,20 @@ retry:
         }
 
         trace_qemu_loadvm_state_section(section_type);
+        if (section_type != QEMU_VM_SECTION_BUFFERED) {
+            /* Anything else waits for the parallel sections before it */
+            ret = qemu_loadvm_flush_parallel(&batch);
+            if (ret < 0) {
+                goto out;
+            }
+        }
         switch (section_type) {
+        case QEMU_VM_SECTION_BUFFERED:
+            ret = qemu_loadvm_section_buffered(f, &batch);
+            if (ret < 0) {
+                goto out;
+            }
+            break;
         case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
             ret = qemu_loadvm_section_start_full(f, mis);
@@ -2511,6 +2919,11 @@ retry:
     }
 
 out:
+    if (batch.jobs->len) {
+        int flush_ret = qemu_loadvm_flush_parallel(&batch);
+
+        ret = ret < 0 ? ret : flush_ret;
+    }
     if (ret < 0) {
         qemu_file_set_error(f, ret);
 
@@ -2528,6 +2941,7 @@ out:
             goto retry;
         }
     }
+    device_state_batch_destroy(&batch);
     return ret;
 }
 
@@ -23,7 +23,7 @@
 static int vmstate_subsection_save(QEMUFile *f, const VMStateDescription *vmsd,
                                    void *opaque, QJSON *vmdesc);
 static int vmstate_subsection_load(QEMUFile *f, const VMStateDescription *vmsd,
-                                   void *opaque);
+                                   void *opaque, GArray *post_load);
 
 static int vmstate_n_elems(void *opaque, const VMStateField *field)
 {
@@ -75,8 +75,10 @@ static void vmstate_handle_alloc(void *ptr, const VMStateField *field,
     }
 }
 
-int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
-                       void *opaque, int version_id)
+static int vmstate_load_state_common(QEMUFile *f,
+                                     const VMStateDescription *vmsd,
+                                     void *opaque, int version_id,
+                                     GArray *post_load)
 {
     const VMStateField *field = vmsd->fields;
     int ret = 0;
@@ -160,17 +162,62 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
         }
         field++;
     }
-    ret = vmstate_subsection_load(f, vmsd, opaque);
+    ret = vmstate_subsection_load(f, vmsd, opaque, post_load);
     if (ret != 0) {
         return ret;
     }
     if (vmsd->post_load) {
-        ret = vmsd->post_load(opaque, version_id);
+        if (post_load) {
+            VMStatePostLoad pl = {
+                .vmsd = vmsd,
+                .opaque = opaque,
+                .version_id = version_id,
+            };
+
+            g_array_append_val(post_load, pl);
+        } else {
+            ret = vmsd->post_load(opaque, version_id);
+        }
     }
     trace_vmstate_load_state_end(vmsd->name, "end", ret);
     return ret;
 }
 
+int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
+                       void *opaque, int version_id)
+{
+    return vmstate_load_state_common(f, vmsd, opaque, version_id, NULL);
+}
+
+/*
+ * Like vmstate_load_state(), but the post_load hooks of @vmsd and of its
+ * subsections are queued to @post_load, an array of VMStatePostLoad,
+ * instead of being called.  Hooks of nested structures still run here.
+ */
+int vmstate_load_state_deferred(QEMUFile *f, const VMStateDescription *vmsd,
+                                void *opaque, int version_id,
+                                GArray *post_load)
+{
+    return vmstate_load_state_common(f, vmsd, opaque, version_id, post_load);
+}
+
+/* Call the post_load hooks queued by vmstate_load_state_deferred() */
+int vmstate_run_post_load(GArray *post_load)
+{
+    unsigned int i;
+
+    for (i = 0; i < post_load->len; i++) {
+        VMStatePostLoad *pl = &g_array_index(post_load, VMStatePostLoad, i);
+        int ret = pl->vmsd->post_load(pl->opaque, pl->version_id);
+
+        if (ret) {
+            error_report("%s: post_load failed: %d", pl->vmsd->name, ret);
+            return ret;
+        }
+    }
+    return 0;
+}
+
 static int vmfield_name_num(const VMStateField *start,
                             const VMStateField *search)
 {
@@ -440,7 +487,7 @@ vmstate_get_subsection(const VMStateDescription **sub, char *idstr)
 }
 
 static int vmstate_subsection_load(QEMUFile *f, const VMStateDescription *vmsd,
-                                   void *opaque)
+                                   void *opaque, GArray *post_load)
 {
     trace_vmstate_subsection_load(vmsd->name);
 
@@ -479,7 +526,8 @@ static int vmstate_subsection_load(QEMUFile *f, const VMStateDescription *vmsd,
         qemu_file_skip(f, len); /* idstr */
         version_id = qemu_get_be32(f);
 
-        ret = vmstate_load_state(f, sub_vmsd, opaque, version_id);
+        ret = vmstate_load_state_common(f, sub_vmsd, opaque, version_id,
+                                        post_load);
         if (ret) {
             trace_vmstate_subsection_load_bad(vmsd->name, idstr, "(child)");
             return ret;
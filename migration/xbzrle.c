@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
 /*
@@ -24,17 +25,14 @@
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0;
     long res;
     uint8_t *nzrun_start = NULL;
 
-    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
-               sizeof(long)));
-
     while (i < slen) {
         /* overflow */
         if (d + 2 > dlen) {
@@ -126,6 +124,327 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+/*
+ * The vectorized encoders split the work in two: an ISA specific helper
+ * compares the pages a block at a time and produces a bitmap with one bit
+ * per byte (set when old and new bytes are equal), and a common loop walks
+ * that bitmap with ctz to find the boundaries of each zrun and nzrun.  The
+ * emitted stream is byte for byte identical to xbzrle_encode_buffer_int.
+ */
+#define XBZRLE_MASK_BYTES 4096
+#define XBZRLE_MASK_WORDS (XBZRLE_MASK_BYTES / 64)
+
+/*
+ * Fill @mask with the equality bitmap of the @len bytes at @old_buf and
+ * @new_buf.  Bits past @len in the last word must be clear.
+ */
+typedef void (*XBZRLEMaskFunc)(const uint8_t *old_buf, const uint8_t *new_buf,
+                               int len, uint64_t *mask);
+
+static inline uint64_t xbzrle_mask_tail(const uint8_t *old_buf,
+                                        const uint8_t *new_buf, int len)
+{
+    uint64_t m = 0;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        m |= (uint64_t)(old_buf[i] == new_buf[i]) << i;
+    }
+    return m;
+}
+
+typedef struct {
+    const uint8_t *old_buf;
+    const uint8_t *new_buf;
+    int slen;
+    /* window of the buffer currently described by mask[] */
+    int base;
+    int len;
+    XBZRLEMaskFunc fn;
+    uint64_t mask[XBZRLE_MASK_WORDS];
+} XBZRLEScan;
+
+/*
+ * Return the offset of the first byte at or after @i whose equality
+ * differs from @equal, or slen if the run extends to the end of the buffer.
+ */
+static int xbzrle_scan_run(XBZRLEScan *s, int i, bool equal)
+{
+    while (i < s->slen) {
+        int off, w;
+        uint64_t m;
+
+        if (i >= s->base + s->len) {
+            s->base = QEMU_ALIGN_DOWN(i, XBZRLE_MASK_BYTES);
+            s->len = MIN(XBZRLE_MASK_BYTES, s->slen - s->base);
+            s->fn(s->old_buf + s->base, s->new_buf + s->base, s->len,
+                  s->mask);
+        }
+
+        off = i - s->base;
+        w = off / 64;
+        m = equal ? ~s->mask[w] : s->mask[w];
+        m &= -1ULL << (off % 64);
+        if (m) {
+            return MIN(s->base + w * 64 + ctz64(m), s->slen);
+        }
+        i = s->base + (w + 1) * 64;
+    }
+    return s->slen;
+}
+
+static int xbzrle_encode_buffer_mask(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen,
+                                     XBZRLEMaskFunc fn)
+{
+    XBZRLEScan s = {
+        .old_buf = old_buf,
+        .new_buf = new_buf,
+        .slen = slen,
+        .fn = fn,
+    };
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, start;
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        start = i;
+        i = xbzrle_scan_run(&s, i, true);
+        zrun_len = i - start;
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        start = i;
+        i = xbzrle_scan_run(&s, i, false);
+        nzrun_len = i - start;
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + start, nzrun_len);
+        d += nzrun_len;
+    }
+
+    return d;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512BW_OPT)
+#include <immintrin.h>
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+static void xbzrle_mask_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                             int len, uint64_t *mask)
+{
+    int i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m256i o0 = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i o1 = _mm256_loadu_si256((const __m256i *)(old_buf + i + 32));
+        __m256i n0 = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        __m256i n1 = _mm256_loadu_si256((const __m256i *)(new_buf + i + 32));
+        uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o0, n0));
+        uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o1, n1));
+
+        mask[i / 64] = ((uint64_t)hi << 32) | lo;
+    }
+    if (i < len) {
+        mask[i / 64] = xbzrle_mask_tail(old_buf + i, new_buf + i, len - i);
+    }
+}
+
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef CONFIG_AVX512BW_OPT
+#pragma GCC push_options
+#pragma GCC target("avx512bw")
+
+static void xbzrle_mask_avx512bw(const uint8_t *old_buf,
+                                 const uint8_t *new_buf,
+                                 int len, uint64_t *mask)
+{
+    int i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m512i o = _mm512_loadu_si512(old_buf + i);
+        __m512i n = _mm512_loadu_si512(new_buf + i);
+
+        mask[i / 64] = _mm512_cmpeq_epi8_mask(o, n);
+    }
+    if (i < len) {
+        mask[i / 64] = xbzrle_mask_tail(old_buf + i, new_buf + i, len - i);
+    }
+}
+
+#pragma GCC pop_options
+#endif /* CONFIG_AVX512BW_OPT */
+
+#ifdef __aarch64__
+#include <arm_neon.h>
+
+static inline uint64_t xbzrle_neon_movemask(uint8x16_t c0, uint8x16_t c1,
+                                            uint8x16_t c2, uint8x16_t c3)
+{
+    static const uint8_t bits[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+    };
+    uint8x16_t b = vld1q_u8(bits);
+    uint8x16_t s0, s1;
+
+    /* Three rounds of pairwise adds fold each group of 8 lanes to a byte */
+    s0 = vpaddq_u8(vandq_u8(c0, b), vandq_u8(c1, b));
+    s1 = vpaddq_u8(vandq_u8(c2, b), vandq_u8(c3, b));
+    s0 = vpaddq_u8(s0, s1);
+    s0 = vpaddq_u8(s0, s0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(s0), 0);
+}
+
+static void xbzrle_mask_neon(const uint8_t *old_buf, const uint8_t *new_buf,
+                             int len, uint64_t *mask)
+{
+    int i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        uint8x16_t c0 = vceqq_u8(vld1q_u8(old_buf + i),
+                                 vld1q_u8(new_buf + i));
+        uint8x16_t c1 = vceqq_u8(vld1q_u8(old_buf + i + 16),
+                                 vld1q_u8(new_buf + i + 16));
+        uint8x16_t c2 = vceqq_u8(vld1q_u8(old_buf + i + 32),
+                                 vld1q_u8(new_buf + i + 32));
+        uint8x16_t c3 = vceqq_u8(vld1q_u8(old_buf + i + 48),
+                                 vld1q_u8(new_buf + i + 48));
+
+        mask[i / 64] = xbzrle_neon_movemask(c0, c1, c2, c3);
+    }
+    if (i < len) {
+        mask[i / 64] = xbzrle_mask_tail(old_buf + i, new_buf + i, len - i);
+    }
+}
+#endif /* __aarch64__ */
+
+/* Note that for test_xbzrle_encode_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX512BW 1
+#define CACHE_AVX2     2
+#define CACHE_NEON     4
+
+#ifdef __aarch64__
+# define INIT_CACHE CACHE_NEON
+# define INIT_ACCEL xbzrle_mask_neon
+#else
+# define INIT_CACHE 0
+# define INIT_ACCEL NULL
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static XBZRLEMaskFunc mask_accel = INIT_ACCEL;
+
+static void init_accel(unsigned cache)
+{
+    XBZRLEMaskFunc fn = NULL;
+
+#ifdef __aarch64__
+    if (cache & CACHE_NEON) {
+        fn = xbzrle_mask_neon;
+    }
+#endif
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = xbzrle_mask_avx2;
+    }
+#endif
+#ifdef CONFIG_AVX512BW_OPT
+    if (cache & CACHE_AVX512BW) {
+        fn = xbzrle_mask_avx512bw;
+    }
+#endif
+    mask_accel = fn;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512BW_OPT)
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+            /* See util/bufferiszero.c for the meaning of 0xe6 */
+            if ((bv & 0xe6) == 0xe6 && (b & bit_AVX512F) &&
+                (b & bit_AVX512BW)) {
+                cache |= CACHE_AVX512BW;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    /* If no bits set, we just tested xbzrle_encode_buffer_int, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
+               sizeof(long)));
+
+    if (mask_accel) {
+        return xbzrle_encode_buffer_mask(old_buf, new_buf, slen, dst, dlen,
+                                         mask_accel);
+    }
+    return xbzrle_encode_buffer_int(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
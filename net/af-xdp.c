@@ -0,0 +1,552 @@
+/*
+ * AF_XDP network backend.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Each queue of the netdev is an AF_XDP socket bound to one queue of the
+ * host interface, with its own UMEM: a buffer of fixed-size frames that
+ * the four rings (rx, tx, fill and completion) pass around by address.
+ * The frames that are not in any ring sit in a LIFO pool.
+ *
+ * Received packets are handed to the peer in batches of up to
+ * AF_XDP_BATCH_SIZE, and their frames go back to the fill ring in one
+ * go.  Transmitted packets are only placed on the tx ring; the kernel is
+ * kicked once per burst from a bottom half, and only if it asked for it
+ * (XDP_USE_NEED_WAKEUP).
+ *
+ * libxdp loads its default XDP program on the interface when the first
+ * socket is created; it redirects the traffic of the bound queues to the
+ * sockets, and is removed again when the netdev goes away.
+ */
+
+#include "qemu/osdep.h"
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <xdp/xsk.h>
+
+#include "clients.h"
+#include "net/net.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+
+
+typedef struct AFXDPState {
+    NetClientState       nc;
+
+    struct xsk_socket    *xsk;
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_cons cq;
+    struct xsk_ring_prod fq;
+
+    char                 ifname[IFNAMSIZ];
+    int                  ifindex;
+    bool                 read_poll;
+    bool                 write_poll;
+    uint32_t             outstanding_tx;
+    QEMUBH               *tx_bh;
+    /* Where the handlers and tx_bh run, NULL for the main loop */
+    AioContext           *ctx;
+
+    uint64_t             *pool;
+    uint32_t             n_pool;
+    struct xsk_umem      *umem;
+    void                 *buffer;
+
+    uint32_t             xdp_flags;
+} AFXDPState;
+
+#define AF_XDP_BATCH_SIZE 64
+
+static void af_xdp_send(void *opaque);
+static bool af_xdp_rx_poll(void *opaque);
+static void af_xdp_writable(void *opaque);
+
+static AioContext *af_xdp_get_aio_context(AFXDPState *s)
+{
+    return s->ctx ? s->ctx : iohandler_get_aio_context();
+}
+
+/*
+ * Set the event-loop handlers for the af-xdp backend.  In an iothread
+ * that polls, the rx ring is busy-polled along with the virtqueues.
+ */
+static void af_xdp_update_fd_handler(AFXDPState *s)
+{
+    aio_set_fd_handler(af_xdp_get_aio_context(s), xsk_socket__fd(s->xsk),
+                       false,
+                       s->read_poll ? af_xdp_send : NULL,
+                       s->write_poll ? af_xdp_writable : NULL,
+                       s->read_poll ? af_xdp_rx_poll : NULL,
+                       s);
+}
+
+/* Update the read handler. */
+static void af_xdp_read_poll(AFXDPState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Update the write handler. */
+static void af_xdp_write_poll(AFXDPState *s, bool enable)
+{
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_poll(NetClientState *nc, bool enable)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->read_poll != enable || s->write_poll != enable) {
+        s->write_poll = enable;
+        s->read_poll  = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Put the frames of the packets that the kernel has sent back in the pool. */
+static void af_xdp_complete_tx(AFXDPState *s)
+{
+    uint32_t idx = 0;
+    uint32_t done, i;
+
+    done = xsk_ring_cons__peek(&s->cq, XSK_RING_CONS__DEFAULT_NUM_DESCS, &idx);
+    for (i = 0; i < done; i++) {
+        s->pool[s->n_pool++] = *xsk_ring_cons__comp_addr(&s->cq, idx++);
+    }
+    if (done) {
+        xsk_ring_cons__release(&s->cq, done);
+        s->outstanding_tx -= done;
+    }
+}
+
+/* Tell the kernel about the packets queued since the last kick. */
+static void af_xdp_kick_tx(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    if (!xsk_ring_prod__needs_wakeup(&s->tx) ||
+        sendto(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0) >= 0) {
+        return;
+    }
+    if (errno == EAGAIN || errno == EBUSY || errno == ENOBUFS) {
+        /*
+         * The kernel is busy.  Nothing is lost, the packets stay on the
+         * ring; retry on POLLOUT, as af_xdp_writable() does.
+         */
+        if (s->outstanding_tx) {
+            af_xdp_write_poll(s, true);
+        }
+        return;
+    }
+    /* Polling would only fail the same way again. */
+    warn_report_once("af-xdp: unable to wake up the tx ring of '%s': %s",
+                     s->ifname, strerror(errno));
+    af_xdp_write_poll(s, false);
+}
+
+/*
+ * The fd_write() callback, invoked if the fd is marked as writable
+ * after a poll.
+ */
+static void af_xdp_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    af_xdp_complete_tx(s);
+    af_xdp_kick_tx(s);
+
+    /* Keep polling while the kernel still has to be woken up. */
+    if (!s->outstanding_tx || !xsk_ring_prod__needs_wakeup(&s->tx)) {
+        af_xdp_write_poll(s, false);
+    }
+
+    qemu_flush_queued_packets(&s->nc);
+}
+
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
+    struct xdp_desc *desc;
+    uint32_t idx;
+
+    af_xdp_complete_tx(s);
+
+    if (size > XSK_UMEM__DEFAULT_FRAME_SIZE) {
+        /* Larger than a frame: the interface could not take it anyway. */
+        return size;
+    }
+
+    if (!s->n_pool || !xsk_ring_prod__reserve(&s->tx, 1, &idx)) {
+        /*
+         * Out of frames or of space on the tx ring: queue the packet and
+         * wait until the kernel is done with some.
+         */
+        af_xdp_write_poll(s, true);
+        qemu_bh_schedule(s->tx_bh);
+        return 0;
+    }
+
+    desc = xsk_ring_prod__tx_desc(&s->tx, idx);
+    desc->addr = s->pool[--s->n_pool];
+    desc->len = size;
+    iov_to_buf(iov, iovcnt, 0, xsk_umem__get_data(s->buffer, desc->addr),
+               size);
+
+    xsk_ring_prod__submit(&s->tx, 1);
+    s->outstanding_tx++;
+
+    /* Kick once the peer is done sending this burst. */
+    qemu_bh_schedule(s->tx_bh);
+
+    return size;
+}
+
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
+/*
+ * Complete a previous send (backend --> guest) and enable the
+ * fd_read callback.
+ */
+static void af_xdp_send_completed(NetClientState *nc, ssize_t len)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    af_xdp_read_poll(s, true);
+}
+
+/* Give up to @n frames from the pool to the kernel for receiving. */
+static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
+{
+    uint32_t i, idx = 0;
+
+    /* Leave one frame for tx, just in case. */
+    if (s->n_pool < n + 1) {
+        n = s->n_pool ? s->n_pool - 1 : 0;
+    }
+
+    if (!n || !xsk_ring_prod__reserve(&s->fq, n, &idx)) {
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        *xsk_ring_prod__fill_addr(&s->fq, idx++) = s->pool[--s->n_pool];
+    }
+    xsk_ring_prod__submit(&s->fq, n);
+
+    if (s->xsk && xsk_ring_prod__needs_wakeup(&s->fq)) {
+        /* Receive was stalled for lack of frames, wake it up. */
+        recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+}
+
+/* Pass a batch of received packets to the peer; true if there were any. */
+static bool af_xdp_rx_batch(AFXDPState *s)
+{
+    uint32_t i, n_rx, idx = 0;
+
+    n_rx = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
+    if (!n_rx) {
+        return false;
+    }
+
+    for (i = 0; i < n_rx; i++) {
+        const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&s->rx, idx++);
+        struct iovec iov = {
+            .iov_base = xsk_umem__get_data(s->buffer, desc->addr),
+            .iov_len = desc->len,
+        };
+
+        /*
+         * A packet that cannot be delivered now is copied to the queue.
+         * The kernel may have put the data at an offset into the frame.
+         */
+        s->pool[s->n_pool++] = desc->addr &
+                               ~(uint64_t)(XSK_UMEM__DEFAULT_FRAME_SIZE - 1);
+
+        if (!qemu_sendv_packet_async(&s->nc, &iov, 1,
+                                     af_xdp_send_completed)) {
+            /*
+             * The peer does not receive anymore.  Packet is queued, stop
+             * reading from the backend until af_xdp_send_completed().
+             */
+            af_xdp_read_poll(s, false);
+
+            /* Leave the other packets on the ring. */
+            xsk_ring_cons__cancel(&s->rx, n_rx - i - 1);
+            n_rx = i + 1;
+            break;
+        }
+    }
+
+    xsk_ring_cons__release(&s->rx, n_rx);
+    af_xdp_fq_refill(s, AF_XDP_BATCH_SIZE);
+    return true;
+}
+
+static void af_xdp_send(void *opaque)
+{
+    af_xdp_rx_batch(opaque);
+}
+
+static bool af_xdp_rx_poll(void *opaque)
+{
+    return af_xdp_rx_batch(opaque);
+}
+
+/* Flush and close. */
+static void af_xdp_cleanup(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    if (s->xsk) {
+        af_xdp_poll(nc, false);
+        xsk_socket__delete(s->xsk);
+        s->xsk = NULL;
+    }
+    if (s->tx_bh) {
+        qemu_bh_delete(s->tx_bh);
+        s->tx_bh = NULL;
+    }
+    g_free(s->pool);
+    s->pool = NULL;
+    if (s->umem) {
+        xsk_umem__delete(s->umem);
+        s->umem = NULL;
+    }
+    qemu_vfree(s->buffer);
+    s->buffer = NULL;
+
+    /*
+     * The first socket loaded the program; all queues are being deleted
+     * together, so remove it with the first one.
+     */
+    if (nc->queue_index == 0 && s->xdp_flags &&
+        bpf_xdp_detach(s->ifindex, s->xdp_flags, NULL) != 0) {
+        error_report("af-xdp: unable to remove XDP program from '%s', "
+                     "ifindex %d", s->ifname, s->ifindex);
+    }
+}
+
+static int af_xdp_umem_create(AFXDPState *s, Error **errp)
+{
+    struct xsk_umem_config config = {
+        .fill_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .frame_size = XSK_UMEM__DEFAULT_FRAME_SIZE,
+        .frame_headroom = 0,
+    };
+    uint64_t n_descs;
+    uint64_t size;
+    uint64_t i;
+
+    /* Enough frames for all four rings to be full at the same time. */
+    n_descs = (XSK_RING_PROD__DEFAULT_NUM_DESCS
+               + XSK_RING_CONS__DEFAULT_NUM_DESCS) * 2;
+    size = n_descs * XSK_UMEM__DEFAULT_FRAME_SIZE;
+
+    s->buffer = qemu_memalign(qemu_real_host_page_size, size);
+    memset(s->buffer, 0, size);
+
+    if (xsk_umem__create(&s->umem, s->buffer, size, &s->fq, &s->cq,
+                         &config)) {
+        error_setg_errno(errp, errno,
+                         "failed to create umem for %s queue_index %d",
+                         s->ifname, s->nc.queue_index);
+        return -1;
+    }
+
+    s->pool = g_new(uint64_t, n_descs);
+    /* The pool is a LIFO: hand out the first frames first. */
+    for (i = 0; i < n_descs; i++) {
+        s->pool[i] = (n_descs - 1 - i) * XSK_UMEM__DEFAULT_FRAME_SIZE;
+    }
+    s->n_pool = n_descs;
+
+    af_xdp_fq_refill(s, XSK_RING_PROD__DEFAULT_NUM_DESCS);
+
+    return 0;
+}
+
+static int af_xdp_socket_create(AFXDPState *s,
+                                const NetdevAFXDPOptions *opts, Error **errp)
+{
+    struct xsk_socket_config cfg = {
+        .rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .libxdp_flags = 0,
+        .bind_flags = XDP_USE_NEED_WAKEUP,
+        .xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST,
+    };
+    int queue_id, error = 0;
+
+    if (opts->has_force_copy && opts->force_copy) {
+        cfg.bind_flags |= XDP_COPY;
+    }
+
+    queue_id = s->nc.queue_index;
+    if (opts->has_start_queue) {
+        queue_id += opts->start_queue;
+    }
+
+    if (opts->has_mode) {
+        cfg.xdp_flags |= opts->mode == AFXDP_MODE_NATIVE ?
+                         XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+        if (xsk_socket__create(&s->xsk, s->ifname, queue_id,
+                               s->umem, &s->rx, &s->tx, &cfg)) {
+            error = errno;
+        }
+    } else {
+        /* Try native mode first, then fall back to skb. */
+        cfg.xdp_flags |= XDP_FLAGS_DRV_MODE;
+        if (xsk_socket__create(&s->xsk, s->ifname, queue_id,
+                               s->umem, &s->rx, &s->tx, &cfg)) {
+            cfg.xdp_flags &= ~XDP_FLAGS_DRV_MODE;
+            cfg.xdp_flags |= XDP_FLAGS_SKB_MODE;
+            if (xsk_socket__create(&s->xsk, s->ifname, queue_id,
+                                   s->umem, &s->rx, &s->tx, &cfg)) {
+                error = errno;
+            }
+        }
+    }
+
+    if (error) {
+        s->xsk = NULL;
+        error_setg_errno(errp, error,
+                         "failed to create AF_XDP socket for %s queue_id %d",
+                         s->ifname, queue_id);
+        return -1;
+    }
+
+    s->xdp_flags = cfg.xdp_flags;
+
+    return 0;
+}
+
+static void af_xdp_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    aio_set_fd_handler(af_xdp_get_aio_context(s), xsk_socket__fd(s->xsk),
+                       false, NULL, NULL, NULL, NULL);
+    s->ctx = ctx;
+    af_xdp_update_fd_handler(s);
+
+    /* A pending kick would be lost with the old bottom half */
+    qemu_bh_delete(s->tx_bh);
+    s->tx_bh = aio_bh_new(ctx ? ctx : qemu_get_aio_context(),
+                          af_xdp_kick_tx, s);
+    qemu_bh_schedule(s->tx_bh);
+}
+
+/* NetClientInfo methods. */
+static NetClientInfo net_af_xdp_info = {
+    .type = NET_CLIENT_DRIVER_AF_XDP,
+    .size = sizeof(AFXDPState),
+    .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
+    .poll = af_xdp_poll,
+    .cleanup = af_xdp_cleanup,
+    .set_aio_context = af_xdp_set_aio_context,
+};
+
+/*
+ * The exported init function
+ *
+ * ... -netdev af-xdp,ifname="...",queues=N
+ */
+int net_init_af_xdp(const Netdev *netdev,
+                    const char *name, NetClientState *peer, Error **errp)
+{
+    const NetdevAFXDPOptions *opts = &netdev->u.af_xdp;
+    NetClientState *nc, *nc0 = NULL;
+    unsigned int ifindex;
+    uint32_t prog_id = 0;
+    int64_t i, queues;
+    AFXDPState *s;
+
+    ifindex = if_nametoindex(opts->ifname);
+    if (!ifindex) {
+        error_setg_errno(errp, errno, "failed to get ifindex for '%s'",
+                         opts->ifname);
+        return -1;
+    }
+
+    queues = opts->has_queues ? opts->queues : 1;
+    if (queues < 1 || queues > MAX_QUEUE_NUM) {
+        error_setg(errp, "invalid number of queues (%" PRIi64 ") for '%s'",
+                   queues, opts->ifname);
+        return -1;
+    }
+    if (opts->has_start_queue && opts->start_queue < 0) {
+        error_setg(errp, "invalid start queue (%" PRIi64 ") for '%s'",
+                   opts->start_queue, opts->ifname);
+        return -1;
+    }
+
+    for (i = 0; i < queues; i++) {
+        nc = qemu_new_net_client(&net_af_xdp_info, peer, "af-xdp", name);
+        snprintf(nc->info_str, sizeof(nc->info_str),
+                 "af-xdp%" PRIi64 " to %s", i, opts->ifname);
+        nc->queue_index = i;
+
+        if (!nc0) {
+            nc0 = nc;
+        }
+
+        s = DO_UPCAST(AFXDPState, nc, nc);
+        pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
+        s->ifindex = ifindex;
+        s->tx_bh = qemu_bh_new(af_xdp_kick_tx, s);
+
+        if (af_xdp_umem_create(s, errp) ||
+            af_xdp_socket_create(s, opts, errp)) {
+            goto err;
+        }
+        af_xdp_read_poll(s, true); /* Initially only poll for reads. */
+    }
+
+    s = DO_UPCAST(AFXDPState, nc, nc0);
+    if (bpf_xdp_query_id(s->ifindex, s->xdp_flags, &prog_id) || !prog_id) {
+        error_setg_errno(errp, errno,
+                         "no XDP program loaded on '%s', ifindex %d",
+                         s->ifname, s->ifindex);
+        goto err;
+    }
+
+    return 0;
+
+err:
+    if (nc0) {
+        qemu_del_net_client(nc0);
+    }
+
+    return -1;
+}
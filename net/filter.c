@@ -257,6 +257,12 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         return;
     }
 
+    if (ncs[0]->ctx) {
+        error_setg(errp, "Network backends processed in an iothread "
+                   "are not supported");
+        return;
+    }
+
     if (strcmp(nf->position, "head") && strcmp(nf->position, "tail")) {
         Object *container;
         Object *obj;
@@ -23,6 +23,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "block/aio-wait.h"
 
 #include "net/net.h"
 #include "clients.h"
@@ -385,7 +386,9 @@ void qemu_del_net_client(NetClientState *nc)
             nc->peer->info->link_status_changed(nc->peer);
         }
 
+        /* The NIC stops sending now that the link is down */
         for (i = 0; i < queues; i++) {
+            qemu_net_client_detach(ncs[i]);
             qemu_cleanup_net_client(ncs[i]);
         }
 
@@ -516,6 +519,45 @@ int qemu_set_vnet_be(NetClientState *nc, bool is_be)
 #endif
 }
 
+bool qemu_has_net_aio_context(NetClientState *nc)
+{
+    return nc && nc->info->set_aio_context;
+}
+
+/*
+ * Move the file descriptor handlers of @nc to @ctx, or back to the main
+ * loop if @ctx is NULL.  The caller must make sure that they are not
+ * running, and that the peer of @nc is only used from @ctx from then on.
+ */
+void qemu_set_net_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    assert(qemu_has_net_aio_context(nc));
+    nc->info->set_aio_context(nc, ctx);
+    nc->ctx = ctx;
+}
+
+static void qemu_net_client_detach_bh(void *opaque)
+{
+    qemu_set_net_aio_context(opaque, NULL);
+}
+
+/*
+ * Take @nc back to the main loop, if it runs in an iothread.  Once this
+ * returns, the iothread is done with whatever handler of @nc or packet
+ * for @nc it had started.
+ */
+static void qemu_net_client_detach(NetClientState *nc)
+{
+    AioContext *ctx = nc->ctx;
+
+    if (!ctx) {
+        return;
+    }
+    aio_context_acquire(ctx);
+    aio_wait_bh_oneshot(ctx, qemu_net_client_detach_bh, nc);
+    aio_context_release(ctx);
+}
+
 int qemu_can_send_packet(NetClientState *sender)
 {
     int vm_running = runstate_is_running();
@@ -952,6 +994,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1094,6 +1139,9 @@ static void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
@@ -44,17 +44,23 @@ typedef struct NetSocketState {
     IOHandler *send_fn;           /* differs between SOCK_STREAM/SOCK_DGRAM */
     bool read_poll;               /* waiting to receive data? */
     bool write_poll;              /* waiting to transmit data? */
+    AioContext *ctx;              /* where fd handlers run, or NULL */
 } NetSocketState;
 
 static void net_socket_accept(void *opaque);
 static void net_socket_writable(void *opaque);
 
+static AioContext *net_socket_get_aio_context(NetSocketState *s)
+{
+    return s->ctx ? s->ctx : iohandler_get_aio_context();
+}
+
 static void net_socket_update_fd_handler(NetSocketState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll ? s->send_fn : NULL,
-                        s->write_poll ? net_socket_writable : NULL,
-                        s);
+    aio_set_fd_handler(net_socket_get_aio_context(s), s->fd, false,
+                       s->read_poll ? s->send_fn : NULL,
+                       s->write_poll ? net_socket_writable : NULL,
+                       NULL, s);
 }
 
 static void net_socket_read_poll(NetSocketState *s, bool enable)
@@ -322,11 +328,28 @@ static void net_socket_cleanup(NetClientState *nc)
     }
 }
 
+static void net_socket_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+    /* Until connected, net_socket_connect() waits in the main loop */
+    bool connected = s->fd != -1 && s->send_fn;
+
+    if (connected) {
+        aio_set_fd_handler(net_socket_get_aio_context(s), s->fd, false,
+                           NULL, NULL, NULL, NULL);
+    }
+    s->ctx = ctx;
+    if (connected) {
+        net_socket_update_fd_handler(s);
+    }
+}
+
 static NetClientInfo net_dgram_socket_info = {
     .type = NET_CLIENT_DRIVER_SOCKET,
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive_dgram,
     .cleanup = net_socket_cleanup,
+    .set_aio_context = net_socket_set_aio_context,
 };
 
 static NetSocketState *net_socket_fd_init_dgram(NetClientState *peer,
@@ -411,6 +434,8 @@ static void net_socket_connect(void *opaque)
 {
     NetSocketState *s = opaque;
     s->send_fn = net_socket_send;
+    /* The handlers may have moved to an iothread meanwhile */
+    qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
     net_socket_read_poll(s, true);
 }
 
@@ -419,6 +444,7 @@ static NetClientInfo net_socket_info = {
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive,
     .cleanup = net_socket_cleanup,
+    .set_aio_context = net_socket_set_aio_context,
 };
 
 static NetSocketState *net_socket_fd_init_stream(NetClientState *peer,
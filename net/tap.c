@@ -61,6 +61,8 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    /* Where the fd handlers run, NULL for the main loop */
+    AioContext *ctx;
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -69,12 +71,17 @@ static void launch_script(const char *setup_script, const char *ifname,
 static void tap_send(void *opaque);
 static void tap_writable(void *opaque);
 
+static AioContext *tap_get_aio_context(TAPState *s)
+{
+    return s->ctx ? s->ctx : iohandler_get_aio_context();
+}
+
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    aio_set_fd_handler(tap_get_aio_context(s), s->fd, false,
+                       s->read_poll && s->enabled ? tap_send : NULL,
+                       s->write_poll && s->enabled ? tap_writable : NULL,
+                       NULL, s);
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -345,6 +352,16 @@ int tap_get_fd(NetClientState *nc)
 
 /* fd support */
 
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    aio_set_fd_handler(tap_get_aio_context(s), s->fd, false,
+                       NULL, NULL, NULL, NULL);
+    s->ctx = ctx;
+    tap_update_fd_handler(s);
+}
+
 static NetClientInfo net_tap_info = {
     .type = NET_CLIENT_DRIVER_TAP,
     .size = sizeof(TAPState),
@@ -361,6 +378,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_hdr_len = tap_set_vnet_hdr_len,
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -88,11 +88,36 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
                                   cb, flags, udata);
 }
 
+/* Inline ops on a plain pointer are ops on a scoreboard-less entry */
+static qemu_plugin_u64 ptr_to_u64(void *ptr)
+{
+    return (qemu_plugin_u64) { .offset = (uintptr_t)ptr };
+}
+
 void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm)
 {
-    plugin_register_inline_op(&tb->cbs[PLUGIN_CB_INLINE], 0, op, ptr, imm);
+    plugin_register_inline_op(&tb->cbs[PLUGIN_CB_INLINE], 0, op,
+                              ptr_to_u64(ptr), imm);
+}
+
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm)
+{
+    plugin_register_inline_op(&tb->cbs[PLUGIN_CB_INLINE], 0, op, entry, imm);
+}
+
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm, void *udata)
+{
+    plugin_register_cond_cb(&tb->cbs[PLUGIN_CB_INLINE], cb, flags, cond,
+                            entry, imm, udata);
 }
 
 void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
@@ -109,7 +134,24 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 void *ptr, uint64_t imm)
 {
     plugin_register_inline_op(&insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE],
-                              0, op, ptr, imm);
+                              0, op, ptr_to_u64(ptr), imm);
+}
+
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm)
+{
+    plugin_register_inline_op(&insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE],
+                              0, op, entry, imm);
+}
+
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn, qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags, enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry, uint64_t imm, void *udata)
+{
+    plugin_register_cond_cb(&insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE],
+                            cb, flags, cond, entry, imm, udata);
 }
 
 
@@ -130,7 +172,23 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           uint64_t imm)
 {
     plugin_register_inline_op(&insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE],
-        rw, op, ptr, imm);
+        rw, op, ptr_to_u64(ptr), imm);
+}
+
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op, qemu_plugin_u64 entry, uint64_t imm)
+{
+    plugin_register_inline_op(&insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE],
+        rw, op, entry, imm);
+}
+
+void qemu_plugin_register_vcpu_mem_buffer(struct qemu_plugin_insn *insn,
+                                          enum qemu_plugin_mem_rw rw,
+                                          struct qemu_plugin_mem_buffer *buf)
+{
+    plugin_register_mem_buffer(&insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE],
+                               rw, buf, insn->vaddr);
 }
 
 void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
@@ -152,6 +210,76 @@ qemu_plugin_register_vcpu_syscall_ret_cb(qemu_plugin_id_t id,
     plugin_register_cb(id, QEMU_PLUGIN_EV_VCPU_SYSCALL_RET, cb);
 }
 
+/*
+ * Per-vCPU storage
+ */
+
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size)
+{
+    return plugin_scoreboard_new(element_size);
+}
+
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    plugin_scoreboard_free(score);
+}
+
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index)
+{
+    return score->data + vcpu_index * score->element_size;
+}
+
+static uint64_t *plugin_u64_address(qemu_plugin_u64 entry,
+                                   unsigned int vcpu_index)
+{
+    return qemu_plugin_scoreboard_find(entry.score, vcpu_index) + entry.offset;
+}
+
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index)
+{
+    return *plugin_u64_address(entry, vcpu_index);
+}
+
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val)
+{
+    *plugin_u64_address(entry, vcpu_index) = val;
+}
+
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added)
+{
+    *plugin_u64_address(entry, vcpu_index) += added;
+}
+
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry)
+{
+    uint64_t total = 0;
+    size_t i;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    /* the entries of vCPUs that do not exist are zero */
+    for (i = 0; i < plugin.scoreboard_alloc_size; i++) {
+        total += qemu_plugin_u64_get(entry, i);
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+    return total;
+}
+
+struct qemu_plugin_mem_buffer *
+qemu_plugin_mem_buffer_new(size_t n_entries,
+                           qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                           void *userdata)
+{
+    return plugin_mem_buffer_new(n_entries, cb, userdata);
+}
+
+void qemu_plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf)
+{
+    plugin_mem_buffer_free(buf);
+}
+
 /*
  * Plugin Queries
  *
@@ -194,10 +194,213 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+/*
+ * Make room for @cpu in the scoreboards.  In system emulation they are
+ * sized for max_cpus from the start (see qemu_plugin_load_list()), so
+ * this only happens to user-mode emulation, where a new thread's vCPU is
+ * created by its parent vCPU from outside the code cache.
+ */
+static void plugin_grow_scoreboards(CPUState *cpu)
+{
+    struct qemu_plugin_scoreboard *score;
+    size_t old_size, size;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    size = plugin.scoreboard_alloc_size;
+    if (cpu->cpu_index < size) {
+        qemu_rec_mutex_unlock(&plugin.lock);
+        return;
+    }
+    while (cpu->cpu_index >= size) {
+        size *= 2;
+    }
+    if (QLIST_EMPTY(&plugin.scoreboards)) {
+        plugin.scoreboard_alloc_size = size;
+        qemu_rec_mutex_unlock(&plugin.lock);
+        return;
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+#ifdef CONFIG_USER_ONLY
+    /*
+     * The code cache loads score->data on each use, so it is enough to
+     * keep the vCPUs out of it while the scoreboards move.
+     */
+    start_exclusive();
+    qemu_rec_mutex_lock(&plugin.lock);
+    old_size = plugin.scoreboard_alloc_size;
+    if (size > old_size) {
+        QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+            score->data = g_realloc(score->data, size * score->element_size);
+            memset(score->data + old_size * score->element_size, 0,
+                   (size - old_size) * score->element_size);
+        }
+        plugin.scoreboard_alloc_size = size;
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+    end_exclusive();
+#else
+    g_assert_not_reached();
+#endif
+}
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score;
+
+    score = g_new0(struct qemu_plugin_scoreboard, 1);
+    score->element_size = element_size;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    score->data = g_malloc0(plugin.scoreboard_alloc_size * element_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    return score;
+}
+
+static void plugin_scoreboard_destroy(struct qemu_plugin_scoreboard *score)
+{
+    g_free(score->data);
+    g_free(score);
+}
+
+static void plugin_scoreboard_free_safe(CPUState *cpu, run_on_cpu_data arg)
+{
+    tb_flush(cpu);
+    plugin_scoreboard_destroy(arg.host_ptr);
+}
+
+/*
+ * Translated code embeds the address of the scoreboard, so the code cache
+ * is flushed before it goes away.  As in plugin_reset_uninstall(), this is
+ * only needed once vCPUs exist, and then current_cpu is set.
+ */
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    WITH_QEMU_LOCK_GUARD(&plugin.lock) {
+        QLIST_REMOVE(score, entry);
+    }
+    if (current_cpu) {
+        async_safe_run_on_cpu(current_cpu, plugin_scoreboard_free_safe,
+                              RUN_ON_CPU_HOST_PTR(score));
+    } else {
+        plugin_scoreboard_destroy(score);
+    }
+}
+
+static void *plugin_scoreboard_entry(struct qemu_plugin_scoreboard *score,
+                                     unsigned int cpu_index)
+{
+    return score->data + cpu_index * score->element_size;
+}
+
+static uint64_t *plugin_u64_address(qemu_plugin_u64 entry,
+                                   unsigned int cpu_index)
+{
+    if (!entry.score) {
+        return (uint64_t *)(uintptr_t)entry.offset;
+    }
+    return plugin_scoreboard_entry(entry.score, cpu_index) + entry.offset;
+}
+
+struct qemu_plugin_mem_buffer *
+plugin_mem_buffer_new(size_t n_entries, qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                      void *userdata)
+{
+    struct qemu_plugin_mem_buffer *buf = g_new0(struct qemu_plugin_mem_buffer,
+                                                1);
+
+    /* make sure that each instruction's records fit */
+    buf->n_entries = MAX(n_entries, 1024);
+    buf->cb = cb;
+    buf->userdata = userdata;
+    buf->score = plugin_scoreboard_new(
+        sizeof(struct qemu_plugin_mem_buffer_vcpu) +
+        buf->n_entries * sizeof(struct qemu_plugin_mem_record));
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    QLIST_INSERT_HEAD(&plugin.mem_buffers, buf, entry);
+    return buf;
+}
+
+static void plugin_mem_buffer_destroy(struct qemu_plugin_mem_buffer *buf)
+{
+    plugin_scoreboard_destroy(buf->score);
+    g_free(buf);
+}
+
+static void plugin_mem_buffer_free_safe(CPUState *cpu, run_on_cpu_data arg)
+{
+    tb_flush(cpu);
+    plugin_mem_buffer_destroy(arg.host_ptr);
+}
+
+/* Translated code refers to @buf as well, see plugin_scoreboard_free() */
+void plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf)
+{
+    WITH_QEMU_LOCK_GUARD(&plugin.lock) {
+        QLIST_REMOVE(buf, entry);
+        QLIST_REMOVE(buf->score, entry);
+    }
+    if (current_cpu) {
+        async_safe_run_on_cpu(current_cpu, plugin_mem_buffer_free_safe,
+                              RUN_ON_CPU_HOST_PTR(buf));
+    } else {
+        plugin_mem_buffer_destroy(buf);
+    }
+}
+
+/* Hand the records of @cpu_index over to the plugin */
+static void plugin_mem_buffer_flush(struct qemu_plugin_mem_buffer *buf,
+                                    unsigned int cpu_index)
+{
+    struct qemu_plugin_mem_buffer_vcpu *b;
+
+    b = plugin_scoreboard_entry(buf->score, cpu_index);
+    if (b->n) {
+        buf->cb(cpu_index, b->recs, b->n, buf->userdata);
+        b->n = 0;
+    }
+}
+
+/* Called from the code cache when a buffer might not fit the next records */
+void HELPER(plugin_vcpu_mem_buffer_flush)(uint32_t cpu_index, void *buf)
+{
+    plugin_mem_buffer_flush(buf, cpu_index);
+}
+
+static void plugin_mem_buffer_append(struct qemu_plugin_mem_buffer *buf,
+                                     unsigned int cpu_index, uint64_t vaddr,
+                                     uint64_t pc, qemu_plugin_meminfo_t info)
+{
+    struct qemu_plugin_mem_buffer_vcpu *b;
+
+    b = plugin_scoreboard_entry(buf->score, cpu_index);
+    if (b->n == buf->n_entries) {
+        plugin_mem_buffer_flush(buf, cpu_index);
+    }
+    b->recs[b->n++] = (struct qemu_plugin_mem_record) {
+        .vaddr = vaddr,
+        .pc = pc,
+        .info = info,
+    };
+}
+
+static void plugin_mem_buffers_flush_vcpu(CPUState *cpu)
+{
+    struct qemu_plugin_mem_buffer *buf;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    QLIST_FOREACH(buf, &plugin.mem_buffers, entry) {
+        plugin_mem_buffer_flush(buf, cpu->cpu_index);
+    }
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_grow_scoreboards(cpu);
+
     qemu_rec_mutex_lock(&plugin.lock);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
@@ -212,6 +415,7 @@ void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_mem_buffers_flush_vcpu(cpu);
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_EXIT);
 
     qemu_rec_mutex_lock(&plugin.lock);
@@ -265,16 +469,18 @@ static struct qemu_plugin_dyn_cb *plugin_get_dyn_cb(GArray **arr)
 
 void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_mem_rw rw,
-                               enum qemu_plugin_op op, void *ptr,
+                               enum qemu_plugin_op op, qemu_plugin_u64 entry,
                                uint64_t imm)
 {
     struct qemu_plugin_dyn_cb *dyn_cb;
 
     dyn_cb = plugin_get_dyn_cb(arr);
-    dyn_cb->userp = ptr;
+    memset(dyn_cb, 0, sizeof(*dyn_cb));
     dyn_cb->type = PLUGIN_CB_INLINE;
     dyn_cb->rw = rw;
+    dyn_cb->inline_insn.kind = PLUGIN_INLINE_OP;
     dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.entry = entry;
     dyn_cb->inline_insn.imm = imm;
 }
 
@@ -309,6 +515,43 @@ plugin_register_dyn_cb__udata(GArray **arr,
     dyn_cb->type = PLUGIN_CB_REGULAR;
 }
 
+void plugin_register_cond_cb(GArray **arr, qemu_plugin_vcpu_udata_cb_t cb,
+                             enum qemu_plugin_cb_flags flags,
+                             enum qemu_plugin_cond cond,
+                             qemu_plugin_u64 entry, uint64_t imm, void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    if (cond == QEMU_PLUGIN_COND_NEVER) {
+        return;
+    }
+    dyn_cb = plugin_get_dyn_cb(arr);
+    memset(dyn_cb, 0, sizeof(*dyn_cb));
+    dyn_cb->userp = udata;
+    dyn_cb->tcg_flags = cb_to_tcg_flags(flags);
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->inline_insn.kind = PLUGIN_INLINE_COND_CB;
+    dyn_cb->inline_insn.cond = cond;
+    dyn_cb->inline_insn.entry = entry;
+    dyn_cb->inline_insn.imm = imm;
+}
+
+void plugin_register_mem_buffer(GArray **arr, enum qemu_plugin_mem_rw rw,
+                                struct qemu_plugin_mem_buffer *buf,
+                                uint64_t pc)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    memset(dyn_cb, 0, sizeof(*dyn_cb));
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.kind = PLUGIN_INLINE_MEM_BUFFER;
+    dyn_cb->inline_insn.buf = buf;
+    dyn_cb->inline_insn.pc = pc;
+}
+
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
                                  enum qemu_plugin_cb_flags flags,
@@ -416,14 +659,17 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, unsigned int cpu_index)
 {
-    uint64_t *val = cb->userp;
+    uint64_t *val = plugin_u64_address(cb->inline_insn.entry, cpu_index);
 
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
     default:
         g_assert_not_reached();
     }
@@ -443,14 +689,19 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
         int w = !!(info & TRACE_MEM_ST) + 1;
 
         if (!(w & cb->rw)) {
-                break;
+            continue;
         }
         switch (cb->type) {
         case PLUGIN_CB_REGULAR:
             cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            if (cb->inline_insn.kind == PLUGIN_INLINE_MEM_BUFFER) {
+                plugin_mem_buffer_append(cb->inline_insn.buf, cpu->cpu_index,
+                                         vaddr, cb->inline_insn.pc, info);
+            } else {
+                exec_inline_op(cb, cpu->cpu_index);
+            }
             break;
         default:
             g_assert_not_reached();
@@ -460,6 +711,20 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
 
 void qemu_plugin_atexit_cb(void)
 {
+    struct qemu_plugin_mem_buffer *buf;
+    unsigned int i;
+
+    /*
+     * Hand the plugins whatever is left in the buffers.  This is racy if
+     * vCPU threads are still running, but the atexit callbacks are too.
+     */
+    WITH_QEMU_LOCK_GUARD(&plugin.lock) {
+        QLIST_FOREACH(buf, &plugin.mem_buffers, entry) {
+            for (i = 0; i < plugin.scoreboard_alloc_size; i++) {
+                plugin_mem_buffer_flush(buf, i);
+            }
+        }
+    }
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
 }
 
@@ -496,6 +761,9 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QTAILQ_INIT(&plugin.ctxs);
+    QLIST_INIT(&plugin.scoreboards);
+    plugin.scoreboard_alloc_size = 16;
+    QLIST_INIT(&plugin.mem_buffers);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
     atexit(qemu_plugin_atexit_cb);
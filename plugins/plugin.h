@@ -43,8 +43,17 @@ struct qemu_plugin_state {
      * the code cache is flushed.
      */
     struct qht dyn_cb_arr_ht;
+    /*
+     * Scoreboards have room for @scoreboard_alloc_size vCPUs.  Growing
+     * them requires all vCPUs to be out of the code cache.
+     */
+    QLIST_HEAD(, qemu_plugin_scoreboard) scoreboards;
+    size_t scoreboard_alloc_size;
+    QLIST_HEAD(, qemu_plugin_mem_buffer) mem_buffers;
 };
 
+extern struct qemu_plugin_state plugin;
+
 
 struct qemu_plugin_ctx {
     GModule *handle;
@@ -65,9 +74,18 @@ struct qemu_plugin_ctx *plugin_id_to_ctx_locked(qemu_plugin_id_t id);
 
 void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_mem_rw rw,
-                               enum qemu_plugin_op op, void *ptr,
+                               enum qemu_plugin_op op, qemu_plugin_u64 entry,
                                uint64_t imm);
 
+void plugin_register_cond_cb(GArray **arr, qemu_plugin_vcpu_udata_cb_t cb,
+                             enum qemu_plugin_cb_flags flags,
+                             enum qemu_plugin_cond cond,
+                             qemu_plugin_u64 entry, uint64_t imm, void *udata);
+
+void plugin_register_mem_buffer(GArray **arr, enum qemu_plugin_mem_rw rw,
+                                struct qemu_plugin_mem_buffer *buf,
+                                uint64_t pc);
+
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
                             bool reset);
@@ -94,6 +112,14 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb);
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, unsigned int cpu_index);
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size);
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+struct qemu_plugin_mem_buffer *
+plugin_mem_buffer_new(size_t n_entries, qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                      void *userdata);
+void plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf);
 
 #endif /* _PLUGIN_INTERNAL_H_ */
@@ -124,6 +124,9 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tier-threshold=n (retranslate TBs run n times as superblocks)\n"
+    "                victim-tlb-size=n (entries in the TCG victim TLB, default=128)\n"
+    "                perf=off|map|jitdump (describe translated code to perf, default=off)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
@@ -151,6 +154,29 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tier-threshold=n``
+        Retranslate a TCG translation block once it has run n times,
+        following forward direct jumps and branches so that fewer
+        blocks are chained together.  Only targets that build such
+        superblocks (currently RISC-V) support it, elsewhere the option
+        is ignored with a warning.  The default, 0, disables
+        retranslation.  It is also disabled with icount.
+
+    ``victim-tlb-size=n``
+        Sets the number of entries, a power of 2 between 8 and 4096, of
+        the TCG victim TLB.  Each MMU mode has one; it keeps the entries
+        evicted from the main TLB so that they can be found again
+        without walking the guest page tables.  The default is 128.
+
+    ``perf=off|map|jitdump``
+        Describe the code generated by TCG to the Linux perf tool, so
+        that samples can be attributed to guest addresses and symbols.
+        ``map`` writes ``/tmp/perf-PID.map``, which perf reads directly
+        but which goes stale once the translation cache is flushed.
+        ``jitdump`` writes ``/tmp/jit-PID.dump`` with the generated code
+        and the guest address of each instruction; record with
+        ``perf record -k 1`` and run ``perf inject --jit`` on the result.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefor taking advantage of
@@ -2414,6 +2440,15 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m]\n"
+    "                attach to the existing network interface 'name' with AF_XDP socket\n"
+    "                use 'mode=MODE' to specify an XDP program attach mode\n"
+    "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
+    "                use 'queues=n' to specify how many queues of a multiqueue interface should be used\n"
+    "                use 'start-queue=m' to specify the first queue that should be used\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
@@ -2434,6 +2469,9 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_POSIX
     "vhost-user|"
 #endif
@@ -2463,7 +2501,7 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "                old way to initialize a host network interface\n"
     "                (use the -netdev option if possible instead)\n", QEMU_ARCH_ALL)
 SRST
-``-nic [tap|bridge|user|l2tpv3|vde|netmap|vhost-user|socket][,...][,mac=macaddr][,model=mn]``
+``-nic [tap|bridge|user|l2tpv3|vde|netmap|af-xdp|vhost-user|socket][,...][,mac=macaddr][,model=mn]``
     This option is a shortcut for configuring both the on-board
     (default) guest NIC hardware and the host network backend in one go.
     The host backend options are the same as with the corresponding
@@ -2877,6 +2915,49 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m]``
+    Configure AF_XDP backend to connect to a network interface 'name'
+    using AF_XDP socket. A specific program attach mode for a default
+    XDP program can be forced with 'mode', defaults to best-effort,
+    where the likely most performant mode will be in use. Number of
+    queues 'n' should generally match the number of queues in the
+    interface and defaults to 1. Traffic arriving on non-configured
+    device queues will not be delivered to the network backend; use
+    'start-queue=m' to use the interface queues starting from 'm'
+    rather than from 0. Each queue is meant to be paired with a queue of
+    a multiqueue virtio-net device (``mq=on``). This option is only
+    available if QEMU has been compiled with AF_XDP support.
+
+    Example (two veth ends, the guest on one and the host stack on the
+    other):
+
+    .. parsed-literal::
+
+        # set up the veth pair, with two queues
+        ip link add veth0 numtxqueues 2 numrxqueues 2 type veth \
+            peer name veth1 numtxqueues 2 numrxqueues 2
+        ip link set veth0 up
+        ip link set veth1 up
+        # launch QEMU instance
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1,mq=on \
+            -netdev af-xdp,id=n1,ifname=veth0,queues=2
+
+    The queues of a virtio-net device can also be processed in IOThreads,
+    either all in one (``iothread=id``) or spread over several
+    (``iothreads=id0:id1``, where queue pair i goes to the i-th IOThread
+    modulo their number). With ``poll-max-ns`` set on the IOThreads, the
+    AF_XDP sockets are then busy-polled along with the virtqueues:
+
+    .. parsed-literal::
+
+        |qemu_system| linux.img -object iothread,id=io0,poll-max-ns=50000 \
+            -object iothread,id=io1,poll-max-ns=50000 \
+            -device virtio-net-pci,netdev=n1,mq=on,iothreads=io0:io1 \
+            -netdev af-xdp,id=n1,ifname=veth0,queues=2
+
+    This works with the tap, socket and af-xdp backends. Network filters
+    cannot be added to a backend while it is processed in an IOThread.
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -3899,12 +3980,12 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off,rr=record|replay,rrfile=<filename>,rrsnapshot=<snapshot>]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off,rr=record|replay,rrfile=<filename>,rrsnapshot=<snapshot>,rrsnapshot-period=<seconds>]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,rr=record|replay,rrfile=filename,rrsnapshot=snapshot]``
+``-icount [shift=N|auto][,rr=record|replay,rrfile=filename,rrsnapshot=snapshot,rrsnapshot-period=seconds]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -3941,6 +4022,11 @@ SRST
     Option rrsnapshot is used to create new vm snapshot named snapshot
     at the start of execution recording. In replay mode this option is
     used to load the initial VM state.
+
+    Option rrsnapshot-period makes the recording also create a snapshot
+    every given number of seconds, named after snapshot and the
+    instruction count. The ``replay_seek`` monitor command uses these
+    snapshots to move the replayed execution backward or forward.
 ERST
 
 DEF("watchdog", HAS_ARG, QEMU_OPTION_watchdog, \
@@ -4039,6 +4125,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                accept incoming migration from a saved file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -4058,6 +4146,11 @@ SRST
     Accept incoming migration as an output from specified external
     command.
 
+``-incoming file:filename``
+    Accept incoming migration from a file previously written with a
+    ``file:`` migration.  Enable the ``mapped-ram`` capability if it
+    was enabled when the file was written.
+
 ``-incoming defer``
     Wait for the URI to be specified via migrate\_incoming. The monitor
     can be used to change settings (such as migration parameters) prior
@@ -0,0 +1,106 @@
+/*
+ * replay-debugging.c
+ *
+ * Moving the replayed execution to an arbitrary instruction count.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "sysemu/replay.h"
+#include "sysemu/runstate.h"
+#include "replay-internal.h"
+#include "monitor/hmp.h"
+#include "monitor/monitor.h"
+#include "qapi/qapi-commands-misc.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/timer.h"
+#include "migration/snapshot.h"
+
+/* Instruction count to stop at, or -1 */
+uint64_t replay_break_icount = -1ULL;
+static QEMUTimer *replay_break_timer;
+
+static void replay_delete_break(void)
+{
+    if (replay_break_timer) {
+        timer_del(replay_break_timer);
+    }
+    replay_break_icount = -1ULL;
+}
+
+static void replay_break(void *opaque)
+{
+    replay_delete_break();
+    vm_stop(RUN_STATE_PAUSED);
+}
+
+void replay_break_reached(void)
+{
+    /* Called from the vCPU thread: stop the VM from the main loop.  */
+    timer_mod_ns(replay_break_timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+}
+
+static void replay_set_break(uint64_t icount)
+{
+    if (!replay_break_timer) {
+        replay_break_timer = timer_new_ns(QEMU_CLOCK_REALTIME,
+                                          replay_break, NULL);
+    }
+    replay_break_icount = icount;
+}
+
+static bool replay_seek_to(uint64_t icount, Error **errp)
+{
+    const ReplayMarker *m = replay_log_find_marker(icount);
+    uint64_t current = replay_get_current_icount();
+
+    if (icount < current || (m && m->icount > current)) {
+        if (!m) {
+            error_setg(errp, "no snapshot was recorded before instruction "
+                       "count %" PRIu64, icount);
+            return false;
+        }
+        vm_stop(RUN_STATE_RESTORE_VM);
+        if (load_snapshot(m->name, errp) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void qmp_replay_seek(int64_t icount, Error **errp)
+{
+    if (replay_mode != REPLAY_MODE_PLAY) {
+        error_setg(errp, "replay_seek is only available in replay mode");
+        return;
+    }
+    if (icount < 0) {
+        error_setg(errp, "invalid instruction count %" PRId64, icount);
+        return;
+    }
+
+    replay_delete_break();
+    if (!replay_seek_to(icount, errp)) {
+        return;
+    }
+
+    if (replay_get_current_icount() == icount) {
+        vm_stop(RUN_STATE_PAUSED);
+    } else {
+        replay_set_break(icount);
+        vm_start();
+    }
+}
+
+void hmp_replay_seek(Monitor *mon, const QDict *qdict)
+{
+    int64_t icount = qdict_get_try_int(qdict, "icount", -1LL);
+    Error *err = NULL;
+
+    qmp_replay_seek(icount, &err);
+    hmp_handle_error(mon, err);
+}
@@ -23,18 +23,6 @@
    written or read to the log. */
 static QemuMutex lock;
 
-/* File for replay writing */
-static bool write_error;
-FILE *replay_file;
-
-static void replay_write_error(void)
-{
-    if (!write_error) {
-        error_report("replay write error");
-        write_error = true;
-    }
-}
-
 static void replay_read_error(void)
 {
     error_report("error reading the replay data");
@@ -44,9 +32,7 @@ static void replay_read_error(void)
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
-        }
+        replay_log_put(&byte, 1);
     }
 }
 
@@ -79,9 +65,7 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
-        }
+        replay_log_put(buf, size);
     }
 }
 
@@ -89,11 +73,9 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
+        if (!replay_log_get(&byte, 1)) {
             replay_read_error();
         }
-        byte = r;
     }
     return byte;
 }
@@ -135,7 +117,7 @@ void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
+        if (!replay_log_get(buf, *size)) {
             replay_read_error();
         }
     }
@@ -146,7 +128,7 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
+        if (!replay_log_get(*buf, *size)) {
             replay_read_error();
         }
     }
@@ -95,6 +95,41 @@ extern ReplayState replay_state;
 /* File for replay writing */
 extern FILE *replay_file;
 
+/* Replay log, see replay-log.c */
+
+/*! A VM snapshot taken while recording */
+typedef struct ReplayMarker {
+    uint64_t icount;
+    /* Position in the event stream */
+    uint64_t offset;
+    char *name;
+} ReplayMarker;
+
+/*! Opens the log and sets replay_file; exits on error */
+void replay_log_open(const char *fname, bool record);
+/*! Writes out the log, if recording, and closes it */
+void replay_log_close(void);
+/*! Appends data to the log */
+void replay_log_put(const void *data, size_t size);
+/*! Reads data from the log, returns false at the end of the log */
+bool replay_log_get(void *data, size_t size);
+/*! Writes out the events recorded so far */
+void replay_log_flush(void);
+/*! Returns the current position in the event stream */
+uint64_t replay_log_tell(void);
+/*! Moves to a position in the event stream, when replaying */
+void replay_log_seek(uint64_t offset);
+/*! Records that snapshot @name was taken at @icount */
+void replay_log_add_marker(uint64_t icount, uint64_t offset,
+                           const char *name);
+/*! Returns the last snapshot taken at or before @icount, or NULL */
+const ReplayMarker *replay_log_find_marker(uint64_t icount);
+
+/*! Instruction count at which replay stops, or -1 */
+extern uint64_t replay_break_icount;
+/*! Stops the VM once the break instruction count is reached */
+void replay_break_reached(void);
+
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
 void replay_put_word(uint16_t word);
@@ -188,6 +223,11 @@ void *replay_event_net_load(void);
 
 /* VMState-related functions */
 
+/*! Seconds between the snapshots taken while recording, or 0 */
+extern uint64_t replay_snapshot_period;
+/*! Starts taking periodic snapshots, if enabled */
+void replay_snapshot_timer_init(void);
+
 /* Registers replay VMState.
    Should be called before virtual devices initialization
    to make cached timers available for post_load functions. */
@@ -0,0 +1,647 @@
+/*
+ * replay-log.c
+ *
+ * Buffered, chunked and compressed replay log
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+/*
+ * The event stream is cut into chunks of REPLAY_CHUNK_SIZE bytes.  While
+ * recording, full chunks are handed to a thread that compresses them
+ * (with zstd, when QEMU is built with it) and appends them to the file,
+ * so the vCPU thread never waits for the disk.  Each chunk is preceded
+ * by a header that gives its offset in the event stream.  The chunk being
+ * filled is also handed over when a snapshot marker is added and, through
+ * replay_log_flush(), about once a second, so that little of the stream
+ * is lost if QEMU dies.
+ *
+ * Snapshot markers are written to the stream as records of their own,
+ * after the chunk that holds their position.  When the recording ends,
+ * an index of the chunks and of the markers is appended to the file, and
+ * its position is written in the file header.  A log without an index,
+ * for instance because QEMU was killed while recording, is indexed by
+ * walking the record headers; it then ends with the last complete chunk.
+ *
+ * Positions in the event stream (see replay_log_tell()) are what VM
+ * snapshots save, so loading a snapshot only needs to decompress the
+ * chunk that holds its position.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bswap.h"
+#include "qemu/thread.h"
+#include "qemu/error-report.h"
+#include "sysemu/replay.h"
+#include "replay-internal.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+/* Current version of the replay mechanism.
+   Increase it when file format changes. */
+#define REPLAY_VERSION              0xe0200b
+/* Size of replay log header: version and index position */
+#define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
+
+#define REPLAY_CHUNK_SIZE           (256 * KiB)
+/* Size of the header that precedes each chunk in the file */
+#define REPLAY_CHUNK_HEADER_SIZE    24
+/* Chunks that may wait for the writer thread before recording blocks */
+#define REPLAY_CHUNK_QUEUE          8
+#define REPLAY_ZSTD_LEVEL           1
+
+enum {
+    REPLAY_CHUNK_RAW,
+    REPLAY_CHUNK_ZSTD,
+    /* Not a chunk: the icount and name of a snapshot marker */
+    REPLAY_CHUNK_MARKER,
+};
+
+/* Index entry for a chunk */
+typedef struct ReplayChunk {
+    /* Position of the chunk in the event stream */
+    uint64_t offset;
+    /* Position of the chunk header in the file */
+    uint64_t file_pos;
+    uint32_t size;
+    uint32_t stored_size;
+    uint32_t encoding;
+} ReplayChunk;
+
+/* A chunk waiting for the writer thread */
+typedef struct ReplayPendingChunk {
+    uint64_t offset;
+    uint32_t size;
+    bool marker;
+    uint8_t *data;
+} ReplayPendingChunk;
+
+/* File for replay writing */
+FILE *replay_file;
+
+static struct {
+    bool record;
+    /* Chunk being filled, or being read */
+    uint8_t *buf;
+    size_t buf_size;
+    size_t len;
+    size_t pos;
+    uint64_t buf_offset;
+    /* Index of the chunk after the one in buf, when reading */
+    size_t next_chunk;
+    GArray *chunks;
+    GArray *markers;
+
+    /* Writer thread; chunks and file_pos are also protected by mutex */
+    QemuThread thread;
+    QemuMutex mutex;
+    QemuCond cond;
+    GQueue queue;
+    bool stop;
+    bool write_error;
+    uint64_t file_pos;
+} replay_log;
+
+static void replay_log_write_error(void)
+{
+    if (!replay_log.write_error) {
+        error_report("replay write error");
+        replay_log.write_error = true;
+    }
+}
+
+static void replay_log_read_error(const char *msg)
+{
+    error_report("error reading the replay data: %s", msg);
+    exit(1);
+}
+
+static void replay_log_write_record(const ReplayChunk *e, const void *data)
+{
+    uint8_t header[REPLAY_CHUNK_HEADER_SIZE] = { 0 };
+
+    stq_be_p(header, e->offset);
+    stl_be_p(header + 8, e->size);
+    stl_be_p(header + 12, e->stored_size);
+    stl_be_p(header + 16, e->encoding);
+    if (fwrite(header, sizeof(header), 1, replay_file) != 1 ||
+        fwrite(data, 1, e->stored_size, replay_file) != e->stored_size ||
+        fflush(replay_file)) {
+        replay_log_write_error();
+    }
+}
+
+static void replay_log_write_marker(ReplayPendingChunk *c)
+{
+    ReplayChunk e = {
+        .offset = c->offset,
+        .file_pos = replay_log.file_pos,
+        .stored_size = c->size,
+        .encoding = REPLAY_CHUNK_MARKER,
+    };
+
+    replay_log_write_record(&e, c->data);
+
+    qemu_mutex_lock(&replay_log.mutex);
+    replay_log.file_pos += REPLAY_CHUNK_HEADER_SIZE + e.stored_size;
+    qemu_mutex_unlock(&replay_log.mutex);
+}
+
+static void replay_log_write_chunk(ReplayPendingChunk *c)
+{
+    ReplayChunk e = {
+        .offset = c->offset,
+        .file_pos = replay_log.file_pos,
+        .size = c->size,
+        .stored_size = c->size,
+        .encoding = REPLAY_CHUNK_RAW,
+    };
+    const uint8_t *data = c->data;
+    uint8_t *zbuf = NULL;
+
+#ifdef CONFIG_ZSTD
+    {
+        size_t bound = ZSTD_compressBound(c->size);
+        size_t ret;
+
+        zbuf = g_malloc(bound);
+        ret = ZSTD_compress(zbuf, bound, c->data, c->size, REPLAY_ZSTD_LEVEL);
+        if (!ZSTD_isError(ret) && ret < c->size) {
+            data = zbuf;
+            e.stored_size = ret;
+            e.encoding = REPLAY_CHUNK_ZSTD;
+        }
+    }
+#endif
+
+    replay_log_write_record(&e, data);
+    g_free(zbuf);
+
+    qemu_mutex_lock(&replay_log.mutex);
+    replay_log.file_pos += REPLAY_CHUNK_HEADER_SIZE + e.stored_size;
+    g_array_append_val(replay_log.chunks, e);
+    qemu_mutex_unlock(&replay_log.mutex);
+}
+
+static void *replay_log_writer(void *opaque)
+{
+    qemu_mutex_lock(&replay_log.mutex);
+    while (true) {
+        ReplayPendingChunk *c = g_queue_pop_head(&replay_log.queue);
+
+        if (!c) {
+            if (replay_log.stop) {
+                break;
+            }
+            qemu_cond_wait(&replay_log.cond, &replay_log.mutex);
+            continue;
+        }
+        /* There is room in the queue again.  */
+        qemu_cond_broadcast(&replay_log.cond);
+        qemu_mutex_unlock(&replay_log.mutex);
+
+        if (c->marker) {
+            replay_log_write_marker(c);
+        } else {
+            replay_log_write_chunk(c);
+        }
+        g_free(c->data);
+        g_free(c);
+
+        qemu_mutex_lock(&replay_log.mutex);
+    }
+    qemu_mutex_unlock(&replay_log.mutex);
+    return NULL;
+}
+
+static void replay_log_queue(ReplayPendingChunk *c)
+{
+    qemu_mutex_lock(&replay_log.mutex);
+    while (g_queue_get_length(&replay_log.queue) >= REPLAY_CHUNK_QUEUE) {
+        qemu_cond_wait(&replay_log.cond, &replay_log.mutex);
+    }
+    g_queue_push_tail(&replay_log.queue, c);
+    qemu_cond_broadcast(&replay_log.cond);
+    qemu_mutex_unlock(&replay_log.mutex);
+}
+
+/* Hand the chunk being filled over to the writer thread.  */
+static void replay_log_flush_chunk(void)
+{
+    ReplayPendingChunk *c;
+
+    if (!replay_log.len) {
+        return;
+    }
+    c = g_new0(ReplayPendingChunk, 1);
+    c->offset = replay_log.buf_offset;
+    c->size = replay_log.len;
+    c->data = replay_log.buf;
+
+    replay_log.buf = g_malloc(REPLAY_CHUNK_SIZE);
+    replay_log.buf_offset += replay_log.len;
+    replay_log.len = 0;
+
+    replay_log_queue(c);
+}
+
+void replay_log_flush(void)
+{
+    if (replay_log.record) {
+        replay_log_flush_chunk();
+    }
+}
+
+void replay_log_put(const void *data, size_t size)
+{
+    const uint8_t *p = data;
+
+    assert(replay_log.record);
+    while (size) {
+        size_t n = MIN(size, REPLAY_CHUNK_SIZE - replay_log.len);
+
+        memcpy(replay_log.buf + replay_log.len, p, n);
+        replay_log.len += n;
+        p += n;
+        size -= n;
+        if (replay_log.len == REPLAY_CHUNK_SIZE) {
+            replay_log_flush_chunk();
+        }
+    }
+}
+
+static void replay_log_load_chunk(size_t i)
+{
+    ReplayChunk *e = &g_array_index(replay_log.chunks, ReplayChunk, i);
+    uint8_t *data;
+
+    if (e->size > replay_log.buf_size) {
+        replay_log.buf_size = e->size;
+        replay_log.buf = g_realloc(replay_log.buf, e->size);
+    }
+    data = e->encoding == REPLAY_CHUNK_RAW ? replay_log.buf
+                                           : g_malloc(e->stored_size);
+
+    if (fseek(replay_file, e->file_pos + REPLAY_CHUNK_HEADER_SIZE,
+              SEEK_SET) ||
+        fread(data, 1, e->stored_size, replay_file) != e->stored_size) {
+        replay_log_read_error("truncated chunk");
+    }
+
+    switch (e->encoding) {
+    case REPLAY_CHUNK_RAW:
+        break;
+#ifdef CONFIG_ZSTD
+    case REPLAY_CHUNK_ZSTD:
+        if (ZSTD_decompress(replay_log.buf, e->size,
+                            data, e->stored_size) != e->size) {
+            replay_log_read_error("corrupted chunk");
+        }
+        g_free(data);
+        break;
+#endif
+    default:
+        replay_log_read_error("unsupported chunk encoding");
+    }
+
+    replay_log.buf_offset = e->offset;
+    replay_log.len = e->size;
+    replay_log.pos = 0;
+    replay_log.next_chunk = i + 1;
+}
+
+bool replay_log_get(void *data, size_t size)
+{
+    uint8_t *p = data;
+
+    assert(!replay_log.record);
+    while (size) {
+        size_t n;
+
+        if (replay_log.pos == replay_log.len) {
+            if (replay_log.next_chunk >= replay_log.chunks->len) {
+                return false;
+            }
+            replay_log_load_chunk(replay_log.next_chunk);
+        }
+        n = MIN(size, replay_log.len - replay_log.pos);
+        memcpy(p, replay_log.buf + replay_log.pos, n);
+        replay_log.pos += n;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+uint64_t replay_log_tell(void)
+{
+    return replay_log.buf_offset +
+           (replay_log.record ? replay_log.len : replay_log.pos);
+}
+
+void replay_log_seek(uint64_t offset)
+{
+    ReplayChunk *chunks = (ReplayChunk *)replay_log.chunks->data;
+    size_t lo = 0, hi = replay_log.chunks->len;
+
+    assert(!replay_log.record);
+    if (!hi) {
+        return;
+    }
+    /* Find the last chunk that starts at or before offset.  */
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+
+        if (chunks[mid].offset <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    if (offset < chunks[lo].offset ||
+        offset - chunks[lo].offset > chunks[lo].size) {
+        replay_log_read_error("invalid position");
+    }
+    if (replay_log.next_chunk != lo + 1) {
+        replay_log_load_chunk(lo);
+    }
+    replay_log.pos = offset - chunks[lo].offset;
+}
+
+void replay_log_add_marker(uint64_t icount, uint64_t offset,
+                           const char *name)
+{
+    ReplayMarker m = {
+        .icount = icount,
+        .offset = offset,
+        .name = g_strdup(name),
+    };
+
+    g_array_append_val(replay_log.markers, m);
+
+    if (replay_log.record) {
+        ReplayPendingChunk *c = g_new0(ReplayPendingChunk, 1);
+        size_t len = strlen(name);
+
+        /* The chunk that holds offset must reach the file first.  */
+        replay_log_flush_chunk();
+        c->offset = offset;
+        c->size = 8 + len;
+        c->marker = true;
+        c->data = g_malloc(c->size);
+        stq_be_p(c->data, icount);
+        memcpy(c->data + 8, name, len);
+        replay_log_queue(c);
+    }
+}
+
+const ReplayMarker *replay_log_find_marker(uint64_t icount)
+{
+    const ReplayMarker *best = NULL;
+    guint i;
+
+    for (i = 0; i < replay_log.markers->len; i++) {
+        const ReplayMarker *m = &g_array_index(replay_log.markers,
+                                               ReplayMarker, i);
+
+        if (m->icount <= icount && (!best || m->icount >= best->icount)) {
+            best = m;
+        }
+    }
+    return best;
+}
+
+static void replay_log_write_index(void)
+{
+    GByteArray *index = g_byte_array_new();
+    uint8_t header[HEADER_SIZE];
+    uint8_t tmp[8];
+    guint i;
+
+#define PUT(type, size, value) \
+    do { st##type##_be_p(tmp, value); \
+         g_byte_array_append(index, tmp, size); } while (0)
+
+    PUT(l, 4, replay_log.chunks->len);
+    for (i = 0; i < replay_log.chunks->len; i++) {
+        ReplayChunk *e = &g_array_index(replay_log.chunks, ReplayChunk, i);
+
+        PUT(q, 8, e->offset);
+        PUT(q, 8, e->file_pos);
+        PUT(l, 4, e->size);
+        PUT(l, 4, e->stored_size);
+        PUT(l, 4, e->encoding);
+    }
+    PUT(l, 4, replay_log.markers->len);
+    for (i = 0; i < replay_log.markers->len; i++) {
+        ReplayMarker *m = &g_array_index(replay_log.markers, ReplayMarker, i);
+
+        PUT(q, 8, m->icount);
+        PUT(q, 8, m->offset);
+        PUT(l, 4, strlen(m->name));
+        g_byte_array_append(index, (const guint8 *)m->name, strlen(m->name));
+    }
+#undef PUT
+
+    stl_be_p(header, REPLAY_VERSION);
+    stq_be_p(header + 4, replay_log.file_pos);
+    if (fseek(replay_file, replay_log.file_pos, SEEK_SET) ||
+        fwrite(index->data, 1, index->len, replay_file) != index->len ||
+        fseek(replay_file, 0, SEEK_SET) ||
+        fwrite(header, sizeof(header), 1, replay_file) != 1) {
+        replay_log_write_error();
+    }
+    g_byte_array_free(index, true);
+}
+
+static bool replay_log_read_index(uint64_t pos)
+{
+    GByteArray *index = g_byte_array_new();
+    uint8_t buf[4096];
+    const uint8_t *p, *end;
+    uint32_t n, i;
+    size_t len;
+    bool ok = false;
+
+    if (fseek(replay_file, pos, SEEK_SET)) {
+        goto out;
+    }
+    while ((len = fread(buf, 1, sizeof(buf), replay_file)) > 0) {
+        g_byte_array_append(index, buf, len);
+    }
+    p = index->data;
+    end = p + index->len;
+
+#define GET(type, size, var) \
+    do { if (end - p < size) { goto out; } \
+         var = ld##type##_be_p(p); p += size; } while (0)
+
+    GET(l, 4, n);
+    for (i = 0; i < n; i++) {
+        ReplayChunk e;
+
+        GET(q, 8, e.offset);
+        GET(q, 8, e.file_pos);
+        GET(l, 4, e.size);
+        GET(l, 4, e.stored_size);
+        GET(l, 4, e.encoding);
+        g_array_append_val(replay_log.chunks, e);
+    }
+    GET(l, 4, n);
+    for (i = 0; i < n; i++) {
+        ReplayMarker m;
+
+        GET(q, 8, m.icount);
+        GET(q, 8, m.offset);
+        GET(l, 4, len);
+        if (end - p < len) {
+            goto out;
+        }
+        m.name = g_strndup((const char *)p, len);
+        p += len;
+        g_array_append_val(replay_log.markers, m);
+    }
+#undef GET
+    ok = true;
+
+out:
+    g_byte_array_free(index, true);
+    return ok;
+}
+
+/* Rebuild the index of a log whose recording did not end normally.  */
+static void replay_log_scan_chunks(void)
+{
+    uint64_t pos = HEADER_SIZE, offset = 0;
+    struct stat st;
+    guint i;
+
+    if (fstat(fileno(replay_file), &st)) {
+        return;
+    }
+    while (pos + REPLAY_CHUNK_HEADER_SIZE <= st.st_size) {
+        uint8_t header[REPLAY_CHUNK_HEADER_SIZE];
+        ReplayChunk e = { .file_pos = pos };
+
+        if (fseek(replay_file, pos, SEEK_SET) ||
+            fread(header, sizeof(header), 1, replay_file) != 1) {
+            break;
+        }
+        e.offset = ldq_be_p(header);
+        e.size = ldl_be_p(header + 8);
+        e.stored_size = ldl_be_p(header + 12);
+        e.encoding = ldl_be_p(header + 16);
+        pos += sizeof(header) + e.stored_size;
+        if (pos > st.st_size) {
+            break;
+        }
+        if (e.encoding == REPLAY_CHUNK_MARKER) {
+            uint8_t *data = g_malloc(e.stored_size);
+            ReplayMarker m = { .offset = e.offset };
+
+            if (e.stored_size < 8 ||
+                fread(data, 1, e.stored_size, replay_file) != e.stored_size) {
+                g_free(data);
+                break;
+            }
+            m.icount = ldq_be_p(data);
+            m.name = g_strndup((const char *)data + 8, e.stored_size - 8);
+            g_free(data);
+            g_array_append_val(replay_log.markers, m);
+            continue;
+        }
+        if (e.offset != offset) {
+            break;
+        }
+        offset += e.size;
+        g_array_append_val(replay_log.chunks, e);
+    }
+    /* Snapshots past the end of the recovered stream cannot be replayed.  */
+    for (i = replay_log.markers->len; i-- > 0;) {
+        if (g_array_index(replay_log.markers, ReplayMarker, i).offset >
+            offset) {
+            g_array_remove_index(replay_log.markers, i);
+        }
+    }
+    warn_report("replay log was not closed properly, "
+                "it ends at offset %" PRIu64, offset);
+}
+
+static void replay_marker_free(gpointer p)
+{
+    ReplayMarker *m = p;
+
+    g_free(m->name);
+}
+
+void replay_log_open(const char *fname, bool record)
+{
+    uint8_t header[HEADER_SIZE];
+
+    replay_file = fopen(fname, record ? "wb" : "rb");
+    if (replay_file == NULL) {
+        fprintf(stderr, "Replay: open %s: %s\n", fname, strerror(errno));
+        exit(1);
+    }
+
+    memset(&replay_log, 0, sizeof(replay_log));
+    replay_log.record = record;
+    replay_log.chunks = g_array_new(false, false, sizeof(ReplayChunk));
+    replay_log.markers = g_array_new(false, false, sizeof(ReplayMarker));
+    g_array_set_clear_func(replay_log.markers, replay_marker_free);
+
+    if (record) {
+        /* The index position is filled in when the recording ends.  */
+        stl_be_p(header, REPLAY_VERSION);
+        stq_be_p(header + 4, 0);
+        if (fwrite(header, sizeof(header), 1, replay_file) != 1) {
+            replay_log_write_error();
+        }
+        replay_log.file_pos = HEADER_SIZE;
+        replay_log.buf_size = REPLAY_CHUNK_SIZE;
+        replay_log.buf = g_malloc(REPLAY_CHUNK_SIZE);
+        qemu_mutex_init(&replay_log.mutex);
+        qemu_cond_init(&replay_log.cond);
+        g_queue_init(&replay_log.queue);
+        qemu_thread_create(&replay_log.thread, "replay-log",
+                           replay_log_writer, NULL, QEMU_THREAD_JOINABLE);
+        return;
+    }
+
+    if (fread(header, sizeof(header), 1, replay_file) != 1 ||
+        ldl_be_p(header) != REPLAY_VERSION) {
+        fprintf(stderr, "Replay: invalid input log file version\n");
+        exit(1);
+    }
+    if (!ldq_be_p(header + 4)) {
+        replay_log_scan_chunks();
+    } else if (!replay_log_read_index(ldq_be_p(header + 4))) {
+        replay_log_read_error("corrupted index");
+    }
+}
+
+void replay_log_close(void)
+{
+    if (replay_log.record) {
+        replay_log_flush_chunk();
+        qemu_mutex_lock(&replay_log.mutex);
+        replay_log.stop = true;
+        qemu_cond_broadcast(&replay_log.cond);
+        qemu_mutex_unlock(&replay_log.mutex);
+        qemu_thread_join(&replay_log.thread);
+        replay_log_write_index();
+        qemu_cond_destroy(&replay_log.cond);
+        qemu_mutex_destroy(&replay_log.mutex);
+    }
+
+    fclose(replay_file);
+    replay_file = NULL;
+    g_free(replay_log.buf);
+    g_array_free(replay_log.chunks, true);
+    g_array_free(replay_log.markers, true);
+    memset(&replay_log, 0, sizeof(replay_log));
+}
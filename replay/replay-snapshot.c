@@ -18,11 +18,18 @@
 #include "qemu/error-report.h"
 #include "migration/vmstate.h"
 #include "migration/snapshot.h"
+#include "qemu/timer.h"
+#include "sysemu/runstate.h"
+
+/* Delay before trying again when a snapshot cannot be taken yet */
+#define REPLAY_SNAPSHOT_RETRY_MS    100
+
+static QEMUTimer *replay_snapshot_timer;
 
 static int replay_pre_save(void *opaque)
 {
     ReplayState *state = opaque;
-    state->file_offset = ftell(replay_file);
+    state->file_offset = replay_log_tell();
 
     return 0;
 }
@@ -31,7 +38,7 @@ static int replay_post_load(void *opaque, int version_id)
 {
     ReplayState *state = opaque;
     if (replay_mode == REPLAY_MODE_PLAY) {
-        fseek(replay_file, state->file_offset, SEEK_SET);
+        replay_log_seek(state->file_offset);
         /* If this was a vmstate, saved in recording mode,
            we need to initialize replay data fields. */
         replay_fetch_data_kind();
@@ -82,6 +89,8 @@ void replay_vmstate_init(void)
                 error_report("Could not create snapshot for icount record");
                 exit(1);
             }
+            replay_log_add_marker(replay_get_current_icount(),
+                                  replay_state.file_offset, replay_snapshot);
         } else if (replay_mode == REPLAY_MODE_PLAY) {
             if (load_snapshot(replay_snapshot, &err) != 0) {
                 error_report_err(err);
@@ -97,3 +106,60 @@ bool replay_can_snapshot(void)
     return replay_mode == REPLAY_MODE_NONE
         || !replay_has_events();
 }
+
+/*
+ * Take one of the periodic snapshots that replay_seek() starts from.
+ * They are named after the initial snapshot and the instruction count.
+ */
+static void replay_snapshot_periodic(void *opaque)
+{
+    int64_t delay = replay_snapshot_period * 1000;
+    const ReplayMarker *last;
+    Error *err = NULL;
+    uint64_t icount;
+    char *name;
+
+    if (!runstate_is_running()) {
+        goto out;
+    }
+    if (!replay_can_snapshot()) {
+        delay = REPLAY_SNAPSHOT_RETRY_MS;
+        goto out;
+    }
+
+    vm_stop(RUN_STATE_SAVE_VM);
+    icount = replay_get_current_icount();
+    last = replay_log_find_marker(icount);
+    if (last && last->icount == icount) {
+        vm_start();
+        goto out;
+    }
+    name = g_strdup_printf("%s-%" PRIu64, replay_snapshot, icount);
+    if (save_snapshot(name, &err) == 0) {
+        replay_log_add_marker(icount, replay_state.file_offset, name);
+    } else {
+        error_report_err(err);
+        error_report("Could not create periodic snapshot for icount record, "
+                     "giving up");
+        delay = 0;
+    }
+    g_free(name);
+    vm_start();
+
+out:
+    if (delay) {
+        timer_mod(replay_snapshot_timer,
+                  qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + delay);
+    }
+}
+
+void replay_snapshot_timer_init(void)
+{
+    if (replay_mode != REPLAY_MODE_RECORD || !replay_snapshot_period) {
+        return;
+    }
+    replay_snapshot_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                         replay_snapshot_periodic, NULL);
+    timer_mod(replay_snapshot_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+              replay_snapshot_period * 1000);
+}
@@ -20,20 +20,19 @@
 #include "sysemu/cpus.h"
 #include "qemu/error-report.h"
 
-/* Current version of the replay mechanism.
-   Increase it when file format changes. */
-#define REPLAY_VERSION              0xe02009
-/* Size of replay log header */
-#define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
-
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
+uint64_t replay_snapshot_period;
 
 /* Name of replay file  */
 static char *replay_filename;
 ReplayState replay_state;
 static GSList *replay_blockers;
 
+/* Interval at which the events recorded so far are written out */
+#define REPLAY_FLUSH_PERIOD_MS 1000
+static QEMUTimer *replay_flush_timer;
+
 bool replay_next_event_is(int event)
 {
     bool res = false;
@@ -73,6 +72,10 @@ int replay_get_instructions(void)
     replay_mutex_lock();
     if (replay_next_event_is(EVENT_INSTRUCTION)) {
         res = replay_state.instruction_count;
+        if (replay_break_icount != -1ULL &&
+            replay_state.current_icount + res > replay_break_icount) {
+            res = replay_break_icount - replay_state.current_icount;
+        }
     }
     replay_mutex_unlock();
     return res;
@@ -91,6 +94,9 @@ void replay_account_executed_instructions(void)
 
             replay_state.instruction_count -= count;
             replay_state.current_icount += count;
+            if (replay_break_icount == replay_state.current_icount) {
+                replay_break_reached();
+            }
             if (replay_state.instruction_count == 0) {
                 assert(replay_state.data_kind == EVENT_INSTRUCTION);
                 replay_finish_event();
@@ -245,28 +251,16 @@ bool replay_has_checkpoint(void)
 
 static void replay_enable(const char *fname, int mode)
 {
-    const char *fmode = NULL;
     assert(!replay_file);
 
-    switch (mode) {
-    case REPLAY_MODE_RECORD:
-        fmode = "wb";
-        break;
-    case REPLAY_MODE_PLAY:
-        fmode = "rb";
-        break;
-    default:
+    if (mode != REPLAY_MODE_RECORD && mode != REPLAY_MODE_PLAY) {
         fprintf(stderr, "Replay: internal error: invalid replay mode\n");
         exit(1);
     }
 
     atexit(replay_finish);
 
-    replay_file = fopen(fname, fmode);
-    if (replay_file == NULL) {
-        fprintf(stderr, "Replay: open %s: %s\n", fname, strerror(errno));
-        exit(1);
-    }
+    replay_log_open(fname, mode == REPLAY_MODE_RECORD);
 
     replay_filename = g_strdup(fname);
     replay_mode = mode;
@@ -277,17 +271,7 @@ static void replay_enable(const char *fname, int mode)
     replay_state.current_icount = 0;
     replay_state.has_unread_data = 0;
 
-    /* skip file header for RECORD and check it for PLAY */
-    if (replay_mode == REPLAY_MODE_RECORD) {
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
-    } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
-            fprintf(stderr, "Replay: invalid input log file version\n");
-            exit(1);
-        }
-        /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+    if (replay_mode == REPLAY_MODE_PLAY) {
         replay_fetch_data_kind();
     }
 
@@ -328,6 +312,11 @@ void replay_configure(QemuOpts *opts)
     }
 
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
+    replay_snapshot_period = qemu_opt_get_number(opts, "rrsnapshot-period", 0);
+    if (replay_snapshot_period && !replay_snapshot) {
+        error_report("rrsnapshot-period requires rrsnapshot");
+        exit(1);
+    }
     replay_vmstate_register();
     replay_enable(fname, mode);
 
@@ -335,6 +324,16 @@ out:
     loc_pop(&loc);
 }
 
+static void replay_flush_periodic(void *opaque)
+{
+    if (replay_mode != REPLAY_MODE_RECORD) {
+        return;
+    }
+    replay_log_flush();
+    timer_mod(replay_flush_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+              REPLAY_FLUSH_PERIOD_MS);
+}
+
 void replay_start(void)
 {
     if (replay_mode == REPLAY_MODE_NONE) {
@@ -350,7 +349,13 @@ void replay_start(void)
         exit(1);
     }
 
-    /* Timer for snapshotting will be set up here. */
+    replay_snapshot_timer_init();
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_flush_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                          replay_flush_periodic, NULL);
+        timer_mod(replay_flush_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                  REPLAY_FLUSH_PERIOD_MS);
+    }
 
     replay_enable_events();
 }
@@ -368,14 +373,9 @@ void replay_finish(void)
         if (replay_mode == REPLAY_MODE_RECORD) {
             /* write end event */
             replay_put_event(EVENT_END);
-
-            /* write header */
-            fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
         }
 
-        fclose(replay_file);
-        replay_file = NULL;
+        replay_log_close();
     }
     if (replay_filename) {
         g_free(replay_filename);
@@ -255,6 +255,22 @@ class HTABSection(object):
         return ""
 
 
+class BufferedSection(object):
+    # The vmdesc does not describe the fields of buffered sections, so
+    # their state is skipped and only its size reported.
+    def __init__(self, file, section_key):
+        self.file = file
+        self.section_key = section_key
+        self.size = 0
+
+    def read(self):
+        self.size = self.file.read32()
+        self.file.readvar(self.size)
+
+    def getDict(self):
+        return collections.OrderedDict([('buffered_size', self.size)])
+
+
 class ConfigurationSection(object):
     def __init__(self, file):
         self.file = file
@@ -486,6 +502,7 @@ class MigrationDump(object):
     QEMU_VM_SUBSECTION    = 0x05
     QEMU_VM_VMDESCRIPTION = 0x06
     QEMU_VM_CONFIGURATION = 0x07
+    QEMU_VM_SECTION_BUFFERED = 0x09
     QEMU_VM_SECTION_FOOTER= 0x7e
 
     def __init__(self, filename):
@@ -539,6 +556,14 @@ class MigrationDump(object):
                 section = classdesc[0](file, version_id, classdesc[1], section_key)
                 self.sections[section_id] = section
                 section.read()
+            elif section_type == self.QEMU_VM_SECTION_BUFFERED:
+                section_id = file.read32()
+                name = file.readstr()
+                instance_id = file.read32()
+                version_id = file.read32()
+                section = BufferedSection(file, (name, instance_id))
+                self.sections[section_id] = section
+                section.read()
             elif section_type == self.QEMU_VM_SECTION_PART or section_type == self.QEMU_VM_SECTION_END:
                 section_id = file.read32()
                 self.sections[section_id].read()
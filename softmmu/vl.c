@@ -466,6 +466,9 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrsnapshot-period",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
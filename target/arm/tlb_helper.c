@@ -144,6 +144,25 @@ void arm_cpu_do_transaction_failed(CPUState *cs, hwaddr physaddr,
     arm_deliver_fault(cpu, addr, access_type, mmu_idx, &fi);
 }
 
+/*
+ * Return true if @mmu_idx is translated by two stages.  get_phys_addr()
+ * then returns the page size of stage 2, over which the mapping is not
+ * necessarily linear.
+ */
+static bool arm_mmu_idx_uses_stage2(CPUARMState *env, ARMMMUIdx mmu_idx)
+{
+    switch (mmu_idx) {
+    case ARMMMUIdx_E10_0:
+    case ARMMMUIdx_E10_1:
+    case ARMMMUIdx_E10_1_PAN:
+        /* HCR.DC means HCR.VM behaves as 1 */
+        return arm_feature(env, ARM_FEATURE_EL2) &&
+               (env->cp15.hcr_el2 & (HCR_DC | HCR_VM));
+    default:
+        return false;
+    }
+}
+
 #endif /* !defined(CONFIG_USER_ONLY) */
 
 bool arm_cpu_tlb_fill(CPUState *cs, vaddr address, int size,
@@ -186,8 +205,17 @@ bool arm_cpu_tlb_fill(CPUState *cs, vaddr address, int size,
             phys_addr &= TARGET_PAGE_MASK;
             address &= TARGET_PAGE_MASK;
         }
-        tlb_set_page_with_attrs(cs, address, phys_addr, attrs,
-                                prot, mmu_idx, page_size);
+        if (page_size > TARGET_PAGE_SIZE &&
+            !arm_mmu_idx_uses_stage2(&cpu->env,
+                                     core_to_arm_mmu_idx(&cpu->env,
+                                                         mmu_idx))) {
+            /* A block mapping: fill the rest of it without a walk.  */
+            tlb_set_large_page_with_attrs(cs, address, phys_addr, attrs,
+                                          prot, mmu_idx, page_size);
+        } else {
+            tlb_set_page_with_attrs(cs, address, phys_addr, attrs,
+                                    prot, mmu_idx, page_size);
+        }
         return true;
     } else if (probe) {
         return false;
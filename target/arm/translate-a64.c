@@ -327,6 +327,7 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint64_t dest)
     TranslationBlock *tb;
 
     tb = s->base.tb;
+    translator_set_successor(&s->base, n, dest);
     if (use_goto_tb(s, n, dest)) {
         tcg_gen_goto_tb(n);
         gen_a64_set_pc_im(dest);
@@ -707,17 +707,28 @@ void HELPER(NAME)(void *vd, void *vn, void *vm, void *stat, uint32_t desc) \
     clear_tail(d, oprsz, simd_maxsz(desc));                                \
 }
 
+/* As DO_3OP, using the softfloat batch entry points.  */
+#define DO_3OP_N(NAME, FUNC, TYPE) \
+void HELPER(NAME)(void *vd, void *vn, void *vm, void *stat, uint32_t desc) \
+{                                                                          \
+    intptr_t oprsz = simd_oprsz(desc);                                     \
+    FUNC(vd, vn, vm, oprsz / sizeof(TYPE), stat);                          \
+    clear_tail(vd, oprsz, simd_maxsz(desc));                               \
+}
+
 DO_3OP(gvec_fadd_h, float16_add, float16)
-DO_3OP(gvec_fadd_s, float32_add, float32)
-DO_3OP(gvec_fadd_d, float64_add, float64)
+DO_3OP_N(gvec_fadd_s, float32_add_n, float32)
+DO_3OP_N(gvec_fadd_d, float64_add_n, float64)
 
 DO_3OP(gvec_fsub_h, float16_sub, float16)
-DO_3OP(gvec_fsub_s, float32_sub, float32)
-DO_3OP(gvec_fsub_d, float64_sub, float64)
+DO_3OP_N(gvec_fsub_s, float32_sub_n, float32)
+DO_3OP_N(gvec_fsub_d, float64_sub_n, float64)
 
 DO_3OP(gvec_fmul_h, float16_mul, float16)
-DO_3OP(gvec_fmul_s, float32_mul, float32)
-DO_3OP(gvec_fmul_d, float64_mul, float64)
+DO_3OP_N(gvec_fmul_s, float32_mul_n, float32)
+DO_3OP_N(gvec_fmul_d, float64_mul_n, float64)
+
+#undef DO_3OP_N
 
 DO_3OP(gvec_ftsmul_h, float16_ftsmul, float16)
 DO_3OP(gvec_ftsmul_s, float32_ftsmul, float32)
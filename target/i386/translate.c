@@ -23,6 +23,7 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg-op.h"
+#include "tcg/tcg-op-gvec.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translator.h"
 
@@ -2225,6 +2226,7 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
 {
     target_ulong pc = s->cs_base + eip;
 
+    translator_set_successor(&s->base, tb_num, pc);
     if (use_goto_tb(s, pc))  {
         /* jump to same page: we can use a direct jump */
         tcg_gen_goto_tb(tb_num);
@@ -2571,12 +2573,48 @@ static void gen_bnd_jmp(DisasContext *s)
     }
 }
 
+/* How an end of block reaches the next TB, see do_gen_eob_worker() */
+enum {
+    EOB_EXIT,           /* through the main loop */
+    EOB_JR,             /* by looking up the TB at the new eip */
+    EOB_JR_IC,          /* same, through the inline cache of this TB */
+    EOB_JR_RET,         /* same, through the return cache of the caller */
+};
+
+/*
+ * Jump to the TB at the new eip, which is also in DEST.  The inline caches
+ * only compare addresses, so only use them for near jumps, when the end
+ * of block does not change the TB flags and the address is the eip.
+ */
+static void gen_lookup_and_goto(DisasContext *s, int jr, TCGv dest)
+{
+    TCGv pc;
+
+    if (jr == EOB_JR || s->cs_base != 0 ||
+        (s->base.tb->flags & (HF_INHIBIT_IRQ_MASK | HF_RF_MASK))) {
+        tcg_gen_lookup_and_goto_ptr();
+        return;
+    }
+    /* The caches branch before comparing the address */
+    pc = tcg_temp_local_new();
+    tcg_gen_mov_tl(pc, dest);
+    if (jr == EOB_JR_RET) {
+        tcg_gen_lookup_and_goto_return(s->base.tb, pc);
+    } else {
+        tcg_gen_lookup_and_goto_ic(s->base.tb, pc);
+    }
+    tcg_temp_free(pc);
+}
+
 /* Generate an end of block. Trace exception is also generated if needed.
    If INHIBIT, set HF_INHIBIT_IRQ_MASK if it isn't already set.
    If RECHECK_TF, emit a rechecking helper for #DB, ignoring the state of
-   S->TF.  This is used by the syscall/sysret insns.  */
+   S->TF.  This is used by the syscall/sysret insns.
+   JR is one of EOB_*, and DEST holds the new eip unless it is EOB_EXIT.
+*/
 static void
-do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr)
+do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, int jr,
+                  TCGv dest)
 {
     gen_update_cc_op(s);
 
@@ -2597,8 +2635,8 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr)
         tcg_gen_exit_tb(NULL, 0);
     } else if (s->tf) {
         gen_helper_single_step(cpu_env);
-    } else if (jr) {
-        tcg_gen_lookup_and_goto_ptr();
+    } else if (jr != EOB_EXIT) {
+        gen_lookup_and_goto(s, jr, dest);
     } else {
         tcg_gen_exit_tb(NULL, 0);
     }
@@ -2608,7 +2646,7 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr)
 static inline void
 gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf)
 {
-    do_gen_eob_worker(s, inhibit, recheck_tf, false);
+    do_gen_eob_worker(s, inhibit, recheck_tf, EOB_EXIT, NULL);
 }
 
 /* End of block.
@@ -2627,7 +2665,19 @@ static void gen_eob(DisasContext *s)
 /* Jump to register */
 static void gen_jr(DisasContext *s, TCGv dest)
 {
-    do_gen_eob_worker(s, false, false, true);
+    do_gen_eob_worker(s, false, false, EOB_JR_IC, dest);
+}
+
+/* Return to the address in register */
+static void gen_jr_ret(DisasContext *s, TCGv dest)
+{
+    do_gen_eob_worker(s, false, false, EOB_JR_RET, dest);
+}
+
+/* Jump to register, after CS may have changed */
+static void gen_jr_far(DisasContext *s, TCGv dest)
+{
+    do_gen_eob_worker(s, false, false, EOB_JR, dest);
 }
 
 /* generate a jump to eip. No segment change must happen before as a
@@ -2872,6 +2922,248 @@ static const SSEFunc_0_epp sse_op_table2[3 * 8][2] = {
     [16 + 7] = { NULL, gen_helper_pslldq_xmm },
 };
 
+/*
+ * Integer operations that are inlined with the gvec expanders instead of
+ * calling the ops_sse.h helpers.  They apply to both the MMX (b1 == 0)
+ * and the SSE (b1 == 1) forms; only the operand size differs.
+ */
+typedef void (*SSEGvecFn)(unsigned vece, uint32_t dofs, uint32_t aofs,
+                          uint32_t bofs, uint32_t oprsz, uint32_t maxsz);
+
+typedef struct SSEGvecOp {
+    SSEGvecFn fn;
+    MemOp vece;
+} SSEGvecOp;
+
+/*
+ * The xmm register is the low 128 bits of the ZMMReg, which are at the
+ * end of the union on big-endian hosts.  The lanes are permuted in the
+ * same way in all operands, so element-wise operations do not care.
+ */
+static inline int sse_gvec_offset(int offset, int is_xmm)
+{
+#ifdef HOST_WORDS_BIGENDIAN
+    if (is_xmm) {
+        offset += sizeof(ZMMReg) - 16;
+    }
+#endif
+    return offset;
+}
+
+static void gen_gvec_pcmpeq(unsigned vece, uint32_t dofs, uint32_t aofs,
+                            uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    tcg_gen_gvec_cmp(TCG_COND_EQ, vece, dofs, aofs, bofs, oprsz, maxsz);
+}
+
+static void gen_gvec_pcmpgt(unsigned vece, uint32_t dofs, uint32_t aofs,
+                            uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    tcg_gen_gvec_cmp(TCG_COND_GT, vece, dofs, aofs, bofs, oprsz, maxsz);
+}
+
+/* pandn complements the destination, not the source.  */
+static void gen_gvec_pandn(unsigned vece, uint32_t dofs, uint32_t aofs,
+                           uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    tcg_gen_gvec_andc(vece, dofs, bofs, aofs, oprsz, maxsz);
+}
+
+/* pabs only reads the source.  */
+static void gen_gvec_pabs(unsigned vece, uint32_t dofs, uint32_t aofs,
+                          uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    tcg_gen_gvec_abs(vece, dofs, bofs, oprsz, maxsz);
+}
+
+/*
+ * psrl, psra and psll by the count in the low quadword of the source.
+ * Counts of the element size or more clear the destination, or fill it
+ * with the sign for psra.
+ */
+static void gen_gvec_shift(TCGOpcode opc, unsigned vece, uint32_t dofs,
+                           uint32_t aofs, uint32_t bofs, uint32_t oprsz,
+                           uint32_t maxsz)
+{
+    TCGv_i64 count = tcg_temp_local_new_i64();
+    TCGv_i32 shift = tcg_temp_new_i32();
+    TCGLabel *done = NULL;
+    int bits = 8 << vece;
+
+#ifdef HOST_WORDS_BIGENDIAN
+    /* The low quadword is the last one, see sse_gvec_offset.  */
+    bofs += oprsz - 8;
+#endif
+    tcg_gen_ld_i64(count, cpu_env, bofs);
+
+    if (opc == INDEX_op_sar_vec) {
+        TCGv_i64 max = tcg_const_i64(bits - 1);
+
+        tcg_gen_umin_i64(count, count, max);
+        tcg_temp_free_i64(max);
+    } else {
+        TCGLabel *in_range = gen_new_label();
+
+        done = gen_new_label();
+        tcg_gen_brcondi_i64(TCG_COND_LTU, count, bits, in_range);
+        tcg_gen_gvec_dup_imm(MO_64, dofs, oprsz, maxsz, 0);
+        tcg_gen_br(done);
+        gen_set_label(in_range);
+    }
+    tcg_gen_extrl_i64_i32(shift, count);
+
+    switch (opc) {
+    case INDEX_op_shr_vec:
+        tcg_gen_gvec_shrs(vece, dofs, aofs, shift, oprsz, maxsz);
+        break;
+    case INDEX_op_sar_vec:
+        tcg_gen_gvec_sars(vece, dofs, aofs, shift, oprsz, maxsz);
+        break;
+    case INDEX_op_shl_vec:
+        tcg_gen_gvec_shls(vece, dofs, aofs, shift, oprsz, maxsz);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    if (done) {
+        gen_set_label(done);
+    }
+
+    tcg_temp_free_i32(shift);
+    tcg_temp_free_i64(count);
+}
+
+static void gen_gvec_psrl(unsigned vece, uint32_t dofs, uint32_t aofs,
+                          uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    gen_gvec_shift(INDEX_op_shr_vec, vece, dofs, aofs, bofs, oprsz, maxsz);
+}
+
+static void gen_gvec_psra(unsigned vece, uint32_t dofs, uint32_t aofs,
+                          uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    gen_gvec_shift(INDEX_op_sar_vec, vece, dofs, aofs, bofs, oprsz, maxsz);
+}
+
+static void gen_gvec_psll(unsigned vece, uint32_t dofs, uint32_t aofs,
+                          uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    gen_gvec_shift(INDEX_op_shl_vec, vece, dofs, aofs, bofs, oprsz, maxsz);
+}
+
+/* Indexed like sse_op_table1 */
+static const SSEGvecOp sse_gvec_table1[256] = {
+    /* and, andn, or and xor of packed floats are plain bitwise ops */
+    [0x54] = { tcg_gen_gvec_and, MO_64 },
+    [0x55] = { gen_gvec_pandn, MO_64 },
+    [0x56] = { tcg_gen_gvec_or, MO_64 },
+    [0x57] = { tcg_gen_gvec_xor, MO_64 },
+    [0x64] = { gen_gvec_pcmpgt, MO_8 },
+    [0x65] = { gen_gvec_pcmpgt, MO_16 },
+    [0x66] = { gen_gvec_pcmpgt, MO_32 },
+    [0x74] = { gen_gvec_pcmpeq, MO_8 },
+    [0x75] = { gen_gvec_pcmpeq, MO_16 },
+    [0x76] = { gen_gvec_pcmpeq, MO_32 },
+    [0xd1] = { gen_gvec_psrl, MO_16 },
+    [0xd2] = { gen_gvec_psrl, MO_32 },
+    [0xd3] = { gen_gvec_psrl, MO_64 },
+    [0xd4] = { tcg_gen_gvec_add, MO_64 },
+    [0xd5] = { tcg_gen_gvec_mul, MO_16 },
+    [0xd8] = { tcg_gen_gvec_ussub, MO_8 },
+    [0xd9] = { tcg_gen_gvec_ussub, MO_16 },
+    [0xda] = { tcg_gen_gvec_umin, MO_8 },
+    [0xdb] = { tcg_gen_gvec_and, MO_64 },
+    [0xdc] = { tcg_gen_gvec_usadd, MO_8 },
+    [0xdd] = { tcg_gen_gvec_usadd, MO_16 },
+    [0xde] = { tcg_gen_gvec_umax, MO_8 },
+    [0xdf] = { gen_gvec_pandn, MO_64 },
+    [0xe1] = { gen_gvec_psra, MO_16 },
+    [0xe2] = { gen_gvec_psra, MO_32 },
+    [0xe8] = { tcg_gen_gvec_sssub, MO_8 },
+    [0xe9] = { tcg_gen_gvec_sssub, MO_16 },
+    [0xea] = { tcg_gen_gvec_smin, MO_16 },
+    [0xeb] = { tcg_gen_gvec_or, MO_64 },
+    [0xec] = { tcg_gen_gvec_ssadd, MO_8 },
+    [0xed] = { tcg_gen_gvec_ssadd, MO_16 },
+    [0xee] = { tcg_gen_gvec_smax, MO_16 },
+    [0xef] = { tcg_gen_gvec_xor, MO_64 },
+    [0xf1] = { gen_gvec_psll, MO_16 },
+    [0xf2] = { gen_gvec_psll, MO_32 },
+    [0xf3] = { gen_gvec_psll, MO_64 },
+    [0xf8] = { tcg_gen_gvec_sub, MO_8 },
+    [0xf9] = { tcg_gen_gvec_sub, MO_16 },
+    [0xfa] = { tcg_gen_gvec_sub, MO_32 },
+    [0xfb] = { tcg_gen_gvec_sub, MO_64 },
+    [0xfc] = { tcg_gen_gvec_add, MO_8 },
+    [0xfd] = { tcg_gen_gvec_add, MO_16 },
+    [0xfe] = { tcg_gen_gvec_add, MO_32 },
+};
+
+/* Indexed like sse_op_table6, i.e. the 0x0f 0x38 opcodes */
+static const SSEGvecOp sse_gvec_table6[256] = {
+    [0x1c] = { gen_gvec_pabs, MO_8 },
+    [0x1d] = { gen_gvec_pabs, MO_16 },
+    [0x1e] = { gen_gvec_pabs, MO_32 },
+    [0x29] = { gen_gvec_pcmpeq, MO_64 },
+    [0x37] = { gen_gvec_pcmpgt, MO_64 },
+    [0x38] = { tcg_gen_gvec_smin, MO_8 },
+    [0x39] = { tcg_gen_gvec_smin, MO_32 },
+    [0x3a] = { tcg_gen_gvec_umin, MO_16 },
+    [0x3b] = { tcg_gen_gvec_umin, MO_32 },
+    [0x3c] = { tcg_gen_gvec_smax, MO_8 },
+    [0x3d] = { tcg_gen_gvec_smax, MO_32 },
+    [0x3e] = { tcg_gen_gvec_umax, MO_16 },
+    [0x3f] = { tcg_gen_gvec_umax, MO_32 },
+    [0x40] = { tcg_gen_gvec_mul, MO_32 },
+};
+
+static bool gen_sse_gvec(const SSEGvecOp *op, int is_xmm, int op1_offset,
+                         int op2_offset)
+{
+    int sz = is_xmm ? 16 : 8;
+
+    if (!op->fn) {
+        return false;
+    }
+    op1_offset = sse_gvec_offset(op1_offset, is_xmm);
+    op2_offset = sse_gvec_offset(op2_offset, is_xmm);
+    op->fn(op->vece, op1_offset, op1_offset, op2_offset, sz, sz);
+    return true;
+}
+
+/* psrl, psra and psll by an immediate, as selected by modrm.reg.  */
+static bool gen_sse_shifti_gvec(int op, MemOp vece, int is_xmm, int offset,
+                                int val)
+{
+    int sz = is_xmm ? 16 : 8;
+    int bits = 8 << vece;
+
+    if (op != 2 && op != 4 && op != 6) {
+        return false;
+    }
+    offset = sse_gvec_offset(offset, is_xmm);
+    if (val >= bits) {
+        if (op != 4) {
+            tcg_gen_gvec_dup_imm(MO_64, offset, sz, sz, 0);
+            return true;
+        }
+        /* Arithmetic shifts by the element size or more fill with sign. */
+        val = bits - 1;
+    }
+    switch (op) {
+    case 2:
+        tcg_gen_gvec_shri(vece, offset, offset, val, sz, sz);
+        break;
+    case 4:
+        tcg_gen_gvec_sari(vece, offset, offset, val, sz, sz);
+        break;
+    case 6:
+        tcg_gen_gvec_shli(vece, offset, offset, val, sz, sz);
+        break;
+    }
+    return true;
+}
+
 static const SSEFunc_0_epi sse_op_table3ai[] = {
     gen_helper_cvtsi2ss,
     gen_helper_cvtsi2sd
@@ -3483,6 +3775,10 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                 rm = (modrm & 7);
                 op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
             }
+            if (gen_sse_shifti_gvec((modrm >> 3) & 7, (b & 0xff) - 0x70,
+                                    is_xmm, op2_offset, val)) {
+                break;
+            }
             tcg_gen_addi_ptr(s->ptr0, cpu_env, op2_offset);
             tcg_gen_addi_ptr(s->ptr1, cpu_env, op1_offset);
             sse_fn_epp(cpu_env, s->ptr0, s->ptr1);
@@ -3759,6 +4055,10 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             if (sse_fn_epp == SSE_SPECIAL) {
                 goto unknown_op;
             }
+            if (gen_sse_gvec(&sse_gvec_table6[b], b1, op1_offset,
+                             op2_offset)) {
+                break;
+            }
 
             tcg_gen_addi_ptr(s->ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(s->ptr1, cpu_env, op2_offset);
@@ -4471,6 +4771,10 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, s->ptr0, s->ptr1, s->A0);
             break;
         default:
+            if (gen_sse_gvec(&sse_gvec_table1[b], is_xmm,
+                             op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(s->ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(s->ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, s->ptr0, s->ptr1);
@@ -5064,6 +5368,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             next_eip = s->pc - s->cs_base;
             tcg_gen_movi_tl(s->T1, next_eip);
             gen_push_v(s, s->T1);
+            tcg_gen_push_return(s->base.tb);
             gen_op_jmp_v(s->T0);
             gen_bnd_jmp(s);
             gen_jr(s, s->T0);
@@ -5085,7 +5390,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
                                       tcg_const_i32(s->pc - s->cs_base));
             }
             tcg_gen_ld_tl(s->tmp4, cpu_env, offsetof(CPUX86State, eip));
-            gen_jr(s, s->tmp4);
+            gen_jr_far(s, s->tmp4);
             break;
         case 4: /* jmp Ev */
             if (dflag == MO_16) {
@@ -5109,7 +5414,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
                 gen_op_jmp_v(s->T1);
             }
             tcg_gen_ld_tl(s->tmp4, cpu_env, offsetof(CPUX86State, eip));
-            gen_jr(s, s->tmp4);
+            gen_jr_far(s, s->tmp4);
             break;
         case 6: /* push Ev */
             gen_push_v(s, s->T0);
@@ -6512,7 +6817,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(s->T0);
         gen_bnd_jmp(s);
-        gen_jr(s, s->T0);
+        gen_jr_ret(s, s->T0);
         break;
     case 0xc3: /* ret */
         ot = gen_pop_T0(s);
@@ -6520,7 +6825,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(s->T0);
         gen_bnd_jmp(s);
-        gen_jr(s, s->T0);
+        gen_jr_ret(s, s->T0);
         break;
     case 0xca: /* lret im */
         val = x86_ldsw_code(env, s);
@@ -6585,6 +6890,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             }
             tcg_gen_movi_tl(s->T0, next_eip);
             gen_push_v(s, s->T0);
+            tcg_gen_push_return(s->base.tb);
             gen_bnd_jmp(s);
             gen_jmp(s, tval);
         }
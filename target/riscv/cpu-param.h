@@ -19,5 +19,7 @@
 #endif
 #define TARGET_PAGE_BITS 12 /* 4 KiB Pages */
 #define NB_MMU_MODES 4
+/* Jumps are followed in superblocks, see translator_follow_jump() */
+#define TARGET_TB_SUPERBLOCKS 1
 
 #endif
@@ -66,7 +66,15 @@ static bool trans_jalr(DisasContext *ctx, arg_jalr *a)
     if (a->rd != 0) {
         tcg_gen_movi_tl(cpu_gpr[a->rd], ctx->pc_succ_insn);
     }
-    lookup_and_goto_ptr(ctx);
+    /* Return address prediction hints, as in the ISA manual */
+    if (is_link_reg(a->rd)) {
+        tcg_gen_push_return(ctx->base.tb);
+        lookup_and_goto_ptr(ctx);
+    } else if (is_link_reg(a->rs1)) {
+        lookup_and_goto_return(ctx);
+    } else {
+        lookup_and_goto_ptr(ctx);
+    }
 
     if (misaligned) {
         gen_set_label(misaligned);
@@ -82,11 +90,29 @@ static bool gen_branch(DisasContext *ctx, arg_b *a, TCGCond cond)
 {
     TCGLabel *l = gen_new_label();
     TCGv source1, source2;
+    target_ulong dest = ctx->base.pc_next + a->imm;
     source1 = tcg_temp_new();
     source2 = tcg_temp_new();
     gen_get_gpr(source1, a->rs1);
     gen_get_gpr(source2, a->rs2);
 
+    /*
+     * In a superblock, forward branches are assumed not taken: the taken
+     * path leaves through a side exit and translation goes on with the
+     * next instruction.
+     */
+    if (a->imm > 0 && (has_ext(ctx, RVC) || !(dest & 0x3)) &&
+        follow_jump(ctx, ctx->pc_succ_insn)) {
+        tcg_gen_brcond_tl(tcg_invert_cond(cond), source1, source2, l);
+        tcg_gen_movi_tl(cpu_pc, dest);
+        lookup_and_goto_ptr(ctx);
+        gen_set_label(l); /* branch not taken */
+
+        tcg_temp_free(source1);
+        tcg_temp_free(source2);
+        return true;
+    }
+
     tcg_gen_brcond_tl(cond, source1, source2, l);
     gen_goto_tb(ctx, 1, ctx->pc_succ_insn);
     gen_set_label(l); /* branch taken */
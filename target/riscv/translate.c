@@ -119,16 +119,34 @@ static void exit_tb(DisasContext *ctx)
     }
 }
 
-/* Wrapper around tcg_gen_lookup_and_goto_ptr that handles single stepping */
+/*
+ * Wrappers around tcg_gen_lookup_and_goto_{ic,return} that handle single
+ * stepping.  No jump changes the TB flags, so inline caches are safe.
+ */
 static void lookup_and_goto_ptr(DisasContext *ctx)
 {
     if (ctx->base.singlestep_enabled) {
         gen_exception_debug();
     } else {
-        tcg_gen_lookup_and_goto_ptr();
+        tcg_gen_lookup_and_goto_ic(ctx->base.tb, cpu_pc);
+    }
+}
+
+static void lookup_and_goto_return(DisasContext *ctx)
+{
+    if (ctx->base.singlestep_enabled) {
+        gen_exception_debug();
+    } else {
+        tcg_gen_lookup_and_goto_return(ctx->base.tb, cpu_pc);
     }
 }
 
+/* x1 and x5 are the link registers of the standard calling convention */
+static bool is_link_reg(int reg)
+{
+    return reg == 1 || reg == 5;
+}
+
 static void gen_exception_illegal(DisasContext *ctx)
 {
     generate_exception(ctx, RISCV_EXCP_ILLEGAL_INST);
@@ -154,6 +172,7 @@ static inline bool use_goto_tb(DisasContext *ctx, target_ulong dest)
 
 static void gen_goto_tb(DisasContext *ctx, int n, target_ulong dest)
 {
+    translator_set_successor(&ctx->base, n, dest);
     if (use_goto_tb(ctx, dest)) {
         /* chaining is only allowed when the jump is to the same page */
         tcg_gen_goto_tb(n);
@@ -169,6 +188,16 @@ static void gen_goto_tb(DisasContext *ctx, int n, target_ulong dest)
     }
 }
 
+/*
+ * In a superblock, go on translating at @dest instead of ending the TB
+ * with a jump there.
+ */
+static bool follow_jump(DisasContext *ctx, target_ulong dest)
+{
+    return dest >= ctx->pc_succ_insn &&
+           translator_follow_jump(&ctx->base, dest);
+}
+
 /* Wrapper for getting reg values - need to check of reg is zero since
  * cpu_gpr[0] is not actually allocated
  */
@@ -331,7 +360,14 @@ static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
     if (rd != 0) {
         tcg_gen_movi_tl(cpu_gpr[rd], ctx->pc_succ_insn);
     }
+    if (is_link_reg(rd)) {
+        tcg_gen_push_return(ctx->base.tb);
+    }
 
+    if (follow_jump(ctx, next_pc)) {
+        ctx->pc_succ_insn = next_pc;
+        return;
+    }
     gen_goto_tb(ctx, 0, ctx->base.pc_next + imm); /* must use this for safety */
     ctx->base.is_jmp = DISAS_NORETURN;
 }
@@ -2681,8 +2681,8 @@ void tcg_gen_exit_tb(TranslationBlock *tb, unsigned idx)
             val = 0;
         }
     } else {
-        /* This is an exit via the exitreq label.  */
-        tcg_debug_assert(idx == TB_EXIT_REQUESTED);
+        /* This is an exit via the exitreq label or the tier counter.  */
+        tcg_debug_assert(idx == TB_EXIT_REQUESTED || idx == TB_EXIT_TIER_UP);
     }
 
     plugin_gen_disable_mem_helpers();
@@ -2720,6 +2720,150 @@ void tcg_gen_lookup_and_goto_ptr(void)
     }
 }
 
+void tcg_gen_movi_tb_ptr(TCGv_ptr ret, const TranslationBlock *tb)
+{
+    tcg_gen_movi_ptr(ret, (uintptr_t)tb);
+    TCGOP_TB_PTR(QTAILQ_LAST(&tcg_ctx->ops)) = 1;
+}
+
+#ifdef CONFIG_USER_ONLY
+static bool tcg_use_ic(const TranslationBlock *tb)
+{
+    /*
+     * CF_NOCACHE TBs are freed right after they run, while the return
+     * stack may still point to them.
+     */
+    return TCG_TARGET_HAS_goto_ptr && !(tb_cflags(tb) & CF_NOCACHE) &&
+           !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN);
+}
+
+/*
+ * Jump to the TB in the inline cache @n of @site if it starts at @addr;
+ * otherwise, or if @site is NULL, look the TB up and update the cache.
+ * @site must be a local temp.
+ */
+static void tcg_gen_goto_ic(TCGv_ptr site, int n, TCGv addr)
+{
+    TCGLabel *miss = gen_new_label();
+    TCGv_ptr dest = tcg_temp_new_ptr();
+    TCGv dest_pc = tcg_temp_new();
+    TCGv_i32 slot;
+
+    plugin_gen_disable_mem_helpers();
+    if (n == TB_JMP_RET) {
+        tcg_gen_brcondi_ptr(TCG_COND_EQ, site, 0, miss);
+    }
+    tcg_gen_ld_ptr(dest, site, offsetof(TranslationBlock, jmp_ic) +
+                   (n - TB_JMP_IC) * sizeof(TranslationBlock *));
+    tcg_gen_brcondi_ptr(TCG_COND_EQ, dest, 0, miss);
+    tcg_gen_ld_tl(dest_pc, dest, offsetof(TranslationBlock, pc));
+    tcg_gen_brcond_tl(TCG_COND_NE, dest_pc, addr, miss);
+    tcg_gen_ld_ptr(dest, dest, offsetof(TranslationBlock, tc.ptr));
+    tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(dest));
+
+    gen_set_label(miss);
+    slot = tcg_const_i32(n);
+    gen_helper_lookup_tb_ic(dest, cpu_env, site, slot);
+    tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(dest));
+
+    tcg_temp_free_i32(slot);
+    tcg_temp_free(dest_pc);
+    tcg_temp_free_ptr(dest);
+}
+
+void tcg_gen_lookup_and_goto_ic(const TranslationBlock *tb, TCGv addr)
+{
+    TCGv_ptr site;
+
+    if (!tcg_use_ic(tb)) {
+        tcg_gen_lookup_and_goto_ptr();
+        return;
+    }
+    site = tcg_temp_local_new_ptr();
+    tcg_gen_movi_tb_ptr(site, tb);
+    tcg_gen_goto_ic(site, TB_JMP_IC, addr);
+    tcg_temp_free_ptr(site);
+}
+
+/* Point @slot at the entry of the return stack that @top indexes.  */
+static void tcg_gen_ras_slot(TCGv_ptr slot, TCGv_i32 top)
+{
+    TCGv_i32 t = tcg_temp_new_i32();
+
+    tcg_gen_shli_i32(t, top, ctz32(sizeof(uintptr_t)));
+    tcg_gen_ext_i32_ptr(slot, t);
+    tcg_gen_add_ptr(slot, slot, cpu_env);
+    tcg_temp_free_i32(t);
+}
+
+void tcg_gen_push_return(const TranslationBlock *tb)
+{
+    TCGv_i32 top;
+    TCGv_ptr slot, site;
+
+    if (!tcg_use_ic(tb)) {
+        return;
+    }
+    top = tcg_temp_new_i32();
+    slot = tcg_temp_new_ptr();
+    site = tcg_temp_new_ptr();
+
+    tcg_gen_ld_i32(top, cpu_env, CPU_RAS_OFS(top));
+    tcg_gen_addi_i32(top, top, 1);
+    tcg_gen_andi_i32(top, top, CPU_RAS_SIZE - 1);
+    tcg_gen_st_i32(top, cpu_env, CPU_RAS_OFS(top));
+    tcg_gen_ras_slot(slot, top);
+    tcg_gen_movi_tb_ptr(site, tb);
+    tcg_gen_st_ptr(site, slot, CPU_RAS_OFS(tb));
+
+    tcg_temp_free_ptr(site);
+    tcg_temp_free_ptr(slot);
+    tcg_temp_free_i32(top);
+}
+
+void tcg_gen_lookup_and_goto_return(const TranslationBlock *tb, TCGv addr)
+{
+    TCGv_i32 top, prev;
+    TCGv_ptr slot, site;
+
+    if (!tcg_use_ic(tb)) {
+        tcg_gen_lookup_and_goto_ptr();
+        return;
+    }
+    top = tcg_temp_new_i32();
+    prev = tcg_temp_new_i32();
+    slot = tcg_temp_new_ptr();
+    site = tcg_temp_local_new_ptr();
+
+    tcg_gen_ld_i32(top, cpu_env, CPU_RAS_OFS(top));
+    tcg_gen_subi_i32(prev, top, 1);
+    tcg_gen_andi_i32(prev, prev, CPU_RAS_SIZE - 1);
+    tcg_gen_st_i32(prev, cpu_env, CPU_RAS_OFS(top));
+    tcg_gen_ras_slot(slot, top);
+    tcg_gen_ld_ptr(site, slot, CPU_RAS_OFS(tb));
+    tcg_gen_goto_ic(site, TB_JMP_RET, addr);
+
+    tcg_temp_free_ptr(site);
+    tcg_temp_free_ptr(slot);
+    tcg_temp_free_i32(prev);
+    tcg_temp_free_i32(top);
+}
+#else
+void tcg_gen_lookup_and_goto_ic(const TranslationBlock *tb, TCGv addr)
+{
+    tcg_gen_lookup_and_goto_ptr();
+}
+
+void tcg_gen_push_return(const TranslationBlock *tb)
+{
+}
+
+void tcg_gen_lookup_and_goto_return(const TranslationBlock *tb, TCGv addr)
+{
+    tcg_gen_lookup_and_goto_ptr();
+}
+#endif
+
 static inline MemOp tcg_canonicalize_memop(MemOp op, bool is64, bool st)
 {
     /* Trigger the asserts within as early as possible.  */
@@ -32,6 +32,7 @@
 
 #include "qemu/error-report.h"
 #include "qemu/cutils.h"
+#include "qemu/bitmap.h"
 #include "qemu/host-utils.h"
 #include "qemu/qemu-print.h"
 #include "qemu/timer.h"
@@ -172,6 +173,10 @@ struct tcg_region_tree {
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * Once every region has been handed out, the coldest ones can be evicted
+ * (see tcg_region_evict) and handed out again, before resorting to a
+ * full flush.
  */
 struct tcg_region_state {
     QemuMutex lock;
@@ -187,6 +192,7 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    unsigned long *evicted; /* evicted regions, free to be reused */
 };
 
 static struct tcg_region_state region;
@@ -399,22 +405,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+static size_t tc_ptr_to_region_idx(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
 
     if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
+        return 0;
     }
-    return region_trees + region_idx * tree_size;
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+{
+    return region_trees + tc_ptr_to_region_idx(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -549,11 +556,20 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t i;
+
+    if (region.current < region.n) {
+        tcg_region_assign(s, region.current);
+        region.current++;
+        return false;
+    }
+
+    i = find_first_bit(region.evicted, region.n);
+    if (i == region.n) {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    clear_bit(i, region.evicted);
+    tcg_region_assign(s, i);
     return false;
 }
 
@@ -594,18 +610,234 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    bitmap_zero(region.evicted, region.n);
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = atomic_read(&tcg_ctxs[i]);
         bool err = tcg_region_initial_alloc__locked(s);
 
         g_assert(!err);
+        if (s->region_hits) {
+            memset(s->region_hits, 0, region.n * sizeof(*s->region_hits));
+        }
     }
     qemu_mutex_unlock(&region.lock);
 
     tcg_region_tree_reset_all();
 }
 
+/*
+ * Account a TB entered through a lookup (from the execution loop or
+ * lookup_and_goto_ptr) to the region holding its code.  The counters
+ * are per TCG thread so this is cheap; tcg_region_evict adds them up.
+ *
+ * TBs that are only ever entered through a direct jump are not seen
+ * here; tcg_region_evict credits them with the hits of the regions
+ * that jump to them.
+ */
+void tcg_region_hit(const void *tc_ptr)
+{
+    uint32_t *hits = tcg_ctx->region_hits;
+
+    if (hits) {
+        hits[tc_ptr_to_region_idx(tc_ptr)]++;
+    }
+}
+
+struct tcg_region_links {
+    size_t from;
+    unsigned long *seen; /* region.n * region.n bitmap of links */
+    GArray *links;       /* pairs of (from, to) region indexes */
+};
+
+static gboolean tcg_region_links_iter(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    const TranslationBlock *tb = value;
+    struct tcg_region_links *l = data;
+    int n;
+
+    for (n = 0; n < ARRAY_SIZE(tb->jmp_dest); n++) {
+        uintptr_t dest = atomic_read(&tb->jmp_dest[n]);
+        const TranslationBlock *tb_next = (TranslationBlock *)dest;
+        size_t to, bit;
+
+        /* not chained, or the destination is being invalidated */
+        if (dest == 0 || (dest & 1)) {
+            continue;
+        }
+        to = tc_ptr_to_region_idx(tb_next->tc.ptr);
+        bit = l->from * region.n + to;
+        if (to != l->from && !test_bit(bit, l->seen)) {
+            size_t link[2] = { l->from, to };
+
+            set_bit(bit, l->seen);
+            g_array_append_vals(l->links, link, 2);
+        }
+    }
+    return false;
+}
+
+/*
+ * Direct jumps bypass tcg_region_hit, so a region whose TBs are only
+ * reached through chaining would look cold.  Make the target region of
+ * each jump at least as hot as the region it is taken from.
+ */
+static void tcg_region_propagate_hits(uint64_t *hits)
+{
+    struct tcg_region_links l;
+    size_t i, pass;
+    bool changed;
+
+    l.seen = bitmap_new(region.n * region.n);
+    l.links = g_array_new(false, false, sizeof(size_t));
+
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+
+        l.from = i;
+        qemu_mutex_lock(&rt->lock);
+        g_tree_foreach(rt->tree, tcg_region_links_iter, &l);
+        qemu_mutex_unlock(&rt->lock);
+    }
+
+    /* Chains can go through several regions; at most n passes needed */
+    for (pass = 0, changed = true; changed && pass < region.n; pass++) {
+        changed = false;
+        for (i = 0; i < l.links->len; i += 2) {
+            size_t from = g_array_index(l.links, size_t, i);
+            size_t to = g_array_index(l.links, size_t, i + 1);
+
+            if (hits[to] < hits[from]) {
+                hits[to] = hits[from];
+                changed = true;
+            }
+        }
+    }
+
+    g_array_free(l.links, true);
+    g_free(l.seen);
+}
+
+static gboolean tcg_region_collect_iter(gpointer key, gpointer value,
+                                        gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+static void tcg_region_evict_one(size_t i, GTraverseFunc func,
+                                 gpointer user_data)
+{
+    struct tcg_region_tree *rt = region_trees + i * tree_size;
+    GPtrArray *tbs = g_ptr_array_new();
+    void *start, *end;
+    guint j;
+
+    /*
+     * Invalidation takes other locks (page locks, jmp_lock) and must not
+     * run under rt->lock, so work on a snapshot of the region's TBs.
+     * Nothing can be added to the region meanwhile: it is full and no
+     * thread is translating into it.
+     */
+    qemu_mutex_lock(&rt->lock);
+    g_tree_foreach(rt->tree, tcg_region_collect_iter, tbs);
+    qemu_mutex_unlock(&rt->lock);
+
+    for (j = 0; j < tbs->len; j++) {
+        TranslationBlock *tb = g_ptr_array_index(tbs, j);
+
+        func(&tb->tc, tb, user_data);
+    }
+    g_ptr_array_free(tbs, true);
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    qemu_mutex_lock(&region.lock);
+    /* The region was accounted as full when its thread moved on */
+    tcg_region_bounds(i, &start, &end);
+    region.agg_size_full -= (end - start) - TCG_HIGHWATER;
+    set_bit(i, region.evicted);
+    qemu_mutex_unlock(&region.lock);
+}
+
+/*
+ * Evict the least used of the regions that are full and not being
+ * translated into: @func is called on each of their TBs, and must make
+ * them unreachable; the regions can then be allocated again.  Lookups
+ * in every region are halved afterwards, so that old hits fade out.
+ *
+ * @func is called without any region lock held.
+ *
+ * Returns the number of evicted regions, 0 if there was nothing to
+ * evict (e.g. with a single region) and a full flush is needed.
+ *
+ * Call from a safe-work context.
+ */
+size_t tcg_region_evict(GTraverseFunc func, gpointer user_data)
+{
+    unsigned int n_ctxs = atomic_read(&n_tcg_ctxs);
+    size_t n_evict = MAX(region.n / 8, 1);
+    size_t evicted = 0;
+    unsigned long *busy;
+    uint64_t *hits;
+    size_t *victims;
+    size_t i, j;
+
+    if (region.n == 1) {
+        return 0;
+    }
+
+    busy = bitmap_new(region.n);
+    hits = g_new0(uint64_t, region.n);
+    victims = g_new(size_t, n_evict);
+
+    qemu_mutex_lock(&region.lock);
+    bitmap_set(busy, region.current, region.n - region.current);
+    bitmap_or(busy, busy, region.evicted, region.n);
+    for (i = 0; i < n_ctxs; i++) {
+        TCGContext *s = atomic_read(&tcg_ctxs[i]);
+
+        set_bit(tc_ptr_to_region_idx(s->code_gen_buffer), busy);
+        for (j = 0; j < region.n; j++) {
+            hits[j] += s->region_hits[j];
+            s->region_hits[j] /= 2;
+        }
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    tcg_region_propagate_hits(hits);
+
+    while (evicted < n_evict) {
+        size_t victim = region.n;
+
+        for (i = 0; i < region.n; i++) {
+            if (!test_bit(i, busy) &&
+                (victim == region.n || hits[i] < hits[victim])) {
+                victim = i;
+            }
+        }
+        if (victim == region.n) {
+            break;
+        }
+        set_bit(victim, busy);
+        victims[evicted++] = victim;
+    }
+
+    for (i = 0; i < evicted; i++) {
+        tcg_region_evict_one(victims[i], func, user_data);
+    }
+
+    g_free(victims);
+    g_free(hits);
+    g_free(busy);
+    return evicted;
+}
+
 #ifdef CONFIG_USER_ONLY
 static size_t tcg_n_regions(void)
 {
@@ -614,37 +846,36 @@ static size_t tcg_n_regions(void)
 #else
 /*
  * It is likely that some vCPUs will translate more code than others, so we
- * first try to set more regions than max_cpus, with those regions being of
- * reasonable size. If that's not possible we make do by evenly dividing
- * the code_gen_buffer among the vCPUs.
+ * first try to set more regions than TCG threads, with those regions being
+ * of reasonable size. If that's not possible we make do by evenly dividing
+ * the code_gen_buffer among the threads.  Having several regions per thread
+ * also lets tcg_region_evict() free part of the buffer instead of all of it,
+ * so this is done even with a single vCPU thread.
  */
 static size_t tcg_n_regions(void)
 {
+    MachineState *ms = MACHINE(qdev_get_machine());
+    unsigned int n_threads = ms->smp.max_cpus;
     size_t i;
 
-    /* Use a single region if all we have is one vCPU thread */
-#if !defined(CONFIG_USER_ONLY)
-    MachineState *ms = MACHINE(qdev_get_machine());
-    unsigned int max_cpus = ms->smp.max_cpus;
-#endif
-    if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+    if (!qemu_tcg_mttcg_enabled()) {
+        n_threads = 1;
     }
 
-    /* Try to have more regions than max_cpus, with each region being >= 2 MB */
+    /* Try to have more regions than threads, with each region being >= 2 MB */
     for (i = 8; i > 0; i--) {
         size_t regions_per_thread = i;
         size_t region_size;
 
         region_size = tcg_init_ctx.code_gen_buffer_size;
-        region_size /= max_cpus * regions_per_thread;
+        region_size /= n_threads * regions_per_thread;
 
         if (region_size >= 2 * 1024u * 1024) {
-            return max_cpus * regions_per_thread;
+            return n_threads * regions_per_thread;
         }
     }
     /* If we can't, then just allocate one region per vCPU thread */
-    return max_cpus;
+    return n_threads;
 }
 #endif
 
@@ -659,7 +890,8 @@ static size_t tcg_n_regions(void)
  * code in parallel without synchronization.
  *
  * In softmmu the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
+ * least max_cpus regions in MTTCG. In !MTTCG there is a single thread, but
+ * we still use a few regions so that they can be evicted one at a time.
  * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
@@ -705,6 +937,7 @@ void tcg_region_init(void)
     /* init the region struct */
     qemu_mutex_init(&region.lock);
     region.n = n_regions;
+    region.evicted = bitmap_new(n_regions);
     region.size = region_size - page_size;
     region.stride = region_size;
     region.start = buf;
@@ -792,6 +1025,7 @@ void tcg_register_thread(void)
     if (n > 0) {
         alloc_tcg_plugin_context(s);
     }
+    s->region_hits = g_new0(uint32_t, region.n);
 
     tcg_ctx = s;
     qemu_mutex_lock(&region.lock);
@@ -1083,6 +1317,10 @@ void tcg_prologue_init(TCGContext *s)
 
     tcg_register_jit(s->code_gen_buffer, total_size);
 
+    if (perf_enabled()) {
+        perf_report_prologue(buf0, prologue_size);
+    }
+
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_OUT_ASM)) {
         FILE *logfile = qemu_log_lock();
@@ -1130,6 +1368,7 @@ void tcg_func_start(TCGContext *s)
 
     s->nb_ops = 0;
     s->nb_labels = 0;
+    s->host_ptr_consts = false;
     s->current_frame_offset = s->frame_start;
 
 #ifdef CONFIG_DEBUG_TCG
@@ -1692,7 +1931,21 @@ bool tcg_op_supported(TCGOpcode op)
 /* Note: we convert the 64 bit args to 32 bit and do some alignment
    and endian swap. Maybe it would be better to do the alignment
    and endian swap in tcg_reg_alloc_call(). */
-void tcg_gen_callN(void *func, TCGTemp *ret, int nargs, TCGTemp **args)
+/*
+ * Let the TCG profiler's sampler tell helpers from generated code
+ * (see tcg_prof_set_state()).
+ */
+static void tcg_gen_prof_state(TCGProfState state)
+{
+    TCGv_i32 t = tcg_const_i32(state);
+
+    tcg_gen_st_i32(t, cpu_env, offsetof(ArchCPU, parent_obj.tcg_prof.state) -
+                               offsetof(ArchCPU, env));
+    tcg_temp_free_i32(t);
+}
+
+static void tcg_gen_callN_internal(void *func, TCGTemp *ret, int nargs,
+                                   TCGTemp **args)
 {
     int i, real_args, nb_rets, pi;
     unsigned sizemask, flags;
@@ -1868,6 +2121,17 @@ void tcg_gen_callN(void *func, TCGTemp *ret, int nargs, TCGTemp **args)
 #endif /* TCG_TARGET_EXTEND_ARGS */
 }
 
+void tcg_gen_callN(void *func, TCGTemp *ret, int nargs, TCGTemp **args)
+{
+    if (tcg_ctx->tb_cflags & CF_PROFILE) {
+        tcg_gen_prof_state(TCG_PROF_HELPER);
+        tcg_gen_callN_internal(func, ret, nargs, args);
+        tcg_gen_prof_state(TCG_PROF_CODE);
+    } else {
+        tcg_gen_callN_internal(func, ret, nargs, args);
+    }
+}
+
 static void tcg_reg_alloc_start(TCGContext *s)
 {
     int i, n;
@@ -2357,6 +2621,12 @@ static TCGOp *tcg_op_alloc(TCGOpcode opc)
 TCGOp *tcg_emit_op(TCGOpcode opc)
 {
     TCGOp *op = tcg_op_alloc(opc);
+#ifdef CONFIG_PLUGIN
+    if (tcg_ctx->emit_before_op) {
+        QTAILQ_INSERT_BEFORE(tcg_ctx->emit_before_op, op, link);
+        return op;
+    }
+#endif
     QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
     return op;
 }
@@ -2375,6 +2645,267 @@ TCGOp *tcg_op_insert_after(TCGContext *s, TCGOp *old_op, TCGOpcode opc)
     return new_op;
 }
 
+/*
+ * Encoding used by tcg_ops_save() and tcg_ops_load().  Everything is in
+ * host byte order: the data only makes sense to the binary that wrote it.
+ * Temps are stored by index, labels by id and helpers by their index in
+ * all_helpers[]; the argument of exit_tb, and the address loaded by
+ * tcg_gen_movi_tb_ptr(), are stored relative to the TB.
+ */
+typedef struct TCGOpsHeader {
+    uint32_t nb_globals;
+    uint32_t nb_temps;
+    uint32_t nb_labels;
+    uint32_t nb_ops;
+    uint16_t size;
+    uint16_t icount;
+} TCGOpsHeader;
+
+typedef struct TCGOpsTemp {
+    uint8_t base_type;
+    uint8_t type;
+    uint8_t temp_local;
+    uint8_t temp_allocated;
+} TCGOpsTemp;
+
+#define TCG_OPS_DUMMY_ARG UINT64_MAX
+
+/* Return the number of arguments of @op, and in @nb_targs how many of
+   them are temps.  */
+static unsigned tcg_op_nb_args(const TCGOp *op, unsigned *nb_targs)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+
+    if (op->opc == INDEX_op_call) {
+        *nb_targs = TCGOP_CALLO(op) + TCGOP_CALLI(op);
+        return *nb_targs + 2;
+    }
+    *nb_targs = def->nb_oargs + def->nb_iargs;
+    return def->nb_args;
+}
+
+/* Return true if @op was emitted by tcg_gen_movi_tb_ptr().  */
+static bool tcg_op_is_tb_ptr(const TCGOp *op)
+{
+    return (op->opc == INDEX_op_movi_i32 || op->opc == INDEX_op_movi_i64) &&
+           TCGOP_TB_PTR(op);
+}
+
+/* Return the index of the label argument of @opc, or -1.  */
+static int tcg_op_label_arg(TCGOpcode opc)
+{
+    switch (opc) {
+    case INDEX_op_set_label:
+    case INDEX_op_br:
+        return 0;
+    case INDEX_op_brcond_i32:
+    case INDEX_op_brcond_i64:
+        return 3;
+    case INDEX_op_brcond2_i32:
+        return 5;
+    default:
+        return -1;
+    }
+}
+
+bool tcg_ops_save(TCGContext *s, const TranslationBlock *tb, GByteArray *buf)
+{
+    guint start = buf->len;
+    TCGOpsHeader hdr = {
+        .nb_globals = s->nb_globals,
+        .nb_temps = s->nb_temps,
+        .nb_labels = s->nb_labels,
+        .size = tb->size,
+        .icount = tb->icount,
+    };
+    TCGOp *op;
+    int i;
+
+    if (s->host_ptr_consts) {
+        return false;
+    }
+
+    g_byte_array_append(buf, (const guint8 *)&hdr, sizeof(hdr));
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+        TCGOpsTemp t = {
+            .base_type = ts->base_type,
+            .type = ts->type,
+            .temp_local = ts->temp_local,
+            .temp_allocated = ts->temp_allocated,
+        };
+
+        g_byte_array_append(buf, (const guint8 *)&t, sizeof(t));
+    }
+
+    QTAILQ_FOREACH(op, &s->ops, link) {
+        unsigned nb_targs, nb_args = tcg_op_nb_args(op, &nb_targs);
+        int label = tcg_op_label_arg(op->opc);
+        uint8_t head[4] = { op->opc, op->param1, op->param2, nb_args };
+
+        g_byte_array_append(buf, head, sizeof(head));
+        for (i = 0; i < nb_args; i++) {
+            TCGArg arg = op->args[i];
+            uint64_t val;
+
+            if (i < nb_targs) {
+                val = arg == TCG_CALL_DUMMY_ARG
+                    ? TCG_OPS_DUMMY_ARG : temp_idx(arg_temp(arg));
+            } else if (i == label) {
+                val = arg_label(arg)->id;
+            } else if (op->opc == INDEX_op_call && i == nb_targs) {
+                TCGHelperInfo *info =
+                    g_hash_table_lookup(helper_table, (gpointer)arg);
+
+                if (!info) {
+                    goto fail;
+                }
+                val = info - all_helpers;
+            } else if (op->opc == INDEX_op_exit_tb && arg) {
+                if (arg - (uintptr_t)tb > TB_EXIT_MASK) {
+                    goto fail;
+                }
+                val = arg - (uintptr_t)tb + 1;
+            } else if (tcg_op_is_tb_ptr(op)) {
+                if (arg != (uintptr_t)tb) {
+                    goto fail;
+                }
+                val = 0;
+            } else {
+                val = arg;
+            }
+            g_byte_array_append(buf, (const guint8 *)&val, sizeof(val));
+        }
+        hdr.nb_ops++;
+    }
+
+    memcpy(buf->data + start, &hdr, sizeof(hdr));
+    return true;
+
+ fail:
+    g_byte_array_set_size(buf, start);
+    return false;
+}
+
+bool tcg_ops_load(TCGContext *s, TranslationBlock *tb,
+                  const void *data, size_t len)
+{
+    const uint8_t *p = data, *end = p + len;
+    TCGOpsHeader hdr;
+    TCGLabel **labels;
+    int i;
+
+    if (len < sizeof(hdr)) {
+        return false;
+    }
+    memcpy(&hdr, p, sizeof(hdr));
+    p += sizeof(hdr);
+
+    if (hdr.nb_globals != s->nb_globals ||
+        hdr.nb_temps < hdr.nb_globals || hdr.nb_temps > TCG_MAX_TEMPS ||
+        hdr.nb_labels >= 1 << 14 ||
+        end - p < (hdr.nb_temps - hdr.nb_globals) * sizeof(TCGOpsTemp)) {
+        return false;
+    }
+
+    for (i = hdr.nb_globals; i < hdr.nb_temps; i++) {
+        TCGTemp *ts = tcg_temp_alloc(s);
+        TCGOpsTemp t;
+
+        memcpy(&t, p, sizeof(t));
+        p += sizeof(t);
+        if (t.base_type >= TCG_TYPE_COUNT || t.type >= TCG_TYPE_COUNT) {
+            goto fail;
+        }
+        ts->base_type = t.base_type;
+        ts->type = t.type;
+        ts->temp_local = t.temp_local;
+        ts->temp_allocated = t.temp_allocated;
+    }
+
+    labels = tcg_malloc(sizeof(TCGLabel *) * hdr.nb_labels);
+    for (i = 0; i < hdr.nb_labels; i++) {
+        labels[i] = gen_new_label();
+    }
+
+    for (; hdr.nb_ops; hdr.nb_ops--) {
+        unsigned nb_targs, nb_args;
+        uint8_t head[4];
+        TCGOp *op;
+        int label;
+
+        if (end - p < sizeof(head)) {
+            goto fail;
+        }
+        memcpy(head, p, sizeof(head));
+        p += sizeof(head);
+        if (head[0] >= NB_OPS || head[1] >= 16 || head[2] >= 16) {
+            goto fail;
+        }
+
+        op = tcg_emit_op(head[0]);
+        op->param1 = head[1];
+        op->param2 = head[2];
+        nb_args = tcg_op_nb_args(op, &nb_targs);
+        if (nb_args != head[3] || nb_args > MAX_OPC_PARAM ||
+            end - p < nb_args * sizeof(uint64_t)) {
+            goto fail;
+        }
+        label = tcg_op_label_arg(op->opc);
+
+        for (i = 0; i < nb_args; i++) {
+            uint64_t val;
+
+            memcpy(&val, p, sizeof(val));
+            p += sizeof(val);
+
+            if (i < nb_targs) {
+                if (val == TCG_OPS_DUMMY_ARG && op->opc == INDEX_op_call) {
+                    op->args[i] = TCG_CALL_DUMMY_ARG;
+                    continue;
+                }
+                if (val >= hdr.nb_temps) {
+                    goto fail;
+                }
+                op->args[i] = temp_arg(&s->temps[val]);
+            } else if (i == label) {
+                if (val >= hdr.nb_labels) {
+                    goto fail;
+                }
+                if (op->opc != INDEX_op_set_label) {
+                    labels[val]->refs++;
+                }
+                op->args[i] = label_arg(labels[val]);
+            } else if (op->opc == INDEX_op_call && i == nb_targs) {
+                if (val >= ARRAY_SIZE(all_helpers)) {
+                    goto fail;
+                }
+                op->args[i] = (uintptr_t)all_helpers[val].func;
+            } else if (op->opc == INDEX_op_exit_tb && val) {
+                if (val > TB_EXIT_MASK + 1) {
+                    goto fail;
+                }
+                op->args[i] = (uintptr_t)tb + val - 1;
+            } else if (tcg_op_is_tb_ptr(op)) {
+                op->args[i] = (uintptr_t)tb;
+            } else {
+                op->args[i] = val;
+            }
+        }
+    }
+
+    if (p != end) {
+        goto fail;
+    }
+    tb->size = hdr.size;
+    tb->icount = hdr.icount;
+    return true;
+
+ fail:
+    tcg_func_start(s);
+    return false;
+}
+
 /* Reachable analysis : remove unreachable code.  */
 static void reachable_code_pass(TCGContext *s)
 {
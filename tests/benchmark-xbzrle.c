@@ -0,0 +1,126 @@
+/*
+ * Xor Based Zero Run Length Encoding speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "../migration/xbzrle.h"
+
+#define PAGE_SIZE 4096
+
+typedef struct XBZRLEBenchOpts {
+    /* percentage of the page that differs, in runs of run_len bytes */
+    int dirty_pct;
+    int run_len;
+} XBZRLEBenchOpts;
+
+static void xbzrle_bench_fill(const XBZRLEBenchOpts *opts,
+                              uint8_t *old_buf, uint8_t *new_buf)
+{
+    int runs = PAGE_SIZE * opts->dirty_pct / 100 / opts->run_len;
+    int i, j;
+
+    for (i = 0; i < PAGE_SIZE; i++) {
+        old_buf[i] = g_test_rand_int();
+    }
+    memcpy(new_buf, old_buf, PAGE_SIZE);
+
+    for (i = 0; i < runs; i++) {
+        int start = g_test_rand_int_range(0, PAGE_SIZE - opts->run_len);
+
+        for (j = start; j < start + opts->run_len; j++) {
+            new_buf[j] = ~old_buf[j];
+        }
+    }
+}
+
+static void test_encode_speed(const void *opaque)
+{
+    const XBZRLEBenchOpts *opts = opaque;
+    uint8_t *old_buf = g_malloc(PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    const size_t total = 4 * GiB;
+    size_t remain;
+
+    xbzrle_bench_fill(opts, old_buf, new_buf);
+
+    g_test_timer_start();
+    for (remain = total; remain; remain -= PAGE_SIZE) {
+        xbzrle_encode_buffer(old_buf, new_buf, PAGE_SIZE, compressed,
+                             PAGE_SIZE);
+    }
+    g_test_timer_elapsed();
+
+    g_print("%.2f MB/sec ", (double)total / MiB / g_test_timer_last());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(compressed);
+}
+
+static void test_decode_speed(const void *opaque)
+{
+    const XBZRLEBenchOpts *opts = opaque;
+    uint8_t *old_buf = g_malloc(PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    const size_t total = 4 * GiB;
+    size_t remain;
+    int dlen;
+
+    xbzrle_bench_fill(opts, old_buf, new_buf);
+    dlen = xbzrle_encode_buffer(old_buf, new_buf, PAGE_SIZE, compressed,
+                                PAGE_SIZE);
+    if (dlen <= 0) {
+        g_test_skip("page does not compress");
+        goto out;
+    }
+
+    g_test_timer_start();
+    for (remain = total; remain; remain -= PAGE_SIZE) {
+        g_assert(xbzrle_decode_buffer(compressed, dlen, old_buf,
+                                      PAGE_SIZE) > 0);
+    }
+    g_test_timer_elapsed();
+
+    g_print("%.2f MB/sec ", (double)total / MiB / g_test_timer_last());
+
+out:
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(compressed);
+}
+
+int main(int argc, char **argv)
+{
+    static const XBZRLEBenchOpts opts[] = {
+        { .dirty_pct = 0, .run_len = 1 },
+        { .dirty_pct = 1, .run_len = 8 },
+        { .dirty_pct = 10, .run_len = 8 },
+        { .dirty_pct = 10, .run_len = 64 },
+        { .dirty_pct = 25, .run_len = 8 },
+        { .dirty_pct = 25, .run_len = 256 },
+    };
+    char name[64];
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(opts); i++) {
+        snprintf(name, sizeof(name),
+                 "/xbzrle/benchmark/encode/dirty-%d/run-%d",
+                 opts[i].dirty_pct, opts[i].run_len);
+        g_test_add_data_func(name, &opts[i], test_encode_speed);
+    }
+    for (i = 1; i < ARRAY_SIZE(opts); i++) {
+        snprintf(name, sizeof(name),
+                 "/xbzrle/benchmark/decode/dirty-%d/run-%d",
+                 opts[i].dirty_pct, opts[i].run_len);
+        g_test_add_data_func(name, &opts[i], test_decode_speed);
+    }
+
+    return g_test_run();
+}
@@ -33,6 +33,8 @@ enum op {
     OP_FMA,
     OP_SQRT,
     OP_CMP,
+    OP_MINNUM,
+    OP_MAXNUM,
     OP_MAX_NR,
 };
 
@@ -44,6 +46,8 @@ static const char * const op_names[] = {
     [OP_FMA] = "mulAdd",
     [OP_SQRT] = "sqrt",
     [OP_CMP] = "cmp",
+    [OP_MINNUM] = "minnum",
+    [OP_MAXNUM] = "maxnum",
     [OP_MAX_NR] = NULL,
 };
 
@@ -235,6 +239,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MINNUM:
+                    res.f = fminf(a, b);
+                    break;
+                case OP_MAXNUM:
+                    res.f = fmaxf(a, b);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -270,6 +280,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MINNUM:
+                    res.d = fmin(a, b);
+                    break;
+                case OP_MAXNUM:
+                    res.d = fmax(a, b);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -305,6 +321,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float32_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MINNUM:
+                    res.f32 = float32_minnum(a, b, &soft_status);
+                    break;
+                case OP_MAXNUM:
+                    res.f32 = float32_maxnum(a, b, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -340,6 +362,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float64_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MINNUM:
+                    res.f64 = float64_minnum(a, b, &soft_status);
+                    break;
+                case OP_MAXNUM:
+                    res.f64 = float64_maxnum(a, b, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -377,6 +405,8 @@ GEN_BENCH_ALL_TYPES(mul, OP_MUL, 2)
 GEN_BENCH_ALL_TYPES(div, OP_DIV, 2)
 GEN_BENCH_ALL_TYPES(fma, OP_FMA, 3)
 GEN_BENCH_ALL_TYPES(cmp, OP_CMP, 2)
+GEN_BENCH_ALL_TYPES(minnum, OP_MINNUM, 2)
+GEN_BENCH_ALL_TYPES(maxnum, OP_MAXNUM, 2)
 #undef GEN_BENCH_ALL_TYPES
 
 #define GEN_BENCH_ALL_TYPES_NO_NEG(name, op, n)                         \
@@ -407,6 +437,8 @@ static const bench_func_t bench_funcs[OP_MAX_NR][PREC_MAX_NR] = {
     GEN_BENCH_FUNCS(fma, OP_FMA),
     GEN_BENCH_FUNCS(sqrt, OP_SQRT),
     GEN_BENCH_FUNCS(cmp, OP_CMP),
+    GEN_BENCH_FUNCS(minnum, OP_MINNUM),
+    GEN_BENCH_FUNCS(maxnum, OP_MAXNUM),
 };
 
 #undef GEN_BENCH_FUNCS
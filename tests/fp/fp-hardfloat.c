@@ -0,0 +1,510 @@
+/*
+ * fp-hardfloat.c - check the softfloat entry points that testfloat
+ * does not cover
+ *
+ * testfloat has no min/max operations and no notion of the batch
+ * (_n) helpers, so both the host fast paths of float{32,64}_min/max
+ * and friends and float{32,64}_{add,sub,mul,div}_n are checked here:
+ * min/max against a bit-level reference and a table of NaN and
+ * signed-zero cases, and the batch helpers against their scalar
+ * equivalents.  Every check is run with and without inexact already
+ * raised, so that both the host and the soft paths are taken.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef HW_POISON_H
+#error Must define HW_POISON_H to work around TARGET_* poisoning
+#endif
+
+#include "qemu/osdep.h"
+#include "fpu/softfloat.h"
+#include "fpu/softfloat-helpers.h"
+
+#define N_RANDOM   100000
+#define BATCH_LEN  263
+
+static int errors;
+
+typedef float32 (*f32_2op)(float32, float32, float_status *);
+typedef float64 (*f64_2op)(float64, float64, float_status *);
+typedef void (*f32_2op_n)(float32 *, const float32 *, const float32 *,
+                          size_t, float_status *);
+typedef void (*f64_2op_n)(float64 *, const float64 *, const float64 *,
+                          size_t, float_status *);
+
+enum {
+    MIN,
+    MINNUM,
+    MINNUMMAG,
+    MAX,
+    MAXNUM,
+    MAXNUMMAG,
+};
+
+static const struct {
+    const char *name;
+    f32_2op f32;
+    f64_2op f64;
+    bool ismin, isiee, ismag;
+} minmax_ops[] = {
+    [MIN] = { "min", float32_min, float64_min, true, false, false },
+    [MINNUM] = { "minnum", float32_minnum, float64_minnum,
+                 true, true, false },
+    [MINNUMMAG] = { "minnummag", float32_minnummag, float64_minnummag,
+                    true, true, true },
+    [MAX] = { "max", float32_max, float64_max, false, false, false },
+    [MAXNUM] = { "maxnum", float32_maxnum, float64_maxnum,
+                 false, true, false },
+    [MAXNUMMAG] = { "maxnummag", float32_maxnummag, float64_maxnummag,
+                    false, true, true },
+};
+
+static const struct {
+    const char *name;
+    f32_2op f32;
+    f32_2op_n f32_n;
+    f64_2op f64;
+    f64_2op_n f64_n;
+} batch_ops[] = {
+    { "add", float32_add, float32_add_n, float64_add, float64_add_n },
+    { "sub", float32_sub, float32_sub_n, float64_sub, float64_sub_n },
+    { "mul", float32_mul, float32_mul_n, float64_mul, float64_mul_n },
+    { "div", float32_div, float32_div_n, float64_div, float64_div_n },
+};
+
+/* The encoding details the reference needs */
+typedef struct {
+    int bits;
+    uint64_t sign;
+    uint64_t inf;
+    uint64_t quiet;
+    uint64_t min_normal;
+} Fmt;
+
+static const Fmt fmt32 = {
+    32, 0x80000000, 0x7f800000, 0x00400000, 0x00800000
+};
+static const Fmt fmt64 = {
+    64, 0x8000000000000000ull, 0x7ff0000000000000ull,
+    0x0008000000000000ull, 0x0010000000000000ull
+};
+
+static uint64_t f_abs(const Fmt *f, uint64_t x)
+{
+    return x & ~f->sign;
+}
+
+static bool f_is_nan(const Fmt *f, uint64_t x)
+{
+    return f_abs(f, x) > f->inf;
+}
+
+static bool f_is_snan(const Fmt *f, uint64_t x)
+{
+    return f_is_nan(f, x) && !(x & f->quiet);
+}
+
+static bool f_is_subnormal(const Fmt *f, uint64_t x)
+{
+    return f_abs(f, x) && f_abs(f, x) < f->min_normal;
+}
+
+/* Total order of the non-NaN values, with -0 before +0 */
+static int64_t f_key(const Fmt *f, uint64_t x)
+{
+    return x & f->sign ? -(int64_t)f_abs(f, x) - 1 : (int64_t)x;
+}
+
+/*
+ * What the soft min/max must return, following the Arm NaN propagation
+ * rules that this test is built with (TARGET_ARM, see the Makefile).
+ */
+static uint64_t ref_minmax(const Fmt *f, int op, uint64_t a, uint64_t b,
+                           const float_status *s, int *flags)
+{
+    bool ismin = minmax_ops[op].ismin;
+    uint64_t r;
+
+    if (s->flush_inputs_to_zero) {
+        if (f_is_subnormal(f, a)) {
+            a &= f->sign;
+            *flags |= float_flag_input_denormal;
+        }
+        if (f_is_subnormal(f, b)) {
+            b &= f->sign;
+            *flags |= float_flag_input_denormal;
+        }
+    }
+
+    if (f_is_snan(f, a) || f_is_snan(f, b)) {
+        *flags |= float_flag_invalid;
+        return (f_is_snan(f, a) ? a : b) | f->quiet;
+    } else if (f_is_nan(f, a) && f_is_nan(f, b)) {
+        return a;
+    } else if (f_is_nan(f, a) || f_is_nan(f, b)) {
+        if (!minmax_ops[op].isiee) {
+            return f_is_nan(f, a) ? a : b;
+        }
+        /* the number is returned, and flushed like any other result */
+        r = f_is_nan(f, a) ? b : a;
+    } else if (minmax_ops[op].ismag && f_abs(f, a) != f_abs(f, b)) {
+        r = ismin == (f_abs(f, a) < f_abs(f, b)) ? a : b;
+    } else {
+        r = ismin == (f_key(f, a) <= f_key(f, b)) ? a : b;
+    }
+    if (s->flush_to_zero && f_is_subnormal(f, r)) {
+        r &= f->sign;
+        *flags |= float_flag_output_denormal;
+    }
+    return r;
+}
+
+static uint64_t do_minmax(const Fmt *f, int op, uint64_t a, uint64_t b,
+                          float_status *s)
+{
+    if (f->bits == 64) {
+        return float64_val(minmax_ops[op].f64(make_float64(a),
+                                              make_float64(b), s));
+    }
+    return float32_val(minmax_ops[op].f32(make_float32(a), make_float32(b),
+                                          s));
+}
+
+/*
+ * Every status the checks run under: host paths are only allowed with
+ * inexact already raised and round-to-nearest-even, and the flush modes
+ * send some of the inputs and results back to the soft code.
+ */
+#define N_STATUS 32
+
+static void make_status(float_status *s, int i)
+{
+    static const FloatRoundMode modes[] = {
+        float_round_nearest_even, float_round_down,
+        float_round_up, float_round_to_zero,
+    };
+
+    memset(s, 0, sizeof(*s));
+    set_float_rounding_mode(modes[i & 3], s);
+    set_flush_inputs_to_zero(i & 4, s);
+    set_flush_to_zero(i & 8, s);
+    if (i & 16) {
+        float_raise(float_flag_inexact, s);
+    }
+}
+
+static void describe_status(const float_status *s)
+{
+    fprintf(stderr, "  rounding %d, flush in %d out %d, flags were %#x\n",
+            s->float_rounding_mode, s->flush_inputs_to_zero,
+            s->flush_to_zero, s->float_exception_flags);
+}
+
+static void check_minmax(const Fmt *f, int op, uint64_t a, uint64_t b,
+                         uint64_t expected, int exp_flags, int st)
+{
+    float_status s;
+    uint64_t r;
+
+    make_status(&s, st);
+    exp_flags |= s.float_exception_flags;
+    r = do_minmax(f, op, a, b, &s);
+    if (r != expected || s.float_exception_flags != exp_flags) {
+        fprintf(stderr, "f%d_%s(%#" PRIx64 ", %#" PRIx64 "): "
+                "got %#" PRIx64 " flags %#x, expected %#" PRIx64
+                " flags %#x\n", f->bits, minmax_ops[op].name, a, b,
+                r, s.float_exception_flags, expected, exp_flags);
+        make_status(&s, st);
+        describe_status(&s);
+        errors++;
+    }
+}
+
+/* Cases whose result does not depend on rounding or flushing */
+static const struct {
+    int op;
+    uint32_t a, b, r;
+    int flags;
+} f32_cases[] = {
+    /* signed zeros */
+    { MIN, 0x00000000, 0x80000000, 0x80000000 },
+    { MIN, 0x80000000, 0x00000000, 0x80000000 },
+    { MAX, 0x00000000, 0x80000000, 0x00000000 },
+    { MAX, 0x80000000, 0x00000000, 0x00000000 },
+    { MINNUM, 0x00000000, 0x80000000, 0x80000000 },
+    { MAXNUM, 0x80000000, 0x00000000, 0x00000000 },
+    { MINNUMMAG, 0x00000000, 0x80000000, 0x80000000 },
+    { MAXNUMMAG, 0x80000000, 0x00000000, 0x00000000 },
+    /* equal magnitudes fall back to the sign, then to the value */
+    { MINNUMMAG, 0x40000000, 0xc0000000, 0xc0000000 },
+    { MAXNUMMAG, 0xc0000000, 0x40000000, 0x40000000 },
+    { MINNUMMAG, 0xbf800000, 0x40000000, 0xbf800000 },
+    { MAXNUMMAG, 0xc0400000, 0x40000000, 0xc0400000 },
+    { MAXNUMMAG, 0xff800000, 0x3f800000, 0xff800000 },
+    { MINNUM, 0xff800000, 0x7f800000, 0xff800000 },
+    /* one quiet NaN: the number for the IEEE variants, else the NaN */
+    { MINNUM, 0x7fc00000, 0x3f800000, 0x3f800000 },
+    { MAXNUM, 0x3f800000, 0xffc00001, 0x3f800000 },
+    { MINNUMMAG, 0x7fc00000, 0xbf800000, 0xbf800000 },
+    { MIN, 0x7fc00000, 0x3f800000, 0x7fc00000 },
+    { MAX, 0x3f800000, 0xffc00001, 0xffc00001 },
+    { MIN, 0xff800000, 0x7fc00000, 0x7fc00000 },
+    /* two quiet NaNs: the first one */
+    { MINNUM, 0x7fc00000, 0xffc00001, 0x7fc00000 },
+    { MAXNUMMAG, 0xffc00001, 0x7fc00000, 0xffc00001 },
+    /* signaling NaNs: raise invalid, and the first sNaN is silenced */
+    { MINNUM, 0x7f800001, 0x3f800000, 0x7fc00001, float_flag_invalid },
+    { MAXNUM, 0x3f800000, 0xff812345, 0xffc12345, float_flag_invalid },
+    { MAXNUMMAG, 0x3f800000, 0xff812345, 0xffc12345, float_flag_invalid },
+    { MIN, 0x7fc00000, 0x7f800001, 0x7fc00001, float_flag_invalid },
+    { MAX, 0x7f800002, 0x7f800001, 0x7fc00002, float_flag_invalid },
+};
+
+static const struct {
+    int op;
+    uint64_t a, b, r;
+    int flags;
+} f64_cases[] = {
+    { MIN, 0x0000000000000000ull, 0x8000000000000000ull,
+      0x8000000000000000ull },
+    { MAX, 0x8000000000000000ull, 0x0000000000000000ull,
+      0x0000000000000000ull },
+    { MINNUMMAG, 0x4000000000000000ull, 0xc000000000000000ull,
+      0xc000000000000000ull },
+    { MAXNUMMAG, 0xc008000000000000ull, 0x4000000000000000ull,
+      0xc008000000000000ull },
+    { MINNUM, 0x7ff8000000000000ull, 0x3ff0000000000000ull,
+      0x3ff0000000000000ull },
+    { MIN, 0x7ff8000000000000ull, 0x3ff0000000000000ull,
+      0x7ff8000000000000ull },
+    { MAXNUM, 0x3ff0000000000000ull, 0xfff0000000000001ull,
+      0xfff8000000000001ull, float_flag_invalid },
+    { MIN, 0x7ff8000000000000ull, 0x7ff0000000000001ull,
+      0x7ff8000000000001ull, float_flag_invalid },
+};
+
+static void test_minmax_cases(void)
+{
+    size_t i;
+    int st;
+
+    for (st = 0; st < N_STATUS; st++) {
+        for (i = 0; i < ARRAY_SIZE(f32_cases); i++) {
+            check_minmax(&fmt32, f32_cases[i].op, f32_cases[i].a,
+                         f32_cases[i].b, f32_cases[i].r,
+                         f32_cases[i].flags, st);
+        }
+        for (i = 0; i < ARRAY_SIZE(f64_cases); i++) {
+            check_minmax(&fmt64, f64_cases[i].op, f64_cases[i].a,
+                         f64_cases[i].b, f64_cases[i].r,
+                         f64_cases[i].flags, st);
+        }
+    }
+}
+
+static uint64_t rng_state = 0xdeadfacedeadfaceull;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static const uint32_t f32_special[] = {
+    0x00000000, 0x80000000, 0x3f800000, 0xbf800000, 0x40000000,
+    0xc0000000, 0x7f800000, 0xff800000, 0x00000001, 0x807fffff,
+    0x00800000, 0x80800000, 0x7f7fffff, 0xff7fffff, 0x7fc00000,
+    0xffc00001, 0x7f800001, 0xff812345,
+};
+
+static const uint64_t f64_special[] = {
+    0x0000000000000000ull, 0x8000000000000000ull, 0x3ff0000000000000ull,
+    0xbff0000000000000ull, 0x7ff0000000000000ull, 0xfff0000000000000ull,
+    0x0000000000000001ull, 0x800fffffffffffffull, 0x0010000000000000ull,
+    0x8010000000000000ull, 0x7fefffffffffffffull, 0xffefffffffffffffull,
+    0x7ff8000000000000ull, 0xfff8000000000001ull, 0x7ff0000000000001ull,
+    0xfff0000000012345ull,
+};
+
+/* Specials, subnormals, values of any exponent, and near ties */
+static uint64_t gen_operand(const Fmt *f)
+{
+    uint64_t r = rng();
+    uint64_t mant = f->min_normal - 1;
+
+    switch (r & 3) {
+    case 0:
+        if (f->bits == 64) {
+            return f64_special[(r >> 8) % ARRAY_SIZE(f64_special)];
+        }
+        return f32_special[(r >> 8) % ARRAY_SIZE(f32_special)];
+    case 1:
+        return rng() & (f->sign | mant);
+    case 2:
+        /* around 1.0, where results stay normal */
+        return (rng() & (f->sign | mant)) | ((f->inf >> 1) & ~mant);
+    default:
+        return f->bits == 64 ? rng() : (uint32_t)rng();
+    }
+}
+
+static uint64_t gen_second(const Fmt *f, uint64_t a)
+{
+    switch (rng() & 7) {
+    case 0:
+        return a;
+    case 1:
+        return a ^ f->sign;
+    case 2:
+        return a + 1;
+    case 3:
+        return a - 1;
+    default:
+        return gen_operand(f);
+    }
+}
+
+static void test_minmax_random(const Fmt *f)
+{
+    size_t op;
+    int i;
+
+    for (i = 0; i < N_RANDOM; i++) {
+        uint64_t mask = f->bits == 64 ? -1ull : 0xffffffffull;
+        uint64_t a = gen_operand(f);
+        uint64_t b = gen_second(f, a) & mask;
+        int st = rng() % N_STATUS;
+
+        for (op = 0; op < ARRAY_SIZE(minmax_ops); op++) {
+            float_status s;
+            uint64_t r;
+            int flags = 0;
+
+            make_status(&s, st);
+            r = ref_minmax(f, op, a, b, &s, &flags);
+            check_minmax(f, op, a, b, r, flags, st);
+        }
+    }
+}
+
+static void check_batch(const char *name, int bits, size_t n, int st,
+                        bool inplace, const uint64_t *got,
+                        const uint64_t *expected, int got_flags,
+                        int exp_flags)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (got[i] != expected[i]) {
+            fprintf(stderr, "f%d_%s_n%s[%zu] of %zu: got %#" PRIx64
+                    ", scalar %#" PRIx64 "\n", bits, name,
+                    inplace ? " in place" : "", i, n, got[i], expected[i]);
+            break;
+        }
+    }
+    if (i < n || got_flags != exp_flags) {
+        float_status s;
+
+        if (got_flags != exp_flags) {
+            fprintf(stderr, "f%d_%s_n%s of %zu: flags %#x, scalar %#x\n",
+                    bits, name, inplace ? " in place" : "", n,
+                    got_flags, exp_flags);
+        }
+        make_status(&s, st);
+        describe_status(&s);
+        errors++;
+    }
+}
+
+static void test_batch_f32(size_t op, size_t n, int st, bool inplace)
+{
+    float32 a[BATCH_LEN], b[BATCH_LEN], d[BATCH_LEN];
+    uint64_t got[BATCH_LEN], exp[BATCH_LEN];
+    float_status sn, s1;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        a[i] = make_float32(gen_operand(&fmt32));
+        b[i] = make_float32(gen_second(&fmt32, float32_val(a[i])));
+    }
+    make_status(&s1, st);
+    for (i = 0; i < n; i++) {
+        exp[i] = float32_val(batch_ops[op].f32(a[i], b[i], &s1));
+    }
+    make_status(&sn, st);
+    if (inplace) {
+        batch_ops[op].f32_n(a, a, b, n, &sn);
+        memcpy(d, a, sizeof(d[0]) * n);
+    } else {
+        batch_ops[op].f32_n(d, a, b, n, &sn);
+    }
+    for (i = 0; i < n; i++) {
+        got[i] = float32_val(d[i]);
+    }
+    check_batch(batch_ops[op].name, 32, n, st, inplace, got, exp,
+                sn.float_exception_flags, s1.float_exception_flags);
+}
+
+static void test_batch_f64(size_t op, size_t n, int st, bool inplace)
+{
+    float64 a[BATCH_LEN], b[BATCH_LEN], d[BATCH_LEN];
+    uint64_t got[BATCH_LEN], exp[BATCH_LEN];
+    float_status sn, s1;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        a[i] = make_float64(gen_operand(&fmt64));
+        b[i] = make_float64(gen_second(&fmt64, float64_val(a[i])));
+    }
+    make_status(&s1, st);
+    for (i = 0; i < n; i++) {
+        exp[i] = float64_val(batch_ops[op].f64(a[i], b[i], &s1));
+    }
+    make_status(&sn, st);
+    if (inplace) {
+        batch_ops[op].f64_n(a, a, b, n, &sn);
+        memcpy(d, a, sizeof(d[0]) * n);
+    } else {
+        batch_ops[op].f64_n(d, a, b, n, &sn);
+    }
+    for (i = 0; i < n; i++) {
+        got[i] = float64_val(d[i]);
+    }
+    check_batch(batch_ops[op].name, 64, n, st, inplace, got, exp,
+                sn.float_exception_flags, s1.float_exception_flags);
+}
+
+static void test_batch(void)
+{
+    static const size_t lens[] = { 0, 1, 2, 7, 64, BATCH_LEN };
+    size_t op, l;
+    int st, rep;
+
+    for (op = 0; op < ARRAY_SIZE(batch_ops); op++) {
+        for (st = 0; st < N_STATUS; st++) {
+            for (l = 0; l < ARRAY_SIZE(lens); l++) {
+                for (rep = 0; rep < 4; rep++) {
+                    test_batch_f32(op, lens[l], st, rep & 1);
+                    test_batch_f64(op, lens[l], st, rep & 1);
+                }
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    test_minmax_cases();
+    test_minmax_random(&fmt32);
+    test_minmax_random(&fmt64);
+    test_batch();
+
+    if (errors) {
+        fprintf(stderr, "%d errors\n", errors);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -18,7 +18,11 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 
 static uint64_t mem_count;
 static uint64_t io_count;
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 vcpu_mem_count;
+static struct qemu_plugin_mem_buffer *mem_buf;
 static bool do_inline;
+static bool do_buffer;
 static bool do_haddr;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 
@@ -26,6 +30,9 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) out = g_string_new("");
 
+    if (do_inline || do_buffer) {
+        mem_count = qemu_plugin_u64_sum(vcpu_mem_count);
+    }
     g_string_printf(out, "mem accesses: %" PRIu64 "\n", mem_count);
     if (do_haddr) {
         g_string_append_printf(out, "io accesses: %" PRIu64 "\n", mem_count);
@@ -49,6 +56,13 @@ static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
     }
 }
 
+static void vcpu_mem_buffer(unsigned int cpu_index,
+                            const struct qemu_plugin_mem_record *recs,
+                            size_t n, void *udata)
+{
+    qemu_plugin_u64_add(vcpu_mem_count, cpu_index, n);
+}
+
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     size_t n = qemu_plugin_tb_n_insns(tb);
@@ -58,9 +72,10 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
         struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
 
         if (do_inline) {
-            qemu_plugin_register_vcpu_mem_inline(insn, rw,
-                                                 QEMU_PLUGIN_INLINE_ADD_U64,
-                                                 &mem_count, 1);
+            qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+                insn, rw, QEMU_PLUGIN_INLINE_ADD_U64, vcpu_mem_count, 1);
+        } else if (do_buffer) {
+            qemu_plugin_register_vcpu_mem_buffer(insn, rw, mem_buf);
         } else {
             qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem,
                                              QEMU_PLUGIN_CB_NO_REGS,
@@ -90,9 +105,17 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
         }
         if (!strcmp(argv[0], "inline")) {
             do_inline = true;
+        } else if (!strcmp(argv[0], "buffer")) {
+            do_buffer = true;
         }
     }
 
+    counts = qemu_plugin_scoreboard_new(sizeof(uint64_t));
+    vcpu_mem_count = (qemu_plugin_u64) { .score = counts, .offset = 0 };
+    if (do_buffer) {
+        mem_buf = qemu_plugin_mem_buffer_new(0, vcpu_mem_buffer, NULL);
+    }
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
     return 0;
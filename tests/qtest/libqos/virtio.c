@@ -388,6 +388,55 @@ void qvirtqueue_kick(QTestState *qts, QVirtioDevice *d, QVirtQueue *vq,
     }
 }
 
+/*
+ * qvirtqueue_kick_batch:
+ * @heads: The descriptor chains to make available, in order
+ * @num: Number of chains
+ *
+ * Like qvirtqueue_kick() for each chain, but the avail index is only
+ * published once and the device notified at most once, so that it finds
+ * all the chains on the ring when it runs.
+ */
+void qvirtqueue_kick_batch(QTestState *qts, QVirtioDevice *d, QVirtQueue *vq,
+                           const uint32_t *heads, unsigned int num)
+{
+    /* vq->avail->idx */
+    uint16_t idx = qvirtio_readw(d, qts, vq->avail + 2);
+    uint16_t new_idx = idx + num;
+    uint16_t flags, avail_event;
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        /* vq->avail->ring[(idx + i) % vq->size] */
+        qvirtio_writew(d, qts,
+                       vq->avail + 4 + 2 * ((uint16_t)(idx + i) % vq->size),
+                       heads[i]);
+    }
+    qvirtio_writew(d, qts, vq->avail + 2, new_idx);
+
+    /* vq->used->flags and vq->used->avail_event, after idx is updated */
+    flags = qvirtio_readw(d, qts, vq->used);
+    avail_event = qvirtqueue_get_avail_event(qts, vq);
+
+    if ((flags & VRING_USED_F_NO_NOTIFY) == 0 &&
+        (!vq->event || (uint16_t)(new_idx - avail_event - 1) < num)) {
+        d->bus->virtqueue_kick(d, vq);
+    }
+}
+
+/*
+ * qvirtqueue_get_avail_event:
+ *
+ * Returns: the avail index from which the device asked to be notified,
+ * when VIRTIO_RING_F_EVENT_IDX is negotiated
+ */
+uint16_t qvirtqueue_get_avail_event(QTestState *qts, QVirtQueue *vq)
+{
+    /* vq->used->avail_event */
+    return qvirtio_readw(vq->vdev, qts, vq->used + 4 +
+                         sizeof(struct vring_used_elem) * vq->size);
+}
+
 /*
  * qvirtqueue_get_buf:
  * @desc_idx: A pointer that is filled with the vq->desc[] index, may be NULL
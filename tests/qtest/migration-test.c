@@ -880,6 +880,160 @@ static void test_precopy_unix(void)
     g_free(uri);
 }
 
+static void test_precopy_file(const char *capability, bool multifd)
+{
+    char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    QDict *rsp;
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        return;
+    }
+
+    if (capability) {
+        migrate_set_capability(from, capability, "true");
+        migrate_set_capability(to, capability, "true");
+    }
+    if (multifd) {
+        migrate_set_parameter_int(from, "multifd-channels", 4);
+        migrate_set_parameter_int(to, "multifd-channels", 4);
+        migrate_set_capability(from, "multifd", "true");
+        migrate_set_capability(to, "multifd", "true");
+    }
+
+    /* Nothing reads the file concurrently, let it converge right away */
+    migrate_set_parameter_int(from, "downtime-limit", 300);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    wait_for_migration_complete(from);
+
+    /* The destination can only start once the file is complete */
+    rsp = qtest_qmp(to, "{ 'execute': 'migrate-incoming',"
+                        "  'arguments': { 'uri': %s }}", uri);
+    g_assert(qdict_haskey(rsp, "return"));
+    qobject_unref(rsp);
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+    g_free(uri);
+}
+
+static void test_precopy_file_stream(void)
+{
+    test_precopy_file(NULL, false);
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    test_precopy_file("mapped-ram", false);
+}
+
+static void test_precopy_file_mapped_ram_multifd(void)
+{
+    test_precopy_file("mapped-ram", true);
+}
+
+static void test_background_snapshot(void)
+{
+    char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    QDict *rsp;
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        return;
+    }
+
+    /* Requires userfaultfd write-protect support from the host kernel */
+    rsp = qtest_qmp(from, "{ 'execute': 'migrate-set-capabilities',"
+                          "'arguments': { 'capabilities': [ {"
+                          "'capability': 'background-snapshot',"
+                          "'state': true } ] } }");
+    if (!qdict_haskey(rsp, "return")) {
+        qobject_unref(rsp);
+        g_test_skip("background-snapshot not supported by the host");
+        test_migrate_end(from, to, false);
+        g_free(uri);
+        return;
+    }
+    qobject_unref(rsp);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+    wait_for_migration_complete(from);
+
+    /* The source keeps running through the whole snapshot */
+    rsp = wait_command(from, "{ 'execute': 'query-status' }");
+    g_assert(qdict_get_bool(rsp, "running"));
+    qobject_unref(rsp);
+
+    rsp = qtest_qmp(to, "{ 'execute': 'migrate-incoming',"
+                        "  'arguments': { 'uri': %s }}", uri);
+    g_assert(qdict_haskey(rsp, "return"));
+    qobject_unref(rsp);
+
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+    g_free(uri);
+}
+
+static void test_parallel_device_state(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+
+    /* Several CPUs, so that there is a batch of sections to run */
+    g_free(args->opts_source);
+    g_free(args->opts_target);
+    args->opts_source = g_strdup("-smp 4");
+    args->opts_target = g_strdup("-smp 4");
+
+    if (test_migrate_start(&from, &to, uri, args)) {
+        return;
+    }
+
+    /* Only the source needs it, the destination follows the stream */
+    migrate_set_capability(from, "parallel-device-state", true);
+
+    migrate_set_parameter_int(from, "downtime-limit", 300);
+    /* 1GB/s */
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    test_migrate_end(from, to, true);
+    g_free(uri);
+}
+
 #if 0
 /* Currently upset on aarch64 TCG */
 static void test_ignore_shared(void)
@@ -1260,7 +1414,7 @@ static void test_migrate_auto_converge(void)
     test_migrate_end(from, to, true);
 }
 
-static void test_multifd_tcp(const char *method)
+static void test_multifd_tcp(const char *method, bool xbzrle)
 {
     MigrateStart *args = migrate_start_new();
     QTestState *from, *to;
@@ -1290,6 +1444,11 @@ static void test_multifd_tcp(const char *method)
     migrate_set_capability(from, "multifd", "true");
     migrate_set_capability(to, "multifd", "true");
 
+    if (xbzrle) {
+        migrate_set_parameter_int(from, "xbzrle-cache-size", 33554432);
+        migrate_set_capability(from, "xbzrle", "true");
+    }
+
     /* Start incoming migration from the 1st socket */
     rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
                            "  'arguments': { 'uri': 'tcp:127.0.0.1:0' }}");
@@ -1320,21 +1479,26 @@ static void test_multifd_tcp(const char *method)
 
 static void test_multifd_tcp_none(void)
 {
-    test_multifd_tcp("none");
+    test_multifd_tcp("none", false);
 }
 
 static void test_multifd_tcp_zlib(void)
 {
-    test_multifd_tcp("zlib");
+    test_multifd_tcp("zlib", false);
 }
 
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
-    test_multifd_tcp("zstd");
+    test_multifd_tcp("zstd", false);
 }
 #endif
 
+static void test_multifd_tcp_xbzrle(void)
+{
+    test_multifd_tcp("none", true);
+}
+
 /*
  * This test does:
  *  source               target
@@ -1485,6 +1649,15 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
     qtest_add_func("/migration/precopy/tcp", test_precopy_tcp);
+    qtest_add_func("/migration/precopy/file", test_precopy_file_stream);
+    qtest_add_func("/migration/precopy/file/mapped-ram",
+                   test_precopy_file_mapped_ram);
+    qtest_add_func("/migration/precopy/file/mapped-ram/multifd",
+                   test_precopy_file_mapped_ram_multifd);
+    qtest_add_func("/migration/background-snapshot",
+                   test_background_snapshot);
+    qtest_add_func("/migration/parallel-device-state",
+                   test_parallel_device_state);
     /* qtest_add_func("/migration/ignore_shared", test_ignore_shared); */
     qtest_add_func("/migration/xbzrle/unix", test_xbzrle_unix);
     qtest_add_func("/migration/fd_proto", test_migrate_fd_proto);
@@ -1499,6 +1672,7 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/multifd/tcp/none", test_multifd_tcp_none);
     qtest_add_func("/migration/multifd/tcp/cancel", test_multifd_tcp_cancel);
     qtest_add_func("/migration/multifd/tcp/zlib", test_multifd_tcp_zlib);
+    qtest_add_func("/migration/multifd/tcp/xbzrle", test_multifd_tcp_xbzrle);
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/zstd", test_multifd_tcp_zstd);
 #endif
@@ -0,0 +1,285 @@
+/*
+ * QTest testcase for the TCG execution profiler
+ *
+ * Runs the migration test guest, which keeps sweeping over 100 MB of
+ * memory, and checks the data returned by x-query-tcg-profile and by
+ * the HMP "info tcg-profile" command.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+
+#include "tests/migration/i386/a-b-bootblock.h"
+#include "tests/migration/aarch64/a-b-kernel.h"
+
+#define WAIT_TIMEOUT_S 30
+
+static const char * const cpu_counters[] = {
+    "samples-idle", "samples-runtime", "samples-code", "samples-helper",
+    "samples-tlb-fill", "samples-translate", "tb-entries", "translations",
+    "translate-ns", "tlb-fills", "tlb-victim-hits",
+};
+
+static char bootpath[] = "/tmp/qtest-tcg-profile-XXXXXX";
+
+static QTestState *start_guest(void)
+{
+    const char *arch = qtest_get_arch();
+
+    if (g_str_equal(arch, "i386") || g_str_equal(arch, "x86_64")) {
+        return qtest_initf("-accel tcg -m 150M -S "
+                           "-drive file=%s,format=raw", bootpath);
+    }
+    g_assert(g_str_equal(arch, "aarch64"));
+    return qtest_initf("-accel tcg -M virt -cpu max -m 150M -S -kernel %s",
+                       bootpath);
+}
+
+static void write_bootfile(void)
+{
+    const char *arch = qtest_get_arch();
+    const void *code = x86_bootsect;
+    size_t len = sizeof(x86_bootsect);
+    int fd;
+
+    if (g_str_equal(arch, "aarch64")) {
+        code = aarch64_kernel;
+        len = sizeof(aarch64_kernel);
+    }
+    fd = mkstemp(bootpath);
+    g_assert(fd != -1);
+    g_assert_cmpint(write(fd, code, len), ==, len);
+    close(fd);
+}
+
+static QDict *query_profile(QTestState *qts, int top)
+{
+    QDict *rsp, *ret;
+
+    rsp = qtest_qmp(qts, "{ 'execute': 'x-query-tcg-profile', "
+                    "'arguments': { 'top': %d } }", top);
+    g_assert(qdict_haskey(rsp, "return"));
+    ret = qdict_get_qdict(rsp, "return");
+    qobject_ref(ret);
+    qobject_unref(rsp);
+    return ret;
+}
+
+static QDict *profile_cpu0(QDict *prof)
+{
+    QList *cpus = qdict_get_qlist(prof, "cpus");
+    QDict *cpu;
+
+    g_assert_cmpint(qlist_size(cpus), ==, 1);
+    cpu = qobject_to(QDict, qlist_peek(cpus));
+    g_assert(cpu);
+    g_assert_cmpint(qdict_get_int(cpu, "cpu-index"), ==, 0);
+    return cpu;
+}
+
+static uint64_t cpu_samples(QDict *cpu)
+{
+    return qdict_get_int(cpu, "samples-idle") +
+           qdict_get_int(cpu, "samples-runtime") +
+           qdict_get_int(cpu, "samples-code") +
+           qdict_get_int(cpu, "samples-helper") +
+           qdict_get_int(cpu, "samples-tlb-fill") +
+           qdict_get_int(cpu, "samples-translate");
+}
+
+/* Wait until the guest has run long enough to be sampled */
+static QDict *wait_profile(QTestState *qts, int top)
+{
+    gint64 end = g_get_monotonic_time() + WAIT_TIMEOUT_S * G_USEC_PER_SEC;
+
+    for (;;) {
+        QDict *prof = query_profile(qts, top);
+        QDict *cpu = profile_cpu0(prof);
+
+        if (cpu_samples(cpu) >= 10 && qdict_get_int(prof, "executions") &&
+            qdict_get_int(cpu, "tlb-fills")) {
+            return prof;
+        }
+        qobject_unref(prof);
+        g_assert(g_get_monotonic_time() < end);
+        g_usleep(10 * 1000);
+    }
+}
+
+static void check_hot_tbs(QDict *prof, int top)
+{
+    QList *tbs = qdict_get_qlist(prof, "hot-tbs");
+    uint64_t prev = UINT64_MAX, sum = 0;
+    const QListEntry *e;
+
+    g_assert_cmpint(qlist_size(tbs), >, 0);
+    g_assert_cmpint(qlist_size(tbs), <=, top);
+    QLIST_FOREACH_ENTRY(tbs, e) {
+        QDict *tb = qobject_to(QDict, qlist_entry_obj(e));
+        uint64_t n = qdict_get_int(tb, "executions");
+
+        g_assert(qdict_haskey(tb, "pc"));
+        g_assert(qdict_haskey(tb, "cs-base"));
+        g_assert(qdict_haskey(tb, "flags"));
+        g_assert_cmpint(n, >, 0);
+        g_assert_cmpint(n, <=, prev);
+        g_assert_cmpint(qdict_get_int(tb, "guest-insns"), >, 0);
+        g_assert_cmpint(qdict_get_int(tb, "host-size"), >, 0);
+        prev = n;
+        sum += n;
+    }
+    g_assert_cmpint(sum, <=, qdict_get_int(prof, "executions"));
+}
+
+static void check_zero(QDict *prof)
+{
+    QDict *cpu = profile_cpu0(prof);
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(cpu_counters); i++) {
+        g_assert_cmpint(qdict_get_int(cpu, cpu_counters[i]), ==, 0);
+    }
+    g_assert_cmpint(qdict_get_int(prof, "executions"), ==, 0);
+    g_assert_cmpint(qdict_get_int(prof, "elapsed-ns"), ==, 0);
+    g_assert_cmpint(qlist_size(qdict_get_qlist(prof, "hot-tbs")), ==, 0);
+}
+
+static void test_qmp(void)
+{
+    QTestState *qts = start_guest();
+    QDict *prof, *cpu;
+    size_t i;
+
+    /* Nothing is counted before the profiler is turned on */
+    prof = query_profile(qts, 10);
+    g_assert(!qdict_get_bool(prof, "enabled"));
+    g_assert_cmpint(qdict_get_int(prof, "sample-interval-us"), >, 0);
+    check_zero(prof);
+    qobject_unref(prof);
+
+    qtest_qmp_assert_success(qts, "{ 'execute': 'x-tcg-profile', "
+                             "'arguments': { 'op': 'on' } }");
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+
+    prof = wait_profile(qts, 3);
+    g_assert(qdict_get_bool(prof, "enabled"));
+    g_assert_cmpint(qdict_get_int(prof, "elapsed-ns"), >, 0);
+    cpu = profile_cpu0(prof);
+    for (i = 0; i < ARRAY_SIZE(cpu_counters); i++) {
+        g_assert(qdict_haskey(cpu, cpu_counters[i]));
+    }
+    g_assert_cmpint(qdict_get_int(cpu, "tb-entries"), >, 0);
+    g_assert_cmpint(qdict_get_int(cpu, "translations"), >, 0);
+    g_assert_cmpint(qdict_get_int(cpu, "translate-ns"), >, 0);
+    g_assert_cmpint(qdict_get_int(cpu, "samples-idle"), <,
+                    cpu_samples(cpu));
+    check_hot_tbs(prof, 3);
+    qobject_unref(prof);
+
+    /* Turning it off keeps the data... */
+    qtest_qmp_assert_success(qts, "{ 'execute': 'x-tcg-profile', "
+                             "'arguments': { 'op': 'off' } }");
+    prof = query_profile(qts, 5);
+    g_assert(!qdict_get_bool(prof, "enabled"));
+    g_assert_cmpint(qdict_get_int(profile_cpu0(prof), "tb-entries"), >, 0);
+    check_hot_tbs(prof, 5);
+    qobject_unref(prof);
+
+    /* ...until it is reset, and nothing is counted while it is off */
+    qtest_qmp_assert_success(qts, "{ 'execute': 'x-tcg-profile', "
+                             "'arguments': { 'op': 'reset' } }");
+    prof = query_profile(qts, 10);
+    check_zero(prof);
+    qobject_unref(prof);
+
+    g_usleep(100 * 1000);
+    prof = query_profile(qts, 10);
+    check_zero(prof);
+    qobject_unref(prof);
+
+    qtest_quit(qts);
+}
+
+static void test_hmp(void)
+{
+    QTestState *qts = start_guest();
+    char *s;
+
+    s = qtest_hmp(qts, "tcg-profile");
+    g_assert_cmpstr(s, ==, "tcg-profile is off\r\n");
+    g_free(s);
+
+    s = qtest_hmp(qts, "tcg-profile sideways");
+    g_assert(strstr(s, "Invalid parameter 'sideways'"));
+    g_free(s);
+
+    s = qtest_hmp(qts, "tcg-profile on");
+    g_assert_cmpstr(s, ==, "");
+    g_free(s);
+    s = qtest_hmp(qts, "tcg-profile");
+    g_assert_cmpstr(s, ==, "tcg-profile is on\r\n");
+    g_free(s);
+
+    s = qtest_hmp(qts, "cont");
+    g_free(s);
+    qobject_unref(wait_profile(qts, 1));
+
+    s = qtest_hmp(qts, "info tcg-profile 2");
+    g_assert(g_str_has_prefix(s, "TCG profile: on, "));
+    g_assert(strstr(s, "TB entries"));
+    g_assert(strstr(s, "victim hits"));
+    g_assert(strstr(s, "\nTB executions: "));
+    g_assert(!strstr(s, "\nTB executions: 0\r\n"));
+    g_assert(strstr(s, "  symbol\r\n"));
+    g_free(s);
+
+    s = qtest_hmp(qts, "tcg-profile off");
+    g_assert_cmpstr(s, ==, "");
+    g_free(s);
+    s = qtest_hmp(qts, "tcg-profile reset");
+    g_assert_cmpstr(s, ==, "");
+    g_free(s);
+    s = qtest_hmp(qts, "info tcg-profile");
+    g_assert(g_str_has_prefix(s, "TCG profile: off, 0.000 s, "));
+    g_assert(strstr(s, "\nTB executions: 0\r\n"));
+    g_assert(!strstr(s, "  symbol\r\n"));
+    g_free(s);
+
+    qtest_quit(qts);
+}
+
+/* The profiler is only available with TCG */
+static void test_not_tcg(void)
+{
+    QTestState *qts = qtest_init("-machine none");
+    QDict *rsp;
+
+    rsp = qtest_qmp(qts, "{ 'execute': 'x-tcg-profile', "
+                    "'arguments': { 'op': 'on' } }");
+    g_assert(qmp_rsp_is_err(rsp));
+    rsp = qtest_qmp(qts, "{ 'execute': 'x-query-tcg-profile' }");
+    g_assert(qmp_rsp_is_err(rsp));
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+    write_bootfile();
+
+    qtest_add_func("/tcg-profile/qmp", test_qmp);
+    qtest_add_func("/tcg-profile/hmp", test_hmp);
+    qtest_add_func("/tcg-profile/not-tcg", test_not_tcg);
+
+    ret = g_test_run();
+    unlink(bootpath);
+    return ret;
+}
@@ -0,0 +1,130 @@
+/*
+ * QTest testcase for the TCG victim TLB
+ *
+ * Runs the migration test guest, whose sweep over 100 MB of memory keeps
+ * evicting its code and stack pages from the main TLB, and checks that
+ * the victim TLB statistics of "info jit" move with the default and the
+ * smallest victim TLB.  Sizes that are not a power of 2 between 8 and
+ * 4096 must be rejected.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#include "tests/migration/i386/a-b-bootblock.h"
+#include "tests/migration/aarch64/a-b-kernel.h"
+
+#define WAIT_TIMEOUT_S 30
+
+static char bootpath[] = "/tmp/qtest-victim-tlb-XXXXXX";
+
+static QTestState *start_guest(const char *accel)
+{
+    const char *arch = qtest_get_arch();
+
+    if (g_str_equal(arch, "i386") || g_str_equal(arch, "x86_64")) {
+        return qtest_initf("-accel %s -m 150M -drive file=%s,format=raw",
+                           accel, bootpath);
+    }
+    g_assert(g_str_equal(arch, "aarch64"));
+    return qtest_initf("-accel %s -M virt -cpu max -m 150M -kernel %s",
+                       accel, bootpath);
+}
+
+static void write_bootfile(void)
+{
+    const char *arch = qtest_get_arch();
+    const void *code = x86_bootsect;
+    size_t len = sizeof(x86_bootsect);
+    int fd;
+
+    if (g_str_equal(arch, "aarch64")) {
+        code = aarch64_kernel;
+        len = sizeof(aarch64_kernel);
+    }
+    fd = mkstemp(bootpath);
+    g_assert(fd != -1);
+    g_assert_cmpint(write(fd, code, len), ==, len);
+    close(fd);
+}
+
+static uint64_t jit_counter(const char *info, const char *name)
+{
+    const char *p = strstr(info, name);
+
+    g_assert(p);
+    return g_ascii_strtoull(p + strlen(name), NULL, 10);
+}
+
+static void test_hits(const void *data)
+{
+    const char *accel = data;
+    QTestState *qts = start_guest(accel);
+    gint64 end = g_get_monotonic_time() + WAIT_TIMEOUT_S * G_USEC_PER_SEC;
+    uint64_t hits, misses;
+
+    for (;;) {
+        char *info = qtest_hmp(qts, "info jit");
+
+        hits = jit_counter(info, "TLB victim hits");
+        misses = jit_counter(info, "TLB victim misses");
+        g_free(info);
+        if (hits && misses) {
+            break;
+        }
+        g_assert(g_get_monotonic_time() < end);
+        g_usleep(10 * 1000);
+    }
+
+    qtest_quit(qts);
+}
+
+/* An invalid size makes QEMU exit before it starts the guest */
+static void test_bad_size(void)
+{
+    static const char * const sizes[] = {
+        "0", "4", "24", "100", "8192", "-8", "big",
+    };
+    const char *qemu = g_getenv("QTEST_QEMU_BINARY");
+    size_t i;
+
+    g_assert(qemu);
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        char *accel = g_strdup_printf("tcg,victim-tlb-size=%s", sizes[i]);
+        const char *args[] = {
+            qemu, "-machine", "none", "-display", "none", "-accel", accel,
+            NULL,
+        };
+        gchar *out_err = NULL;
+        gint exit_status = -1;
+
+        g_assert(g_spawn_sync(NULL, (gchar **)args, NULL,
+                              G_SPAWN_STDOUT_TO_DEV_NULL,
+                              NULL, NULL, NULL, &out_err, &exit_status,
+                              NULL));
+        g_assert_cmpint(exit_status, !=, 0);
+        g_assert(strstr(out_err, "victim-tlb-size"));
+        g_free(out_err);
+        g_free(accel);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+    write_bootfile();
+
+    qtest_add_data_func("/victim-tlb/hits/default", "tcg", test_hits);
+    qtest_add_data_func("/victim-tlb/hits/small", "tcg,victim-tlb-size=8",
+                        test_hits);
+    qtest_add_func("/victim-tlb/bad-size", test_bad_size);
+
+    ret = g_test_run();
+    unlink(bootpath);
+    return ret;
+}
@@ -12,6 +12,7 @@
 #include "libqtest-single.h"
 #include "qemu/bswap.h"
 #include "qemu/module.h"
+#include "qapi/qmp/qdict.h"
 #include "standard-headers/linux/virtio_blk.h"
 #include "standard-headers/linux/virtio_pci.h"
 #include "libqos/qgraph.h"
@@ -766,6 +767,397 @@ static void resize(void *obj, void *data, QGuestAllocator *t_alloc)
 
 }
 
+/*
+ * Requests that are made available to the device all at once, so that it
+ * pops and completes them in batches.
+ */
+#define BATCH_MAX               300
+
+typedef struct BlkBatch {
+    QVirtioDevice *dev;
+    QGuestAllocator *alloc;
+    QVirtQueue *vq;
+    unsigned int num;
+    uint32_t heads[BATCH_MAX];
+    uint64_t req_addr[BATCH_MAX];
+} BlkBatch;
+
+static void batch_start(BlkBatch *b, QVirtioDevice *dev,
+                        QGuestAllocator *alloc, bool event_idx)
+{
+    uint64_t features;
+
+    features = qvirtio_get_features(dev);
+    features &= ~(QVIRTIO_F_BAD_FEATURE |
+                  (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                  (1u << VIRTIO_BLK_F_SCSI));
+    if (!event_idx) {
+        features &= ~(1u << VIRTIO_RING_F_EVENT_IDX);
+    }
+    qvirtio_set_features(dev, features);
+
+    b->dev = dev;
+    b->alloc = alloc;
+    b->vq = qvirtqueue_setup(dev, alloc, 0);
+    b->num = 0;
+    qvirtio_set_driver_ok(dev);
+}
+
+/* Queue a request on @nsegs sectors at @data, one descriptor each */
+static void batch_add(BlkBatch *b, uint32_t type, uint64_t sector,
+                      uint64_t data, unsigned int nsegs)
+{
+    QVirtioBlkReq req = {
+        .type = type,
+        .sector = sector,
+    };
+    QTestState *qts = global_qtest;
+    uint8_t status = 0xFF;
+    uint64_t addr;
+    unsigned int i;
+
+    g_assert_cmpuint(b->num, <, BATCH_MAX);
+    addr = guest_alloc(b->alloc, 16 + sizeof(status));
+    virtio_blk_fix_request(b->dev, &req);
+    memwrite(addr, &req, 16);
+    memwrite(addr + 16, &status, sizeof(status));
+
+    b->heads[b->num] = qvirtqueue_add(qts, b->vq, addr, 16, false, true);
+    for (i = 0; i < nsegs; i++) {
+        qvirtqueue_add(qts, b->vq, data + i * 512, 512,
+                       type == VIRTIO_BLK_T_IN, true);
+    }
+    qvirtqueue_add(qts, b->vq, addr + 16, sizeof(status), true, false);
+    b->req_addr[b->num++] = addr;
+}
+
+static void batch_kick(BlkBatch *b)
+{
+    qvirtqueue_kick_batch(global_qtest, b->dev, b->vq, b->heads, b->num);
+}
+
+static void batch_discard(BlkBatch *b)
+{
+    unsigned int i;
+
+    for (i = 0; i < b->num; i++) {
+        guest_free(b->alloc, b->req_addr[i]);
+    }
+    b->num = 0;
+}
+
+/* Wait for all the requests of the batch, completed in any order */
+static void batch_wait(BlkBatch *b)
+{
+    QTestState *qts = global_qtest;
+    bool done[BATCH_MAX] = {};
+    gint64 start_time = g_get_monotonic_time();
+    unsigned int n = 0, i;
+    uint32_t desc_idx;
+
+    while (n < b->num) {
+        qtest_clock_step(qts, 100);
+        while (qvirtqueue_get_buf(qts, b->vq, &desc_idx, NULL)) {
+            for (i = 0; i < b->num; i++) {
+                if (b->heads[i] == desc_idx) {
+                    break;
+                }
+            }
+            g_assert_cmpuint(i, <, b->num);
+            g_assert(!done[i]);
+            done[i] = true;
+            n++;
+        }
+        g_assert(g_get_monotonic_time() - start_time <=
+                 QVIRTIO_BLK_TIMEOUT_US);
+    }
+
+    for (i = 0; i < b->num; i++) {
+        g_assert_cmpint(readb(b->req_addr[i] + 16), ==, VIRTIO_BLK_S_OK);
+    }
+    batch_discard(b);
+}
+
+static void batch_run(BlkBatch *b)
+{
+    batch_kick(b);
+    batch_wait(b);
+}
+
+static void batch_end(BlkBatch *b)
+{
+    qvirtqueue_cleanup(b->dev->bus, b->vq, b->alloc);
+}
+
+/* Sector contents that are different for each sector and each @seed */
+static void batch_fill(uint64_t addr, uint64_t sector, unsigned int n,
+                       uint8_t seed)
+{
+    char buf[512];
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        memset(buf, (uint8_t)(sector + i) ^ seed, sizeof(buf));
+        memcpy(buf, &seed, sizeof(seed));
+        memwrite(addr + i * 512, buf, sizeof(buf));
+    }
+}
+
+static void batch_check(uint64_t addr, uint64_t sector, unsigned int n,
+                        uint8_t seed)
+{
+    char buf[512], expected[512];
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        memset(expected, (uint8_t)(sector + i) ^ seed, sizeof(expected));
+        memcpy(expected, &seed, sizeof(seed));
+        memread(addr + i * 512, buf, sizeof(buf));
+        g_assert(memcmp(buf, expected, sizeof(buf)) == 0);
+    }
+}
+
+/*
+ * Requests with more segments than the preallocated elements have room
+ * for, between requests that fit.
+ */
+static void batch_many_sg(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    BlkBatch b;
+    uint64_t buf;
+    unsigned int i;
+
+    batch_start(&b, blk_if->vdev, t_alloc, false);
+    buf = guest_alloc(t_alloc, 48 * 512);
+
+    batch_fill(buf, 0, 48, 1);
+    for (i = 0; i < 4; i++) {
+        batch_add(&b, VIRTIO_BLK_T_OUT, i, buf + i * 512, 1);
+    }
+    batch_add(&b, VIRTIO_BLK_T_OUT, 4, buf + 4 * 512, 40);
+    for (i = 44; i < 48; i++) {
+        batch_add(&b, VIRTIO_BLK_T_OUT, i, buf + i * 512, 1);
+    }
+    batch_run(&b);
+
+    qtest_memset(global_qtest, buf, 0, 48 * 512);
+    batch_add(&b, VIRTIO_BLK_T_IN, 0, buf, 40);
+    for (i = 40; i < 48; i++) {
+        batch_add(&b, VIRTIO_BLK_T_IN, i, buf + i * 512, 1);
+    }
+    batch_run(&b);
+    batch_check(buf, 0, 48, 1);
+
+    guest_free(t_alloc, buf);
+    batch_end(&b);
+}
+
+/*
+ * More requests in flight than the virtqueue has preallocated elements.
+ * The second time around, the device is reset with all of them in flight.
+ */
+static void batch_arena_full(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    BlkBatch b;
+    uint64_t buf;
+    unsigned int i;
+
+    batch_start(&b, dev, t_alloc, false);
+    buf = guest_alloc(t_alloc, BATCH_MAX * 512);
+
+    batch_fill(buf, 0, BATCH_MAX, 1);
+    for (i = 0; i < BATCH_MAX; i++) {
+        batch_add(&b, VIRTIO_BLK_T_OUT, i, buf + i * 512, 1);
+    }
+    batch_run(&b);
+
+    batch_fill(buf, 0, BATCH_MAX, 2);
+    for (i = 0; i < BATCH_MAX; i++) {
+        batch_add(&b, VIRTIO_BLK_T_OUT, i, buf + i * 512, 1);
+    }
+    batch_kick(&b);
+
+    /* The reset waits for the requests, which must all have been done */
+    qvirtio_start_device(dev);
+    batch_discard(&b);
+    batch_end(&b);
+    batch_start(&b, dev, t_alloc, false);
+
+    qtest_memset(global_qtest, buf, 0, BATCH_MAX * 512);
+    for (i = 0; i < BATCH_MAX; i += 30) {
+        batch_add(&b, VIRTIO_BLK_T_IN, i, buf + i * 512, 30);
+    }
+    batch_run(&b);
+    batch_check(buf, 0, BATCH_MAX, 2);
+
+    guest_free(t_alloc, buf);
+    batch_end(&b);
+}
+
+/*
+ * A batch of requests is popped, and its buffers are completed, in one
+ * go: the avail event and the used index are only updated once.
+ */
+static void batch_event_idx(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    const char *log_path = data;
+    BlkBatch b;
+    uint64_t buf;
+    char *log, **lines;
+    unsigned int i, pops = 0, flushes = 0;
+
+    batch_start(&b, blk_if->vdev, t_alloc, true);
+    buf = guest_alloc(t_alloc, 8 * 512);
+
+    batch_fill(buf, 0, 8, 3);
+    for (i = 0; i < 8; i++) {
+        batch_add(&b, VIRTIO_BLK_T_OUT, i, buf + i * 512, 1);
+    }
+    batch_run(&b);
+    g_assert_cmpint(qvirtqueue_get_avail_event(global_qtest, b.vq), ==, 8);
+
+    g_assert(g_file_get_contents(log_path, &log, NULL, NULL));
+    lines = g_strsplit(log, "\n", -1);
+    for (i = 0; lines[i]; i++) {
+        if (strstr(lines[i], ":virtqueue_pop_batch ")) {
+            pops += !!strstr(lines[i], " num 8 ");
+        } else if (strstr(lines[i], ":virtqueue_flush ")) {
+            g_assert(g_str_has_suffix(lines[i], " count 8"));
+            flushes++;
+        }
+    }
+    g_strfreev(lines);
+    g_free(log);
+
+    if (!pops && !flushes) {
+        g_test_message("no trace output, skipping the batch size checks");
+    } else {
+        g_assert_cmpint(pops, ==, 1);
+        g_assert_cmpint(flushes, ==, 1);
+    }
+
+    guest_free(t_alloc, buf);
+    batch_end(&b);
+}
+
+/*
+ * Buffers in memory that is plugged after the first batch, mixed with
+ * buffers in the RAM the device has already seen.
+ */
+static void batch_memory_hotplug(void *obj, void *data,
+                                 QGuestAllocator *t_alloc)
+{
+    QVirtioBlkPCI *blk = obj;
+    QTestState *qts = global_qtest;
+    const char *arch = qtest_get_arch();
+    BlkBatch b;
+    uint64_t buf, dimm;
+    unsigned int i;
+    QDict *rsp;
+
+    if (strcmp(arch, "i386") && strcmp(arch, "x86_64")) {
+        return;
+    }
+
+    batch_start(&b, &blk->pci_vdev.vdev, t_alloc, false);
+    buf = guest_alloc(t_alloc, 16 * 512);
+
+    batch_fill(buf, 0, 16, 4);
+    for (i = 0; i < 16; i++) {
+        batch_add(&b, VIRTIO_BLK_T_OUT, i, buf + i * 512, 1);
+    }
+    batch_run(&b);
+
+    qtest_qmp_assert_success(qts, "{ 'execute': 'object-add', 'arguments': {"
+                             " 'qom-type': 'memory-backend-ram',"
+                             " 'id': 'mem1',"
+                             " 'props': { 'size': %d } } }",
+                             128 * 1024 * 1024);
+    qtest_qmp_device_add(qts, "pc-dimm", "dimm1", "{'memdev': 'mem1'}");
+    rsp = qmp("{ 'execute': 'qom-get', 'arguments': {"
+              " 'path': '/machine/peripheral/dimm1', 'property': 'addr' } }");
+    g_assert(qdict_haskey(rsp, "return"));
+    dimm = qdict_get_int(rsp, "return");
+    qobject_unref(rsp);
+
+    /* Every other sector comes from the DIMM, then read it all back there */
+    batch_fill(dimm, 16, 16, 5);
+    batch_fill(buf, 16, 16, 5);
+    for (i = 16; i < 32; i++) {
+        batch_add(&b, VIRTIO_BLK_T_OUT, i,
+                  (i & 1 ? dimm : buf) + (i - 16) * 512, 1);
+    }
+    batch_run(&b);
+
+    qtest_memset(qts, dimm, 0, 32 * 512);
+    batch_add(&b, VIRTIO_BLK_T_IN, 0, dimm, 16);
+    for (i = 16; i < 32; i++) {
+        batch_add(&b, VIRTIO_BLK_T_IN, i, dimm + i * 512, 1);
+    }
+    batch_run(&b);
+    batch_check(dimm, 0, 16, 4);
+    batch_check(dimm + 16 * 512, 16, 16, 5);
+
+    guest_free(t_alloc, buf);
+    batch_end(&b);
+}
+
+/*
+ * Requests that failed with werror=stop are kept by the device until the
+ * VM runs again.  Unplugging it in the meantime frees them after their
+ * virtqueue, which must not leave their elements behind.
+ */
+static void batch_orphan(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioPCIDevice *dev1 = obj;
+    QTestState *qts = dev1->pdev->bus->qts;
+    const char *arch = qtest_get_arch();
+    QPCIAddress addr = { .devfn = QPCI_DEVFN(PCI_SLOT_HP, 0) };
+    QVirtioPCIDevice *dev;
+    BlkBatch b;
+    uint64_t buf;
+    unsigned int i;
+    QDict *rsp;
+
+    if (strcmp(arch, "i386") && strcmp(arch, "x86_64")) {
+        return;
+    }
+
+    qtest_qmp_device_add(qts, "virtio-blk-pci", "drv2",
+                         "{'addr': %s, 'drive': 'err0', 'werror': 'stop'}",
+                         stringify(PCI_SLOT_HP) ".0");
+    dev = virtio_pci_new(dev1->pdev->bus, &addr);
+    g_assert_nonnull(dev);
+    qvirtio_pci_device_enable(dev);
+    qvirtio_start_device(&dev->vdev);
+
+    batch_start(&b, &dev->vdev, t_alloc, false);
+    buf = guest_alloc(t_alloc, 8 * 512);
+    batch_fill(buf, 0, 8, 6);
+    for (i = 0; i < 8; i++) {
+        batch_add(&b, VIRTIO_BLK_T_OUT, i * 2, buf + i * 512, 1);
+    }
+    batch_kick(&b);
+    qtest_qmp_eventwait(qts, "STOP");
+
+    batch_discard(&b);
+    guest_free(t_alloc, buf);
+    batch_end(&b);
+    qvirtio_pci_device_disable(dev);
+    qos_object_destroy((QOSGraphObject *)dev);
+
+    qpci_unplug_acpi_device_test(qts, "drv2", PCI_SLOT_HP);
+
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+    rsp = qmp("{ 'execute': 'query-status' }");
+    g_assert(qdict_get_bool(qdict_get_qdict(rsp, "return"), "running"));
+    qobject_unref(rsp);
+}
+
 static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
 {
     char *tmp_path = drive_create();
@@ -780,6 +1172,48 @@ static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
     return arg;
 }
 
+static void batch_log_destroy(void *path)
+{
+    unlink(path);
+    g_free(path);
+}
+
+static void *virtio_blk_test_setup_trace(GString *cmd_line, void *arg)
+{
+    char *log_path;
+    int fd;
+
+    fd = g_file_open_tmp("qtest-virtio-blk-XXXXXX.log", &log_path, NULL);
+    g_assert_cmpint(fd, >=, 0);
+    close(fd);
+    g_test_queue_destroy(batch_log_destroy, log_path);
+
+    g_string_append_printf(cmd_line,
+                           " -trace enable=virtqueue_pop_batch"
+                           " -trace enable=virtqueue_flush -D %s ",
+                           log_path);
+    virtio_blk_test_setup(cmd_line, arg);
+    return log_path;
+}
+
+static void *virtio_blk_test_setup_memory(GString *cmd_line, void *arg)
+{
+    const char *arch = qtest_get_arch();
+
+    if (!strcmp(arch, "i386") || !strcmp(arch, "x86_64")) {
+        g_string_append(cmd_line, " -m 128M,slots=1,maxmem=1G ");
+    }
+    return virtio_blk_test_setup(cmd_line, arg);
+}
+
+static void *virtio_blk_test_setup_error(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line,
+                    " -blockdev driver=blkdebug,node-name=err0,"
+                    "image.driver=null-co,inject-error.0.event=pwritev ");
+    return virtio_blk_test_setup(cmd_line, arg);
+}
+
 static void register_virtio_blk_test(void)
 {
     QOSGraphTestOptions opts = {
@@ -797,6 +1231,18 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+
+    qos_add_test("batch/many-sg", "virtio-blk", batch_many_sg, &opts);
+    opts.edge.extra_device_opts = "queue-size=1024";
+    qos_add_test("batch/arena-full", "virtio-blk", batch_arena_full, &opts);
+    opts.edge.extra_device_opts = NULL;
+    opts.before = virtio_blk_test_setup_trace;
+    qos_add_test("batch/event-idx", "virtio-blk", batch_event_idx, &opts);
+    opts.before = virtio_blk_test_setup_memory;
+    qos_add_test("batch/memory-hotplug", "virtio-blk-pci",
+                 batch_memory_hotplug, &opts);
+    opts.before = virtio_blk_test_setup_error;
+    qos_add_test("batch/orphan", "virtio-blk-pci", batch_orphan, &opts);
 }
 
 libqos_init(register_virtio_blk_test);
@@ -12,11 +12,20 @@
 #include "libqtest-single.h"
 #include "qemu/iov.h"
 #include "qemu/module.h"
+#include "qemu/timer.h"
 #include "qapi/qmp/qdict.h"
 #include "hw/virtio/virtio-net.h"
 #include "libqos/qgraph.h"
 #include "libqos/virtio-net.h"
 
+#ifdef CONFIG_LINUX
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include "net/eth.h"
+#include "net/tap-linux.h"
+#endif
+
 #ifndef ETH_P_RARP
 #define ETH_P_RARP 0x8035
 #endif
@@ -166,6 +175,620 @@ static void stop_cont_test(void *obj, void *data, QGuestAllocator *t_alloc)
     rx_stop_cont_test(dev, t_alloc, rx, sv[0]);
 }
 
+#define TX_BATCH_PACKETS        64
+#define TX_BATCH_SIZE           (16 * 1024)
+
+/*
+ * Queue more packets at once than the socket can take, so that the device
+ * stops in the middle of a batch and gives the rest of it back.  They must
+ * all still go out once and in order, and be used in order.
+ */
+static void tx_batch_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *vq = net_if->queues[1];
+    QTestState *qts = global_qtest;
+    uint64_t req_addr[TX_BATCH_PACKETS];
+    uint32_t heads[TX_BATCH_PACKETS];
+    uint32_t desc_idx, len;
+    char *buffer = g_malloc(TX_BATCH_SIZE);
+    gint64 start_time;
+    int *sv = data;
+    int i, j, ret;
+
+    for (i = 0; i < TX_BATCH_PACKETS; i++) {
+        req_addr[i] = guest_alloc(t_alloc, VNET_HDR_SIZE + TX_BATCH_SIZE);
+        qtest_memset(qts, req_addr[i], 0, VNET_HDR_SIZE);
+        memset(buffer, i, TX_BATCH_SIZE);
+        memwrite(req_addr[i] + VNET_HDR_SIZE, buffer, TX_BATCH_SIZE);
+        heads[i] = qvirtqueue_add(qts, vq, req_addr[i],
+                                  VNET_HDR_SIZE + TX_BATCH_SIZE, false, false);
+    }
+    qvirtqueue_kick_batch(qts, dev, vq, heads, TX_BATCH_PACKETS);
+
+    for (i = 0; i < TX_BATCH_PACKETS; i++) {
+        ret = qemu_recv(sv[0], &len, sizeof(len), MSG_WAITALL);
+        g_assert_cmpint(ret, ==, sizeof(len));
+        g_assert_cmpint(ntohl(len), ==, TX_BATCH_SIZE);
+
+        ret = qemu_recv(sv[0], buffer, TX_BATCH_SIZE, MSG_WAITALL);
+        g_assert_cmpint(ret, ==, TX_BATCH_SIZE);
+        for (j = 0; j < TX_BATCH_SIZE; j++) {
+            g_assert_cmpint((uint8_t)buffer[j], ==, i);
+        }
+    }
+
+    start_time = g_get_monotonic_time();
+    for (i = 0; i < TX_BATCH_PACKETS; ) {
+        qtest_clock_step(qts, 100);
+        if (qvirtqueue_get_buf(qts, vq, &desc_idx, NULL)) {
+            g_assert_cmpint(desc_idx, ==, heads[i]);
+            i++;
+            continue;
+        }
+        g_assert(g_get_monotonic_time() - start_time <=
+                 QVIRTIO_NET_TIMEOUT_US);
+    }
+
+    /* Nothing was sent twice */
+    ret = qemu_recv(sv[0], &len, sizeof(len), MSG_DONTWAIT);
+    g_assert_cmpint(ret, ==, -1);
+    g_assert_cmpint(errno, ==, EAGAIN);
+
+    for (i = 0; i < TX_BATCH_PACKETS; i++) {
+        guest_free(t_alloc, req_addr[i]);
+    }
+    g_free(buffer);
+}
+
+/*
+ * With the queues in an iothread, packets go through, filters cannot be
+ * added to the backend, and the device survives the backend going away.
+ */
+static void iothread_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNetPCI *net_pci = obj;
+    QVirtioNet *net_if = &net_pci->net;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *rx = net_if->queues[0];
+    QVirtQueue *tx = net_if->queues[1];
+    QTestState *qts = global_qtest;
+    uint64_t req_addr;
+    uint32_t free_head;
+    int *sv = data;
+    QDict *rsp;
+
+    rx_test(dev, t_alloc, rx, sv[0]);
+    tx_test(dev, t_alloc, tx, sv[0]);
+
+    rsp = qmp("{ 'execute': 'object-add', 'arguments': {"
+              " 'qom-type': 'filter-buffer', 'id': 'fb0',"
+              " 'props': { 'netdev': 'hs0', 'interval': 1000 } } }");
+    g_assert(qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    rsp = qmp("{ 'execute': 'netdev_del', 'arguments': { 'id': 'hs0' } }");
+    g_assert(!qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    /* Without a backend, the packets are dropped */
+    req_addr = guest_alloc(t_alloc, 64);
+    memwrite(req_addr + VNET_HDR_SIZE, "TEST", 4);
+    free_head = qvirtqueue_add(qts, tx, req_addr, 64, false, false);
+    qvirtqueue_kick(qts, dev, tx, free_head);
+    qvirtio_wait_used_elem(qts, dev, tx, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    guest_free(t_alloc, req_addr);
+}
+
+/*
+ * The coalesce-usecs property holds back the interrupts of the data queues,
+ * but not those of the control queue, through which the driver can turn
+ * coalescing off.  NOTF_COAL cannot be offered without a control queue.
+ */
+static void coalesce_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNetPCI *net_pci = obj;
+    QVirtioNet *net_if = &net_pci->net;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *tx = net_if->queues[1];
+    QVirtQueue *ctrl = net_if->queues[2];
+    QTestState *qts = global_qtest;
+    struct virtio_net_ctrl_hdr hdr = {
+        .class = VIRTIO_NET_CTRL_NOTF_COAL,
+        .cmd = VIRTIO_NET_CTRL_NOTF_COAL_TX_SET,
+    };
+    struct virtio_net_ctrl_coal_tx coal = { 0 };
+    uint64_t req_addr;
+    uint32_t free_head, desc_idx;
+    int *sv = data;
+    QDict *rsp;
+
+    rsp = qmp("{ 'execute': 'device_add', 'arguments': {"
+              " 'driver': 'virtio-net-pci', 'id': 'net1', 'addr': %s,"
+              " 'notf_coal': true, 'ctrl_vq': false } }",
+              stringify(PCI_SLOT_HP));
+    g_assert(qdict_haskey(rsp, "error"));
+    g_assert(strstr(qdict_get_str(qdict_get_qdict(rsp, "error"), "desc"),
+                    "require 'ctrl_vq'"));
+    qobject_unref(rsp);
+
+    /* The packet is sent, but the interrupt waits for coalesce-usecs */
+    req_addr = guest_alloc(t_alloc, 64);
+    memwrite(req_addr + VNET_HDR_SIZE, "TEST", 4);
+    free_head = qvirtqueue_add(qts, tx, req_addr, 64, false, false);
+    qvirtqueue_kick(qts, dev, tx, free_head);
+    while (!qvirtqueue_get_buf(qts, tx, &desc_idx, NULL)) {
+        qtest_clock_step(qts, 100);
+    }
+    g_assert_cmpint(desc_idx, ==, free_head);
+    g_assert(!dev->bus->get_queue_isr_status(dev, tx));
+    qtest_clock_step(qts, NANOSECONDS_PER_SECOND);
+    g_assert(dev->bus->get_queue_isr_status(dev, tx));
+    guest_free(t_alloc, req_addr);
+
+    /* Control commands complete right away, and turn coalescing off */
+    req_addr = guest_alloc(t_alloc, 64);
+    memwrite(req_addr, &hdr, sizeof(hdr));
+    memwrite(req_addr + sizeof(hdr), &coal, sizeof(coal));
+    writeb(req_addr + 32, 0xff);
+    free_head = qvirtqueue_add(qts, ctrl, req_addr, sizeof(hdr) + sizeof(coal),
+                               false, true);
+    qvirtqueue_add(qts, ctrl, req_addr + 32, 1, true, false);
+    qvirtqueue_kick(qts, dev, ctrl, free_head);
+    qvirtio_wait_used_elem(qts, dev, ctrl, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    g_assert_cmpint(readb(req_addr + 32), ==, VIRTIO_NET_OK);
+    guest_free(t_alloc, req_addr);
+
+    tx_test(dev, t_alloc, tx, sv[0]);
+}
+
+/*
+ * RSS needs more than one queue pair to steer packets.  The socket
+ * backend has only one, so a multiqueue tap device is used when the test
+ * may create one.
+ */
+#define RSS_QUEUES      2
+#define RSS_RX_BUFS     32
+#define RSS_BUF_SIZE    128
+#define RSS_HDR_SIZE    sizeof(struct virtio_net_hdr_v1_hash)
+#define RSS_TABLE_LEN   8
+
+typedef struct RssBackend {
+    int fd;             /* where frames are sent from */
+    int ifindex;        /* of the tap device, 0 with a socket */
+    int peer_fd;        /* the other end of the socket */
+    int tap_fds[RSS_QUEUES];
+} RssBackend;
+
+typedef struct RssRxQueue {
+    QVirtQueue *vq;
+    uint64_t *bufs;     /* by descriptor index */
+} RssRxQueue;
+
+/* The first IPv4 vector of the Microsoft RSS verification suite */
+static const uint8_t rss_key[VIRTIO_NET_RSS_MAX_KEY_SIZE + 1] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+#define RSS_HASH_IPV4   0x323e8fc2
+#define RSS_HASH_TCPV4  0x51ccc178
+
+/* 66.9.149.187:2794 -> 161.142.100.80:1766, TCP SYN */
+static const uint8_t rss_tcp_frame[] = {
+    0x52, 0x54, 0x00, 0x12, 0x34, 0x56, 0x52, 0x54, 0x00, 0x12, 0x34, 0x57,
+    0x08, 0x00,
+    0x45, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00,
+    0x42, 0x09, 0x95, 0xbb, 0xa1, 0x8e, 0x64, 0x50,
+    0x0a, 0xea, 0x06, 0xe6, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x50, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/* An ARP request, which RSS does not classify */
+static const uint8_t rss_arp_frame[] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x52, 0x54, 0x00, 0x12, 0x34, 0x57,
+    0x08, 0x06,
+    0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x01,
+    0x52, 0x54, 0x00, 0x12, 0x34, 0x57, 0x0a, 0x00, 0x02, 0x0f,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x02, 0x02,
+};
+
+/* Send a control command and return its ack */
+static uint8_t ctrl_cmd(QVirtioDevice *dev, QGuestAllocator *alloc,
+                        QVirtQueue *ctrl, uint8_t class, uint8_t cmd,
+                        const void *data, size_t len)
+{
+    QTestState *qts = global_qtest;
+    struct virtio_net_ctrl_hdr hdr = { .class = class, .cmd = cmd };
+    uint64_t req_addr = guest_alloc(alloc, sizeof(hdr) + len + 1);
+    uint64_t ack_addr = req_addr + sizeof(hdr) + len;
+    uint32_t free_head;
+    uint8_t ack;
+
+    memwrite(req_addr, &hdr, sizeof(hdr));
+    memwrite(req_addr + sizeof(hdr), data, len);
+    writeb(ack_addr, 0xff);
+    free_head = qvirtqueue_add(qts, ctrl, req_addr, sizeof(hdr) + len,
+                               false, true);
+    qvirtqueue_add(qts, ctrl, ack_addr, 1, true, false);
+    qvirtqueue_kick(qts, dev, ctrl, free_head);
+    qvirtio_wait_used_elem(qts, dev, ctrl, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    ack = readb(ack_addr);
+    guest_free(alloc, req_addr);
+    return ack;
+}
+
+/* struct virtio_net_rss_config, with a key of @key_len bytes */
+static size_t rss_config(uint8_t *buf, uint32_t types, uint16_t table_len,
+                         const uint16_t *table, uint16_t unclassified,
+                         uint16_t max_tx_vq, uint8_t key_len)
+{
+    size_t off = 8;
+    int i;
+
+    stl_le_p(buf, types);
+    stw_le_p(buf + 4, table_len - 1);
+    stw_le_p(buf + 6, unclassified);
+    for (i = 0; i < table_len; i++, off += 2) {
+        stw_le_p(buf + off, table[i]);
+    }
+    stw_le_p(buf + off, max_tx_vq);
+    buf[off + 2] = key_len;
+    memcpy(buf + off + 3, rss_key, key_len);
+    return off + 3 + key_len;
+}
+
+/* struct virtio_net_hash_config, with a key of @key_len bytes */
+static size_t hash_config(uint8_t *buf, uint32_t types, uint8_t key_len)
+{
+    memset(buf, 0, 12);
+    stl_le_p(buf, types);
+    buf[12] = key_len;
+    memcpy(buf + 13, rss_key, key_len);
+    return 13 + key_len;
+}
+
+static void rss_send(RssBackend *be, const uint8_t *frame, size_t len)
+{
+    int ret;
+
+#ifdef CONFIG_LINUX
+    if (be->ifindex) {
+        struct sockaddr_ll sll = {
+            .sll_family = AF_PACKET,
+            .sll_ifindex = be->ifindex,
+            .sll_halen = ETH_ALEN,
+        };
+
+        memcpy(sll.sll_addr, frame, ETH_ALEN);
+        ret = sendto(be->fd, frame, len, 0, (struct sockaddr *)&sll,
+                     sizeof(sll));
+        g_assert_cmpint(ret, ==, len);
+        return;
+    }
+#endif
+    {
+        uint32_t be_len = htonl(len);
+        struct iovec iov[] = {
+            { .iov_base = &be_len, .iov_len = sizeof(be_len) },
+            { .iov_base = (void *)frame, .iov_len = len },
+        };
+
+        ret = iov_send(be->fd, iov, 2, 0, sizeof(be_len) + len);
+        g_assert_cmpint(ret, ==, sizeof(be_len) + len);
+    }
+}
+
+/*
+ * Send @frame and return the rx queue it lands on, with its header in
+ * @hdr.  Other packets, e.g. sent by the host to a tap device, are
+ * skipped.
+ */
+static int rss_recv(RssBackend *be, RssRxQueue *rx, int n_rx,
+                    const uint8_t *frame, size_t len,
+                    struct virtio_net_hdr_v1_hash *hdr)
+{
+    QTestState *qts = global_qtest;
+    gint64 end = g_get_monotonic_time() + QVIRTIO_NET_TIMEOUT_US;
+    uint8_t buf[RSS_BUF_SIZE];
+    uint32_t idx, used_len;
+    int q;
+
+    rss_send(be, frame, len);
+    for (;;) {
+        for (q = 0; q < n_rx; q++) {
+            while (qvirtqueue_get_buf(qts, rx[q].vq, &idx, &used_len)) {
+                memread(rx[q].bufs[idx], buf, sizeof(buf));
+                if (used_len == RSS_HDR_SIZE + len &&
+                    !memcmp(buf + RSS_HDR_SIZE, frame, len)) {
+                    memcpy(hdr, buf, sizeof(*hdr));
+                    return q;
+                }
+            }
+        }
+        g_assert(g_get_monotonic_time() < end);
+        qtest_clock_step(qts, 100);
+    }
+}
+
+static void check_hash(struct virtio_net_hdr_v1_hash *hdr,
+                       uint32_t value, uint16_t report)
+{
+    g_assert_cmphex(le32_to_cpu(hdr->hash_value), ==, value);
+    g_assert_cmpint(le16_to_cpu(hdr->hash_report), ==, report);
+}
+
+/*
+ * Malformed RSS and hash configurations are refused and turn RSS off,
+ * valid ones hash packets with the Toeplitz function and steer them
+ * through the indirection table.
+ */
+static void rss_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNetPCI *net_pci = obj;
+    QVirtioNet *net_if = &net_pci->net;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *ctrl = net_if->queues[net_if->n_queues - 1];
+    QTestState *qts = global_qtest;
+    uint16_t n_pairs = (net_if->n_queues - 1) / 2;
+    uint32_t types = VIRTIO_NET_RSS_HASH_TYPE_IPv4 |
+                     VIRTIO_NET_RSS_HASH_TYPE_TCPv4;
+    uint16_t table[VIRTIO_NET_RSS_MAX_TABLE_LEN * 2] = { 0 };
+    int slot = RSS_HASH_TCPV4 & (RSS_TABLE_LEN - 1);
+    int steer = n_pairs > 1 ? 1 : 0;
+    struct virtio_net_hdr_v1_hash hdr;
+    RssRxQueue rx[RSS_QUEUES];
+    RssBackend *be = data;
+    uint8_t cfg[1024];
+    size_t len;
+    int i, q;
+
+    g_assert_cmpint(n_pairs, <=, RSS_QUEUES);
+    g_assert_cmpint(qvirtio_config_readb(dev, 17), ==,
+                    VIRTIO_NET_RSS_MAX_KEY_SIZE);
+    g_assert_cmpint(qvirtio_config_readw(dev, 18), ==,
+                    VIRTIO_NET_RSS_MAX_TABLE_LEN);
+    g_assert_cmphex(qvirtio_config_readl(dev, 20) & types, ==, types);
+
+    for (q = 0; q < n_pairs; q++) {
+        rx[q].vq = net_if->queues[q * 2];
+        rx[q].bufs = g_new0(uint64_t, rx[q].vq->size);
+        for (i = 0; i < RSS_RX_BUFS; i++) {
+            uint64_t addr = guest_alloc(t_alloc, RSS_BUF_SIZE);
+            uint32_t head = qvirtqueue_add(qts, rx[q].vq, addr, RSS_BUF_SIZE,
+                                           true, false);
+
+            rx[q].bufs[head] = addr;
+            qvirtqueue_kick(qts, dev, rx[q].vq, head);
+        }
+    }
+
+    /* Hash reporting alone: a key too long, then the TCP and IP hashes */
+    len = hash_config(cfg, types, VIRTIO_NET_RSS_MAX_KEY_SIZE + 1);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_HASH_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_ERR);
+    len = hash_config(cfg, types, VIRTIO_NET_RSS_MAX_KEY_SIZE);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_HASH_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_OK);
+    q = rss_recv(be, rx, n_pairs, rss_tcp_frame, sizeof(rss_tcp_frame), &hdr);
+    check_hash(&hdr, RSS_HASH_TCPV4, VIRTIO_NET_HASH_REPORT_TCPv4);
+    if (!be->ifindex) {
+        g_assert_cmpint(q, ==, 0);
+    }
+    len = hash_config(cfg, VIRTIO_NET_RSS_HASH_TYPE_IPv4,
+                      VIRTIO_NET_RSS_MAX_KEY_SIZE);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_HASH_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_OK);
+    rss_recv(be, rx, n_pairs, rss_tcp_frame, sizeof(rss_tcp_frame), &hdr);
+    check_hash(&hdr, RSS_HASH_IPV4, VIRTIO_NET_HASH_REPORT_IPv4);
+
+    /* Malformed RSS configurations */
+    len = rss_config(cfg, types, 3, table, 0, n_pairs,
+                     VIRTIO_NET_RSS_MAX_KEY_SIZE);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_ERR);
+    len = rss_config(cfg, types, VIRTIO_NET_RSS_MAX_TABLE_LEN * 2, table, 0,
+                     n_pairs, VIRTIO_NET_RSS_MAX_KEY_SIZE);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_ERR);
+    table[RSS_TABLE_LEN - 1] = n_pairs;
+    len = rss_config(cfg, types, RSS_TABLE_LEN, table, 0, n_pairs,
+                     VIRTIO_NET_RSS_MAX_KEY_SIZE);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_ERR);
+    table[RSS_TABLE_LEN - 1] = 0;
+    len = rss_config(cfg, types, RSS_TABLE_LEN, table, n_pairs, n_pairs,
+                     VIRTIO_NET_RSS_MAX_KEY_SIZE);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_ERR);
+    len = rss_config(cfg, types, RSS_TABLE_LEN, table, 0, 0,
+                     VIRTIO_NET_RSS_MAX_KEY_SIZE);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_ERR);
+    len = rss_config(cfg, types, RSS_TABLE_LEN, table, 0, n_pairs + 1,
+                     VIRTIO_NET_RSS_MAX_KEY_SIZE);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_ERR);
+    len = rss_config(cfg, types, RSS_TABLE_LEN, table, 0, n_pairs,
+                     VIRTIO_NET_RSS_MAX_KEY_SIZE + 1);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_ERR);
+    len = rss_config(cfg, types, RSS_TABLE_LEN, table, 0, n_pairs, 0);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_ERR);
+
+    /* The last error turned hashing off */
+    rss_recv(be, rx, n_pairs, rss_tcp_frame, sizeof(rss_tcp_frame), &hdr);
+    check_hash(&hdr, 0, VIRTIO_NET_HASH_REPORT_NONE);
+
+    /* The hashed packet goes to the table, the ARP one to queue 0 */
+    table[slot] = steer;
+    len = rss_config(cfg, types, RSS_TABLE_LEN, table, 0, n_pairs,
+                     VIRTIO_NET_RSS_MAX_KEY_SIZE);
+    g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, len),
+                    ==, VIRTIO_NET_OK);
+    q = rss_recv(be, rx, n_pairs, rss_tcp_frame, sizeof(rss_tcp_frame), &hdr);
+    check_hash(&hdr, RSS_HASH_TCPV4, VIRTIO_NET_HASH_REPORT_TCPv4);
+    g_assert_cmpint(q, ==, steer);
+    q = rss_recv(be, rx, n_pairs, rss_arp_frame, sizeof(rss_arp_frame), &hdr);
+    check_hash(&hdr, 0, VIRTIO_NET_HASH_REPORT_NONE);
+    g_assert_cmpint(q, ==, 0);
+
+    if (n_pairs > 1) {
+        /* And the other way round */
+        for (i = 0; i < RSS_TABLE_LEN; i++) {
+            table[i] = i != slot;
+        }
+        len = rss_config(cfg, types, RSS_TABLE_LEN, table, 1, n_pairs,
+                         VIRTIO_NET_RSS_MAX_KEY_SIZE);
+        g_assert_cmpint(ctrl_cmd(dev, t_alloc, ctrl, VIRTIO_NET_CTRL_MQ,
+                                 VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, len),
+                        ==, VIRTIO_NET_OK);
+        q = rss_recv(be, rx, n_pairs, rss_tcp_frame, sizeof(rss_tcp_frame),
+                     &hdr);
+        g_assert_cmpint(q, ==, 0);
+        q = rss_recv(be, rx, n_pairs, rss_arp_frame, sizeof(rss_arp_frame),
+                     &hdr);
+        g_assert_cmpint(q, ==, 1);
+    } else {
+        g_test_message("no multiqueue tap device, steering not tested");
+    }
+
+    for (q = 0; q < n_pairs; q++) {
+        g_free(rx[q].bufs);
+    }
+}
+
+static void rss_backend_cleanup(void *opaque)
+{
+    RssBackend *be = opaque;
+    int i;
+
+    if (be->fd >= 0) {
+        close(be->fd);
+    }
+    qos_invalidate_command_line();
+    if (be->peer_fd >= 0) {
+        close(be->peer_fd);
+    }
+    for (i = 0; i < RSS_QUEUES; i++) {
+        if (be->tap_fds[i] >= 0) {
+            close(be->tap_fds[i]);
+        }
+    }
+    g_free(be);
+}
+
+#ifdef CONFIG_LINUX
+/*
+ * Create a tap device with RSS_QUEUES queues, bring it up and open a
+ * packet socket on it.  This needs CAP_NET_ADMIN, so failure is not an
+ * error.
+ */
+static bool rss_backend_tap(RssBackend *be)
+{
+    struct ifreq ifr;
+    char *path;
+    int i, fd;
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_MULTI_QUEUE;
+    for (i = 0; i < RSS_QUEUES; i++) {
+        be->tap_fds[i] = open("/dev/net/tun", O_RDWR);
+        if (be->tap_fds[i] < 0 || ioctl(be->tap_fds[i], TUNSETIFF, &ifr)) {
+            return false;
+        }
+    }
+
+    /* Keep the host quiet on the link */
+    path = g_strdup_printf("/proc/sys/net/ipv6/conf/%s/disable_ipv6",
+                           ifr.ifr_name);
+    fd = open(path, O_WRONLY);
+    g_free(path);
+    if (fd >= 0) {
+        /* Best effort, unrelated packets are skipped anyway */
+        if (write(fd, "1", 1) < 0) {
+            g_test_message("cannot disable IPv6 on %s", ifr.ifr_name);
+        }
+        close(fd);
+    }
+
+    fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd < 0) {
+        return false;
+    }
+    be->fd = fd;
+    if (ioctl(fd, SIOCGIFFLAGS, &ifr)) {
+        return false;
+    }
+    ifr.ifr_flags |= IFF_UP;
+    if (ioctl(fd, SIOCSIFFLAGS, &ifr) || ioctl(fd, SIOCGIFINDEX, &ifr)) {
+        return false;
+    }
+    be->ifindex = ifr.ifr_ifindex;
+    return true;
+}
+#endif
+
+static void *virtio_net_test_setup_rss(GString *cmd_line, void *arg)
+{
+    RssBackend *be = g_new0(RssBackend, 1);
+    int sv[2], i;
+
+    be->fd = be->peer_fd = -1;
+    for (i = 0; i < RSS_QUEUES; i++) {
+        be->tap_fds[i] = -1;
+    }
+    g_test_queue_destroy(rss_backend_cleanup, be);
+
+#ifdef CONFIG_LINUX
+    if (rss_backend_tap(be)) {
+        g_string_append_printf(cmd_line, " -netdev tap,id=hs0,fds=%d",
+                               be->tap_fds[0]);
+        for (i = 1; i < RSS_QUEUES; i++) {
+            g_string_append_printf(cmd_line, ":%d", be->tap_fds[i]);
+        }
+        g_string_append(cmd_line, " ");
+        return be;
+    }
+    for (i = 0; i < RSS_QUEUES; i++) {
+        if (be->tap_fds[i] >= 0) {
+            close(be->tap_fds[i]);
+            be->tap_fds[i] = -1;
+        }
+    }
+    if (be->fd >= 0) {
+        close(be->fd);
+    }
+    be->ifindex = 0;
+#endif
+
+    g_assert_cmpint(socketpair(PF_UNIX, SOCK_STREAM, 0, sv), !=, -1);
+    be->fd = sv[0];
+    be->peer_fd = sv[1];
+    g_string_append_printf(cmd_line, " -netdev socket,fd=%d,id=hs0 ", sv[1]);
+    return be;
+}
+
 #endif
 
 static void hotplug(void *obj, void *data, QGuestAllocator *t_alloc)
@@ -282,6 +905,12 @@ static void *virtio_net_test_setup(GString *cmd_line, void *arg)
     return sv;
 }
 
+static void *virtio_net_test_setup_iothread(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -object iothread,id=thread0 ");
+    return virtio_net_test_setup(cmd_line, arg);
+}
+
 static void large_tx(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioNet *dev = obj;
@@ -323,8 +952,22 @@ static void register_virtio_net_test(void)
 #ifndef _WIN32
     qos_add_test("basic", "virtio-net", send_recv_test, &opts);
     qos_add_test("rx_stop_cont", "virtio-net", stop_cont_test, &opts);
+    qos_add_test("tx_batch", "virtio-net", tx_batch_test, &opts);
 #endif
     qos_add_test("announce-self", "virtio-net", announce_self, &opts);
+#ifndef _WIN32
+    /* The dataplane needs the guest notifiers of virtio-pci */
+    opts.before = virtio_net_test_setup_iothread;
+    opts.edge.extra_device_opts = "iothread=thread0";
+    qos_add_test("iothread", "virtio-net-pci", iothread_test, &opts);
+    opts.before = virtio_net_test_setup;
+    opts.edge.extra_device_opts = "notf_coal=on,coalesce-usecs=1000000";
+    qos_add_test("coalesce", "virtio-net-pci", coalesce_test, &opts);
+    opts.before = virtio_net_test_setup_rss;
+    opts.edge.extra_device_opts = "mq=on,rss=on,hash=on";
+    qos_add_test("rss", "virtio-net-pci", rss_test, &opts);
+    opts.edge.extra_device_opts = NULL;
+#endif
 
     /* These tests do not need a loopback backend.  */
     opts.before = virtio_net_test_setup_nosocket;
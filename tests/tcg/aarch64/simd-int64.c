@@ -0,0 +1,215 @@
+/*
+ * Check AdvSIMD integer operations on 64-bit and 16-bit elements
+ * against a plain C reference.
+ *
+ * These are the gvec operations that an x86 host with AVX-512VL emits
+ * as single EVEX-encoded instructions: arithmetic shifts and abs of
+ * 64-bit elements, variable shifts of 16-bit and 64-bit elements, and
+ * unsigned 64-bit compares.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define N_ITER 2000
+
+typedef union {
+    uint16_t h[8];
+    uint64_t d[2];
+    int64_t sd[2];
+} V;
+
+typedef void (*OpFn)(V *d, const V *a, const V *b);
+
+#define SIMD_OP(name, insn)                                             \
+static void name##_op(V *d, const V *a, const V *b)                    \
+{                                                                       \
+    asm("ldr q0, [%1]\n\t"                                              \
+        "ldr q1, [%2]\n\t"                                              \
+        insn "\n\t"                                                     \
+        "str q0, [%0]"                                                  \
+        : : "r" (d), "r" (a), "r" (b) : "v0", "v1", "memory");          \
+}
+
+SIMD_OP(sshr1_d, "sshr v0.2d, v0.2d, #1")
+SIMD_OP(sshr17_d, "sshr v0.2d, v0.2d, #17")
+SIMD_OP(sshr63_d, "sshr v0.2d, v0.2d, #63")
+SIMD_OP(sshr64_d, "sshr v0.2d, v0.2d, #64")
+SIMD_OP(sshl_d, "sshl v0.2d, v0.2d, v1.2d")
+SIMD_OP(ushl_d, "ushl v0.2d, v0.2d, v1.2d")
+SIMD_OP(sshl_h, "sshl v0.8h, v0.8h, v1.8h")
+SIMD_OP(ushl_h, "ushl v0.8h, v0.8h, v1.8h")
+SIMD_OP(abs_d, "abs v0.2d, v0.2d")
+SIMD_OP(neg_d, "neg v0.2d, v0.2d")
+SIMD_OP(cmhi_d, "cmhi v0.2d, v0.2d, v1.2d")
+SIMD_OP(cmhs_d, "cmhs v0.2d, v0.2d, v1.2d")
+SIMD_OP(cmgt_d, "cmgt v0.2d, v0.2d, v1.2d")
+SIMD_OP(cmge_d, "cmge v0.2d, v0.2d, v1.2d")
+
+/* SSHL and USHL shift by the signed low byte, right if negative */
+static uint64_t ref_shl(uint64_t x, int8_t sh, int bits, int is_signed)
+{
+    uint64_t mask = bits == 64 ? -1ull : (1ull << bits) - 1;
+    int neg = is_signed && ((x >> (bits - 1)) & 1);
+    int64_t sx = neg ? (int64_t)(x | ~mask) : (int64_t)x;
+
+    if (sh >= bits) {
+        return 0;
+    } else if (sh >= 0) {
+        return (x << sh) & mask;
+    } else if (sh <= -bits) {
+        return neg ? mask : 0;
+    } else if (is_signed) {
+        return (uint64_t)(sx >> -sh) & mask;
+    } else {
+        return x >> -sh;
+    }
+}
+
+static int64_t ref_sar(int64_t x, int sh)
+{
+    return sh >= 64 ? (x < 0 ? -1 : 0) : x >> sh;
+}
+
+static void ref(const char *name, V *r, const V *a, const V *b)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        uint64_t x = a->d[i], y = b->d[i];
+        int64_t sx = a->sd[i], sy = b->sd[i];
+
+        if (!strcmp(name, "sshr1_d")) {
+            r->sd[i] = ref_sar(sx, 1);
+        } else if (!strcmp(name, "sshr17_d")) {
+            r->sd[i] = ref_sar(sx, 17);
+        } else if (!strcmp(name, "sshr63_d")) {
+            r->sd[i] = ref_sar(sx, 63);
+        } else if (!strcmp(name, "sshr64_d")) {
+            r->sd[i] = ref_sar(sx, 64);
+        } else if (!strcmp(name, "sshl_d")) {
+            r->d[i] = ref_shl(x, (int8_t)y, 64, 1);
+        } else if (!strcmp(name, "ushl_d")) {
+            r->d[i] = ref_shl(x, (int8_t)y, 64, 0);
+        } else if (!strcmp(name, "abs_d")) {
+            r->d[i] = sx < 0 ? -x : x;
+        } else if (!strcmp(name, "neg_d")) {
+            r->d[i] = -x;
+        } else if (!strcmp(name, "cmhi_d")) {
+            r->d[i] = x > y ? -1ull : 0;
+        } else if (!strcmp(name, "cmhs_d")) {
+            r->d[i] = x >= y ? -1ull : 0;
+        } else if (!strcmp(name, "cmgt_d")) {
+            r->d[i] = sx > sy ? -1ull : 0;
+        } else if (!strcmp(name, "cmge_d")) {
+            r->d[i] = sx >= sy ? -1ull : 0;
+        }
+    }
+    for (i = 0; i < 8; i++) {
+        if (!strcmp(name, "sshl_h")) {
+            r->h[i] = ref_shl(a->h[i], (int8_t)b->h[i], 16, 1);
+        } else if (!strcmp(name, "ushl_h")) {
+            r->h[i] = ref_shl(a->h[i], (int8_t)b->h[i], 16, 0);
+        }
+    }
+}
+
+static const struct {
+    const char *name;
+    OpFn fn;
+} ops[] = {
+#define OP(name) { #name, name##_op }
+    OP(sshr1_d), OP(sshr17_d), OP(sshr63_d), OP(sshr64_d),
+    OP(sshl_d), OP(ushl_d), OP(sshl_h), OP(ushl_h),
+    OP(abs_d), OP(neg_d),
+    OP(cmhi_d), OP(cmhs_d), OP(cmgt_d), OP(cmge_d),
+#undef OP
+};
+
+static const uint64_t special[] = {
+    0, 1, -1ull, 0x8000000000000000ull, 0x7fffffffffffffffull,
+    0x8000000000000001ull, 0x0123456789abcdefull, 0xfedcba9876543210ull,
+    0x00000000ffffffffull, 0xffffffff00000000ull, 0x8000800080008000ull,
+    0x7fff7fff7fff7fffull,
+};
+
+/* Shift counts around the element sizes, in both directions */
+static const int8_t shifts[] = {
+    0, 1, 7, 15, 16, 17, 31, 63, 64, 65, 127,
+    -1, -7, -15, -16, -17, -31, -63, -64, -65, -128,
+};
+
+static uint64_t rng_state = 0x2545f4914f6cdd1dull;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static uint64_t pick_value(void)
+{
+    uint64_t r = rng();
+
+    return r & 1 ? special[(r >> 8) % (sizeof(special) / sizeof(special[0]))]
+                 : rng();
+}
+
+/* A random upper part, and a shift count in the low byte of each lane */
+static uint64_t pick_shift(int bits)
+{
+    uint64_t mask = bits == 64 ? -1ull : (1ull << bits) - 1;
+    uint64_t r = 0;
+    int i;
+
+    for (i = 0; i < 64; i += bits) {
+        uint64_t n = rng();
+        uint8_t sh = shifts[n % (sizeof(shifts) / sizeof(shifts[0]))];
+
+        r |= (((n >> 32) << 8 | sh) & mask) << i;
+    }
+    return r;
+}
+
+int main(void)
+{
+    int errors = 0;
+    size_t i, k;
+
+    for (k = 0; k < sizeof(ops) / sizeof(ops[0]); k++) {
+        int bits = strstr(ops[k].name, "_h") ? 16 : 64;
+
+        for (i = 0; i < N_ITER; i++) {
+            V a, b, d, r;
+
+            a.d[0] = pick_value();
+            a.d[1] = pick_value();
+            if (strstr(ops[k].name, "shl")) {
+                b.d[0] = pick_shift(bits);
+                b.d[1] = pick_shift(bits);
+            } else {
+                b.d[0] = i & 1 ? a.d[0] : pick_value();
+                b.d[1] = pick_value();
+            }
+
+            ops[k].fn(&d, &a, &b);
+            ref(ops[k].name, &r, &a, &b);
+            if (memcmp(&d, &r, sizeof(d))) {
+                printf("%s: a %016llx%016llx b %016llx%016llx\n"
+                       "  got %016llx%016llx\n  exp %016llx%016llx\n",
+                       ops[k].name,
+                       (unsigned long long)a.d[1], (unsigned long long)a.d[0],
+                       (unsigned long long)b.d[1], (unsigned long long)b.d[0],
+                       (unsigned long long)d.d[1], (unsigned long long)d.d[0],
+                       (unsigned long long)r.d[1], (unsigned long long)r.d[0]);
+                errors++;
+            }
+        }
+    }
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Block mapping test
+ *
+ * Map a 2M block at a spare virtual address and check what the guest
+ * sees after changing its translation tables:
+ *
+ *  - pointing the block elsewhere and invalidating one address inside
+ *    it must remap all of it, including the 4K pages that have not
+ *    been touched yet;
+ *  - splitting it into 4K pages with one different page, and then
+ *    changing one more page, must change only that page each time;
+ *  - writes to a read-only block must fault even after reads have
+ *    already mapped the page, and must succeed once it is writable.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <minilib.h>
+
+#define PAGE_SIZE       0x1000ul
+#define BLOCK_SIZE      0x200000ul
+#define N_PAGES         (BLOCK_SIZE / PAGE_SIZE)
+
+/* Virtual window and two blocks of RAM behind it, away from the image */
+#define WINDOW          0x44000000ul
+#define FRAME_A         0x42000000ul
+#define FRAME_B         0x42200000ul
+
+#define DESC_ADDR(d)    ((d) & 0xfffffffff000ul)
+#define DESC_BLOCK      0x1ul
+#define DESC_TABLE      0x3ul
+#define DESC_PAGE       0x3ul
+#define DESC_AF         (1ul << 10)
+#define DESC_RO         (1ul << 7)      /* AP[2] */
+#define DESC_XN         (3ul << 53)
+#define DESC_ATTRS      (DESC_XN | DESC_AF)
+
+#define L2_INDEX(va)    (((va) >> 21) & 511)
+
+#define TAG_A           0xaaaa000000000000ul
+#define TAG_B           0xbbbb000000000000ul
+
+#define ARRAY_SIZE(a)   ((int)(sizeof(a) / sizeof((a)[0])))
+
+static uint64_t l3[N_PAGES] __attribute__((aligned(PAGE_SIZE)));
+static uint64_t *l2;
+static int errors;
+
+/* The first pages touched, and some that are only touched later */
+static const int touched[] = { 0, 1, 100, 255, 256, 511 };
+static const int untouched[] = { 2, 3, 257, 300, 510 };
+#define MID 258
+
+/* Written by the exception handler below */
+uint64_t fault_esr, fault_far;
+
+/*
+ * Only synchronous exceptions from EL1 with SP_EL1 are expected: record
+ * them and skip the faulting instruction.
+ */
+asm(".pushsection .text\n"
+    "   .balign 2048\n"
+    "fault_vectors:\n"
+    "   .space 0x200\n"
+    "   stp x0, x1, [sp, #-16]!\n"
+    "   mrs x0, esr_el1\n"
+    "   adrp x1, fault_esr\n"
+    "   str x0, [x1, :lo12:fault_esr]\n"
+    "   mrs x0, far_el1\n"
+    "   adrp x1, fault_far\n"
+    "   str x0, [x1, :lo12:fault_far]\n"
+    "   mrs x0, elr_el1\n"
+    "   add x0, x0, #4\n"
+    "   msr elr_el1, x0\n"
+    "   ldp x0, x1, [sp], #16\n"
+    "   eret\n"
+    "   .popsection");
+
+static uint64_t *page(int i)
+{
+    return (uint64_t *)(WINDOW + i * PAGE_SIZE);
+}
+
+static uint64_t tag(uint64_t frame, int i)
+{
+    return *(uint64_t *)(frame + i * PAGE_SIZE);
+}
+
+static void tlbi_page(int i)
+{
+    asm volatile("dsb ishst\n\t"
+                 "tlbi vae1, %0\n\t"
+                 "dsb ish\n\t"
+                 "isb" : : "r" ((uint64_t)page(i) >> 12) : "memory");
+}
+
+static void flush_tlb(void)
+{
+    asm volatile("dsb ishst\n\t"
+                 "tlbi vmalle1\n\t"
+                 "dsb ish\n\t"
+                 "isb" : : : "memory");
+}
+
+/* Change a valid entry through an invalid one, invalidating page @i */
+static void break_before_make(uint64_t *entry, uint64_t desc, int i)
+{
+    *entry = 0;
+    tlbi_page(i);
+    *entry = desc;
+    asm volatile("dsb ishst\n\t"
+                 "isb" : : : "memory");
+}
+
+static void check(const char *what, int i, uint64_t expected)
+{
+    uint64_t got = *page(i);
+
+    if (got != expected) {
+        ml_printf("%s: page %d: got %lx, expected %lx\n",
+                  what, i, (unsigned long)got, (unsigned long)expected);
+        errors++;
+    }
+}
+
+static void check_all(const char *what, uint64_t frame)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(touched); i++) {
+        check(what, touched[i], tag(frame, touched[i]));
+    }
+    for (i = 0; i < ARRAY_SIZE(untouched); i++) {
+        check(what, untouched[i], tag(frame, untouched[i]));
+    }
+}
+
+static void map_block(uint64_t frame, uint64_t attrs)
+{
+    l2[L2_INDEX(WINDOW)] = frame | attrs | DESC_BLOCK;
+    flush_tlb();
+}
+
+static void test_remap(void)
+{
+    int i;
+
+    map_block(FRAME_A, DESC_ATTRS);
+    for (i = 0; i < ARRAY_SIZE(touched); i++) {
+        check("block", touched[i], tag(FRAME_A, touched[i]));
+    }
+
+    /* Invalidating one address drops the whole block */
+    break_before_make(&l2[L2_INDEX(WINDOW)],
+                      FRAME_B | DESC_ATTRS | DESC_BLOCK, MID);
+    check_all("remapped block", FRAME_B);
+}
+
+static void test_split(void)
+{
+    int i;
+
+    map_block(FRAME_A, DESC_ATTRS);
+    for (i = 0; i < ARRAY_SIZE(touched); i++) {
+        check("block", touched[i], tag(FRAME_A, touched[i]));
+    }
+
+    /* The same mapping in 4K pages, except for the one in the middle */
+    for (i = 0; i < N_PAGES; i++) {
+        l3[i] = (FRAME_A + i * PAGE_SIZE) | DESC_ATTRS | DESC_PAGE;
+    }
+    l3[MID] = (FRAME_B + MID * PAGE_SIZE) | DESC_ATTRS | DESC_PAGE;
+    break_before_make(&l2[L2_INDEX(WINDOW)], (uint64_t)l3 | DESC_TABLE, MID);
+    check("split block", MID, tag(FRAME_B, MID));
+    check_all("split block", FRAME_A);
+
+    /* Then change one 4K page */
+    break_before_make(&l3[MID + 1], (FRAME_B + (MID + 1) * PAGE_SIZE) |
+                      DESC_ATTRS | DESC_PAGE, MID + 1);
+    check("changed page", MID + 1, tag(FRAME_B, MID + 1));
+    check("changed page", MID, tag(FRAME_B, MID));
+    check("changed page", MID + 2, tag(FRAME_A, MID + 2));
+    check_all("changed page", FRAME_A);
+}
+
+/* Store to page @i, and return whether it raised a permission fault */
+static bool store_faults(int i, uint64_t val)
+{
+    uint64_t *p = page(i);
+
+    fault_esr = 0;
+    asm volatile("str %0, [%1]" : : "r" (val), "r" (p) : "memory");
+    if (!fault_esr) {
+        return false;
+    }
+    /* Data abort from EL1, on a write, permission fault at level 2 */
+    if ((fault_esr >> 26) != 0x25 || !(fault_esr & (1 << 6)) ||
+        (fault_esr & 0x3f) != 0x0e || fault_far != (uintptr_t)p) {
+        ml_printf("page %d: unexpected fault, esr %lx far %lx\n", i,
+                  (unsigned long)fault_esr, (unsigned long)fault_far);
+        errors++;
+    }
+    return true;
+}
+
+static void test_read_only(void)
+{
+    uint64_t vbar, tmp;
+    int i;
+
+    asm volatile("mrs %0, vbar_el1\n\t"
+                 "adrp %1, fault_vectors\n\t"
+                 "add %1, %1, :lo12:fault_vectors\n\t"
+                 "msr vbar_el1, %1\n\t"
+                 "isb" : "=&r" (vbar), "=&r" (tmp));
+
+    map_block(FRAME_A, DESC_ATTRS | DESC_RO);
+    for (i = 0; i < ARRAY_SIZE(touched); i++) {
+        check("read-only block", touched[i], tag(FRAME_A, touched[i]));
+    }
+    if (!store_faults(300, 300)) {
+        ml_printf("write to an untouched page: no fault\n");
+        errors++;
+    }
+    if (!store_faults(100, 100)) {
+        ml_printf("write to a page just read: no fault\n");
+        errors++;
+    }
+    check_all("read-only block", FRAME_A);
+
+    /* A change of permissions needs no break-before-make */
+    l2[L2_INDEX(WINDOW)] = FRAME_A | DESC_ATTRS | DESC_BLOCK;
+    tlbi_page(MID);
+    if (store_faults(100, 100) || store_faults(300, 300)) {
+        ml_printf("write to a writable block: fault\n");
+        errors++;
+    }
+    if (tag(FRAME_A, 100) != 100 || tag(FRAME_A, 300) != 300) {
+        ml_printf("write to a writable block: lost\n");
+        errors++;
+    }
+
+    asm volatile("msr vbar_el1, %0\n\t"
+                 "isb" : : "r" (vbar));
+}
+
+int main(void)
+{
+    uint64_t ttbr, *l1;
+    int i;
+
+    /* The level 2 table of the first GB of RAM, set up by boot.S */
+    asm volatile("mrs %0, ttbr0_el1" : "=r" (ttbr));
+    l1 = (uint64_t *)DESC_ADDR(ttbr);
+    l2 = (uint64_t *)DESC_ADDR(l1[WINDOW >> 30]);
+
+    /* Map the frames where they are, to fill them */
+    l2[L2_INDEX(FRAME_A)] = FRAME_A | DESC_ATTRS | DESC_BLOCK;
+    l2[L2_INDEX(FRAME_B)] = FRAME_B | DESC_ATTRS | DESC_BLOCK;
+    flush_tlb();
+    for (i = 0; i < N_PAGES; i++) {
+        *(uint64_t *)(FRAME_A + i * PAGE_SIZE) = TAG_A | i;
+        *(uint64_t *)(FRAME_B + i * PAGE_SIZE) = TAG_B | i;
+    }
+
+    test_remap();
+    test_split();
+    test_read_only();
+
+    ml_printf("Test complete: %s\n", errors ? "FAILED" : "PASSED");
+    return errors;
+}
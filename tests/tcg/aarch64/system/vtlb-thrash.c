@@ -0,0 +1,122 @@
+/*
+ * Victim TLB thrashing test
+ *
+ * Map twice as many 4K pages as the main TLB holds by default and access
+ * them with both normal and unprivileged loads and stores, which go
+ * through the EL1 and EL0 MMU modes.  Pages that share a main TLB entry
+ * are accessed in turn, so that entries keep being evicted to the victim
+ * TLB and brought back from it.  Every load must see the last value
+ * stored through either mode.
+ *
+ * The run rules also use the smallest and the largest victim TLB.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+#define PAGE_SIZE       4096
+#define N_PAGES         512             /* one level 3 table */
+#define N_PASSES        16
+
+/* Virtual window and the RAM behind it, away from the test image */
+#define WINDOW          0x44000000ul
+#define FRAMES          0x42000000ul
+
+#define DESC_ADDR(d)    ((d) & 0xfffffffff000ul)
+#define DESC_TABLE      0x3ul
+#define DESC_PAGE       0x3ul
+#define DESC_AF         (1ul << 10)
+#define DESC_AP_EL0     (1ul << 6)      /* EL0 and EL1 read/write */
+#define DESC_XN         (3ul << 53)
+
+static uint64_t l3[512] __attribute__((aligned(PAGE_SIZE)));
+static int errors;
+
+/* The level 2 table of the first GB of RAM, set up by boot.S */
+static uint64_t *l2_table(void)
+{
+    uint64_t ttbr, *l1;
+
+    asm volatile("mrs %0, ttbr0_el1" : "=r" (ttbr));
+    l1 = (uint64_t *)DESC_ADDR(ttbr);
+    return (uint64_t *)DESC_ADDR(l1[WINDOW >> 30]);
+}
+
+static void flush_tlb(void)
+{
+    asm volatile("dsb ishst\n\t"
+                 "tlbi vmalle1\n\t"
+                 "dsb ish\n\t"
+                 "isb" : : : "memory");
+}
+
+static void store_el0(uint64_t *p, uint64_t val)
+{
+    asm volatile("sttr %0, [%1]" : : "r" (val), "r" (p) : "memory");
+}
+
+static uint64_t load_el0(uint64_t *p)
+{
+    uint64_t val;
+
+    asm volatile("ldtr %0, [%1]" : "=r" (val) : "r" (p) : "memory");
+    return val;
+}
+
+static uint64_t *word(int page, int pass)
+{
+    return (uint64_t *)(WINDOW + page * PAGE_SIZE + (pass * 8) % PAGE_SIZE);
+}
+
+static uint64_t value(int page, int pass)
+{
+    return (uint64_t)pass << 32 | page;
+}
+
+static void check(int page, int pass)
+{
+    uint64_t *p = word(page, pass);
+    uint64_t el1 = *p, el0 = load_el0(p);
+
+    if (el1 != value(page, pass) || el0 != value(page, pass)) {
+        ml_printf("pass %d page %d: got %lx/%lx, expected %lx\n",
+                  pass, page, (unsigned long)el1, (unsigned long)el0,
+                  (unsigned long)value(page, pass));
+        errors++;
+    }
+}
+
+int main(void)
+{
+    uint64_t *l2 = l2_table();
+    int pass, i;
+
+    for (i = 0; i < N_PAGES; i++) {
+        l3[i] = (FRAMES + i * PAGE_SIZE) | DESC_XN | DESC_AF | DESC_AP_EL0 |
+                DESC_PAGE;
+    }
+    l2[(WINDOW >> 21) & 511] = (uint64_t)l3 | DESC_TABLE;
+    flush_tlb();
+
+    for (pass = 0; pass < N_PASSES && errors < 10; pass++) {
+        /* Every other page is written through EL0 */
+        for (i = 0; i < N_PAGES; i++) {
+            if ((i + pass) & 1) {
+                store_el0(word(i, pass), value(i, pass));
+            } else {
+                *word(i, pass) = value(i, pass);
+            }
+        }
+        /* Pages N_PAGES / 2 apart evict each other from the main TLB */
+        for (i = 0; i < N_PAGES / 2; i++) {
+            check(i, pass);
+            check(i + N_PAGES / 2, pass);
+            check(i, pass);
+        }
+    }
+
+    ml_printf("Test complete: %s\n", errors ? "FAILED" : "PASSED");
+    return errors;
+}
@@ -0,0 +1,345 @@
+/*
+ * Check the MMX/SSE integer operations that are translated inline
+ * against a plain C reference, for register and memory operands.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef union {
+    uint8_t b[16];
+    uint16_t w[8];
+    uint32_t d[4];
+    uint64_t q[2];
+    int8_t sb[16];
+    int16_t sw[8];
+    int32_t sd[4];
+    int64_t sq[2];
+} V;
+
+typedef void (*OpFn)(V *d, const V *a, const V *b);
+
+/* Each operation is run as "insn b, a" and stores the new a in d */
+#define XMM_OP(name, insn)                                              \
+static void name##_reg(V *d, const V *a, const V *b)                   \
+{                                                                       \
+    asm("movdqu %1, %%xmm0\n\t"                                         \
+        "movdqu %2, %%xmm1\n\t"                                         \
+        insn " %%xmm1, %%xmm0\n\t"                                      \
+        "movdqu %%xmm0, %0"                                             \
+        : "=m" (*d) : "m" (*a), "m" (*b) : "xmm0", "xmm1");             \
+}                                                                       \
+static void name##_mem(V *d, const V *a, const V *b)                   \
+{                                                                       \
+    asm("movdqu %1, %%xmm0\n\t"                                         \
+        insn " %2, %%xmm0\n\t"                                          \
+        "movdqu %%xmm0, %0"                                             \
+        : "=m" (*d) : "m" (*a), "m" (*b) : "xmm0");                     \
+}
+
+#define MMX_OP(name, insn)                                              \
+static void name##_mmx(V *d, const V *a, const V *b)                   \
+{                                                                       \
+    asm("movq %1, %%mm0\n\t"                                            \
+        "movq %2, %%mm1\n\t"                                            \
+        insn " %%mm1, %%mm0\n\t"                                        \
+        "movq %%mm0, %0\n\t"                                            \
+        "emms"                                                          \
+        : "=m" (d->q[0]) : "m" (a->q[0]), "m" (b->q[0])                 \
+        : "mm0", "mm1");                                                \
+}
+
+/* Shifts by an immediate only have a destination */
+#define XMM_SHIFTI(name, insn, imm)                                     \
+static void name##_reg(V *d, const V *a, const V *b)                   \
+{                                                                       \
+    asm("movdqu %1, %%xmm0\n\t"                                         \
+        insn " $" #imm ", %%xmm0\n\t"                                   \
+        "movdqu %%xmm0, %0"                                             \
+        : "=m" (*d) : "m" (*a) : "xmm0");                               \
+}
+
+#define MMX_SHIFTI(name, insn, imm)                                     \
+static void name##_mmx(V *d, const V *a, const V *b)                   \
+{                                                                       \
+    asm("movq %1, %%mm0\n\t"                                            \
+        insn " $" #imm ", %%mm0\n\t"                                    \
+        "movq %%mm0, %0\n\t"                                            \
+        "emms"                                                          \
+        : "=m" (d->q[0]) : "m" (a->q[0]) : "mm0");                      \
+}
+
+/* Element-wise reference, A and B are the lanes of a and b */
+#define REF(name, lane, expr)                                           \
+static void name##_ref(V *d, const V *a, const V *b)                   \
+{                                                                       \
+    int i;                                                              \
+    for (i = 0; i < sizeof(V) / sizeof(a->lane[0]); i++) {              \
+        __typeof__(a->lane[0]) A = a->lane[i], B = b->lane[i];          \
+        (void)A;                                                        \
+        (void)B;                                                        \
+        d->lane[i] = (expr);                                            \
+    }                                                                   \
+}
+
+static int64_t sat(int64_t x, int64_t min, int64_t max)
+{
+    return x < min ? min : x > max ? max : x;
+}
+
+/* Shift counts come from the low quadword of b */
+#define COUNT  (b->q[0])
+
+REF(paddb, b, A + B)
+REF(paddw, w, A + B)
+REF(paddd, d, A + B)
+REF(paddq, q, A + B)
+REF(psubb, b, A - B)
+REF(psubw, w, A - B)
+REF(psubd, d, A - B)
+REF(psubq, q, A - B)
+REF(paddusb, b, sat((int64_t)A + B, 0, UINT8_MAX))
+REF(paddusw, w, sat((int64_t)A + B, 0, UINT16_MAX))
+REF(psubusb, b, sat((int64_t)A - B, 0, UINT8_MAX))
+REF(psubusw, w, sat((int64_t)A - B, 0, UINT16_MAX))
+REF(paddsb, sb, sat((int64_t)A + B, INT8_MIN, INT8_MAX))
+REF(paddsw, sw, sat((int64_t)A + B, INT16_MIN, INT16_MAX))
+REF(psubsb, sb, sat((int64_t)A - B, INT8_MIN, INT8_MAX))
+REF(psubsw, sw, sat((int64_t)A - B, INT16_MIN, INT16_MAX))
+REF(pmullw, w, A * B)
+REF(pmulld, d, A * B)
+REF(pand, q, A & B)
+REF(pandn, q, ~A & B)
+REF(por, q, A | B)
+REF(pxor, q, A ^ B)
+REF(pcmpeqb, b, A == B ? -1 : 0)
+REF(pcmpeqw, w, A == B ? -1 : 0)
+REF(pcmpeqd, d, A == B ? -1 : 0)
+REF(pcmpeqq, q, A == B ? -1 : 0)
+REF(pcmpgtb, sb, A > B ? -1 : 0)
+REF(pcmpgtw, sw, A > B ? -1 : 0)
+REF(pcmpgtd, sd, A > B ? -1 : 0)
+REF(pcmpgtq, sq, A > B ? -1 : 0)
+REF(pminub, b, A < B ? A : B)
+REF(pmaxub, b, A > B ? A : B)
+REF(pminsw, sw, A < B ? A : B)
+REF(pmaxsw, sw, A > B ? A : B)
+REF(pminsb, sb, A < B ? A : B)
+REF(pmaxsb, sb, A > B ? A : B)
+REF(pminuw, w, A < B ? A : B)
+REF(pmaxuw, w, A > B ? A : B)
+REF(pminsd, sd, A < B ? A : B)
+REF(pmaxsd, sd, A > B ? A : B)
+REF(pminud, d, A < B ? A : B)
+REF(pmaxud, d, A > B ? A : B)
+REF(pabsb, sb, B < 0 ? -B : B)
+REF(pabsw, sw, B < 0 ? -B : B)
+REF(pabsd, sd, B < 0 ? -B : B)
+REF(psrlw, w, COUNT > 15 ? 0 : A >> COUNT)
+REF(psrld, d, COUNT > 31 ? 0 : A >> COUNT)
+REF(psrlq, q, COUNT > 63 ? 0 : A >> COUNT)
+REF(psraw, sw, A >> (COUNT > 15 ? 15 : COUNT))
+REF(psrad, sd, A >> (COUNT > 31 ? 31 : COUNT))
+REF(psllw, w, COUNT > 15 ? 0 : A << COUNT)
+REF(pslld, d, COUNT > 31 ? 0 : A << COUNT)
+REF(psllq, q, COUNT > 63 ? 0 : A << COUNT)
+REF(psrlw_3, w, A >> 3)
+REF(psrlw_16, w, 0)
+REF(psrad_7, sd, A >> 7)
+REF(psrad_40, sd, A >> 31)
+REF(psllq_33, q, A << 33)
+REF(psllq_64, q, 0)
+
+XMM_OP(paddb, "paddb")
+XMM_OP(paddw, "paddw")
+XMM_OP(paddd, "paddd")
+XMM_OP(paddq, "paddq")
+XMM_OP(psubb, "psubb")
+XMM_OP(psubw, "psubw")
+XMM_OP(psubd, "psubd")
+XMM_OP(psubq, "psubq")
+XMM_OP(paddusb, "paddusb")
+XMM_OP(paddusw, "paddusw")
+XMM_OP(psubusb, "psubusb")
+XMM_OP(psubusw, "psubusw")
+XMM_OP(paddsb, "paddsb")
+XMM_OP(paddsw, "paddsw")
+XMM_OP(psubsb, "psubsb")
+XMM_OP(psubsw, "psubsw")
+XMM_OP(pmullw, "pmullw")
+XMM_OP(pmulld, "pmulld")
+XMM_OP(pand, "pand")
+XMM_OP(pandn, "pandn")
+XMM_OP(por, "por")
+XMM_OP(pxor, "pxor")
+XMM_OP(andps, "andps")
+XMM_OP(andnpd, "andnpd")
+XMM_OP(orps, "orps")
+XMM_OP(xorpd, "xorpd")
+XMM_OP(pcmpeqb, "pcmpeqb")
+XMM_OP(pcmpeqw, "pcmpeqw")
+XMM_OP(pcmpeqd, "pcmpeqd")
+XMM_OP(pcmpeqq, "pcmpeqq")
+XMM_OP(pcmpgtb, "pcmpgtb")
+XMM_OP(pcmpgtw, "pcmpgtw")
+XMM_OP(pcmpgtd, "pcmpgtd")
+XMM_OP(pcmpgtq, "pcmpgtq")
+XMM_OP(pminub, "pminub")
+XMM_OP(pmaxub, "pmaxub")
+XMM_OP(pminsw, "pminsw")
+XMM_OP(pmaxsw, "pmaxsw")
+XMM_OP(pminsb, "pminsb")
+XMM_OP(pmaxsb, "pmaxsb")
+XMM_OP(pminuw, "pminuw")
+XMM_OP(pmaxuw, "pmaxuw")
+XMM_OP(pminsd, "pminsd")
+XMM_OP(pmaxsd, "pmaxsd")
+XMM_OP(pminud, "pminud")
+XMM_OP(pmaxud, "pmaxud")
+XMM_OP(pabsb, "pabsb")
+XMM_OP(pabsw, "pabsw")
+XMM_OP(pabsd, "pabsd")
+XMM_OP(psrlw, "psrlw")
+XMM_OP(psrld, "psrld")
+XMM_OP(psrlq, "psrlq")
+XMM_OP(psraw, "psraw")
+XMM_OP(psrad, "psrad")
+XMM_OP(psllw, "psllw")
+XMM_OP(pslld, "pslld")
+XMM_OP(psllq, "psllq")
+XMM_SHIFTI(psrlw_3, "psrlw", 3)
+XMM_SHIFTI(psrlw_16, "psrlw", 16)
+XMM_SHIFTI(psrad_7, "psrad", 7)
+XMM_SHIFTI(psrad_40, "psrad", 40)
+XMM_SHIFTI(psllq_33, "psllq", 33)
+XMM_SHIFTI(psllq_64, "psllq", 64)
+
+MMX_OP(paddw, "paddw")
+MMX_OP(psubusb, "psubusb")
+MMX_OP(pmullw, "pmullw")
+MMX_OP(pandn, "pandn")
+MMX_OP(pcmpgtd, "pcmpgtd")
+MMX_OP(pmaxsw, "pmaxsw")
+MMX_OP(pabsw, "pabsw")
+MMX_OP(psraw, "psraw")
+MMX_OP(psllq, "psllq")
+MMX_SHIFTI(psrlw_3, "psrlw", 3)
+MMX_SHIFTI(psllq_64, "psllq", 64)
+
+static const struct {
+    const char *name;
+    OpFn op[2];         /* register and memory source operand */
+    OpFn ref;
+    int size;           /* bytes compared */
+    int shift;          /* b holds a shift count */
+} tests[] = {
+#define T_XMM(name, ref, shift) \
+    { #name " xmm", { name##_reg, name##_mem }, ref##_ref, 16, shift }
+#define T_XMMI(name)    { #name " xmm", { name##_reg }, name##_ref, 16, 0 }
+#define T_MMX(name, shift) { #name " mm", { name##_mmx }, name##_ref, 8, shift }
+    T_XMM(paddb, paddb, 0), T_XMM(paddw, paddw, 0),
+    T_XMM(paddd, paddd, 0), T_XMM(paddq, paddq, 0),
+    T_XMM(psubb, psubb, 0), T_XMM(psubw, psubw, 0),
+    T_XMM(psubd, psubd, 0), T_XMM(psubq, psubq, 0),
+    T_XMM(paddusb, paddusb, 0), T_XMM(paddusw, paddusw, 0),
+    T_XMM(psubusb, psubusb, 0), T_XMM(psubusw, psubusw, 0),
+    T_XMM(paddsb, paddsb, 0), T_XMM(paddsw, paddsw, 0),
+    T_XMM(psubsb, psubsb, 0), T_XMM(psubsw, psubsw, 0),
+    T_XMM(pmullw, pmullw, 0), T_XMM(pmulld, pmulld, 0),
+    T_XMM(pand, pand, 0), T_XMM(pandn, pandn, 0),
+    T_XMM(por, por, 0), T_XMM(pxor, pxor, 0),
+    T_XMM(andps, pand, 0), T_XMM(andnpd, pandn, 0),
+    T_XMM(orps, por, 0), T_XMM(xorpd, pxor, 0),
+    T_XMM(pcmpeqb, pcmpeqb, 0), T_XMM(pcmpeqw, pcmpeqw, 0),
+    T_XMM(pcmpeqd, pcmpeqd, 0), T_XMM(pcmpeqq, pcmpeqq, 0),
+    T_XMM(pcmpgtb, pcmpgtb, 0), T_XMM(pcmpgtw, pcmpgtw, 0),
+    T_XMM(pcmpgtd, pcmpgtd, 0), T_XMM(pcmpgtq, pcmpgtq, 0),
+    T_XMM(pminub, pminub, 0), T_XMM(pmaxub, pmaxub, 0),
+    T_XMM(pminsw, pminsw, 0), T_XMM(pmaxsw, pmaxsw, 0),
+    T_XMM(pminsb, pminsb, 0), T_XMM(pmaxsb, pmaxsb, 0),
+    T_XMM(pminuw, pminuw, 0), T_XMM(pmaxuw, pmaxuw, 0),
+    T_XMM(pminsd, pminsd, 0), T_XMM(pmaxsd, pmaxsd, 0),
+    T_XMM(pminud, pminud, 0), T_XMM(pmaxud, pmaxud, 0),
+    T_XMM(pabsb, pabsb, 0), T_XMM(pabsw, pabsw, 0),
+    T_XMM(pabsd, pabsd, 0),
+    T_XMM(psrlw, psrlw, 1), T_XMM(psrld, psrld, 1),
+    T_XMM(psrlq, psrlq, 1), T_XMM(psraw, psraw, 1),
+    T_XMM(psrad, psrad, 1), T_XMM(psllw, psllw, 1),
+    T_XMM(pslld, pslld, 1), T_XMM(psllq, psllq, 1),
+    T_XMMI(psrlw_3), T_XMMI(psrlw_16), T_XMMI(psrad_7),
+    T_XMMI(psrad_40), T_XMMI(psllq_33), T_XMMI(psllq_64),
+    T_MMX(paddw, 0), T_MMX(psubusb, 0), T_MMX(pmullw, 0),
+    T_MMX(pandn, 0), T_MMX(pcmpgtd, 0), T_MMX(pmaxsw, 0),
+    T_MMX(pabsw, 0), T_MMX(psraw, 1), T_MMX(psllq, 1),
+    T_MMX(psrlw_3, 0), T_MMX(psllq_64, 0),
+};
+
+static uint64_t seed = 0x123456789abcdef0ull;
+
+static uint64_t rand64(void)
+{
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    return seed ^ (seed >> 29);
+}
+
+int main(void)
+{
+    int errors = 0;
+    int t, m, i, j;
+
+    for (t = 0; t < sizeof(tests) / sizeof(tests[0]); t++) {
+        for (i = 0; i < 400; i++) {
+            V a, b, got, exp;
+
+            /* alternate between the register and memory forms */
+            m = i & 1;
+            if (!tests[t].op[m]) {
+                m = 0;
+            }
+
+            a.q[0] = rand64();
+            a.q[1] = rand64();
+            b.q[0] = rand64();
+            b.q[1] = rand64();
+            /* make some lanes equal, and some extreme */
+            if (i % 8 < 2) {
+                for (j = 0; j < 16; j += 3) {
+                    b.b[j] = a.b[j];
+                }
+            } else if (i % 8 < 4) {
+                for (j = 0; j < 16; j += 2) {
+                    a.b[j] = 0x80;
+                    b.b[j + 1] = 0x7f;
+                }
+            }
+            /* counts around and past every element size */
+            if (tests[t].shift) {
+                b.q[0] = i < 140 ? i / 2 : rand64();
+            }
+
+            memset(&got, 0x55, sizeof(got));
+            memset(&exp, 0x55, sizeof(exp));
+            tests[t].op[m](&got, &a, &b);
+            tests[t].ref(&exp, &a, &b);
+            if (memcmp(&got, &exp, tests[t].size)) {
+                printf("%s, %s: a=%016llx%016llx b=%016llx%016llx\n"
+                       "  got %016llx%016llx expected %016llx%016llx\n",
+                       tests[t].name, m ? "mem" : "reg",
+                       (unsigned long long)a.q[1], (unsigned long long)a.q[0],
+                       (unsigned long long)b.q[1], (unsigned long long)b.q[0],
+                       (unsigned long long)got.q[1],
+                       (unsigned long long)got.q[0],
+                       (unsigned long long)exp.q[1],
+                       (unsigned long long)exp.q[0]);
+                errors++;
+                break;
+            }
+        }
+    }
+
+    printf("%s\n", errors ? "FAILED" : "PASSED");
+    return errors ? 1 : 0;
+}
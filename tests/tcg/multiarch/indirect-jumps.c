@@ -0,0 +1,307 @@
+/*
+ * Inline cache test for indirect jumps and returns
+ *
+ * Indirect calls and computed gotos that keep going to the same place,
+ * then alternate between several; call/return pairs that do not match,
+ * through longjmp and through recursion deeper than the return
+ * prediction stack; and code rewritten behind a cached call site.  Every
+ * result is checked against what the C semantics require.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define N_ITER 1000
+
+static int errors;
+
+static void check(const char *what, long got, long expected)
+{
+    if (got != expected) {
+        fprintf(stderr, "%s: got %ld, expected %ld\n", what, got, expected);
+        errors++;
+    }
+}
+
+static long __attribute__((noinline)) f0(long x)
+{
+    return x + 1;
+}
+
+static long __attribute__((noinline)) f1(long x)
+{
+    return x * 3;
+}
+
+static long __attribute__((noinline)) f2(long x)
+{
+    return x ^ 0x5a;
+}
+
+static long __attribute__((noinline)) f3(long x)
+{
+    return x - 7;
+}
+
+static long (*const funcs[])(long) = { f0, f1, f2, f3 };
+
+/* A single call site, so that all calls share its inline cache */
+static long __attribute__((noinline)) call(long (*fn)(long), long x)
+{
+    return fn(x);
+}
+
+static long expected_call(int i, long x)
+{
+    switch (i & 3) {
+    case 0:
+        return x + 1;
+    case 1:
+        return x * 3;
+    case 2:
+        return x ^ 0x5a;
+    default:
+        return x - 7;
+    }
+}
+
+static void test_calls(void)
+{
+    long sum = 0, expected = 0;
+    int i;
+
+    /* Hits: always the same target */
+    for (i = 0; i < N_ITER; i++) {
+        sum += call(funcs[2], i);
+        expected += i ^ 0x5a;
+    }
+    check("same target", sum, expected);
+
+    /* Misses: the target changes on every call */
+    sum = expected = 0;
+    for (i = 0; i < N_ITER; i++) {
+        sum += call(funcs[i & 3], i);
+        expected += expected_call(i, i);
+    }
+    check("alternating targets", sum, expected);
+
+    /* Runs of hits between misses */
+    sum = expected = 0;
+    for (i = 0; i < N_ITER; i++) {
+        sum += call(funcs[(i / 10) & 3], i);
+        expected += expected_call(i / 10, i);
+    }
+    check("changing target", sum, expected);
+}
+
+/* A computed goto, that is an indirect jump that is not a call */
+static long __attribute__((noinline)) dispatch(const uint8_t *ops, int n)
+{
+    static void *const labels[] = { &&op_inc, &&op_dbl, &&op_neg, &&op_end };
+    long acc = 1;
+    int pc = 0;
+
+    goto *labels[ops[pc]];
+op_inc:
+    acc++;
+    if (++pc < n) {
+        goto *labels[ops[pc]];
+    }
+    return acc;
+op_dbl:
+    acc *= 2;
+    if (++pc < n) {
+        goto *labels[ops[pc]];
+    }
+    return acc;
+op_neg:
+    acc = -acc;
+    if (++pc < n) {
+        goto *labels[ops[pc]];
+    }
+    return acc;
+op_end:
+    return acc;
+}
+
+static void test_computed_goto(void)
+{
+    uint8_t ops[64];
+    long acc = 1;
+    int i;
+
+    for (i = 0; i < 63; i++) {
+        ops[i] = (i * 7 / 3) % 3;
+        switch (ops[i]) {
+        case 0:
+            acc++;
+            break;
+        case 1:
+            acc *= 2;
+            break;
+        default:
+            acc = -acc;
+            break;
+        }
+    }
+    ops[63] = 3;
+    for (i = 0; i < 100; i++) {
+        check("computed goto", dispatch(ops, 64), acc);
+    }
+}
+
+/* Recursion deeper than the return prediction stack */
+static long __attribute__((noinline)) depth(int n)
+{
+    if (n == 0) {
+        return 0;
+    }
+    return depth(n - 1) + n;
+}
+
+static long __attribute__((noinline)) odd(int n);
+
+static long __attribute__((noinline)) even(int n)
+{
+    return n == 0 ? 1 : odd(n - 1) * 2;
+}
+
+static long __attribute__((noinline)) odd(int n)
+{
+    return n == 0 ? 0 : even(n - 1) + 1;
+}
+
+static void test_recursion(void)
+{
+    long e = 1, o = 0, t;
+    int n;
+
+    for (n = 0; n < 100; n++) {
+        check("recursion", depth(n), (long)n * (n + 1) / 2);
+    }
+    /* Mutual recursion returns through two alternating return sites */
+    for (n = 0; n < 40; n++) {
+        check("mutual recursion", even(n), e);
+        check("mutual recursion", odd(n), o);
+        t = e;
+        e = o * 2;
+        o = t + 1;
+    }
+}
+
+/* Calls that never return normally */
+static jmp_buf env;
+/* Opaque to the compiler, so that dive() may return */
+static volatile int jump_out = 1;
+
+static long __attribute__((noinline)) dive(int n)
+{
+    if (n == 0) {
+        if (jump_out) {
+            longjmp(env, 1);
+        }
+        return 0;
+    }
+    return dive(n - 1) + 1;
+}
+
+static void test_longjmp(void)
+{
+    volatile int i;     /* live across setjmp */
+
+    for (i = 1; i < 50; i++) {
+        if (!setjmp(env)) {
+            dive(i);
+        }
+        /* The stale return predictions must not be used */
+        check("after longjmp", depth(i), (long)i * (i + 1) / 2);
+        check("after longjmp", call(funcs[i & 3], i), expected_call(i, i));
+    }
+}
+
+/*
+ * "Return N" in host code, for the targets that have an encoding here.
+ * Return the size in bytes, or 0 if unsupported.
+ */
+static size_t gen_return(void *buf, int n)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint8_t *p = buf;
+
+    p[0] = 0xb8;                    /* mov $n, %eax */
+    memcpy(p + 1, &n, 4);
+    p[5] = 0xc3;                    /* ret */
+    return 6;
+#elif defined(__aarch64__)
+    uint32_t *p = buf;
+
+    p[0] = 0x52800000 | (n << 5);   /* mov w0, #n */
+    p[1] = 0xd65f03c0;              /* ret */
+    return 8;
+#elif defined(__arm__) && !defined(__thumb__)
+    uint32_t *p = buf;
+
+    p[0] = 0xe3a00000 | n;          /* mov r0, #n */
+    p[1] = 0xe12fff1e;              /* bx lr */
+    return 8;
+#elif defined(__riscv)
+    uint32_t *p = buf;
+
+    p[0] = (n << 20) | (10 << 7) | 0x13;    /* li a0, n */
+    p[1] = 0x00008067;                      /* ret */
+    return 8;
+#else
+    return 0;
+#endif
+}
+
+static int __attribute__((noinline)) call_code(int (*fn)(void))
+{
+    return fn();
+}
+
+static void test_smc(void)
+{
+    int (*fn)(void);
+    uint8_t *code;
+    size_t len;
+    int n, i;
+
+    code = mmap(NULL, 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        perror("mmap");
+        errors++;
+        return;
+    }
+    fn = (int (*)(void))code;
+    for (n = 1; n < 20; n++) {
+        len = gen_return(code, n);
+        if (!len) {
+            printf("self-modifying code test skipped\n");
+            break;
+        }
+        __builtin___clear_cache((char *)code, (char *)code + len);
+        /* The call site caches the old code after the first run */
+        for (i = 0; i < 10; i++) {
+            check("rewritten code", call_code(fn), n);
+        }
+    }
+    munmap(code, 4096);
+}
+
+int main(void)
+{
+    test_calls();
+    test_computed_goto();
+    test_recursion();
+    test_longjmp();
+    test_smc();
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
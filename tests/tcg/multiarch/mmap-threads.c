@@ -0,0 +1,135 @@
+/*
+ * Concurrent mmap, munmap, mprotect and shmat
+ *
+ * Each thread keeps changing the mapping and the protection of its own
+ * target page, next to the pages of the other threads, and maps and
+ * unmaps memory elsewhere.  With -p, several of these target pages share
+ * a host page, so the calls have to agree on its host protection while
+ * they run concurrently.  Every thread checks that its page always holds
+ * what it last wrote, and the run rule's timeout catches livelocks.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+
+#define N_THREADS   4
+#define N_ITERS     1000
+
+static uint8_t *region;
+static size_t pagesize;
+
+#define fail_unless(x)                                                  \
+    do {                                                                \
+        if (!(x)) {                                                     \
+            fprintf(stderr, "FAILED at %s:%d\n", __FILE__, __LINE__);   \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+    } while (0)
+
+static void fill(uint8_t *p, size_t len, uint8_t val)
+{
+    memset(p, val, len);
+}
+
+static void check(const uint8_t *p, size_t len, uint8_t val)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        fail_unless(p[i] == val);
+    }
+}
+
+static void test_shm(uint8_t val)
+{
+    int id = shmget(IPC_PRIVATE, pagesize, IPC_CREAT | 0600);
+    uint8_t *p;
+
+    if (id < 0) {
+        /* no System V IPC here */
+        return;
+    }
+    p = shmat(id, NULL, 0);
+    fail_unless(p != (void *)-1);
+    fill(p, pagesize, val);
+    check(p, pagesize, val);
+    fail_unless(shmdt(p) == 0);
+    fail_unless(shmctl(id, IPC_RMID, NULL) == 0);
+}
+
+static void *worker(void *arg)
+{
+    uintptr_t t = (uintptr_t)arg;
+    uint8_t *page = region + t * pagesize;
+    int i;
+
+    for (i = 0; i < N_ITERS; i++) {
+        uint8_t val = t * 64 + i % 64;
+        size_t len = (1 + i % 3) * pagesize;
+        uint8_t *p;
+
+        /* protection changes of our page */
+        fill(page, pagesize, val);
+        fail_unless(mprotect(page, pagesize, PROT_READ) == 0);
+        check(page, pagesize, val);
+        fail_unless(mprotect(page, pagesize, PROT_READ | PROT_WRITE) == 0);
+        fill(page, pagesize, val + 1);
+        check(page, pagesize, val + 1);
+
+        /*
+         * Remap our page in place.  Not through munmap, or another
+         * thread's mmap could be given the hole.
+         */
+        p = mmap(page, pagesize, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        fail_unless(p == page);
+        check(page, pagesize, 0);
+        fill(page, pagesize, val);
+
+        /* and let the kernel pick a place for some more memory */
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        fail_unless(p != MAP_FAILED);
+        fill(p, len, val);
+        check(p, len, val);
+        fail_unless(munmap(p, len) == 0);
+
+        if (i % 64 == 0) {
+            test_shm(val);
+        }
+        check(page, pagesize, val);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t threads[N_THREADS];
+    uintptr_t t;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    region = mmap(NULL, N_THREADS * pagesize, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(region != MAP_FAILED);
+
+    for (t = 0; t < N_THREADS; t++) {
+        fail_unless(pthread_create(&threads[t], NULL, worker,
+                                   (void *)t) == 0);
+    }
+    for (t = 0; t < N_THREADS; t++) {
+        fail_unless(pthread_join(threads[t], NULL) == 0);
+    }
+
+    fprintf(stdout, "PASSED\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+#
+# Check a /tmp/perf-PID.map file written by -perfmap
+#
+# Every line must be "start size name" with hex start and size, the
+# ranges must not overlap (the tests are too small to flush the code
+# buffer), there must be one prologue, and each of the guest symbols
+# given on the command line must have at least one translation block.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+import re
+import sys
+
+LINE_RE = re.compile(r"^([0-9a-f]+) ([0-9a-f]+) (.+)$")
+TB_RE = re.compile(r"^(?:(\S+) \[guest-0x[0-9a-f]+\]|guest-0x[0-9a-f]+)$")
+
+
+def fail(msg):
+    print("perfmap: %s" % msg)
+    sys.exit(1)
+
+
+def main():
+    if len(sys.argv) < 2:
+        fail("usage: %s MAP [SYMBOL...]" % sys.argv[0])
+
+    ranges = []
+    prologues = 0
+    symbols = set()
+
+    with open(sys.argv[1]) as f:
+        for n, line in enumerate(f, 1):
+            m = LINE_RE.match(line.rstrip("\n"))
+            if not m:
+                fail("line %d is malformed: %r" % (n, line))
+            start, size, name = int(m.group(1), 16), int(m.group(2), 16), \
+                m.group(3)
+            if size == 0:
+                fail("line %d has an empty range" % n)
+            ranges.append((start, start + size, n))
+            if name == "qemu-prologue":
+                prologues += 1
+                continue
+            tb = TB_RE.match(name)
+            if not tb:
+                fail("line %d has an unexpected name: %r" % (n, name))
+            if tb.group(1):
+                symbols.add(tb.group(1))
+
+    if not ranges:
+        fail("no translation blocks")
+    if prologues != 1:
+        fail("%d prologues" % prologues)
+
+    ranges.sort()
+    for (s0, e0, n0), (s1, e1, n1) in zip(ranges, ranges[1:]):
+        if s1 < e0:
+            fail("lines %d and %d overlap" % (n0, n1))
+
+    missing = [s for s in sys.argv[2:] if s not in symbols]
+    if missing:
+        fail("no translation blocks for %s" % ", ".join(missing))
+
+    print("perfmap: %d translation blocks, %d symbols" %
+          (len(ranges) - 1, len(symbols)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,77 @@
+/*
+ * Persistent translation cache test
+ *
+ * Print results that depend on a fair amount of branchy code.  The run
+ * rule runs this without a cache, then twice with the same cache
+ * directory, so that the second run executes translations restored from
+ * the first one, and checks that all three print the same.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static uint32_t __attribute__((noinline)) crc32(const uint8_t *p, size_t len)
+{
+    uint32_t crc = ~0u;
+    int i;
+
+    while (len--) {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static uint64_t __attribute__((noinline)) collatz(uint64_t n)
+{
+    uint64_t steps = 0;
+
+    while (n != 1) {
+        n = n & 1 ? 3 * n + 1 : n / 2;
+        steps++;
+    }
+    return steps;
+}
+
+static int __attribute__((noinline)) is_prime(uint32_t n)
+{
+    uint32_t d;
+
+    if (n < 2) {
+        return 0;
+    }
+    for (d = 2; d * d <= n; d++) {
+        if (n % d == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(void)
+{
+    static const char *words[] = {
+        "translation", "block", "cache", "restore", "guest", "host",
+    };
+    uint64_t steps = 0;
+    uint32_t primes = 0;
+    uint32_t n;
+    int i;
+
+    for (i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        printf("crc32(%s) = %08x\n", words[i],
+               crc32((const uint8_t *)words[i], strlen(words[i])));
+    }
+    for (n = 1; n < 10000; n++) {
+        steps += collatz(n);
+        primes += is_prime(n);
+    }
+    printf("collatz steps = %llu\n", (unsigned long long)steps);
+    printf("primes = %u\n", primes);
+    return 0;
+}
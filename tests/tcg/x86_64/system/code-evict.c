@@ -0,0 +1,69 @@
+/*
+ * Code buffer eviction test
+ *
+ * Keep rewriting a block of code and running it, so that the stale
+ * translations fill up a small code buffer (see the run rule) and the
+ * coldest regions get evicted over and over, while the loop driving the
+ * test stays hot and chained.  Every run of the block must return what
+ * was last written into it.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+#define N_ADDS  400
+#define N_RUNS  20000
+
+/* xor %eax,%eax; N_ADDS times add $imm32,%eax; ret */
+static uint8_t code[4096] __attribute__((aligned(4096)));
+
+static void set_imm(int n, uint32_t imm)
+{
+    uint8_t *p = &code[2 + n * 5 + 1];
+
+    p[0] = imm;
+    p[1] = imm >> 8;
+    p[2] = imm >> 16;
+    p[3] = imm >> 24;
+}
+
+int main(void)
+{
+    uint32_t (*fn)(void) = (uint32_t (*)(void))code;
+    uint32_t imm[N_ADDS];
+    uint32_t expected = 0;
+    int errors = 0;
+    int i;
+
+    code[0] = 0x31;
+    code[1] = 0xc0;
+    for (i = 0; i < N_ADDS; i++) {
+        code[2 + i * 5] = 0x05;
+        imm[i] = i;
+        set_imm(i, i);
+        expected += i;
+    }
+    code[2 + N_ADDS * 5] = 0xc3;
+
+    for (i = 0; i < N_RUNS; i++) {
+        int n = i % N_ADDS;
+        uint32_t got;
+
+        expected += i - imm[n];
+        imm[n] = i;
+        set_imm(n, i);
+
+        got = fn();
+        if (got != expected) {
+            ml_printf("run %d: got %x, expected %x\n", i, got, expected);
+            if (++errors > 10) {
+                break;
+            }
+        }
+    }
+
+    ml_printf("Test complete: %s\n", errors ? "FAILED" : "PASSED");
+    return errors ? -1 : 0;
+}
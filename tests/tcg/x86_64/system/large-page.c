@@ -0,0 +1,211 @@
+/*
+ * Large page test
+ *
+ * Map a 2M page at a spare virtual address and check what the guest
+ * sees after changing its page tables:
+ *
+ *  - pointing the page elsewhere and invalidating one address inside
+ *    it must remap all of it, including the 4K pages that have not
+ *    been touched yet;
+ *  - splitting it into 4K pages with one different page, and then
+ *    changing one more page, must change only that page each time;
+ *  - reads of a clean page must not set its dirty bit, and a write
+ *    must set it even after reads have already mapped the page.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <minilib.h>
+
+#define PAGE_SIZE       0x1000ul
+#define LARGE_SIZE      0x200000ul
+#define N_PAGES         (LARGE_SIZE / PAGE_SIZE)
+
+/* Above the RAM, in the second GB mapped by boot.S */
+#define WINDOW          0x40000000ul
+
+#define PG_P            0x001ul
+#define PG_RW           0x002ul
+#define PG_A            0x020ul
+#define PG_D            0x040ul
+#define PG_PS           0x080ul
+#define PG_ADDR(e)      ((e) & 0x000ffffffffff000ul)
+
+#define TAG_A           0xaaaa000000000000ul
+#define TAG_B           0xbbbb000000000000ul
+
+#define ARRAY_SIZE(a)   ((int)(sizeof(a) / sizeof((a)[0])))
+
+static uint8_t frame_a[LARGE_SIZE] __attribute__((aligned(LARGE_SIZE)));
+static uint8_t frame_b[LARGE_SIZE] __attribute__((aligned(LARGE_SIZE)));
+static uint64_t pt[N_PAGES] __attribute__((aligned(PAGE_SIZE)));
+static uint64_t *pde;
+static int errors;
+
+/* The first pages touched, and some that are only touched later */
+static const int touched[] = { 0, 1, 100, 255, 256, 511 };
+static const int untouched[] = { 2, 3, 257, 300, 510 };
+#define MID 258
+
+static uint64_t *page(int i)
+{
+    return (uint64_t *)(WINDOW + i * PAGE_SIZE);
+}
+
+static uint64_t tag(uint8_t *frame, int i)
+{
+    return *(uint64_t *)(frame + i * PAGE_SIZE);
+}
+
+static void invlpg(int i)
+{
+    asm volatile("invlpg (%0)" : : "r" (page(i)) : "memory");
+}
+
+static void flush_tlb(void)
+{
+    uint64_t cr3;
+
+    asm volatile("mov %%cr3, %0\n\t"
+                 "mov %0, %%cr3" : "=r" (cr3) : : "memory");
+}
+
+static void check(const char *what, int i, uint64_t expected)
+{
+    uint64_t got = *page(i);
+
+    if (got != expected) {
+        ml_printf("%s: page %d: got %lx, expected %lx\n",
+                  what, i, (unsigned long)got, (unsigned long)expected);
+        errors++;
+    }
+}
+
+static void check_all(const char *what, uint8_t *frame)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(touched); i++) {
+        check(what, touched[i], tag(frame, touched[i]));
+    }
+    for (i = 0; i < ARRAY_SIZE(untouched); i++) {
+        check(what, untouched[i], tag(frame, untouched[i]));
+    }
+}
+
+static void check_dirty(const char *what, bool dirty)
+{
+    /* Set by the page walk, behind the compiler's back */
+    asm volatile("" : : : "memory");
+    if (!!(*pde & PG_D) != dirty) {
+        ml_printf("%s: dirty bit %s\n", what, dirty ? "clear" : "set");
+        errors++;
+    }
+}
+
+static void test_remap(void)
+{
+    int i;
+
+    *pde = (uintptr_t)frame_a | PG_PS | PG_D | PG_A | PG_RW | PG_P;
+    flush_tlb();
+    for (i = 0; i < ARRAY_SIZE(touched); i++) {
+        check("large page", touched[i], tag(frame_a, touched[i]));
+    }
+
+    /* Invalidating one address drops the whole large page */
+    *pde = (uintptr_t)frame_b | PG_PS | PG_D | PG_A | PG_RW | PG_P;
+    invlpg(MID);
+    check_all("remapped large page", frame_b);
+}
+
+static void test_split(void)
+{
+    int i;
+
+    *pde = (uintptr_t)frame_a | PG_PS | PG_D | PG_A | PG_RW | PG_P;
+    flush_tlb();
+    for (i = 0; i < ARRAY_SIZE(touched); i++) {
+        check("large page", touched[i], tag(frame_a, touched[i]));
+    }
+
+    /* The same mapping in 4K pages, except for the one in the middle */
+    for (i = 0; i < N_PAGES; i++) {
+        pt[i] = (uintptr_t)(frame_a + i * PAGE_SIZE) |
+                PG_D | PG_A | PG_RW | PG_P;
+    }
+    pt[MID] = (uintptr_t)(frame_b + MID * PAGE_SIZE) |
+              PG_D | PG_A | PG_RW | PG_P;
+    *pde = (uintptr_t)pt | PG_A | PG_RW | PG_P;
+    invlpg(MID);
+    check("split page", MID, tag(frame_b, MID));
+    check_all("split page", frame_a);
+
+    /* Then change one 4K page */
+    pt[MID + 1] = (uintptr_t)(frame_b + (MID + 1) * PAGE_SIZE) |
+                  PG_D | PG_A | PG_RW | PG_P;
+    invlpg(MID + 1);
+    check("changed page", MID + 1, tag(frame_b, MID + 1));
+    check("changed page", MID, tag(frame_b, MID));
+    check("changed page", MID + 2, tag(frame_a, MID + 2));
+    check_all("changed page", frame_a);
+}
+
+static void test_dirty(void)
+{
+    int i;
+
+    *pde = (uintptr_t)frame_a | PG_PS | PG_A | PG_RW | PG_P;
+    flush_tlb();
+    for (i = 0; i < ARRAY_SIZE(touched); i++) {
+        check("clean page", touched[i], tag(frame_a, touched[i]));
+    }
+    check_dirty("after reads", false);
+
+    /* A page that has not been touched since the flush */
+    *page(300) = 300;
+    check_dirty("write to an untouched page", true);
+    if (tag(frame_a, 300) != 300) {
+        ml_printf("write to an untouched page: lost\n");
+        errors++;
+    }
+
+    /* A page that has just been read */
+    *pde &= ~PG_D;
+    invlpg(MID);
+    check("clean page", 100, tag(frame_a, 100));
+    check_dirty("after a read", false);
+    *page(100) = 100;
+    check_dirty("write to a page just read", true);
+    if (tag(frame_a, 100) != 100) {
+        ml_printf("write to a page just read: lost\n");
+        errors++;
+    }
+}
+
+int main(void)
+{
+    uint64_t cr3, *pml4, *pdp;
+    int i;
+
+    for (i = 0; i < N_PAGES; i++) {
+        *(uint64_t *)(frame_a + i * PAGE_SIZE) = TAG_A | i;
+        *(uint64_t *)(frame_b + i * PAGE_SIZE) = TAG_B | i;
+    }
+
+    /* The page directory entry of WINDOW; the tables are identity mapped */
+    asm volatile("mov %%cr3, %0" : "=r" (cr3));
+    pml4 = (uint64_t *)PG_ADDR(cr3);
+    pdp = (uint64_t *)PG_ADDR(pml4[(WINDOW >> 39) & 511]);
+    pde = (uint64_t *)PG_ADDR(pdp[(WINDOW >> 30) & 511]) +
+          ((WINDOW >> 21) & 511);
+
+    test_remap();
+    test_split();
+    test_dirty();
+
+    ml_printf("Test complete: %s\n", errors ? "FAILED" : "PASSED");
+    return errors ? -1 : 0;
+}
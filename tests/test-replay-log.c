@@ -0,0 +1,189 @@
+/*
+ * Replay log unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "sysemu/replay.h"
+#include "../replay/replay-internal.h"
+
+/* Same as in replay-log.c */
+#define HEADER_SIZE         12
+#define RECORD_HEADER_SIZE  24
+
+#define LOG_SIZE            800000
+
+static const struct {
+    uint64_t icount;
+    uint64_t offset;
+    const char *name;
+} markers[] = {
+    { 1000, 100000, "snap-1000" },
+    { 6000, 600000, "snap-6000" },
+    { 7900, 790000, "snap-7900" },
+};
+
+static uint8_t pattern(uint64_t offset)
+{
+    uint32_t x = offset * 0x9e3779b1;
+
+    x ^= x >> 15;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    return x;
+}
+
+static void record(const char *fname)
+{
+    uint8_t buf[4096];
+    uint64_t offset = 0;
+    size_t i, m = 0;
+
+    replay_log_open(fname, true);
+    while (offset < LOG_SIZE) {
+        /* Uneven sizes, so that puts straddle the chunk boundaries.  */
+        size_t n = MIN(1 + offset % 4093, LOG_SIZE - offset);
+
+        if (m < ARRAY_SIZE(markers) && offset + n > markers[m].offset) {
+            n = markers[m].offset - offset;
+        }
+        for (i = 0; i < n; i++) {
+            buf[i] = pattern(offset + i);
+        }
+        replay_log_put(buf, n);
+        offset += n;
+        g_assert_cmpuint(replay_log_tell(), ==, offset);
+        if (m < ARRAY_SIZE(markers) && offset == markers[m].offset) {
+            replay_log_add_marker(markers[m].icount, markers[m].offset,
+                                  markers[m].name);
+            m++;
+        }
+    }
+    replay_log_close();
+}
+
+/* Seek to @offset and check that the stream then ends at @end.  */
+static void check_stream(uint64_t offset, uint64_t end)
+{
+    uint8_t buf[1000];
+    size_t i;
+
+    replay_log_seek(offset);
+    g_assert_cmpuint(replay_log_tell(), ==, offset);
+    while (offset + sizeof(buf) <= end) {
+        g_assert_true(replay_log_get(buf, sizeof(buf)));
+        for (i = 0; i < sizeof(buf); i++) {
+            g_assert_cmpuint(buf[i], ==, pattern(offset + i));
+        }
+        offset += sizeof(buf);
+    }
+    g_assert_true(replay_log_get(buf, end - offset));
+    g_assert_false(replay_log_get(buf, 1));
+}
+
+/* Drop the index and cut the file at @size, as if QEMU had died.  */
+static void truncate_log(const char *fname, off_t size)
+{
+    uint8_t zero[8] = { 0 };
+    int fd = open(fname, O_WRONLY);
+
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(pwrite(fd, zero, sizeof(zero), 4), ==, sizeof(zero));
+    g_assert_cmpint(ftruncate(fd, size), ==, 0);
+    close(fd);
+}
+
+static uint64_t index_pos(const char *fname)
+{
+    uint8_t header[HEADER_SIZE];
+    int fd = open(fname, O_RDONLY);
+
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(read(fd, header, sizeof(header)), ==, sizeof(header));
+    close(fd);
+    return ldq_be_p(header + 4);
+}
+
+static char *make_log(void)
+{
+    char *fname;
+    int fd;
+
+    fd = g_file_open_tmp("test-replay-log-XXXXXX", &fname, NULL);
+    g_assert_cmpint(fd, >=, 0);
+    close(fd);
+    record(fname);
+    return fname;
+}
+
+static void test_indexed(void)
+{
+    char *fname = make_log();
+    size_t i;
+
+    replay_log_open(fname, false);
+    for (i = 0; i < ARRAY_SIZE(markers); i++) {
+        const ReplayMarker *m = replay_log_find_marker(markers[i].icount + 1);
+
+        g_assert_nonnull(m);
+        g_assert_cmpstr(m->name, ==, markers[i].name);
+        g_assert_cmpuint(m->offset, ==, markers[i].offset);
+        check_stream(m->offset, LOG_SIZE);
+    }
+    g_assert_null(replay_log_find_marker(markers[0].icount - 1));
+    check_stream(0, LOG_SIZE);
+    replay_log_close();
+
+    unlink(fname);
+    g_free(fname);
+}
+
+static void test_truncated(void)
+{
+    char *fname = make_log();
+    const ReplayMarker *m;
+    size_t i;
+
+    /*
+     * Cutting into the last chunk leaves the stream up to the last
+     * snapshot, and every marker.
+     */
+    truncate_log(fname, index_pos(fname) - 10);
+    replay_log_open(fname, false);
+    for (i = 0; i < ARRAY_SIZE(markers); i++) {
+        m = replay_log_find_marker(markers[i].icount);
+        g_assert_nonnull(m);
+        g_assert_cmpstr(m->name, ==, markers[i].name);
+        g_assert_cmpuint(m->icount, ==, markers[i].icount);
+        g_assert_cmpuint(m->offset, ==, markers[i].offset);
+        check_stream(m->offset, markers[2].offset);
+    }
+    check_stream(0, markers[2].offset);
+    replay_log_close();
+
+    /*
+     * Random data is stored uncompressed, so the first chunk ends right
+     * before the first marker.  Cutting into that marker leaves only the
+     * first chunk.
+     */
+    truncate_log(fname, HEADER_SIZE + RECORD_HEADER_SIZE + markers[0].offset +
+                        RECORD_HEADER_SIZE + 4);
+    replay_log_open(fname, false);
+    g_assert_null(replay_log_find_marker(markers[2].icount));
+    check_stream(markers[0].offset / 2, markers[0].offset);
+    replay_log_close();
+
+    unlink(fname);
+    g_free(fname);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/replay-log/indexed", test_indexed);
+    g_test_add_func("/replay-log/truncated", test_truncated);
+    return g_test_run();
+}
@@ -174,6 +174,85 @@ static void test_encode_decode(void)
     }
 }
 
+#define ACCEL_PAGES 64
+
+/*
+ * Encode the same set of pages with every available implementation of
+ * xbzrle_encode_buffer, and check that each produces the same stream as
+ * the most preferred one; the last one tested is the generic encoder.
+ */
+static void test_encode_accel(void)
+{
+    uint8_t *old_buf = g_malloc(ACCEL_PAGES * PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(ACCEL_PAGES * PAGE_SIZE);
+    uint8_t *ref = g_malloc(ACCEL_PAGES * PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    uint8_t *decoded = g_malloc(PAGE_SIZE);
+    int ref_len[ACCEL_PAGES];
+    bool first = true;
+    int i, j;
+
+    for (i = 0; i < ACCEL_PAGES * PAGE_SIZE; i++) {
+        old_buf[i] = g_test_rand_int();
+    }
+    memcpy(new_buf, old_buf, ACCEL_PAGES * PAGE_SIZE);
+
+    for (i = 0; i < ACCEL_PAGES; i++) {
+        uint8_t *page = new_buf + i * PAGE_SIZE;
+        int runs = g_test_rand_int_range(0, 64);
+        int max_run = i % 2 ? 512 : 8;
+
+        for (j = 0; j < runs; j++) {
+            int start = g_test_rand_int_range(0, PAGE_SIZE);
+            int len = g_test_rand_int_range(1, max_run + 1);
+
+            for (; len && start < PAGE_SIZE; len--, start++) {
+                page[start] ^= g_test_rand_int_range(1, 256);
+            }
+        }
+    }
+
+    do {
+        for (i = 0; i < ACCEL_PAGES; i++) {
+            uint8_t *old_page = old_buf + i * PAGE_SIZE;
+            uint8_t *new_page = new_buf + i * PAGE_SIZE;
+            int dlen;
+
+            /* odd pages check the overflow path with a short output */
+            dlen = xbzrle_encode_buffer(old_page, new_page, PAGE_SIZE,
+                                        compressed,
+                                        i % 2 ? PAGE_SIZE / 8 : PAGE_SIZE);
+            if (first) {
+                ref_len[i] = dlen;
+                if (dlen > 0) {
+                    memcpy(ref + i * PAGE_SIZE, compressed, dlen);
+                }
+            } else {
+                g_assert_cmpint(dlen, ==, ref_len[i]);
+                if (dlen > 0) {
+                    g_assert(memcmp(ref + i * PAGE_SIZE, compressed,
+                                    dlen) == 0);
+                }
+            }
+
+            if (dlen > 0) {
+                memcpy(decoded, old_page, PAGE_SIZE);
+                g_assert_cmpint(xbzrle_decode_buffer(compressed, dlen,
+                                                     decoded, PAGE_SIZE),
+                                <=, PAGE_SIZE);
+                g_assert(memcmp(decoded, new_page, PAGE_SIZE) == 0);
+            }
+        }
+        first = false;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(ref);
+    g_free(compressed);
+    g_free(decoded);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +265,8 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    /* must run last, it steps through the encoder implementations */
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }